@@ -35,35 +35,45 @@ void ActionList::go(bool wait_for_timeouts) {
   D("go");
   while(actions.size() > 0) {
     trigger();
-    eventloop->wait(wait_for_timeouts);
+    if(eventloop)
+      eventloop->wait(wait_for_timeouts);
+    else if(actions.size() > 0)
+      throw std::logic_error("ActionList::go: action did not complete");
   }
 }
 
 void ActionList::trigger() {
   D("trigger");
-  Action *chosen = nullptr;
-  for(auto it: actions) {
-    Action *a = it.second;
-    if(a->running
-       || blocked_by_resource(a)
-       || blocked_by_dependency(a))
-      continue;
-    if(failed_by_dependency(a)) {
-      cleanup(a, false, false);
-      return trigger();
+  // Iterate rather than recurse: with no event loop each action completes
+  // inside go(), so recursion would grow the stack with every action.
+  for(;;) {
+    Action *chosen = nullptr;
+    bool skipped = false;
+    for(auto it: actions) {
+      Action *a = it.second;
+      if(a->running
+         || blocked_by_resource(a)
+         || blocked_by_dependency(a))
+        continue;
+      if(failed_by_dependency(a)) {
+        cleanup(a, false, false);
+        skipped = true;
+        break;
+      }
+      if(chosen == nullptr
+         || chosen->priority < a->priority)
+        chosen = a;
     }
-    if(chosen == nullptr
-       || chosen->priority < a->priority)
-      chosen = a;
-  }
-  if(chosen) {
+    if(skipped)
+      continue;
+    if(!chosen)
+      return;
     chosen->running = true;
     for(std::string &r: chosen->resources)
       resources.insert(r);
     D("action %s starting", chosen->name.c_str());
     chosen->go(eventloop, this);
     // Repeat in case there are more
-    return trigger();
   }
 }
 
@@ -86,7 +96,10 @@ void ActionList::cleanup(Action *a, bool succeeded, bool ran) {
     status[a->name] = succeeded;
     if(ran) {
       a->done(eventloop, this);
-      trigger();
+      // Without an event loop, completion happens inside trigger(), which
+      // will pick the next action itself.
+      if(eventloop)
+        trigger();
     }
     return;
   }
@@ -194,7 +194,12 @@ private:
 class ActionList {
 public:
   /** @brief Constructor
-   * @param e Event loop
+   * @param e Event loop, or a null pointer
+   *
+   * If @p e is a null pointer then every action must call @ref
+   * ActionList::completed before returning from @ref Action::go.  The actions
+   * are then run one at a time, in priority order.  This is useful for work
+   * which performs its own blocking waits, and so cannot share an event loop.
    */
   ActionList(EventLoop *e): eventloop(e) {
   }
@@ -215,6 +220,9 @@ public:
    * This method repeatedly calls @ref EventLoop::wait, so if there are any
    * @ref Reactor objects attached to the event loop that do not belong to some
    * action, unexpected delays may result.
+   *
+   * If there is no event loop then @c std::logic_error is thrown if an action
+   * does not complete synchronously.
    */
   void go(bool wait_for_timeouts = false);
 
@@ -22,6 +22,7 @@
 #include "Database.h"
 #include <cstdio>
 #include <cassert>
+#include <sys/stat.h>
 
 // Return the path to this backup
 std::string Backup::backupPath() const {
@@ -89,6 +90,13 @@ void Backup::setStatus(int n) {
   }
 }
 
+bool Backup::onStoreFilesystem() const {
+  struct stat store, root;
+  return stat(getDevice()->store->path.c_str(), &store) == 0
+    && stat(backupPath().c_str(), &root) == 0
+    && store.st_dev == root.st_dev;
+}
+
 Device *Backup::getDevice() const {
   return volume->parent->parent->findDevice(deviceName);
 }
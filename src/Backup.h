@@ -130,6 +130,15 @@ public:
   /** @brief Return path to backup */
   std::string backupPath() const;
 
+  /** @brief Test whether the backup is on its store's filesystem
+   * @return @c true if inode numbers in the backup are those of its store
+   *
+   * This is false for backups that are snapshots, which have inode numbers
+   * of their own.  Files can only be hard-linked between backups for which
+   * this is true.  The backup's device must have a store.
+   */
+  bool onStoreFilesystem() const;
+
   /** @brief Return containing device
    *
    * @todo could this be null pointer if device has been retired?
@@ -17,10 +17,16 @@
 #include "Utils.h"
 #include <cassert>
 #include "BulkRemove.h"
+#include "Snapshot.h"
 
 void BulkRemove::initialize(const std::string &path) {
-  // Invoking rm makes more sense than re-implementing it.
-  std::vector<std::string> cmd = { "rm", "-rf", path };
+  // Invoking rm makes more sense than re-implementing it.  Snapshots are
+  // much faster to delete as a whole.
+  std::vector<std::string> cmd;
+  if(isSubvolume(path))
+    cmd = deleteSubvolumeCommand(path);
+  else
+    cmd = { "rm", "-rf", path };
   setCommand(cmd);
   reporting(warning_mask & WARNING_VERBOSE, false);
   // BulkRemoves only get created when the caller has committed to removing
@@ -52,7 +52,8 @@ public:
   /** @brief Initialize the bulk remover
    * @param path Base path to remove
    *
-   * The effect is equivalent to @c rm @c -rf.
+   * The effect is equivalent to @c rm @c -rf.  If @p path is a btrfs
+   * subvolume then it is deleted as a subvolume.
    */
   void initialize(const std::string &path);
 
@@ -0,0 +1,172 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "rsbackup.h"
+#include "Capacity.h"
+#include "Conf.h"
+#include "Backup.h"
+#include "Volume.h"
+#include "Host.h"
+#include "Database.h"
+#include "Errors.h"
+#include "Utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <vector>
+#include <sys/statvfs.h>
+
+void StoreUsage::measure(const std::string &path) {
+  struct statvfs sv;
+  if(statvfs(path.c_str(), &sv) < 0)
+    throw IOError("statvfs " + path, errno);
+  when = Date::now();
+  freeBytes = static_cast<int64_t>(sv.f_bavail) * sv.f_frsize;
+  totalBytes = static_cast<int64_t>(sv.f_blocks) * sv.f_frsize;
+  freeFiles = sv.f_favail;
+  totalFiles = sv.f_files;
+}
+
+void StoreUsage::record(Database &db, const std::string &device) const {
+  Database::Statement(db,
+                      "INSERT OR REPLACE INTO store_usage"
+                      " (device,time,free_bytes,total_bytes,free_files,total_files)"
+                      " VALUES (?,?,?,?,?,?)",
+                      SQL_STRING, &device,
+                      SQL_INT64, (sqlite_int64)when,
+                      SQL_INT64, (sqlite_int64)freeBytes,
+                      SQL_INT64, (sqlite_int64)totalBytes,
+                      SQL_INT64, (sqlite_int64)freeFiles,
+                      SQL_INT64, (sqlite_int64)totalFiles,
+                      SQL_END).next();
+}
+
+// Least-squares slope of y against x
+static double slope(const std::vector<double> &x,
+                    const std::vector<double> &y) {
+  const size_t n = x.size();
+  double sx = 0, sy = 0, sxx = 0, sxy = 0;
+  for(size_t i = 0; i < n; ++i) {
+    sx += x[i];
+    sy += y[i];
+    sxx += x[i] * x[i];
+    sxy += x[i] * y[i];
+  }
+  const double d = n * sxx - sx * sx;
+  return d ? (n * sxy - sx * sy) / d : 0;
+}
+
+void CapacityForecast::compute(Database &db, const std::string &device) {
+  latest = StoreUsage();
+  growthKnown = false;
+  bytesPerDay = filesPerDay = 0;
+  if(!db.hasTable("store_usage"))
+    return;
+  const int64_t cutoff = Date::now() - 86400 * CAPACITY_FORECAST_DAYS;
+  Database::Statement stmt(db,
+                           "SELECT time,free_bytes,total_bytes,"
+                           "free_files,total_files"
+                           " FROM store_usage"
+                           " WHERE device=?"
+                           " ORDER BY time",
+                           SQL_STRING, &device,
+                           SQL_END);
+  // Days since first sample and usage in bytes and inodes
+  std::vector<double> days, usedBytes, usedFiles;
+  while(stmt.next()) {
+    latest.when = stmt.get_int64(0);
+    latest.freeBytes = stmt.get_int64(1);
+    latest.totalBytes = stmt.get_int64(2);
+    latest.freeFiles = stmt.get_int64(3);
+    latest.totalFiles = stmt.get_int64(4);
+    if(latest.when < cutoff)
+      continue;
+    days.push_back(latest.when / 86400.0);
+    usedBytes.push_back(latest.totalBytes - latest.freeBytes);
+    usedFiles.push_back(latest.totalFiles - latest.freeFiles);
+  }
+  if(days.size() < 2 || days.back() - days.front() < 1)
+    return;
+  // Subtract the first day to preserve precision
+  const double origin = days.front();
+  for(auto &d: days)
+    d -= origin;
+  bytesPerDay = slope(days, usedBytes);
+  filesPerDay = slope(days, usedFiles);
+  growthKnown = true;
+}
+
+int CapacityForecast::daysUntilFull() const {
+  if(!growthKnown)
+    return -1;
+  double days = -1;
+  if(bytesPerDay > 0)
+    days = latest.freeBytes / bytesPerDay;
+  if(filesPerDay > 0 && latest.totalFiles > 0) {
+    double fileDays = latest.freeFiles / filesPerDay;
+    if(days < 0 || fileDays < days)
+      days = fileDays;
+  }
+  if(days < 0)
+    return -1;
+  return static_cast<int>(std::min(floor(days), (double)INT_MAX));
+}
+
+void recordBackupUsage(Database &db, const Backup *backup,
+                       const StoreUsage &before, const StoreUsage &after) {
+  // Space freed by some concurrent activity is not evidence that the backup
+  // was small, so negative consumption is ignored.
+  const int64_t bytes = std::max<int64_t>(before.freeBytes - after.freeBytes,
+                                          0);
+  const int64_t files = std::max<int64_t>(before.freeFiles - after.freeFiles,
+                                          0);
+  Database::Statement(db,
+                      "INSERT OR REPLACE INTO backup_usage"
+                      " (host,volume,device,id,bytes,files)"
+                      " VALUES (?,?,?,?,?,?)",
+                      SQL_STRING, &backup->volume->parent->name,
+                      SQL_STRING, &backup->volume->name,
+                      SQL_STRING, &backup->deviceName,
+                      SQL_STRING, &backup->id,
+                      SQL_INT64, (sqlite_int64)bytes,
+                      SQL_INT64, (sqlite_int64)files,
+                      SQL_END).next();
+}
+
+bool predictBackupUsage(Database &db,
+                        const std::string &host,
+                        const std::string &volume,
+                        const std::string &device,
+                        int64_t &bytes, int64_t &files) {
+  if(!db.hasTable("backup_usage"))
+    return false;
+  Database::Statement stmt(db,
+                           "SELECT bytes,files FROM backup_usage"
+                           " WHERE host=? AND volume=? AND device=?"
+                           " ORDER BY id DESC LIMIT ?",
+                           SQL_STRING, &host,
+                           SQL_STRING, &volume,
+                           SQL_STRING, &device,
+                           SQL_INT, CAPACITY_BACKUP_HISTORY,
+                           SQL_END);
+  bool found = false;
+  bytes = files = 0;
+  while(stmt.next()) {
+    bytes = std::max<int64_t>(bytes, stmt.get_int64(0));
+    files = std::max<int64_t>(files, stmt.get_int64(1));
+    found = true;
+  }
+  return found;
+}
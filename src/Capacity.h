@@ -0,0 +1,117 @@
+// -*-C++-*-
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef CAPACITY_H
+#define CAPACITY_H
+/** @file Capacity.h
+ * @brief Tracking and forecasting of store capacity
+ */
+
+#include <string>
+#include <cstdint>
+#include <ctime>
+
+class Database;
+class Backup;
+
+/** @brief Space and inode usage of a store at a point in time */
+struct StoreUsage {
+  /** @brief When the measurement was made, or 0 if it has not been */
+  time_t when = 0;
+
+  /** @brief Bytes available to unprivileged users */
+  int64_t freeBytes = 0;
+
+  /** @brief Size of filesystem in bytes */
+  int64_t totalBytes = 0;
+
+  /** @brief Inodes available to unprivileged users */
+  int64_t freeFiles = 0;
+
+  /** @brief Total inodes */
+  int64_t totalFiles = 0;
+
+  /** @brief Measure a filesystem
+   * @param path Any path within the filesystem
+   *
+   * Throws @ref IOError on error.
+   */
+  void measure(const std::string &path);
+
+  /** @brief Record this measurement in the database
+   * @param db Database
+   * @param device Device name
+   */
+  void record(Database &db, const std::string &device) const;
+};
+
+/** @brief Projected growth of a device */
+struct CapacityForecast {
+  /** @brief Most recent measurement, if any */
+  StoreUsage latest;
+
+  /** @brief True if @ref bytesPerDay and @ref filesPerDay are meaningful */
+  bool growthKnown = false;
+
+  /** @brief Growth in bytes per day */
+  double bytesPerDay = 0;
+
+  /** @brief Growth in inodes per day */
+  double filesPerDay = 0;
+
+  /** @brief Compute the forecast for a device
+   * @param db Database
+   * @param device Device name
+   *
+   * The growth rate is a least-squares fit to the measurements over the last
+   * @ref CAPACITY_FORECAST_DAYS days.  It is only considered known if the
+   * measurements span at least a day.
+   */
+  void compute(Database &db, const std::string &device);
+
+  /** @brief Predict the number of days until the device is full
+   * @return Days until full, or -1 if unknown or not growing
+   */
+  int daysUntilFull() const;
+};
+
+/** @brief Record the space consumed by a backup
+ * @param db Database
+ * @param backup Backup
+ * @param before Measurement before the backup
+ * @param after Measurement after the backup
+ */
+void recordBackupUsage(Database &db, const Backup *backup,
+                       const StoreUsage &before, const StoreUsage &after);
+
+/** @brief Predict the space a backup will consume
+ * @param db Database
+ * @param host Host name
+ * @param volume Volume name
+ * @param device Device name
+ * @param bytes Where to store predicted bytes
+ * @param files Where to store predicted inodes
+ * @return @c true if a prediction was possible
+ *
+ * The prediction is the largest consumption of the last few backups of the
+ * volume to the device.
+ */
+bool predictBackupUsage(Database &db,
+                        const std::string &host,
+                        const std::string &volume,
+                        const std::string &device,
+                        int64_t &bytes, int64_t &files);
+
+#endif /* CAPACITY_H */
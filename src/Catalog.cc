@@ -0,0 +1,358 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Catalog.h"
+#include "Backup.h"
+#include "Errors.h"
+#include "Utils.h"
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+// Width of rsync's %i output
+#define FLAGS_WIDTH 11
+
+// Width of rsync's %M output, YYYY/MM/DD-HH:MM:SS
+#define MTIME_WIDTH 19
+
+std::vector<std::string> catalogRsyncOptions() {
+  // Itemizing twice includes unchanged items
+  return {
+    "--itemize-changes",
+    "--itemize-changes",
+    "--out-format=%i %l %M %n",
+  };
+}
+
+bool parseCatalogLine(const std::string &line, CatalogEntry &entry) {
+  const char *s = line.c_str();
+  // Change summary
+  if(line.size() <= FLAGS_WIDTH || s[FLAGS_WIDTH] != ' '
+     || !strchr("<>ch.*", s[0]))
+    return false;
+  entry.flags.assign(s, FLAGS_WIDTH);
+  s += FLAGS_WIDTH + 1;
+  // Size
+  if(!isdigit(static_cast<unsigned char>(*s)))
+    return false;
+  int64_t size = 0;
+  while(isdigit(static_cast<unsigned char>(*s))) {
+    if(size > (INT64_MAX - 9) / 10)
+      return false;
+    size = size * 10 + (*s++ - '0');
+  }
+  if(*s++ != ' ')
+    return false;
+  // Modification time
+  struct tm t;
+  int n = -1;
+  memset(&t, 0, sizeof t);
+  if(strlen(s) <= MTIME_WIDTH
+     || sscanf(s, "%4d/%2d/%2d-%2d:%2d:%2d%n",
+               &t.tm_year, &t.tm_mon, &t.tm_mday,
+               &t.tm_hour, &t.tm_min, &t.tm_sec, &n) != 6
+     || n != MTIME_WIDTH
+     || s[MTIME_WIDTH] != ' ')
+    return false;
+  t.tm_year -= 1900;
+  t.tm_mon -= 1;
+  t.tm_isdst = -1;
+  s += MTIME_WIDTH + 1;
+  // Path
+  if(!*s)
+    return false;
+  entry.size = size;
+  entry.mtime = mktime(&t);
+  entry.path = catalogPath(unescapeRsync(s));
+  return true;
+}
+
+std::string catalogFlags(const struct stat &sb, bool transferred) {
+  char type = 'S';
+  if(S_ISREG(sb.st_mode))
+    type = 'f';
+  else if(S_ISDIR(sb.st_mode))
+    type = 'd';
+  else if(S_ISLNK(sb.st_mode))
+    type = 'L';
+  else if(S_ISCHR(sb.st_mode) || S_ISBLK(sb.st_mode))
+    type = 'D';
+  std::string flags(FLAGS_WIDTH, transferred ? '+' : ' ');
+  flags[0] = !transferred ? '.' : type == 'f' ? '>' : 'c';
+  flags[1] = type;
+  return flags;
+}
+
+std::string catalogPath(const std::string &path) {
+  size_t begin = 0, end = path.size();
+  for(;;) {
+    if(begin < end && path[begin] == '/')
+      ++begin;
+    else if(end - begin >= 2 && path.compare(begin, 2, "./") == 0)
+      begin += 2;
+    else
+      break;
+  }
+  while(end > begin && path[end - 1] == '/')
+    --end;
+  if(begin == end)
+    return ".";
+  return path.substr(begin, end - begin);
+}
+
+bool catalogRelativePath(const std::string &root,
+                         const std::string &path,
+                         std::string &relative) {
+  size_t len = root.size();
+  while(len > 0 && root[len - 1] == '/')
+    --len;
+  if(path.compare(0, len, root, 0, len) != 0
+     || (path.size() > len && path[len] != '/'))
+    return false;
+  relative = catalogPath(path.substr(len));
+  return true;
+}
+
+CatalogWriter::CatalogWriter(Database &db,
+                             const std::string &host,
+                             const std::string &volume,
+                             const std::string &device,
+                             const std::string &id,
+                             const std::string &basis):
+  db(db),
+  host(host),
+  volume(volume),
+  device(device),
+  id(id),
+  basis(basis),
+  extend(db),
+  insert(db) {
+}
+
+CatalogWriter::~CatalogWriter() {
+  abandon();
+}
+
+void CatalogWriter::start() {
+  if(!(spool = tmpfile()))
+    throw IOError("creating temporary file", errno);
+  extend.prepare("UPDATE catalog SET last_id=?"
+                 " WHERE host=? AND volume=? AND path=? AND device=?"
+                 " AND last_id>=? AND size=? AND mtime=?"
+                 " AND first_id=(SELECT MAX(first_id) FROM catalog AS c"
+                 "  WHERE c.host=catalog.host"
+                 "  AND c.volume=catalog.volume"
+                 "  AND c.path=catalog.path"
+                 "  AND c.device=catalog.device)",
+                 SQL_END);
+  insert.prepare("INSERT OR REPLACE INTO catalog"
+                 " (host,volume,path,device,first_id,last_id,size,mtime,flags)"
+                 " VALUES (?,?,?,?,?,?,?,?,?)",
+                 SQL_END);
+}
+
+// Spooled items are written as the flags, size and modification time,
+// followed by the path.  The strings are preceded by their lengths, since
+// paths from the native copy engine may contain newlines.
+
+void CatalogWriter::add(const CatalogEntry &entry) {
+  ++items;
+  if(entry.deleted())
+    return;
+  const uint32_t lengths[2] = {
+    static_cast<uint32_t>(entry.flags.size()),
+    static_cast<uint32_t>(entry.path.size()),
+  };
+  const int64_t numbers[2] = { entry.size, static_cast<int64_t>(entry.mtime) };
+  if(fwrite(lengths, sizeof lengths, 1, spool) != 1
+     || fwrite(numbers, sizeof numbers, 1, spool) != 1
+     || fwrite(entry.flags.data(), 1, lengths[0], spool) != lengths[0]
+     || fwrite(entry.path.data(), 1, lengths[1], spool) != lengths[1])
+    throw IOError("writing catalog temporary file", errno);
+}
+
+// Report a short read from the temporary file
+static void truncated(FILE *spool) {
+  if(ferror(spool))
+    throw IOError("reading catalog temporary file", errno);
+  throw IOError("reading catalog temporary file: truncated");
+}
+
+bool CatalogWriter::read(CatalogEntry &entry) {
+  uint32_t lengths[2];
+  int64_t numbers[2];
+  if(fread(lengths, sizeof lengths, 1, spool) != 1) {
+    if(ferror(spool))
+      throw IOError("reading catalog temporary file", errno);
+    return false;
+  }
+  if(fread(numbers, sizeof numbers, 1, spool) != 1)
+    truncated(spool);
+  entry.size = numbers[0];
+  entry.mtime = numbers[1];
+  entry.flags.resize(lengths[0]);
+  entry.path.resize(lengths[1]);
+  if((lengths[0] && fread(&entry.flags[0], 1, lengths[0], spool) != lengths[0])
+     || (lengths[1]
+         && fread(&entry.path[0], 1, lengths[1], spool) != lengths[1]))
+    truncated(spool);
+  return true;
+}
+
+void CatalogWriter::finish() {
+  int retries = 0;
+  for(;;) {
+    if(fflush(spool) < 0 || fseek(spool, 0, SEEK_SET) < 0)
+      throw IOError("rewinding catalog temporary file", errno);
+    bool begun = false;
+    try {
+      db.begin();
+      begun = true;
+      forget();
+      CatalogEntry entry;
+      while(read(entry))
+        write(entry);
+      db.commit();
+      break;
+    } catch(DatabaseBusy &) {
+      if(begun)
+        db.rollback();
+      // Log a message every second or so
+      if(!(retries++ & 1023))
+        warning(WARNING_DATABASE,
+                "cataloging %s:%s on %s: retrying database update",
+                host.c_str(), volume.c_str(), device.c_str());
+      // Wait a millisecond and try again
+      usleep(1000);
+    } catch(...) {
+      if(begun)
+        db.rollback();
+      throw;
+    }
+  }
+  abandon();
+}
+
+void CatalogWriter::abandon() {
+  if(spool) {
+    fclose(spool);
+    spool = nullptr;
+  }
+}
+
+void CatalogWriter::forget() {
+  Database::Statement(db,
+                      "DELETE FROM catalog"
+                      " WHERE host=? AND volume=? AND device=? AND first_id=?",
+                      SQL_STRING, &host,
+                      SQL_STRING, &volume,
+                      SQL_STRING, &device,
+                      SQL_STRING, &id,
+                      SQL_END).next();
+  Database::Statement(db,
+                      "UPDATE catalog SET last_id=MAX(first_id, COALESCE("
+                      "  (SELECT MAX(id) FROM backup"
+                      "   WHERE backup.host=catalog.host"
+                      "   AND backup.volume=catalog.volume"
+                      "   AND backup.device=catalog.device"
+                      "   AND backup.id<catalog.last_id),"
+                      "  first_id))"
+                      " WHERE host=? AND volume=? AND device=? AND last_id=?",
+                      SQL_STRING, &host,
+                      SQL_STRING, &volume,
+                      SQL_STRING, &device,
+                      SQL_STRING, &id,
+                      SQL_END).next();
+}
+
+void CatalogWriter::write(const CatalogEntry &entry) {
+  extend.reset(SQL_STRING, &id,
+               SQL_STRING, &host,
+               SQL_STRING, &volume,
+               SQL_STRING, &entry.path,
+               SQL_STRING, &device,
+               SQL_STRING, &basis,
+               SQL_INT64, (sqlite_int64)entry.size,
+               SQL_INT64, (sqlite_int64)entry.mtime,
+               SQL_END);
+  extend.next();
+  if(db.changes())
+    return;
+  insert.reset(SQL_STRING, &host,
+               SQL_STRING, &volume,
+               SQL_STRING, &entry.path,
+               SQL_STRING, &device,
+               SQL_STRING, &id,
+               SQL_STRING, &id,
+               SQL_INT64, (sqlite_int64)entry.size,
+               SQL_INT64, (sqlite_int64)entry.mtime,
+               SQL_STRING, &entry.flags,
+               SQL_END);
+  insert.next();
+}
+
+std::vector<CatalogVersion> findCatalogVersions(Database &db,
+                                                const std::string &host,
+                                                const std::string &volume,
+                                                const std::string &path) {
+  std::vector<CatalogVersion> versions;
+  if(!db.hasTable("catalog"))
+    return versions;
+  // Versions can span backups that have since been pruned, so report only
+  // those that survive.
+  Database::Statement stmt(db,
+                           "SELECT c.device, MIN(b.id), MAX(b.id), COUNT(b.id),"
+                           " c.flags, c.size, c.mtime"
+                           " FROM catalog AS c JOIN backup AS b"
+                           " ON b.host=c.host AND b.volume=c.volume"
+                           " AND b.device=c.device"
+                           " AND b.id BETWEEN c.first_id AND c.last_id"
+                           " WHERE c.host=? AND c.volume=? AND c.path=?"
+                           " AND b.status!=?"
+                           " GROUP BY c.device, c.first_id"
+                           " ORDER BY c.device, c.first_id",
+                           SQL_STRING, &host,
+                           SQL_STRING, &volume,
+                           SQL_STRING, &path,
+                           SQL_INT, PRUNED,
+                           SQL_END);
+  while(stmt.next()) {
+    CatalogVersion v;
+    v.device = stmt.get_string(0);
+    v.first = stmt.get_string(1);
+    v.last = stmt.get_string(2);
+    v.backups = stmt.get_int(3);
+    v.flags = stmt.get_string(4);
+    v.size = stmt.get_int64(5);
+    v.mtime = stmt.get_int64(6);
+    versions.push_back(v);
+  }
+  return versions;
+}
+
+void pruneCatalog(Database &db) {
+  if(!db.hasTable("catalog"))
+    return;
+  Database::Statement(db,
+                      "DELETE FROM catalog"
+                      " WHERE NOT EXISTS (SELECT 1 FROM backup"
+                      "  WHERE backup.host=catalog.host"
+                      "  AND backup.volume=catalog.volume"
+                      "  AND backup.device=catalog.device"
+                      "  AND backup.id BETWEEN catalog.first_id"
+                      "  AND catalog.last_id)",
+                      SQL_END).next();
+}
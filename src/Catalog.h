@@ -0,0 +1,262 @@
+// -*-C++-*-
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef CATALOG_H
+#define CATALOG_H
+/** @file Catalog.h
+ * @brief Catalog of the files in each backup
+ *
+ * The catalog records each version of each file in a volume.  A version is
+ * identified by size and modification time, and covers a range of backups on
+ * a single device, from the first backup that contained it to the last.
+ *
+ * The catalog is built from rsync's itemized output as a backup is made, so
+ * questions about the history of a file can be answered from the database
+ * without reading the backups themselves.
+ */
+
+#include "Database.h"
+#include <string>
+#include <vector>
+#include <ctime>
+#include <cstdint>
+#include <cstdio>
+#include <sys/stat.h>
+
+/** @brief One item from rsync's itemized output */
+struct CatalogEntry {
+  /** @brief rsync's change summary
+   *
+   * See the description of @c --itemize-changes in @c rsync(1).
+   */
+  std::string flags;
+
+  /** @brief Size in bytes */
+  int64_t size = 0;
+
+  /** @brief Last modification time */
+  time_t mtime = 0;
+
+  /** @brief Path relative to the volume root
+   *
+   * Normalized by @ref catalogPath.
+   */
+  std::string path;
+
+  /** @brief Test whether the item was deleted */
+  bool deleted() const {
+    return flags.size() && flags[0] == '*';
+  }
+};
+
+/** @brief One version of a file
+ *
+ * Returned by @ref findCatalogVersions.
+ */
+struct CatalogVersion {
+  /** @brief Device containing this version */
+  std::string device;
+
+  /** @brief Earliest backup containing this version */
+  std::string first;
+
+  /** @brief Latest backup containing this version */
+  std::string last;
+
+  /** @brief Number of backups containing this version */
+  int backups = 0;
+
+  /** @brief rsync's change summary when the version first appeared */
+  std::string flags;
+
+  /** @brief Size in bytes */
+  int64_t size = 0;
+
+  /** @brief Last modification time */
+  time_t mtime = 0;
+};
+
+/** @brief Return the rsync options needed to build the catalog
+ * @return Options to add to the rsync command
+ *
+ * The options produce one line of output for every item in the backup,
+ * including unchanged ones.  @c --quiet must not be used with them.
+ */
+std::vector<std::string> catalogRsyncOptions();
+
+/** @brief Parse one line of output from rsync
+ * @param line Line of output
+ * @param entry Where to store the result
+ * @return @c true if @p line was a catalog item, @c false otherwise
+ *
+ * @p line should have been produced using @ref catalogRsyncOptions.  Other
+ * output, such as error messages, is rejected.
+ */
+bool parseCatalogLine(const std::string &line, CatalogEntry &entry);
+
+/** @brief Construct a change summary for an item copied without rsync
+ * @param sb Status of the item
+ * @param transferred @c true if the item was created or its data copied,
+ * @c false if it was unchanged
+ * @return Change summary in the form produced by rsync
+ */
+std::string catalogFlags(const struct stat &sb, bool transferred);
+
+/** @brief Normalize a path for the catalog
+ * @param path Path relative to the volume root
+ * @return Normalized path
+ *
+ * Removes trailing and leading slashes.  The volume root is represented as
+ * ".".
+ */
+std::string catalogPath(const std::string &path);
+
+/** @brief Find the catalog path of a file within a volume
+ * @param root Path to the volume root
+ * @param path Absolute path to the file
+ * @param relative Where to store the normalized path relative to @p root
+ * @return @c true if @p path is within @p root, otherwise @c false
+ */
+bool catalogRelativePath(const std::string &root,
+                         const std::string &path,
+                         std::string &relative);
+
+/** @brief Builds the catalog for a single backup
+ *
+ * Items are collected in a temporary file while the backup is made, and
+ * written to the database in a single transaction by @ref finish.  This
+ * keeps the database lock only for as long as the write takes, rather than
+ * for the whole backup.
+ */
+class CatalogWriter {
+public:
+  /** @brief Constructor
+   * @param db Database
+   * @param host Host name
+   * @param volume Volume name
+   * @param device Device name
+   * @param id ID of new backup
+   * @param basis ID of the backup that rsync is building on, or ""
+   */
+  CatalogWriter(Database &db,
+                const std::string &host,
+                const std::string &volume,
+                const std::string &device,
+                const std::string &id,
+                const std::string &basis);
+
+  CatalogWriter(const CatalogWriter &) = delete;
+  CatalogWriter &operator=(const CatalogWriter &) = delete;
+
+  /** @brief Destructor
+   *
+   * Abandons the catalog if it has not been finished.
+   */
+  ~CatalogWriter();
+
+  /** @brief Start collecting items
+   * @throw IOError if the temporary file cannot be created
+   */
+  void start();
+
+  /** @brief Add one item to the catalog
+   * @param entry Item to add
+   * @throw IOError if the temporary file cannot be written
+   *
+   * Deleted items are ignored.
+   */
+  void add(const CatalogEntry &entry);
+
+  /** @brief Write the catalog to the database
+   * @throw IOError if the temporary file cannot be read
+   * @throw DatabaseError if an error occurs
+   *
+   * If the backup has been attempted before, the catalog is first restored
+   * to its state before that attempt.  Then, for each item, if the latest
+   * version of the file was in the basis backup and has the same size and
+   * modification time, it is extended to cover the new backup.  Otherwise a
+   * new version is recorded.
+   *
+   * If the database is busy, the transaction is retried.
+   */
+  void finish();
+
+  /** @brief Abandon the catalog */
+  void abandon();
+
+  /** @brief Number of items seen */
+  size_t items = 0;
+
+private:
+  /** @brief Forget any previous attempt at this backup */
+  void forget();
+
+  /** @brief Write one item to the database
+   * @param entry Item to write
+   */
+  void write(const CatalogEntry &entry);
+
+  /** @brief Read one item back from @ref spool
+   * @param entry Where to store the item
+   * @return @c true if an item was read, @c false at end of file
+   */
+  bool read(CatalogEntry &entry);
+
+  /** @brief Database */
+  Database &db;
+
+  /** @brief Host name */
+  std::string host;
+
+  /** @brief Volume name */
+  std::string volume;
+
+  /** @brief Device name */
+  std::string device;
+
+  /** @brief ID of new backup */
+  std::string id;
+
+  /** @brief ID of basis backup */
+  std::string basis;
+
+  /** @brief Statement to extend an existing version */
+  Database::Statement extend;
+
+  /** @brief Statement to record a new version */
+  Database::Statement insert;
+
+  /** @brief Temporary file holding items not yet written, or null pointer */
+  FILE *spool = nullptr;
+};
+
+/** @brief Find all versions of a file
+ * @param db Database
+ * @param host Host name
+ * @param volume Volume name
+ * @param path Path relative to volume root
+ * @return Versions of @p path in surviving backups, ordered by device and age
+ */
+std::vector<CatalogVersion> findCatalogVersions(Database &db,
+                                                const std::string &host,
+                                                const std::string &volume,
+                                                const std::string &path);
+
+/** @brief Remove catalog entries for backups that no longer exist
+ * @param db Database
+ */
+void pruneCatalog(Database &db);
+
+#endif /* CATALOG_H */
@@ -35,6 +35,13 @@ enum {
   NO_WARN_PARTIAL = 265,
   LOG_VERBOSITY = 266,
   DUMP_CONFIG = 267,
+  CONFIG_CACHE = 268,
+  DAEMON = 269,
+  FIND = 270,
+  RESTORE = 271,
+  DATE = 272,
+  TO = 273,
+  VERIFY = 274,
 };
 
 const struct option Command::options[] = {
@@ -66,6 +73,13 @@ const struct option Command::options[] = {
   { "logs", required_argument, nullptr, LOG_VERBOSITY },
   { "dump-config", no_argument, nullptr, DUMP_CONFIG },
   { "database", required_argument, nullptr, 'D' },
+  { "config-cache", required_argument, nullptr, CONFIG_CACHE },
+  { "daemon", required_argument, nullptr, DAEMON },
+  { "find", required_argument, nullptr, FIND },
+  { "restore", required_argument, nullptr, RESTORE },
+  { "date", required_argument, nullptr, DATE },
+  { "to", required_argument, nullptr, TO },
+  { "verify", no_argument, nullptr, VERIFY },
   { nullptr, 0, nullptr, 0 }
 };
 
@@ -81,6 +95,8 @@ const char *Command::helpString() {
 "  rsbackup [OPTIONS] [--] [[-]HOST...] [[-]HOST:VOLUME...]\n"
 "  rsbackup --retire [OPTIONS] [--] [HOST...] [HOST:VOLUME...]\n"
 "  rsbackup --retire-device [OPTIONS] [--] DEVICES...\n"
+"  rsbackup --find PATH [OPTIONS] [--] [HOST...] [HOST:VOLUME...]\n"
+"  rsbackup --restore HOST:VOLUME[:PATH] --to DEST [--date DATE] [OPTIONS]\n"
 "\n"
 "At least one action option is required:\n"
 "  --backup, -b            Back up selected volumes (default: all)\n"
@@ -89,16 +105,24 @@ const char *Command::helpString() {
 "  --email, -e ADDRESS     Mail HTML report to ADDRESS\n"
 "  --prune, -p             Prune old backups of selected volumes (default: all)\n"
 "  --prune-incomplete, -P  Prune incomplete backups\n"
+"  --verify                Verify backups of selected volumes (default: all)\n"
 "  --retire                Retire volumes (must specify at least one)\n"
 "  --retire-device         Retire devices (must specify at least one)\n"
 "  --dump-config           Dump parsed configuration\n"
+"  --daemon SOCKET         Run as a daemon, accepting commands on SOCKET\n"
+"  --find PATH             List cataloged backups containing PATH\n"
+"  --restore HOST:VOLUME[:PATH]\n"
+"                          Restore from a backup (requires --to)\n"
 "\n"
 "Additional options:\n"
 "  --logs all|errors|recent|latest|failed   Log verbosity in report\n"
 "  --store, -s DIR         Override directory(s) to store backups in\n"
 "  --config, -c PATH       Set config file (default: /etc/rsbackup/config)\n"
+"  --config-cache PATH     Cache parsed config in PATH\n"
 "  --wait, -w              Wait until running rsbackup finishes\n"
 "  --force, -f             Don't prompt when retiring\n"
+"  --date DATE             Date to restore to (default: today)\n"
+"  --to DEST               Restore destination, local or [USER@]HOST:PATH\n"
 "  --dry-run, -n           Dry run only\n"
 "  --verbose, -v           Verbose output\n"
 "  --debug, -d             Debug output\n"
@@ -164,6 +188,13 @@ void Command::parse(int argc, const char *const *argv) {
     case LOG_VERBOSITY: logVerbosity = getVerbosity(optarg); break;
     case 'W': enable_warning(static_cast<unsigned>(-1)); break;
     case DUMP_CONFIG: dumpConfig = true; break;
+    case CONFIG_CACHE: configCachePath = optarg; break;
+    case DAEMON: daemonSocket = new std::string(optarg); break;
+    case FIND: find = new std::string(optarg); break;
+    case RESTORE: restore = new std::string(optarg); break;
+    case DATE: date = new std::string(optarg); break;
+    case TO: to = new std::string(optarg); break;
+    case VERIFY: verify = true; break;
     default: exit(1);
     }
   }
@@ -181,9 +212,48 @@ void Command::parse(int argc, const char *const *argv) {
                     || email
                     || prune
                     || pruneIncomplete
+                    || verify
                     || retireDevice
                     || retire))
     throw CommandError("--dump-config cannot be used with any other action");
+  if(daemonSocket && (backup
+                      || html
+                      || text
+                      || email
+                      || prune
+                      || pruneIncomplete
+                      || verify
+                      || retireDevice
+                      || retire
+                      || dumpConfig))
+    throw CommandError("--daemon cannot be used with any other action");
+  if(find && (backup
+              || html
+              || text
+              || email
+              || prune
+              || pruneIncomplete
+              || verify
+              || retireDevice
+              || retire
+              || dumpConfig
+              || daemonSocket))
+    throw CommandError("--find cannot be used with any other action");
+  if(restore && (backup
+                 || html
+                 || text
+                 || email
+                 || prune
+                 || pruneIncomplete
+                 || verify
+                 || retireDevice
+                 || retire
+                 || dumpConfig
+                 || daemonSocket
+                 || find))
+    throw CommandError("--restore cannot be used with any other action");
+  if((date || to) && !restore)
+    throw CommandError("--date and --to can only be used with --restore");
 
   // We have to do *something*
   if(!backup
@@ -192,13 +262,17 @@ void Command::parse(int argc, const char *const *argv) {
      && !email
      && !prune
      && !pruneIncomplete
+     && !verify
      && !retireDevice
      && !retire
-     && !dumpConfig)
+     && !dumpConfig
+     && !daemonSocket
+     && !find
+     && !restore)
     throw CommandError("no action specified");
 
-  if(backup || prune || pruneIncomplete || retire) {
-    // Volumes to back up, prune or retire
+  if(backup || prune || pruneIncomplete || verify || retire || find) {
+    // Volumes to back up, prune, verify or retire
     if(optind < argc) {
       for(n = optind; n < argc; ++n)
         selections.add(argv[n]);
@@ -217,6 +291,16 @@ void Command::parse(int argc, const char *const *argv) {
     if(optind < argc)
       throw CommandError("no arguments allowed to --dump-config");
   }
+  if(daemonSocket) {
+    if(optind < argc)
+      throw CommandError("no arguments allowed to --daemon");
+  }
+  if(restore) {
+    if(!to)
+      throw CommandError("--restore requires --to");
+    if(optind < argc)
+      throw CommandError("no arguments allowed to --restore");
+  }
 }
 
 Command::LogVerbosity Command::getVerbosity(const std::string &v) {
@@ -232,8 +316,14 @@ Command::~Command() {
   delete html;
   delete text;
   delete email;
+  delete daemonSocket;
+  delete find;
+  delete restore;
+  delete date;
+  delete to;
 }
 
 Command command;
 std::string configPath = DEFAULT_CONFIG;
 std::string database;
+std::string configCachePath;
@@ -65,6 +65,12 @@ public:
    */
   bool pruneIncomplete = false;
 
+  /** @brief @c --verify action
+   *
+   * The default is @c false.
+   */
+  bool verify = false;
+
   /** @brief @c --retire action
    *
    * The default is @c false.
@@ -92,6 +98,21 @@ public:
   /** @brief Address for email report or null pointer */
   std::string *email = nullptr;
 
+  /** @brief Socket for @c --daemon action or null pointer */
+  std::string *daemonSocket = nullptr;
+
+  /** @brief Path for @c --find action or null pointer */
+  std::string *find = nullptr;
+
+  /** @brief Source for @c --restore action or null pointer */
+  std::string *restore = nullptr;
+
+  /** @brief Date for @c --restore action or null pointer */
+  std::string *date = nullptr;
+
+  /** @brief Destination for @c --restore action or null pointer */
+  std::string *to = nullptr;
+
   /** @brief Explicitly specified stores */
   std::vector<std::string> stores;
 
@@ -158,4 +179,10 @@ extern std::string configPath;
 /** @brief Database path */
 extern std::string database;
 
+/** @brief Path to compiled configuration cache
+ *
+ * Empty to disable the cache.
+ */
+extern std::string configCachePath;
+
 #endif /* COMMANDLINE_H */
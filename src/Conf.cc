@@ -26,11 +26,18 @@
 #include "Database.h"
 #include "Prune.h"
 #include "ConfDirective.h"
+#include "ConfCache.h"
 #include "Device.h"
 #include "Indent.h"
+#include "DeviceAccess.h"
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <regex>
 #include <sstream>
+#include <thread>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <boost/filesystem.hpp>
 
 Conf::Conf() {
@@ -46,6 +53,8 @@ Conf::~Conf() {
   deviceColorStrategy = nullptr;
   delete db;
   db = nullptr;
+  delete cache;
+  cache = nullptr;
   for(auto &d: devices)
     delete d.second;
   devices.clear();
@@ -84,6 +93,42 @@ void Conf::write(std::ostream &os, int step, bool verbose) const {
     os << indent(step) << "lock " << quote(lock) << '\n';
   d(os, "", step);
 
+  d(os, "# Time limit for starting backups, from start of run", step);
+  d(os, "#  backup-window INTERVAL", step);
+  if(backupWindow)
+    os << indent(step) << "backup-window " << backupWindow << '\n';
+  d(os, "", step);
+
+  d(os, "# Copy new backups from the first device to the others", step);
+  d(os, "#  replicate-locally true|false", step);
+  if(replicateLocally)
+    os << indent(step) << "replicate-locally true\n";
+  d(os, "", step);
+
+  d(os, "# Record the files in each backup in the database", step);
+  d(os, "#  catalog true|false", step);
+  if(catalog)
+    os << indent(step) << "catalog true\n";
+  d(os, "", step);
+
+  d(os, "# Link identical files in new backups across volumes", step);
+  d(os, "#  dedup true|false", step);
+  if(dedup)
+    os << indent(step) << "dedup true\n";
+  d(os, "", step);
+
+  d(os, "# Bytes to read per device per run when deduplicating", step);
+  d(os, "#  dedup-budget SIZE", step);
+  if(dedupBudget != DEFAULT_DEDUP_BUDGET)
+    os << indent(step) << "dedup-budget " << dedupBudget << '\n';
+  d(os, "", step);
+
+  d(os, "# Interval before verified files are verified again", step);
+  d(os, "#  verify-interval INTERVAL", step);
+  if(verifyInterval != DEFAULT_VERIFY_INTERVAL)
+    os << indent(step) << "verify-interval " << verifyInterval << '\n';
+  d(os, "", step);
+
   d(os, "# Command to run before accessing backup devices", step);
   d(os, "#  pre-access-hook COMMAND ...", step);
   if(preAccess.size())
@@ -97,9 +142,20 @@ void Conf::write(std::ostream &os, int step, bool verbose) const {
   d(os, "", step);
 
   d(os, "# Names of backup devices", step);
-  d(os, "#  device NAME", step);
-  for(auto &d: devices)
-    os << "device " << quote(d.first) << '\n';
+  d(os, "#  device NAME [min-free-space SIZE[%]] [min-free-inodes COUNT[%]]",
+    step);
+  d(os, "#               [space-prune policy|oldest]", step);
+  for(auto &d: devices) {
+    const Device *device = d.second;
+    os << "device " << quote(d.first);
+    if(device->minFreeSpace.value)
+      os << " min-free-space " << device->minFreeSpace.toString();
+    if(device->minFreeInodes.value)
+      os << " min-free-inodes " << device->minFreeInodes.toString();
+    if(device->spacePrune == Device::SpacePruneOldest)
+      os << " space-prune oldest";
+    os << '\n';
+  }
   d(os, "", step);
 
   d(os, "# ---- Reporting ----", step);
@@ -134,6 +190,7 @@ void Conf::write(std::ostream &os, int step, bool verbose) const {
   d(os, "#  report [+] KEY[:VALUE][?CONDITION]", step);
   d(os, "#", step);
   d(os, "# Keys:", step);
+  d(os, "#   capacity          -- device capacity forecasts", step);
   d(os, "#   generated         -- generation time", step);
   d(os, "#   history-graph     -- graphical representation ofbackups", step);
   d(os, "#   h1:HEADING        -- level-1 heading", step);
@@ -142,6 +199,7 @@ void Conf::write(std::ostream &os, int step, bool verbose) const {
   d(os, "#   logs              -- logs of failed backups", step);
   d(os, "#   p:TEXT            -- arbitrary text", step);
   d(os, "#   prune-logs[:DAYS] -- pruning logs (default 3 days)", step);
+  d(os, "#   space             -- space used by backups", step);
   d(os, "#   summary           -- summary table", step);
   d(os, "#   title:TITLE       -- report title", step);
   d(os, "#   warnings          -- warning messages", step);
@@ -254,6 +312,10 @@ void Conf::write(std::ostream &os, int step, bool verbose) const {
 
 // Read the master configuration file plus anything it includes.
 void Conf::read() {
+  if(configCachePath.size()) {
+    cache = new ConfCache(configCachePath);
+    cache->load(configPath);
+  }
   readOneFile(configPath);
 }
 
@@ -263,55 +325,91 @@ void Conf::readOneFile(const std::string &path) {
   ConfContext cc(this);
   Indent indenter;
 
+  cc.path = path;
+  sources.push_back(path);
+  struct stat sb;
+  if(cache) {
+    if(const std::vector<ConfLine> *lines = cache->findFile(path, sb)) {
+      D("Conf::readOneFile %s (cached)", path.c_str());
+      for(auto &line: *lines) {
+        cc.line = line.lineno;
+        cc.bits = line.bits;
+        processLine(cc, indenter, line.indent);
+      }
+      return;
+    }
+  }
+
   IO input;
   D("Conf::readOneFile %s", path.c_str());
   input.open(path, "r");
 
   std::string line;
   int lineno = 0;
+  uint64_t hash = ConfCache::HASH_INIT;
+  std::vector<ConfLine> lines;
   while(input.readline(line)) {
     ++lineno;                           // keep track of where we are
-    cc.path = path;
     cc.line = lineno;
+    size_t indent;
     try {
-      size_t indent;
       split(cc.bits, line, &indent);
-      if(!cc.bits.size())                  // skip blank lines
-        continue;
-      // Consider all the possible commands
-      const ConfDirective *d = ConfDirective::find(cc.bits[0]);
-      if(d) {
-        unsigned level = indenter.check(d->acceptable_levels, indent);
-        switch(level) {
-        case 0:
-          throw SyntaxError("inconsistent indentation");
-        case LEVEL_TOP:
-          cc.context = this;
-          cc.host = nullptr;
-          cc.volume = nullptr;
-          break;
-        case LEVEL_HOST:
-          cc.context = cc.host;
-          cc.volume = nullptr;
-          break;
-        case LEVEL_VOLUME:
-          cc.context = cc.volume;
-          break;
-        default:
-          throw std::logic_error("unexpected indent level");
-        }
-        d->check(cc);
-        d->set(cc);
-        indenter.introduce(d->new_level);
-      } else {
-        throw SyntaxError("unknown command '" + cc.bits[0] + "'");
-      }
     } catch(SyntaxError &e) {
       // Wrap up in a ConfigError, which carries the path/line information.
       std::stringstream s;
       s << path << ":" << lineno << ": " << e.what();
       throw ConfigError(s.str());
     }
+    if(cache) {
+      hash = ConfCache::hashLine(hash, line);
+      if(cc.bits.size())
+        lines.push_back({lineno, indent, cc.bits});
+    }
+    if(!cc.bits.size())                  // skip blank lines
+      continue;
+    processLine(cc, indenter, indent);
+  }
+  if(cache)
+    cache->addFile(path, sb, hash, std::move(lines));
+}
+
+// Act on one line from a configuration file.  Throws ConfigError if it is
+// bad.
+void Conf::processLine(ConfContext &cc, Indent &indenter, size_t indent) {
+  try {
+    // Consider all the possible commands
+    const ConfDirective *d = ConfDirective::find(cc.bits[0]);
+    if(d) {
+      unsigned level = indenter.check(d->acceptable_levels, indent);
+      switch(level) {
+      case 0:
+        throw SyntaxError("inconsistent indentation");
+      case LEVEL_TOP:
+        cc.context = this;
+        cc.host = nullptr;
+        cc.volume = nullptr;
+        break;
+      case LEVEL_HOST:
+        cc.context = cc.host;
+        cc.volume = nullptr;
+        break;
+      case LEVEL_VOLUME:
+        cc.context = cc.volume;
+        break;
+      default:
+        throw std::logic_error("unexpected indent level");
+      }
+      d->check(cc);
+      d->set(cc);
+      indenter.introduce(d->new_level);
+    } else {
+      throw SyntaxError("unknown command '" + cc.bits[0] + "'");
+    }
+  } catch(SyntaxError &e) {
+    // Wrap up in a ConfigError, which carries the path/line information.
+    std::stringstream s;
+    s << cc.path << ":" << cc.line << ": " << e.what();
+    throw ConfigError(s.str());
   }
 }
 
@@ -321,8 +419,17 @@ void Conf::readOneFile(const std::string &path) {
 // tries to read it.
 void Conf::includeFile(const std::string &path) {
   D("Conf::includeFile %s", path.c_str());
+  struct stat sb;
+  sources.push_back(path);
+  if(cache) {
+    if(const std::vector<std::string> *files = cache->findDirectory(path, sb)) {
+      for(auto &name: *files)
+        readOneFile(path + PATH_SEP + name);
+      return;
+    }
+  }
   if(boost::filesystem::is_directory(path)) {
-    std::vector<std::string> files;
+    std::vector<std::string> files, included;
     Directory::getFiles(path, files);
     for(auto &name: files) {
       if(!name.size()
@@ -332,16 +439,25 @@ void Conf::includeFile(const std::string &path) {
         continue;
       std::string fullname = path + PATH_SEP + name;
       if(boost::filesystem::is_regular_file(fullname))
-        readOneFile(fullname);
+        included.push_back(name);
     }
+    if(cache)
+      cache->addDirectory(path, sb, included);
+    for(auto &name: included)
+      readOneFile(path + PATH_SEP + name);
   } else
     readOneFile(path);
 }
 
 void Conf::validate() const {
+  // Validation depends on more than the configuration files (for instance
+  // whether a prune script is still executable), so it is done even if the
+  // configuration came entirely from the cache.
   for(auto &h: hosts)
     for(auto &v: h.second->volumes)
       validatePrunePolicy(v.second);
+  if(cache && !cache->current())
+    cache->save();
 }
 
 // (De-)select all hosts
@@ -529,6 +645,16 @@ void Conf::readState() {
     progressBar(IO::err, nullptr, 0, 0);
 }
 
+void Conf::forgetState() {
+  for(auto &h: hosts)
+    for(auto &v: h.second->volumes)
+      v.second->forgetBackups();
+  unknownDevices.clear();
+  unknownHosts.clear();
+  unknownObjects = 0;
+  logsRead = false;
+}
+
 void Conf::addBackup(Backup &backup,
                      const std::string &hostName,
                      const std::string &volumeName,
@@ -585,9 +711,42 @@ void Conf::addBackup(Backup &backup,
 }
 
 // Create the mapping between stores and devices.
+// Probe stores concurrently.  Identifying a store may involve waiting for a
+// disk to spin up, so the total time is bounded by the slowest store rather
+// than the sum of all of them.
+static void probeStores(const std::vector<Store *> &toProbe) {
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    size_t n;
+    while((n = next++) < toProbe.size())
+      toProbe[n]->probe();
+  };
+  size_t nthreads = std::min(toProbe.size(),
+                             static_cast<size_t>(MAX_IDENTIFY_THREADS));
+  std::vector<std::thread> threads;
+  for(size_t n = 1; n < nthreads; ++n)
+    threads.push_back(std::thread(worker));
+  worker();
+  for(auto &t: threads)
+    t.join();
+}
+
 void Conf::identifyDevices(int states) {
   if((devicesIdentified & states) == states)
     return;
+  // Stores are probed in parallel; the results are then examined serially,
+  // in a consistent order, so that duplicate detection is deterministic.
+  std::vector<Store *> toProbe;
+  for(auto &s: stores) {
+    Store *store = s.second;
+    if((store->state & states) && !store->probed && !store->device)
+      toProbe.push_back(store);
+  }
+  if(toProbe.size()) {
+    // Make sure backup devices are mounted
+    preDeviceAccess();
+    probeStores(toProbe);
+  }
   int found = 0;
   std::vector<UnavailableStore> storeExceptions;
   for(auto &s: stores) {
@@ -617,6 +776,50 @@ void Conf::identifyDevices(int states) {
         IO::err.writef("  %s\n", storeExceptions[n].what());
   }
   devicesIdentified |= states;
+  if(command.act)
+    recordStoreUsage(toProbe);
+}
+
+void Conf::forgetDevices() {
+  for(auto &s: stores)
+    s.second->forget();
+  devicesIdentified = 0;
+}
+
+// Record the usage of newly identified stores
+void Conf::recordStoreUsage(const std::vector<Store *> &identified) {
+  std::vector<const Store *> measured;
+  for(const Store *store: identified)
+    if(store->device && store->usage.when)
+      measured.push_back(store);
+  if(measured.size() == 0)
+    return;
+  int retries = 0;
+  for(;;) {
+    bool begun = false;
+    try {
+      getdb().begin();
+      begun = true;
+      for(const Store *store: measured)
+        store->usage.record(getdb(), store->device->name);
+      getdb().commit();
+    } catch(DatabaseBusy &) {
+      if(begun)
+        getdb().rollback();
+      // Log a message every second or so
+      if(!(retries++ & 1023))
+        warning(WARNING_DATABASE,
+                "recording store usage: retrying database update");
+      // Wait a millisecond and try again
+      usleep(1000);
+      continue;
+    }
+    break;
+  }
+}
+
+void Conf::forgetDatabase() {
+  db = nullptr;
 }
 
 Database &Conf::getdb() {
@@ -625,8 +828,7 @@ Database &Conf::getdb() {
       database = logs + "/backups.db";
     if(command.act) {
       db = new Database(database);
-      if(!db->hasTable("backup"))
-        createTables();
+      createTables();
     } else {
       try {
         db = new Database(database, false);
@@ -640,19 +842,185 @@ Database &Conf::getdb() {
 }
 
 void Conf::createTables() {
+  // Each table is created if missing, so tables added in later versions are
+  // created in existing databases too.  The early return below is derived
+  // from the same list, so it cannot miss a table.
+  static const struct {
+    const char *name;
+    const char *sql;
+  } tables[] = {
+    {"backup",
+      "CREATE TABLE backup (\n"
+      "  host TEXT,\n"
+      "  volume TEXT,\n"
+      "  device TEXT,\n"
+      "  id TEXT,\n"
+      "  time INTEGER,\n"
+      "  pruned INTEGER,\n"
+      "  rc INTEGER,\n"
+      "  status INTEGER,\n"
+      "  log BLOB,\n"
+      "  PRIMARY KEY (host,volume,device,id)\n"
+      ")"},
+    {"store_usage",
+      "CREATE TABLE store_usage (\n"
+      "  device TEXT,\n"
+      "  time INTEGER,\n"
+      "  free_bytes INTEGER,\n"
+      "  total_bytes INTEGER,\n"
+      "  free_files INTEGER,\n"
+      "  total_files INTEGER,\n"
+      "  PRIMARY KEY (device,time)\n"
+      ")"},
+    {"backup_usage",
+      "CREATE TABLE backup_usage (\n"
+      "  host TEXT,\n"
+      "  volume TEXT,\n"
+      "  device TEXT,\n"
+      "  id TEXT,\n"
+      "  bytes INTEGER,\n"
+      "  files INTEGER,\n"
+      "  PRIMARY KEY (host,volume,device,id)\n"
+      ")"},
+    {"backup_duration",
+      "CREATE TABLE backup_duration (\n"
+      "  host TEXT,\n"
+      "  volume TEXT,\n"
+      "  device TEXT,\n"
+      "  id TEXT,\n"
+      "  seconds INTEGER,\n"
+      "  PRIMARY KEY (host,volume,device,id)\n"
+      ")"},
+    {"backup_space",
+      "CREATE TABLE backup_space (\n"
+      "  host TEXT,\n"
+      "  volume TEXT,\n"
+      "  device TEXT,\n"
+      "  id TEXT,\n"
+      "  total_bytes INTEGER,\n"
+      "  exclusive_bytes INTEGER,\n"
+      "  complete INTEGER,\n"
+      "  PRIMARY KEY (host,volume,device,id)\n"
+      ")"},
+    {"backup_space_part",
+      "CREATE TABLE backup_space_part (\n"
+      "  host TEXT,\n"
+      "  volume TEXT,\n"
+      "  device TEXT,\n"
+      "  id TEXT,\n"
+      "  name TEXT,\n"
+      "  total_bytes INTEGER,\n"
+      "  exclusive_bytes INTEGER,\n"
+      "  PRIMARY KEY (host,volume,device,id,name)\n"
+      ")"},
+    {"catalog",
+      "CREATE TABLE catalog (\n"
+      "  host TEXT,\n"
+      "  volume TEXT,\n"
+      "  path TEXT,\n"
+      "  device TEXT,\n"
+      "  first_id TEXT,\n"
+      "  last_id TEXT,\n"
+      "  size INTEGER,\n"
+      "  mtime INTEGER,\n"
+      "  flags TEXT,\n"
+      "  PRIMARY KEY (host,volume,path,device,first_id)\n"
+      ")"},
+    {"verify_inode",
+      "CREATE TABLE verify_inode (\n"
+      "  device TEXT,\n"
+      "  inode INTEGER,\n"
+      "  size INTEGER,\n"
+      "  mtime INTEGER,\n"
+      "  hash INTEGER,\n"
+      "  verified INTEGER,\n"
+      "  host TEXT,\n"
+      "  volume TEXT,\n"
+      "  id TEXT,\n"
+      "  PRIMARY KEY (device,inode,size,mtime)\n"
+      ")"},
+    {"verify_backup",
+      "CREATE TABLE verify_backup (\n"
+      "  host TEXT,\n"
+      "  volume TEXT,\n"
+      "  device TEXT,\n"
+      "  id TEXT,\n"
+      "  time INTEGER,\n"
+      "  files INTEGER,\n"
+      "  bytes INTEGER,\n"
+      "  errors INTEGER,\n"
+      "  PRIMARY KEY (host,volume,device,id)\n"
+      ")"},
+    {"dedup_index",
+      "CREATE TABLE dedup_index (\n"
+      "  device TEXT,\n"
+      "  size INTEGER,\n"
+      "  hash INTEGER,\n"
+      "  mode INTEGER,\n"
+      "  uid INTEGER,\n"
+      "  gid INTEGER,\n"
+      "  mtime INTEGER,\n"
+      "  inode INTEGER,\n"
+      "  host TEXT,\n"
+      "  volume TEXT,\n"
+      "  id TEXT,\n"
+      "  path TEXT,\n"
+      "  PRIMARY KEY (device,size,hash,mode,uid,gid,mtime)\n"
+      ")"},
+    {"dedup_backup",
+      "CREATE TABLE dedup_backup (\n"
+      "  host TEXT,\n"
+      "  volume TEXT,\n"
+      "  device TEXT,\n"
+      "  id TEXT,\n"
+      "  complete INTEGER,\n"
+      "  bytes_read INTEGER,\n"
+      "  linked INTEGER,\n"
+      "  reclaimed INTEGER,\n"
+      "  PRIMARY KEY (host,volume,device,id)\n"
+      ")"},
+    {"backup_transfer",
+      "CREATE TABLE backup_transfer (\n"
+      "  host TEXT,\n"
+      "  volume TEXT,\n"
+      "  device TEXT,\n"
+      "  id TEXT,\n"
+      "  link_dests INTEGER,\n"
+      "  files INTEGER,\n"
+      "  files_transferred INTEGER,\n"
+      "  total_size INTEGER,\n"
+      "  transferred_size INTEGER,\n"
+      "  literal_bytes INTEGER,\n"
+      "  matched_bytes INTEGER,\n"
+      "  bytes_sent INTEGER,\n"
+      "  bytes_received INTEGER,\n"
+      "  PRIMARY KEY (host,volume,device,id)\n"
+      ")"},
+    {"backup_tuning",
+      "CREATE TABLE backup_tuning (\n"
+      "  host TEXT,\n"
+      "  volume TEXT,\n"
+      "  device TEXT,\n"
+      "  id TEXT,\n"
+      "  compress INTEGER,\n"
+      "  compress_choice TEXT,\n"
+      "  compress_level INTEGER,\n"
+      "  whole_file INTEGER,\n"
+      "  fuzzy INTEGER,\n"
+      "  checksum_choice TEXT,\n"
+      "  PRIMARY KEY (host,volume,device,id)\n"
+      ")"},
+  };
+  bool missing = false;
+  for(auto &t: tables)
+    if(!db->hasTable(t.name))
+      missing = true;
+  if(!missing)
+    return;
   db->begin();
-  db->execute("CREATE TABLE backup (\n"
-              "  host TEXT,\n"
-              "  volume TEXT,\n"
-              "  device TEXT,\n"
-              "  id TEXT,\n"
-              "  time INTEGER,\n"
-              "  pruned INTEGER,\n"
-              "  rc INTEGER,\n"
-              "  status INTEGER,\n"
-              "  log BLOB,\n"
-              "  PRIMARY KEY (host,volume,device,id)\n"
-              ")");
+  for(auto &t: tables)
+    if(!db->hasTable(t.name))
+      db->execute(t.sql);
   db->commit();
 }
 
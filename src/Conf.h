@@ -54,6 +54,9 @@ class Host;
 class Volume;
 class Database;
 class Backup;
+class ConfCache;
+class Indent;
+struct ConfContext;
 
 /** @brief Type of map from host names to hosts
  *
@@ -112,6 +115,42 @@ public:
   /** @brief Lockfile path */
   std::string lock;
 
+  /** @brief Backup window in seconds, or 0 for no limit
+   *
+   * Corresponds to @c backup-window.
+   */
+  int64_t backupWindow = 0;
+
+  /** @brief Replicate new backups locally to further devices
+   *
+   * Corresponds to @c replicate-locally.
+   */
+  bool replicateLocally = false;
+
+  /** @brief Catalog the files in each backup
+   *
+   * Corresponds to @c catalog.
+   */
+  bool catalog = false;
+
+  /** @brief Interval before a verified file is verified again, in seconds
+   *
+   * Corresponds to @c verify-interval.
+   */
+  int64_t verifyInterval = DEFAULT_VERIFY_INTERVAL;
+
+  /** @brief Deduplicate new backups across volumes
+   *
+   * Corresponds to @c dedup.
+   */
+  bool dedup = false;
+
+  /** @brief Bytes read per device per run when deduplicating, or 0
+   *
+   * Corresponds to @c dedup-budget.
+   */
+  int64_t dedupBudget = DEFAULT_DEDUP_BUDGET;
+
   /** @brief Age to keep pruning logs */
   int keepPruneLogs = DEFAULT_KEEP_PRUNE_LOGS;
 
@@ -263,6 +302,12 @@ public:
    * ignored. */
   void readState();
 
+  /** @brief Forget the backup state
+   *
+   * The next call to @ref readState() will read it again.
+   */
+  void forgetState();
+
   /** @brief Identify devices
    * @param states Bitmap of store states to consider
    *
@@ -270,6 +315,19 @@ public:
    */
   void identifyDevices(int states);
 
+  /** @brief Forget which devices were identified
+   *
+   * The next call to @ref identifyDevices() will access every store again.
+   * The caller is responsible for calling postDeviceAccess() first.
+   */
+  void forgetDevices();
+
+  /** @brief Configuration files and directories read
+   *
+   * Set by @ref read().
+   */
+  std::vector<std::string> sources;
+
   /** @brief Unrecognized device names found in logs
    *
    * Set by readState().
@@ -295,6 +353,14 @@ public:
    */
   Database &getdb();
 
+  /** @brief Abandon the database access object without closing it
+   *
+   * For use in a child process, which must not use a database connection
+   * inherited from its parent.  The next call to @ref getdb() opens a new
+   * connection.
+   */
+  void forgetDatabase();
+
   ConfBase *getParent() const override;
 
   std::string what() const override;
@@ -324,6 +390,17 @@ private:
   void includeFile(const std::string &path);
   friend struct IncludeDirective;
 
+  /** @brief Act on one line of a configuration file
+   * @param cc Context, containing the tokenized line and its location
+   * @param indenter Indentation tracker for the file
+   * @param indent Indent depth of the line
+   * @throws ConfigError if the line is malformed
+   */
+  void processLine(ConfContext &cc, Indent &indenter, size_t indent);
+
+  /** @brief Compiled configuration cache, or null pointer */
+  ConfCache *cache = nullptr;
+
   /** @brief (De-)select all hosts
    * @param sense @c true to select all hosts, @c false to deselect them all
    */
@@ -352,9 +429,14 @@ private:
   /** @brief Database access object */
   Database *db = nullptr;
 
-  /** @brief Create database tables */
+  /** @brief Create any missing database tables */
   void createTables();
 
+  /** @brief Record the measured usage of newly identified stores
+   * @param identified Stores just probed
+   */
+  void recordStoreUsage(const std::vector<Store *> &identified);
+
   /** @brief Validate and add a backup to a volume
    * @param backup Populated backup
    * @param hostName Host owning @p backup
@@ -56,10 +56,32 @@ std::string ConfBase::quote(const std::vector<std::string> &vs) {
   return ss.str();
 }
 
+const char *ConfBase::tristate(Tristate value) {
+  switch(value) {
+  case TRISTATE_FALSE:
+    return "false";
+  case TRISTATE_TRUE:
+    return "true";
+  case TRISTATE_AUTO:
+    break;
+  }
+  return "auto";
+}
+
 std::string ConfBase::indent(int step) {
   return std::string(step, ' ');
 }
 
+// Whether a setting must be written out.  At the top level that is when it
+// differs from the built-in default; below it, when it differs from the
+// value that would otherwise be inherited.
+template<typename T>
+static bool overridden(const ConfBase *self, const ConfBase *parent,
+                       T ConfBase::*setting, const T &builtin) {
+  return parent ? self->*setting != parent->*setting
+                : self->*setting != builtin;
+}
+
 void ConfBase::write(std::ostream &os, int step, bool verbose) const {
   describe_type *d = verbose && !getParent() ? describe : nodescribe;
 
@@ -119,6 +141,60 @@ void ConfBase::write(std::ostream &os, int step, bool verbose) const {
     os << indent(step) << "hook-timeout " << hookTimeout << '\n';
   d(os, "", 0);
 
+  d(os, "# Maximum number of earlier backups to link against", step);
+  d(os, "#  max-link-dest COUNT", step);
+  if(overridden(this, parent, &ConfBase::maxLinkDest, DEFAULT_MAX_LINK_DEST))
+    os << indent(step) << "max-link-dest " << maxLinkDest << '\n';
+  d(os, "", 0);
+
+  d(os, "# How to copy local volumes", step);
+  d(os, "#  copy-engine rsync|native", step);
+  if(overridden(this, parent, &ConfBase::copyEngine,
+                std::string(DEFAULT_COPY_ENGINE)))
+    os << indent(step) << "copy-engine " << copyEngine << '\n';
+  d(os, "", 0);
+
+  d(os, "# Whether rsync compresses data in transit", step);
+  d(os, "#  rsync-compress true|false|auto", step);
+  if(overridden(this, parent, &ConfBase::rsyncCompress, TRISTATE_TRUE))
+    os << indent(step) << "rsync-compress " << tristate(rsyncCompress)
+       << '\n';
+  d(os, "", 0);
+
+  d(os, "# Compression algorithm and level for rsync", step);
+  d(os, "#  rsync-compress-choice ALGORITHM", step);
+  d(os, "#  rsync-compress-level LEVEL", step);
+  if(overridden(this, parent, &ConfBase::rsyncCompressChoice,
+                std::string()))
+    os << indent(step) << "rsync-compress-choice "
+       << quote(rsyncCompressChoice) << '\n';
+  if(overridden(this, parent, &ConfBase::rsyncCompressLevel, -1))
+    os << indent(step) << "rsync-compress-level " << rsyncCompressLevel
+       << '\n';
+  d(os, "", 0);
+
+  d(os, "# Whether rsync copies whole files rather than differences", step);
+  d(os, "#  rsync-whole-file true|false|auto", step);
+  if(overridden(this, parent, &ConfBase::rsyncWholeFile, TRISTATE_FALSE))
+    os << indent(step) << "rsync-whole-file " << tristate(rsyncWholeFile)
+       << '\n';
+  d(os, "", 0);
+
+  d(os, "# Whether rsync looks for similar files to copy differences from",
+    step);
+  d(os, "#  rsync-fuzzy true|false|auto", step);
+  if(overridden(this, parent, &ConfBase::rsyncFuzzy, TRISTATE_TRUE))
+    os << indent(step) << "rsync-fuzzy " << tristate(rsyncFuzzy) << '\n';
+  d(os, "", 0);
+
+  d(os, "# Checksum algorithm for rsync", step);
+  d(os, "#  rsync-checksum-choice ALGORITHM", step);
+  if(overridden(this, parent, &ConfBase::rsyncChecksumChoice,
+                std::string()))
+    os << indent(step) << "rsync-checksum-choice "
+       << quote(rsyncChecksumChoice) << '\n';
+  d(os, "", 0);
+
   // TODO hacky way of managing {toplevel,host}-only directives
   if(what() != "volume") {
     d(os, "# Host check behavior", step);
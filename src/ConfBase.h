@@ -25,6 +25,18 @@
 
 #include "Defaults.h"
 
+/** @brief Value of a setting that rsbackup can choose for itself */
+enum Tristate {
+  /** @brief Setting is off */
+  TRISTATE_FALSE,
+
+  /** @brief Setting is on */
+  TRISTATE_TRUE,
+
+  /** @brief Setting is chosen automatically */
+  TRISTATE_AUTO,
+};
+
 /** @brief Base for Volume, Host and Conf
  *
  * Volume, Host and Conf share certain parameters, which are inherited from
@@ -54,6 +66,14 @@ public:
                               rsyncTimeout(parent->rsyncTimeout),
                               sshTimeout(parent->sshTimeout),
                               hookTimeout(parent->hookTimeout),
+                              maxLinkDest(parent->maxLinkDest),
+                              copyEngine(parent->copyEngine),
+                              rsyncCompress(parent->rsyncCompress),
+                              rsyncCompressChoice(parent->rsyncCompressChoice),
+                              rsyncCompressLevel(parent->rsyncCompressLevel),
+                              rsyncWholeFile(parent->rsyncWholeFile),
+                              rsyncFuzzy(parent->rsyncFuzzy),
+                              rsyncChecksumChoice(parent->rsyncChecksumChoice),
                               hostCheck(parent->hostCheck),
                               devicePattern(parent->devicePattern) {}
 
@@ -85,6 +105,47 @@ public:
   /** @brief hook timeout */
   int hookTimeout = 0;
 
+  /** @brief Maximum number of earlier backups to pass to rsync
+   *
+   * Corresponds to @c max-link-dest. */
+  int maxLinkDest = DEFAULT_MAX_LINK_DEST;
+
+  /** @brief How to copy volumes into backups
+   *
+   * Corresponds to @c copy-engine.  Either @c rsync or @c native; the native
+   * engine is only used for volumes on the local host. */
+  std::string copyEngine = DEFAULT_COPY_ENGINE;
+
+  /** @brief Whether rsync compresses data in transit
+   *
+   * Corresponds to @c rsync-compress. */
+  Tristate rsyncCompress = TRISTATE_TRUE;
+
+  /** @brief Compression algorithm for rsync, or "" to negotiate one
+   *
+   * Corresponds to @c rsync-compress-choice. */
+  std::string rsyncCompressChoice;
+
+  /** @brief Compression level for rsync, or -1 for its default
+   *
+   * Corresponds to @c rsync-compress-level. */
+  int rsyncCompressLevel = -1;
+
+  /** @brief Whether rsync copies whole files instead of using delta-transfer
+   *
+   * Corresponds to @c rsync-whole-file. */
+  Tristate rsyncWholeFile = TRISTATE_FALSE;
+
+  /** @brief Whether rsync looks for similar files to use as a basis
+   *
+   * Corresponds to @c rsync-fuzzy. */
+  Tristate rsyncFuzzy = TRISTATE_TRUE;
+
+  /** @brief Checksum algorithm for rsync, or "" to negotiate one
+   *
+   * Corresponds to @c rsync-checksum-choice. */
+  std::string rsyncChecksumChoice;
+
   /** @brief Host check behavior */
   std::vector<std::string> hostCheck;
 
@@ -130,6 +191,12 @@ protected:
    */
   static std::string quote(const std::vector<std::string> &vs);
 
+  /** @brief Format a tristate setting for the config file
+   * @param value Setting
+   * @return "true", "false" or "auto"
+   */
+  static const char *tristate(Tristate value);
+
   /** @brief Construct indent text
    * @param step Indent depth
    * @return String containing enough spaces
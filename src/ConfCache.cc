@@ -0,0 +1,289 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "ConfCache.h"
+#include "Defaults.h"
+#include "Errors.h"
+#include "IO.h"
+#include "Utils.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// The cache file is a header line followed by length-prefixed binary
+// records in host byte order.  It is only ever read by the same build that
+// wrote it.
+static const char cache_magic[] = "rsbackup config cache " VERSION "\n";
+
+// Cache file is malformed
+struct BadCache {};
+
+namespace {
+
+// Serialization for the cache file
+struct CacheWriter {
+  std::string data;
+
+  template<typename T> void put(T n) {
+    data.append(reinterpret_cast<const char *>(&n), sizeof n);
+  }
+
+  void put(const std::string &s) {
+    put<uint32_t>(s.size());
+    data.append(s);
+  }
+
+  void put(const struct timespec &ts) {
+    put<int64_t>(ts.tv_sec);
+    put<int64_t>(ts.tv_nsec);
+  }
+};
+
+// Deserialization for the cache file.  Throws BadCache if the file is
+// truncated.
+struct CacheReader {
+  CacheReader(const std::string &data): data(data) {}
+
+  const std::string &data;
+  size_t pos = 0;
+
+  template<typename T> T get() {
+    T n;
+    if(data.size() - pos < sizeof n)
+      throw BadCache();
+    memcpy(&n, data.data() + pos, sizeof n);
+    pos += sizeof n;
+    return n;
+  }
+
+  std::string getString() {
+    size_t len = get<uint32_t>();
+    if(data.size() - pos < len)
+      throw BadCache();
+    std::string s(data, pos, len);
+    pos += len;
+    return s;
+  }
+
+  struct timespec getTime() {
+    struct timespec ts;
+    ts.tv_sec = get<int64_t>();
+    ts.tv_nsec = get<int64_t>();
+    return ts;
+  }
+};
+
+}
+
+void ConfCache::load(const std::string &root_) {
+  root = root_;
+  std::string data;
+  try {
+    IO input;
+    input.open(path, "r");
+    input.readall(data);
+  } catch(IOError &e) {
+    D("ConfCache::load: %s", e.what());
+    return;
+  }
+  try {
+    if(data.compare(0, sizeof cache_magic - 1, cache_magic))
+      throw BadCache();
+    CacheReader r(data);
+    r.pos = sizeof cache_magic - 1;
+    if(r.getString() != root)
+      throw BadCache();
+    for(uint32_t n = r.get<uint32_t>(); n > 0; --n) {
+      std::string name = r.getString();
+      File &f = oldFiles[name];
+      f.mtime = r.getTime();
+      f.size = r.get<uint64_t>();
+      f.hash = r.get<uint64_t>();
+      f.lines.resize(r.get<uint32_t>());
+      for(auto &line: f.lines) {
+        line.lineno = r.get<int32_t>();
+        line.indent = r.get<uint32_t>();
+        line.bits.resize(r.get<uint32_t>());
+        for(auto &bit: line.bits)
+          bit = r.getString();
+      }
+    }
+    for(uint32_t n = r.get<uint32_t>(); n > 0; --n) {
+      std::string name = r.getString();
+      Directory &d = oldDirectories[name];
+      d.mtime = r.getTime();
+      d.files.resize(r.get<uint32_t>());
+      for(auto &file: d.files)
+        file = r.getString();
+    }
+    if(r.pos != data.size())
+      throw BadCache();
+  } catch(BadCache &) {
+    D("ConfCache::load: %s: ignoring malformed or outdated cache",
+      path.c_str());
+    oldFiles.clear();
+    oldDirectories.clear();
+    return;
+  }
+  D("ConfCache::load: %s: %zu files, %zu directories",
+    path.c_str(), oldFiles.size(), oldDirectories.size());
+  loaded = true;
+}
+
+void ConfCache::save() const {
+  CacheWriter w;
+  w.data = cache_magic;
+  w.put(root);
+  w.put<uint32_t>(files.size());
+  for(auto &fe: files) {
+    const File &f = fe.second;
+    w.put(fe.first);
+    w.put(f.mtime);
+    w.put<uint64_t>(f.size);
+    w.put<uint64_t>(f.hash);
+    w.put<uint32_t>(f.lines.size());
+    for(auto &line: f.lines) {
+      w.put<int32_t>(line.lineno);
+      w.put<uint32_t>(line.indent);
+      w.put<uint32_t>(line.bits.size());
+      for(auto &bit: line.bits)
+        w.put(bit);
+    }
+  }
+  w.put<uint32_t>(directories.size());
+  for(auto &de: directories) {
+    w.put(de.first);
+    w.put(de.second.mtime);
+    w.put<uint32_t>(de.second.files.size());
+    for(auto &file: de.second.files)
+      w.put(file);
+  }
+  const std::string tmp = path + ".tmp";
+  try {
+    IO output;
+    output.open(tmp, "w");
+    output.write(w.data);
+    output.close();
+    if(rename(tmp.c_str(), path.c_str()) < 0)
+      throw IOError("renaming " + tmp, errno);
+  } catch(IOError &e) {
+    warning(WARNING_ALWAYS, "cannot save configuration cache: %s", e.what());
+    remove(tmp.c_str());
+  }
+}
+
+const std::vector<ConfLine> *ConfCache::findFile(const std::string &file,
+                                                 struct stat &sb) {
+  if(stat(file.c_str(), &sb) < 0) {
+    memset(&sb, 0, sizeof sb);
+    ++misses;
+    return nullptr;
+  }
+  // The same file may be included more than once
+  auto seen = files.find(file);
+  if(seen != files.end()
+     && seen->second.mtime == sb.st_mtim
+     && seen->second.size == (uint64_t)sb.st_size)
+    return &seen->second.lines;
+  auto it = oldFiles.find(file);
+  if(S_ISREG(sb.st_mode) && it != oldFiles.end()) {
+    File &f = it->second;
+    bool hit = f.mtime == sb.st_mtim && f.size == (uint64_t)sb.st_size;
+    if(!hit) {
+      // Modified, but perhaps only touched
+      try {
+        hit = hashFile(file) == f.hash;
+      } catch(IOError &) {
+      }
+      f.mtime = sb.st_mtim;
+      f.size = sb.st_size;
+    }
+    if(hit) {
+      File &g = files[file] = std::move(f);
+      oldFiles.erase(it);
+      return &g.lines;
+    }
+  }
+  ++misses;
+  return nullptr;
+}
+
+void ConfCache::addFile(const std::string &file, const struct stat &sb,
+                        uint64_t hash, std::vector<ConfLine> &&lines) {
+  if(!S_ISREG(sb.st_mode))
+    return;
+  File &f = files[file];
+  f.mtime = sb.st_mtim;
+  f.size = sb.st_size;
+  f.hash = hash;
+  f.lines = std::move(lines);
+}
+
+const std::vector<std::string> *ConfCache::findDirectory(
+  const std::string &directory, struct stat &sb) {
+  if(stat(directory.c_str(), &sb) < 0) {
+    memset(&sb, 0, sizeof sb);
+    return nullptr;
+  }
+  if(!S_ISDIR(sb.st_mode))
+    return nullptr;                     // not a miss; it's a file
+  auto it = oldDirectories.find(directory);
+  if(it != oldDirectories.end() && it->second.mtime == sb.st_mtim) {
+    // A symlink can change type without changing the directory
+    bool hit = true;
+    for(auto &name: it->second.files) {
+      struct stat fsb;
+      if(stat((directory + PATH_SEP + name).c_str(), &fsb) < 0
+         || !S_ISREG(fsb.st_mode)) {
+        hit = false;
+        break;
+      }
+    }
+    if(hit) {
+      Directory &d = directories[directory] = std::move(it->second);
+      oldDirectories.erase(it);
+      return &d.files;
+    }
+  }
+  ++misses;
+  return nullptr;
+}
+
+void ConfCache::addDirectory(const std::string &directory,
+                             const struct stat &sb,
+                             const std::vector<std::string> &files) {
+  if(!S_ISDIR(sb.st_mode))
+    return;
+  Directory &d = directories[directory];
+  d.mtime = sb.st_mtim;
+  d.files = files;
+}
+
+uint64_t ConfCache::hashLine(uint64_t hash, const std::string &line) {
+  // FNV-1a
+  for(char c: line)
+    hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+  return (hash ^ '\n') * 1099511628211ULL;
+}
+
+uint64_t ConfCache::hashFile(const std::string &file) {
+  IO input;
+  input.open(file, "r");
+  std::string line;
+  uint64_t hash = HASH_INIT;
+  while(input.readline(line))
+    hash = hashLine(hash, line);
+  return hash;
+}
@@ -0,0 +1,183 @@
+// -*-C++-*-
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef CONFCACHE_H
+#define CONFCACHE_H
+/** @file ConfCache.h
+ * @brief Compiled configuration cache
+ */
+
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+/** @brief One tokenized line of a configuration file */
+struct ConfLine {
+  /** @brief Line number */
+  int lineno;
+
+  /** @brief Indent depth */
+  size_t indent;
+
+  /** @brief Tokens, as produced by split() */
+  std::vector<std::string> bits;
+};
+
+/** @brief Compiled configuration cache
+ *
+ * Records the tokenized contents of every configuration file read, and the
+ * list of files found in every included directory, so that later runs can
+ * skip tokenizing and directory scanning.
+ *
+ * A file's entry is used if its modification time and size are unchanged, or
+ * if they have changed but the hash of its contents has not.  A directory's
+ * entry is used if its modification time is unchanged and the files it
+ * listed are all still regular files.
+ *
+ * The cache is only saved once the configuration has been validated.  It is
+ * validated again on every run, since validity also depends on things outside
+ * the configuration files, such as whether prune scripts exist.
+ */
+class ConfCache {
+public:
+  /** @brief Constructor
+   * @param path Path to cache file
+   */
+  ConfCache(const std::string &path): path(path) {}
+
+  /** @brief Load the cache
+   * @param root Path to top-level configuration file
+   *
+   * A cache which is missing, unreadable, malformed, written by a different
+   * version of rsbackup or for a different @p root is treated as empty.
+   */
+  void load(const std::string &root);
+
+  /** @brief Save the cache
+   *
+   * Only the files and directories read during this run are saved.  The cache
+   * is replaced atomically.  Failure to save the cache is not fatal.
+   */
+  void save() const;
+
+  /** @brief Find the tokenized contents of a configuration file
+   * @param file Path to configuration file
+   * @param sb Updated with the file's status, or zeroed if it cannot be found
+   * @return Tokenized contents or null pointer if not cached
+   */
+  const std::vector<ConfLine> *findFile(const std::string &file,
+                                        struct stat &sb);
+
+  /** @brief Record the tokenized contents of a configuration file
+   * @param file Path to configuration file
+   * @param sb File status from @ref findFile, before it was read
+   * @param hash Hash of contents (see @ref hashLine)
+   * @param lines Tokenized contents, excluding blank lines
+   */
+  void addFile(const std::string &file, const struct stat &sb, uint64_t hash,
+               std::vector<ConfLine> &&lines);
+
+  /** @brief Find the files to include from a directory
+   * @param directory Path to directory
+   * @param sb Updated with the directory's status, or zeroed if it cannot be
+   * found
+   * @return Names of files to include, or null pointer if not cached
+   */
+  const std::vector<std::string> *findDirectory(const std::string &directory,
+                                                struct stat &sb);
+
+  /** @brief Record the files included from a directory
+   * @param directory Path to directory
+   * @param sb Directory status from @ref findDirectory, before it was read
+   * @param files Names of files to include
+   */
+  void addDirectory(const std::string &directory, const struct stat &sb,
+                    const std::vector<std::string> &files);
+
+  /** @brief Test whether everything read so far came from the cache */
+  bool current() const {
+    return loaded && misses == 0;
+  }
+
+  /** @brief Add a line to a content hash
+   * @param hash Hash so far (start with @ref HASH_INIT)
+   * @param line Line, excluding newline
+   * @return Updated hash
+   */
+  static uint64_t hashLine(uint64_t hash, const std::string &line);
+
+  /** @brief Initial value for @ref hashLine */
+  static const uint64_t HASH_INIT = 14695981039346656037ULL;
+
+private:
+  /** @brief A cached configuration file */
+  struct File {
+    /** @brief Modification time */
+    struct timespec mtime;
+
+    /** @brief Size in bytes */
+    uint64_t size;
+
+    /** @brief Hash of contents */
+    uint64_t hash;
+
+    /** @brief Tokenized contents */
+    std::vector<ConfLine> lines;
+  };
+
+  /** @brief A cached include directory */
+  struct Directory {
+    /** @brief Modification time */
+    struct timespec mtime;
+
+    /** @brief Files to include */
+    std::vector<std::string> files;
+  };
+
+  /** @brief Hash the contents of a file
+   * @param file Path to file
+   * @return Hash of contents
+   */
+  static uint64_t hashFile(const std::string &file);
+
+  /** @brief Path to cache file */
+  std::string path;
+
+  /** @brief Path to top-level configuration file */
+  std::string root;
+
+  /** @brief Set if a cache was successfully loaded */
+  bool loaded = false;
+
+  /** @brief Number of files or directories not found in cache */
+  unsigned misses = 0;
+
+  /** @brief Files loaded from cache */
+  std::map<std::string, File> oldFiles;
+
+  /** @brief Directories loaded from cache */
+  std::map<std::string, Directory> oldDirectories;
+
+  /** @brief Files read during this run */
+  std::map<std::string, File> files;
+
+  /** @brief Directories read during this run */
+  std::map<std::string, Directory> directories;
+};
+
+#endif /* CONFCACHE_H */
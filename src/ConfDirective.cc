@@ -66,6 +66,18 @@ bool ConfDirective::get_boolean(const ConfContext &cc) const {
                       + "' - only 'true' or 'false' allowed");
 }
 
+Tristate ConfDirective::get_tristate(const ConfContext &cc) const {
+  if(cc.bits[1] == "true")
+    return TRISTATE_TRUE;
+  else if(cc.bits[1] == "false")
+    return TRISTATE_FALSE;
+  else if(cc.bits[1] == "auto")
+    return TRISTATE_AUTO;
+  else
+    throw SyntaxError("invalid argument to '" + name
+                      + "' - only 'true', 'false' or 'auto' allowed");
+}
+
 void ConfDirective::extend(const ConfContext &cc,
                            std::vector<std::string> &conf) const {
   if(cc.bits[1] == "+")
@@ -139,22 +151,52 @@ void ColorDirective::set_packed(ConfContext &cc, size_t n, int radix) const {
 
 // Global directives ----------------------------------------------------------
 
+/** @brief Base class for @c store and @c store-pattern */
+struct StoreBaseDirective: public ConfDirective {
+  /** @brief Constructor
+   * @param name Name of directive
+   */
+  StoreBaseDirective(const char *name): ConfDirective(name, 1, 2) {}
+
+  /** @brief Add a store
+   * @param cc Context containing directive
+   * @param path Location of store
+   */
+  void add(ConfContext &cc, const std::string &path) const {
+    Store *store = new Store(path);
+    store->snapshot = snapshot(cc);
+    cc.conf->stores[path] = store;
+  }
+
+  /** @brief Parse store options
+   * @param cc Context containing directive
+   * @return @c true if the @c snapshot option was given
+   */
+  static bool snapshot(ConfContext &cc) {
+    if(cc.bits.size() < 3)
+      return false;
+    if(cc.bits[2] != "snapshot")
+      throw SyntaxError("unrecognized store option '" + cc.bits[2] + "'");
+    return true;
+  }
+};
+
 /** @brief The @c store directive */
-static const struct StoreDirective: public ConfDirective {
-  StoreDirective(): ConfDirective("store", 1, 1) {}
+static const struct StoreDirective: public StoreBaseDirective {
+  StoreDirective(): StoreBaseDirective("store") {}
   void set(ConfContext &cc) const override {
-    cc.conf->stores[cc.bits[1]] = new Store(cc.bits[1]);
+    add(cc, cc.bits[1]);
   }
 } store_directive;
 
 /** @brief The @c store-pattern directive */
-static const struct StorePatternDirective: public ConfDirective {
-  StorePatternDirective(): ConfDirective("store-pattern", 1, 1) {}
+static const struct StorePatternDirective: public StoreBaseDirective {
+  StorePatternDirective(): StoreBaseDirective("store-pattern") {}
   void set(ConfContext &cc) const override {
     std::vector<std::string> files;
     globFiles(files, cc.bits[1], GLOB_NOCHECK);
     for(auto &file: files)
-      cc.conf->stores[file] = new Store(file);
+      add(cc, file);
   }
 } store_pattern_directive;
 
@@ -196,9 +238,33 @@ static const struct ColorBadDirective: public ColorDirective {
 
 /** @brief The @c device directive */
 static const struct DeviceDirective: public ConfDirective {
-  DeviceDirective(): ConfDirective("device", 1, 1) {}
-  void set(ConfContext &cc) const override {
-    cc.conf->devices[cc.bits[1]] = new Device(cc.bits[1]);
+  DeviceDirective(): ConfDirective("device", 1, 7) {}
+  void set(ConfContext &cc) const override {
+    Device *device = new Device(cc.bits[1]);
+    try {
+      for(size_t n = 2; n < cc.bits.size(); n += 2) {
+        if(n + 1 >= cc.bits.size())
+          throw SyntaxError("missing value for '" + cc.bits[n] + "'");
+        if(cc.bits[n] == "min-free-space")
+          device->minFreeSpace.parse(cc.bits[n + 1], true);
+        else if(cc.bits[n] == "min-free-inodes")
+          device->minFreeInodes.parse(cc.bits[n + 1], false);
+        else if(cc.bits[n] == "space-prune") {
+          if(cc.bits[n + 1] == "policy")
+            device->spacePrune = Device::SpacePrunePolicy;
+          else if(cc.bits[n + 1] == "oldest")
+            device->spacePrune = Device::SpacePruneOldest;
+          else
+            throw SyntaxError("invalid space-prune value '" + cc.bits[n + 1]
+                              + "'");
+        } else
+          throw SyntaxError("unrecognized device option '" + cc.bits[n] + "'");
+      }
+    } catch(...) {
+      delete device;
+      throw;
+    }
+    cc.conf->devices[cc.bits[1]] = device;
   }
 } device_directive;
 
@@ -266,6 +332,54 @@ static const struct PostAccessHookDirective: public ConfDirective {
   }
 } post_access_hook_directive;
 
+/** @brief The @c backup-window directive */
+static const struct BackupWindowDirective: public ConfDirective {
+  BackupWindowDirective(): ConfDirective("backup-window", 1, 1) {}
+  void set(ConfContext &cc) const override {
+    cc.conf->backupWindow = parseTimeInterval(cc.bits[1]);
+  }
+} backup_window_directive;
+
+/** @brief The @c replicate-locally directive */
+static const struct ReplicateLocallyDirective: public ConfDirective {
+  ReplicateLocallyDirective(): ConfDirective("replicate-locally", 0, 1) {}
+  void set(ConfContext &cc) const override {
+    cc.conf->replicateLocally = get_boolean(cc);
+  }
+} replicate_locally_directive;
+
+/** @brief The @c catalog directive */
+static const struct CatalogDirective: public ConfDirective {
+  CatalogDirective(): ConfDirective("catalog", 0, 1) {}
+  void set(ConfContext &cc) const override {
+    cc.conf->catalog = get_boolean(cc);
+  }
+} catalog_directive;
+
+/** @brief The @c dedup directive */
+static const struct DedupDirective: public ConfDirective {
+  DedupDirective(): ConfDirective("dedup", 0, 1) {}
+  void set(ConfContext &cc) const override {
+    cc.conf->dedup = get_boolean(cc);
+  }
+} dedup_directive;
+
+/** @brief The @c dedup-budget directive */
+static const struct DedupBudgetDirective: public ConfDirective {
+  DedupBudgetDirective(): ConfDirective("dedup-budget", 1, 1) {}
+  void set(ConfContext &cc) const override {
+    cc.conf->dedupBudget = parseSize(cc.bits[1]);
+  }
+} dedup_budget_directive;
+
+/** @brief The @c verify-interval directive */
+static const struct VerifyIntervalDirective: public ConfDirective {
+  VerifyIntervalDirective(): ConfDirective("verify-interval", 1, 1) {}
+  void set(ConfContext &cc) const override {
+    cc.conf->verifyInterval = parseTimeInterval(cc.bits[1]);
+  }
+} verify_interval_directive;
+
 /** @brief The @c keep-prune-logs directive */
 static const struct KeepPruneLogsDirective: public ConfDirective {
   KeepPruneLogsDirective(): ConfDirective("keep-prune-logs", 1, 1) {}
@@ -562,6 +676,77 @@ static const struct HookTimeoutDirective: InheritableDirective {
   }
 } hook_timeout_directive;
 
+/** @brief The @c max-link-dest directive */
+static const struct MaxLinkDestDirective: InheritableDirective {
+  MaxLinkDestDirective(): InheritableDirective("max-link-dest", 1, 1) {}
+  void set(ConfContext &cc) const override {
+    cc.context->maxLinkDest = parseInteger(cc.bits[1], 1,
+                                           DEFAULT_MAX_LINK_DEST);
+  }
+} max_link_dest_directive;
+
+/** @brief The @c copy-engine directive */
+static const struct CopyEngineDirective: InheritableDirective {
+  CopyEngineDirective(): InheritableDirective("copy-engine", 1, 1) {}
+  void set(ConfContext &cc) const override {
+    if(cc.bits[1] != "rsync" && cc.bits[1] != "native")
+      throw SyntaxError("unrecognized copy engine '" + cc.bits[1] + "'");
+    cc.context->copyEngine = cc.bits[1];
+  }
+} copy_engine_directive;
+
+/** @brief The @c rsync-compress directive */
+static const struct RsyncCompressDirective: InheritableDirective {
+  RsyncCompressDirective(): InheritableDirective("rsync-compress", 1, 1) {}
+  void set(ConfContext &cc) const override {
+    cc.context->rsyncCompress = get_tristate(cc);
+  }
+} rsync_compress_directive;
+
+/** @brief The @c rsync-compress-choice directive */
+static const struct RsyncCompressChoiceDirective: InheritableDirective {
+  RsyncCompressChoiceDirective():
+    InheritableDirective("rsync-compress-choice", 1, 1) {}
+  void set(ConfContext &cc) const override {
+    cc.context->rsyncCompressChoice = cc.bits[1];
+  }
+} rsync_compress_choice_directive;
+
+/** @brief The @c rsync-compress-level directive */
+static const struct RsyncCompressLevelDirective: InheritableDirective {
+  RsyncCompressLevelDirective():
+    InheritableDirective("rsync-compress-level", 1, 1) {}
+  void set(ConfContext &cc) const override {
+    cc.context->rsyncCompressLevel = parseInteger(cc.bits[1], 0,
+                                                  MAX_COMPRESS_LEVEL);
+  }
+} rsync_compress_level_directive;
+
+/** @brief The @c rsync-whole-file directive */
+static const struct RsyncWholeFileDirective: InheritableDirective {
+  RsyncWholeFileDirective(): InheritableDirective("rsync-whole-file", 1, 1) {}
+  void set(ConfContext &cc) const override {
+    cc.context->rsyncWholeFile = get_tristate(cc);
+  }
+} rsync_whole_file_directive;
+
+/** @brief The @c rsync-fuzzy directive */
+static const struct RsyncFuzzyDirective: InheritableDirective {
+  RsyncFuzzyDirective(): InheritableDirective("rsync-fuzzy", 1, 1) {}
+  void set(ConfContext &cc) const override {
+    cc.context->rsyncFuzzy = get_tristate(cc);
+  }
+} rsync_fuzzy_directive;
+
+/** @brief The @c rsync-checksum-choice directive */
+static const struct RsyncChecksumChoiceDirective: InheritableDirective {
+  RsyncChecksumChoiceDirective():
+    InheritableDirective("rsync-checksum-choice", 1, 1) {}
+  void set(ConfContext &cc) const override {
+    cc.context->rsyncChecksumChoice = cc.bits[1];
+  }
+} rsync_checksum_choice_directive;
+
 /** @brief The @c host-check directive */
 static const struct HostCheckDirective: InheritableDirective {
   HostCheckDirective(): InheritableDirective("host-check", 1, INT_MAX,
@@ -693,3 +878,35 @@ static const struct CheckMountedDirective: public VolumeOnlyDirective {
     cc.volume->checkMounted = get_boolean(cc);
   }
 } check_mounted_directive;
+
+/** @brief The @c shards directive */
+static const struct ShardsDirective: public VolumeOnlyDirective {
+  ShardsDirective(): VolumeOnlyDirective("shards", 1, 1) {}
+  void set(ConfContext &cc) const override {
+    cc.volume->shards = parseInteger(cc.bits[1], 1, MAX_SHARDS);
+  }
+} shards_directive;
+
+/** @brief The @c shard directive */
+static const struct ShardDirective: public VolumeOnlyDirective {
+  ShardDirective(): VolumeOnlyDirective("shard", 1, INT_MAX) {}
+  void set(ConfContext &cc) const override {
+    std::vector<std::string> group;
+    for(size_t i = 1; i < cc.bits.size(); ++i) {
+      std::string path = cc.bits[i];
+      // Paths are relative to the root of the volume
+      while(path.size() && path.front() == '/')
+        path.erase(0, 1);
+      while(path.size() && path.back() == '/')
+        path.pop_back();
+      if(path.empty()
+         || path.find("//") != std::string::npos
+         || path.find("**") != std::string::npos
+         || ("/" + path + "/").find("/./") != std::string::npos
+         || ("/" + path + "/").find("/../") != std::string::npos)
+        throw SyntaxError("invalid shard path '" + cc.bits[i] + "'");
+      group.push_back(path);
+    }
+    cc.volume->shardGroups.push_back(group);
+  }
+} shard_directive;
@@ -22,6 +22,9 @@
  * classes that define directives (@ref ConfDirective).
  */
 
+#include <unordered_map>
+#include "ConfBase.h"
+
 /** @brief Bit indicating the top level of the configuration file */
 #define LEVEL_TOP 1
 
@@ -73,7 +76,7 @@ struct ConfContext {
 class ConfDirective;
 
 /** @brief Type of name-to-directive map */
-typedef std::map<std::string, const ConfDirective *> directives_type;
+typedef std::unordered_map<std::string, const ConfDirective *> directives_type;
 
 /** @brief Base class for configuration file directives
  *
@@ -118,6 +121,15 @@ public:
    */
   bool get_boolean(const ConfContext &cc) const;
 
+  /** @brief Get a tristate parameter
+   * @param cc Context containing directive
+   * @return Setting
+   *
+   * Use in ConfDirective::set implementations for directives that can be
+   * @c true, @c false or @c auto.
+   */
+  Tristate get_tristate(const ConfContext &cc) const;
+
   /** @brief Set or extend a vector directive
    * @param cc Context containing directive
    * @param conf Configuration value to update
@@ -0,0 +1,541 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "rsbackup.h"
+#include "Daemon.h"
+#include "Command.h"
+#include "Conf.h"
+#include "Device.h"
+#include "Backup.h"
+#include "Date.h"
+#include "Host.h"
+#include "Volume.h"
+#include "Document.h"
+#include "Report.h"
+#include "DeviceAccess.h"
+#include "FileLock.h"
+#include "Errors.h"
+#include "IO.h"
+#include "Utils.h"
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+Daemon::~Daemon() {
+  try {
+    wait();
+  } catch(std::runtime_error &) {
+  }
+  for(auto &c: clients)
+    close(c.first);
+  if(listener >= 0) {
+    close(listener);
+    unlink(socketPath.c_str());
+  }
+}
+
+void Daemon::run() {
+  listen();
+  sourceTimes(configTimes);
+  struct timespec now, nextScheduled, nextWatch;
+  getMonotonicTime(now);
+  nextScheduled = nextWatch = now;
+  // Keep serving until any running job has finished and every reply has
+  // been sent
+  while(!quit || jobPid >= 0 || replying()) {
+    reap(false);
+    if(restartPending && jobPid < 0 && !replying())
+      restart();
+    getMonotonicTime(now);
+    // A pass that falls due while a job is running waits for it to finish
+    if(now >= nextScheduled && !quit && scheduled()) {
+      nextScheduled = now;
+      nextScheduled.tv_sec += DAEMON_INTERVAL;
+    }
+    if(now >= nextWatch) {
+      if(configChanged()) {
+        warning(WARNING_ALWAYS, "configuration changed");
+        if(checkConfig())
+          restartPending = true;
+        sourceTimes(configTimes);       // don't keep trying
+      }
+      nextWatch = now;
+      nextWatch.tv_sec += DAEMON_WATCH_INTERVAL;
+    }
+    if(restartPending && jobPid < 0 && !replying())
+      continue;
+    struct timespec next = nextScheduled < nextWatch
+      ? nextScheduled : nextWatch;
+    if(jobPid >= 0) {
+      // Check regularly for the job finishing
+      struct timespec reapTime = now;
+      reapTime.tv_sec += DAEMON_JOB_INTERVAL;
+      if(reapTime < next)
+        next = reapTime;
+    }
+    std::vector<struct pollfd> pfds;
+    if(clients.size() < DAEMON_MAX_CLIENTS)
+      pfds.push_back(pollfd{listener, POLLIN, 0});
+    for(auto &c: clients) {
+      if(c.second.deadline < next)
+        next = c.second.deadline;
+      pfds.push_back(pollfd{c.first,
+                            static_cast<short>(c.second.replying
+                                               ? POLLOUT : POLLIN),
+                            0});
+    }
+    struct timespec delay = next >= now ? next - now : timespec{0, 0};
+    int timeout = delay.tv_sec * 1000 + delay.tv_nsec / 1000000 + 1;
+    int n = poll(pfds.data(), pfds.size(), timeout);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      throw SystemError("poll", errno);
+    }
+    for(auto &pfd: pfds) {
+      if(!(pfd.revents & (POLLIN | POLLOUT | POLLERR | POLLHUP)))
+        continue;
+      if(pfd.fd == listener) {
+        acceptClient();
+        continue;
+      }
+      Client &client = clients[pfd.fd];
+      if(!(client.replying ? transmit(pfd.fd, client)
+                           : receive(pfd.fd, client)))
+        drop(pfd.fd);
+    }
+    expire();
+  }
+}
+
+void Daemon::listen() {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  if(socketPath.size() >= sizeof addr.sun_path)
+    throw CommandError("socket path too long: " + socketPath);
+  strcpy(addr.sun_path, socketPath.c_str());
+  // Refuse to take over from a daemon that is still answering, but remove a
+  // stale socket left by a previous instance
+  struct stat sb;
+  if(lstat(socketPath.c_str(), &sb) == 0 && S_ISSOCK(sb.st_mode)) {
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(probe < 0)
+      throw SystemError("socket", errno);
+    int rc = connect(probe, reinterpret_cast<struct sockaddr *>(&addr),
+                     sizeof addr);
+    int connectErrno = errno;
+    close(probe);
+    if(rc == 0)
+      throw CommandError("daemon already running on " + socketPath);
+    if(connectErrno != ECONNREFUSED)
+      throw SystemError("connecting to " + socketPath, connectErrno);
+    unlink(socketPath.c_str());
+  }
+  listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(listener < 0)
+    throw SystemError("socket", errno);
+  // Anyone who can connect can initiate backups and pruning
+  mode_t oldMask = umask(077);
+  int rc = bind(listener, reinterpret_cast<struct sockaddr *>(&addr),
+                sizeof addr);
+  int bindErrno = errno;
+  umask(oldMask);
+  if(rc < 0) {
+    close(listener);
+    listener = -1;
+    throw SystemError("binding " + socketPath, bindErrno);
+  }
+  if(::listen(listener, 8) < 0)
+    throw SystemError("listen", errno);
+  D("listening on %s", socketPath.c_str());
+}
+
+void Daemon::acceptClient() {
+  int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+  if(fd < 0) {
+    if(errno == EINTR || errno == EAGAIN || errno == ECONNABORTED)
+      return;
+    throw SystemError("accept", errno);
+  }
+  Client &client = clients[fd];
+  getMonotonicTime(client.deadline);
+  client.deadline.tv_sec += DAEMON_CLIENT_TIMEOUT;
+}
+
+bool Daemon::receive(int fd, Client &client) {
+  char buffer[512];
+  for(;;) {
+    size_t newline = client.request.find('\n');
+    if(newline != std::string::npos) {
+      client.request.erase(newline);
+      return serve(fd, client);
+    }
+    if(client.request.size() > DAEMON_MAX_REQUEST) {
+      warning(WARNING_ALWAYS, "daemon request too long");
+      return false;
+    }
+    ssize_t bytes = read(fd, buffer, sizeof buffer);
+    if(bytes < 0) {
+      if(errno == EINTR)
+        continue;
+      if(errno == EAGAIN || errno == EWOULDBLOCK)
+        return true;
+      warning(WARNING_ALWAYS, "reading daemon request: %s", strerror(errno));
+      return false;
+    }
+    if(bytes == 0) {
+      // Accept a final line with no newline
+      if(client.request.size() == 0)
+        return false;
+      return serve(fd, client);
+    }
+    client.request.append(buffer, bytes);
+  }
+}
+
+bool Daemon::serve(int fd, Client &client) {
+  D("request: %s", client.request.c_str());
+  errors = 0;
+  try {
+    // If a job was started, it sends the reply itself
+    if(!execute(client.request, client.reply, fd))
+      return false;
+    client.reply += outcome();
+  } catch(std::runtime_error &e) {
+    error("%s", e.what());
+    client.reply += std::string("error: ") + e.what() + "\n";
+  }
+  errors = 0;
+  client.replying = true;
+  return transmit(fd, client);
+}
+
+bool Daemon::transmit(int fd, Client &client) {
+  while(client.written < client.reply.size()) {
+    ssize_t n = send(fd, client.reply.data() + client.written,
+                     client.reply.size() - client.written, MSG_NOSIGNAL);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      if(errno == EAGAIN || errno == EWOULDBLOCK)
+        return true;
+      warning(WARNING_VERBOSE, "sending reply: %s", strerror(errno));
+      return false;
+    }
+    client.written += n;
+  }
+  return false;
+}
+
+void Daemon::drop(int fd) {
+  close(fd);
+  clients.erase(fd);
+}
+
+void Daemon::expire() {
+  struct timespec now;
+  getMonotonicTime(now);
+  for(auto it = clients.begin(); it != clients.end();) {
+    auto next = it;
+    ++next;
+    if(now >= it->second.deadline) {
+      warning(WARNING_ALWAYS, "daemon client timed out");
+      drop(it->first);
+    }
+    it = next;
+  }
+}
+
+bool Daemon::replying() const {
+  for(auto &c: clients)
+    if(c.second.replying)
+      return true;
+  return false;
+}
+
+std::string Daemon::outcome() {
+  if(errors)
+    return "error: " + std::to_string(errors) + " errors detected\n";
+  else
+    return "ok\n";
+}
+
+void Daemon::sendReply(int fd, const std::string &reply) {
+  size_t written = 0;
+  while(written < reply.size()) {
+    ssize_t n = send(fd, reply.data() + written, reply.size() - written,
+                     MSG_NOSIGNAL);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      warning(WARNING_VERBOSE, "sending reply: %s", strerror(errno));
+      return;
+    }
+    written += n;
+  }
+}
+
+bool Daemon::execute(const std::string &request, std::string &reply,
+                     int fd) {
+  std::vector<std::string> bits;
+  split(bits, request);
+  if(bits.size() == 0)
+    throw CommandError("empty request");
+  const std::string verb = bits[0];
+  bits.erase(bits.begin());
+  // Each request is a run of its own, so it may see a new day
+  Date::forgetToday();
+  if(verb == "backup") {
+    startJob(true, false, bits, fd);
+    return false;
+  } else if(verb == "prune") {
+    startJob(false, true, bits, fd);
+    return false;
+  } else if(verb == "report") {
+    if(bits.size() != 1)
+      throw CommandError("usage: report text|html");
+    report(bits[0], reply);
+  } else if(verb == "status") {
+    if(bits.size() != 0)
+      throw CommandError("usage: status");
+    status(reply);
+  } else if(verb == "reload") {
+    if(bits.size() != 0)
+      throw CommandError("usage: reload");
+    if(!checkConfig())
+      throw ConfigError("new configuration is not valid");
+    restartPending = true;
+  } else if(verb == "quit") {
+    if(bits.size() != 0)
+      throw CommandError("usage: quit");
+    quit = true;
+  } else
+    throw CommandError("unknown command '" + verb + "'");
+  return true;
+}
+
+void Daemon::startJob(bool backup, bool prune,
+                      const std::vector<std::string> &selections, int fd) {
+  if(jobPid >= 0)
+    throw CommandError("busy");
+  IO::out.flush();
+  IO::err.flush();
+  pid_t pid = fork();
+  if(pid < 0)
+    throw SystemError("fork", errno);
+  if(pid > 0) {
+    D("started job %jd", (intmax_t)pid);
+    jobPid = pid;
+    return;
+  }
+  // Child process: never return to the caller, and never run the
+  // destructor, which would remove the socket
+  int status = 1;
+  try {
+    if(listener >= 0) {
+      close(listener);
+      listener = -1;
+    }
+    // Other clients belong to the daemon
+    for(auto &c: clients)
+      if(c.first != fd)
+        close(c.first);
+    clients.clear();
+    config.forgetDatabase();
+    // The job may take a while, so wait for the client rather than poll
+    int flags;
+    if(fd >= 0 && (flags = fcntl(fd, F_GETFL)) >= 0)
+      fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+    std::string reply;
+    errors = 0;
+    try {
+      job(backup, prune, selections);
+      reply = outcome();
+    } catch(std::runtime_error &e) {
+      error("%s", e.what());
+      reply = std::string("error: ") + e.what() + "\n";
+    }
+    if(fd >= 0)
+      sendReply(fd, reply);
+    else if(errors)
+      warning(WARNING_VERBOSE, "%d errors detected", errors);
+    status = errors ? 1 : 0;
+    IO::out.flush();
+    IO::err.flush();
+  } catch(...) {
+  }
+  _exit(status);
+}
+
+int Daemon::reap(bool block) {
+  if(jobPid < 0)
+    return 0;
+  int status;
+  pid_t pid;
+  for(;;) {
+    pid = waitpid(jobPid, &status, block ? 0 : WNOHANG);
+    if(pid >= 0)
+      break;
+    if(errno != EINTR)
+      throw SystemError("waitpid", errno);
+  }
+  if(pid == 0)
+    return 0;
+  D("job %jd finished with wait status %#x", (intmax_t)jobPid, status);
+  jobPid = -1;
+  // The job changed the backup state behind our back
+  config.forgetState();
+  return status;
+}
+
+int Daemon::wait() {
+  return reap(true);
+}
+
+void Daemon::job(bool backup, bool prune,
+                 const std::vector<std::string> &selections) {
+  VolumeSelections vs;
+  for(auto &s: selections)
+    vs.add(s);
+  FileLock lockFile(config.lock);
+  if(config.lock.size() && !lockFile.acquire(false))
+    throw SystemError("cannot acquire lockfile " + config.lock);
+  config.selectVolume("*", "*", false);
+  vs.select(config);
+  try {
+    if(backup)
+      makeBackups();
+    if(prune) {
+      command.prune = true;
+      pruneBackups();
+      prunePruneLogs();
+      command.prune = false;
+    }
+  } catch(...) {
+    command.prune = false;
+    postDeviceAccess();
+    config.forgetDevices();
+    throw;
+  }
+  // Release the devices, and check them again next time
+  postDeviceAccess();
+  config.forgetDevices();
+}
+
+bool Daemon::scheduled() {
+  if(jobPid >= 0)
+    return false;
+  D("scheduled backup and prune");
+  // Each pass is a run of its own, so it may see a new day
+  Date::forgetToday();
+  try {
+    startJob(true, true, {}, -1);
+  } catch(std::runtime_error &e) {
+    error("%s", e.what());
+  }
+  return true;
+}
+
+void Daemon::status(std::string &reply) {
+  config.readState();
+  std::stringstream ss;
+  for(auto &h: config.hosts) {
+    const Host *host = h.second;
+    for(auto &v: host->volumes) {
+      const Volume *volume = v.second;
+      if(volume->perDevice.size() == 0)
+        ss << host->name << ':' << volume->name << " - 0 -\n";
+      for(auto &pd: volume->perDevice)
+        ss << host->name << ':' << volume->name
+           << ' ' << pd.first
+           << ' ' << pd.second.count
+           << ' ' << pd.second.newest.toString() << '\n';
+    }
+  }
+  reply += ss.str();
+}
+
+void Daemon::report(const std::string &format, std::string &reply) {
+  if(format != "text" && format != "html")
+    throw CommandError("usage: report text|html");
+  config.readState();
+  Document d;
+  Report r(d);
+  r.setStyleSheet();
+  r.generate();
+  std::stringstream ss;
+  if(format == "html")
+    d.renderHtml(ss);
+  else
+    d.renderText(ss);
+  reply += ss.str();
+}
+
+void Daemon::sourceTimes(std::map<std::string, struct timespec> &times) {
+  times.clear();
+  for(auto &path: config.sources) {
+    struct stat sb;
+    if(stat(path.c_str(), &sb) == 0)
+      times[path] = sb.st_mtim;
+    else
+      times[path] = timespec{0, 0};
+  }
+}
+
+bool Daemon::configChanged() {
+  std::map<std::string, struct timespec> times;
+  sourceTimes(times);
+  for(auto &t: times)
+    if(!(configTimes[t.first] == t.second))
+      return true;
+  return false;
+}
+
+bool Daemon::checkConfig() {
+  try {
+    Conf candidate;
+    candidate.read();
+    candidate.validate();
+  } catch(std::runtime_error &e) {
+    error("%s", e.what());
+    return false;
+  }
+  return true;
+}
+
+void Daemon::restart() {
+  warning(WARNING_ALWAYS, "restarting with new configuration");
+  close(listener);
+  listener = -1;
+  IO::out.flush();
+  IO::err.flush();
+  execvp(argv[0], argv);
+  throw SystemError(std::string("executing ") + argv[0], errno);
+}
+
+void runDaemon(const std::string &socketPath, char **argv) {
+  Daemon d(socketPath, argv);
+  d.run();
+}
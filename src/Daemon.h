@@ -0,0 +1,255 @@
+//-*-C++-*-
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef DAEMON_H
+#define DAEMON_H
+/** @file Daemon.h
+ * @brief Daemon mode
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+#include <ctime>
+#include <sys/types.h>
+
+/** @brief State of a running daemon */
+class Daemon {
+public:
+  /** @brief Constructor
+   * @param socketPath Path to listening socket
+   * @param argv Command line
+   */
+  Daemon(const std::string &socketPath, char **argv):
+    socketPath(socketPath), argv(argv) {}
+
+  /** @brief Destructor
+   *
+   * Waits for any running job to finish.
+   */
+  ~Daemon();
+
+  /** @brief Serve requests until told to quit */
+  void run();
+
+  /** @brief Start the scheduled backup and prune pass
+   * @return @c true if it was started, @c false if a job was already running
+   */
+  bool scheduled();
+
+  /** @brief Wait for the running job, if any, to finish
+   * @return Wait status of the job, or 0 if none was running
+   */
+  int wait();
+
+private:
+  /** @brief Create the listening socket */
+  void listen();
+
+  /** @brief A connected client */
+  struct Client {
+    /** @brief Request received so far */
+    std::string request;
+
+    /** @brief Reply, once the request has been executed */
+    std::string reply;
+
+    /** @brief Number of bytes of @ref reply sent so far */
+    size_t written = 0;
+
+    /** @brief Set once the request has been executed */
+    bool replying = false;
+
+    /** @brief Time by which the exchange must be complete */
+    struct timespec deadline;
+  };
+
+  /** @brief Accept a new connection */
+  void acceptClient();
+
+  /** @brief Read as much of a request as is available
+   * @param fd Connected socket
+   * @param client Client state
+   * @return @c true to keep the connection, @c false to close it
+   *
+   * Once the request is complete, it is executed.
+   */
+  bool receive(int fd, Client &client);
+
+  /** @brief Execute a complete request
+   * @param fd Connected socket
+   * @param client Client state
+   * @return @c true to keep the connection, @c false to close it
+   */
+  bool serve(int fd, Client &client);
+
+  /** @brief Send as much of a reply as the client will take
+   * @param fd Connected socket
+   * @param client Client state
+   * @return @c true to keep the connection, @c false to close it
+   */
+  bool transmit(int fd, Client &client);
+
+  /** @brief Close a connection
+   * @param fd Connected socket
+   */
+  void drop(int fd);
+
+  /** @brief Close connections that have run out of time */
+  void expire();
+
+  /** @brief Test whether any reply is still being sent
+   * @return @c true if some client has not had all of its reply
+   */
+  bool replying() const;
+
+  /** @brief Execute a request
+   * @param request Request line
+   * @param reply Output to send to the client
+   * @param fd Connected socket
+   * @return @c true if @p reply is ready, @c false if a job will reply
+   *
+   * Throws on error.
+   */
+  bool execute(const std::string &request, std::string &reply, int fd);
+
+  /** @brief Send a reply, blocking until it is sent
+   * @param fd Connected socket
+   * @param reply Reply to send
+   */
+  static void sendReply(int fd, const std::string &reply);
+
+  /** @brief Final line of a reply to a request that completed */
+  static std::string outcome();
+
+  /** @brief Start a job in a child process
+   * @param backup @c true to back up
+   * @param prune @c true to prune
+   * @param selections Volumes to select, as on the command line
+   * @param fd Connected socket to send the outcome to, or -1
+   *
+   * Throws if a job is already running.
+   */
+  void startJob(bool backup, bool prune,
+                const std::vector<std::string> &selections, int fd);
+
+  /** @brief Notice if the running job has finished
+   * @param block @c true to wait for it to finish
+   * @return Wait status of the job, or 0 if none was running
+   */
+  int reap(bool block);
+
+  /** @brief Back up and/or prune selected volumes
+   * @param backup @c true to back up
+   * @param prune @c true to prune
+   * @param selections Volumes to select, as on the command line
+   *
+   * Throws on error.
+   */
+  void job(bool backup, bool prune,
+           const std::vector<std::string> &selections);
+
+  /** @brief Describe the state of every volume
+   * @param reply Where to write the description
+   */
+  void status(std::string &reply);
+
+  /** @brief Generate a report
+   * @param format @c text or @c html
+   * @param reply Where to write the report
+   */
+  void report(const std::string &format, std::string &reply);
+
+  /** @brief Record the modification times of the configuration
+   * @param times Where to store the modification times
+   */
+  static void sourceTimes(std::map<std::string, struct timespec> &times);
+
+  /** @brief Check whether the configuration has changed */
+  bool configChanged();
+
+  /** @brief Check that the configuration on disk is valid
+   * @return @c true if it is valid
+   */
+  static bool checkConfig();
+
+  /** @brief Re-execute, picking up the new configuration
+   *
+   * Only returns by throwing an exception.
+   */
+  void restart();
+
+  /** @brief Path to listening socket */
+  std::string socketPath;
+
+  /** @brief Command line */
+  char **argv;
+
+  /** @brief Listening socket, or -1 */
+  int listener = -1;
+
+  /** @brief Connected clients, indexed by socket */
+  std::map<int, Client> clients;
+
+  /** @brief Set to terminate @ref run() */
+  bool quit = false;
+
+  /** @brief Set to call @ref restart() once no job is running */
+  bool restartPending = false;
+
+  /** @brief Process ID of the running job, or -1 */
+  pid_t jobPid = -1;
+
+  /** @brief Modification times of configuration files and directories */
+  std::map<std::string, struct timespec> configTimes;
+};
+
+/** @brief Run as a daemon
+ * @param socketPath Path to listening socket
+ * @param argv Command line, used to restart when the configuration changes
+ *
+ * The configuration, backup state and database remain loaded between
+ * commands.  Commands are accepted on a Unix domain socket at @p socketPath.
+ * If another daemon is already answering there, a @ref CommandError is
+ * thrown; a stale socket is replaced.
+ *
+ * Connections are handled concurrently, so a slow client does not hold up
+ * others, but each has only @ref DAEMON_CLIENT_TIMEOUT seconds to send its
+ * request and read the reply.  Backups and pruning run in a child process,
+ * one job at a time, so that other commands can still be served meanwhile;
+ * while a job is running, @c backup and @c prune fail with <tt>error:
+ * busy</tt>.  Each connection carries a single line, which is split as by
+ * split(); the daemon replies with any output, followed by a final line of
+ * @c ok or <tt>error: </tt><i>MESSAGE</i>, and closes the connection.
+ * Commands are:
+ * - <tt>backup [SELECTION...]</tt>
+ * - <tt>prune [SELECTION...]</tt>
+ * - <tt>report text|html</tt>
+ * - @c status
+ * - @c reload
+ * - @c quit
+ *
+ * In addition, every @ref DAEMON_INTERVAL seconds all volumes are backed up
+ * (volumes which do not need a backup are skipped as usual) and pruned.
+ *
+ * If any configuration file changes, the new configuration is checked and,
+ * if valid, the daemon re-executes itself with the same command line.
+ * Restarting waits for any running job to finish.
+ *
+ * Returns after a @c quit command, once any running job has finished.
+ */
+void runDaemon(const std::string &socketPath, char **argv);
+
+#endif /* DAEMON_H */
@@ -52,6 +52,10 @@ void Database::execute(const char *cmd) {
   Statement(*this, cmd, SQL_END).next();
 }
 
+int Database::changes() {
+  return sqlite3_changes(db);
+}
+
 void Database::begin() {
   execute("BEGIN");
 }
@@ -110,7 +114,7 @@ void Database::Statement::vprepare(const char *cmd, va_list ap) {
     throw std::logic_error(std::string("Database::Statement::vprepare: trailing junk: \"") + tail + "\"");
   try {
     param = 1;
-    vbind(ap);
+    vbind(va_arg(ap, int), ap);
   } catch(std::runtime_error &e) {
     sqlite3_finalize(stmt);
     stmt = nullptr;
@@ -118,15 +122,36 @@ void Database::Statement::vprepare(const char *cmd, va_list ap) {
   }
 }
 
-void Database::Statement::vbind(va_list ap) {
-  int t, i, rc;
+void Database::Statement::reset(int type, ...) {
+  if(!stmt)
+    throw std::logic_error("Database::Statement::reset: not prepared");
+  // sqlite3_reset reports the outcome of the last step, which has already
+  // been handled
+  sqlite3_reset(stmt);
+  int rc = sqlite3_clear_bindings(stmt);
+  if(rc != SQLITE_OK)
+    error("sqlite3_clear_bindings", rc);
+  param = 1;
+  va_list ap;
+  va_start(ap, type);
+  try {
+    vbind(type, ap);
+  } catch(std::runtime_error &e) {
+    va_end(ap);
+    throw;
+  }
+  va_end(ap);
+}
+
+void Database::Statement::vbind(int t, va_list ap) {
+  int i, rc;
   sqlite3_int64 i64;
   const char *cs;
   const std::string *s;
 
   if(param <= 0)
     throw std::logic_error("Database::Statement::vbind: invalid 'param' value");
-  while((t = va_arg(ap, int)) != SQL_END) {
+  for(; t != SQL_END; t = va_arg(ap, int)) {
     switch(t) {
     case SQL_INT:
       i = va_arg(ap, int);
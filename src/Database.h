@@ -87,6 +87,16 @@ public:
      */
     void prepare(const char *cmd, ...);
 
+    /** @brief Reset a statement and bind new data to it
+     * @param type Type of first parameter, or @ref SQL_END
+     * @param ... Binding information
+     * @throw DatabaseError if an error occurs
+     *
+     * This allows a statement to be executed repeatedly without preparing it
+     * again each time.  Binding information is as for @ref prepare.
+     */
+    void reset(int type, ...);
+
     /** @brief Fetch the next row
      * @return @c true if a row is available, otherwise @c false
      * @throw DatabaseError if an error occurs
@@ -130,13 +140,14 @@ public:
     void vprepare(const char *cmd, va_list ap);
 
     /** @brief Bind to a statement
+     * @param t Type of first parameter, or @ref SQL_END
      * @param ap Binding information
      * @throw DatabaseError if an error occurs
      *
      * Depends on @ref param being initialized so only callable from or after
      * @ref vprepare and its callers.
      */
-    void vbind(va_list ap);
+    void vbind(int t, va_list ap);
 
     /** @brief Raise an error
      * @param description Context for error
@@ -186,6 +197,11 @@ public:
    */
   void execute(const char *cmd);
 
+  /** @brief Return the number of rows changed by the last statement
+   * @return Number of rows inserted, updated or deleted
+   */
+  int changes();
+
   /** @brief Begin a transaction */
   void begin();
 
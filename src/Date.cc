@@ -18,7 +18,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cerrno>
-#include <climits>
+#include <algorithm>
 #include <sstream>
 
 // Cumulative day numbers at start of each month
@@ -64,15 +64,15 @@ Date &Date::operator=(const std::string &dateString) {
   }
   if(*s)
     throw InvalidDate("invalid date string '" + dateString + "'");
-  if(bits[0] < 1 || bits[0] > INT_MAX)
+  if(bits[0] < 1)
     throw InvalidDate("invalid date string '" + dateString + "' - year too small");
-  y = bits[0];
+  if(bits[0] > 9999)
+    throw InvalidDate("invalid date string '" + dateString + "' - year too large");
   if(bits[1] < 1 || bits[1] > 12)
     throw InvalidDate("invalid date string '" + dateString + "' - month out of range");
-  m = bits[1];
-  if(bits[2] < 1 || bits[2] > monthLength(y, m))
+  if(bits[2] < 1 || bits[2] > monthLength(bits[0], bits[1]))
     throw InvalidDate("invalid date string '" + dateString + "' - day out of range");
-  d = bits[2];
+  dayNumber = daysFromCivil(bits[0], bits[1], bits[2]);
   return *this;
 }
 
@@ -83,37 +83,23 @@ Date::Date(time_t when) {
     ss << "invalid time_t: " << when << ": " << strerror(errno);
     throw InvalidDate(ss.str());
   }
-  y = result.tm_year + 1900;
-  m = result.tm_mon + 1;
-  d = result.tm_mday;
-}
-
-Date &Date::operator++() {
-  if(d < monthLength(y, m))
-    ++d;
-  else {
-    d = 1;
-    if(++m > 12) {
-      m -= 12;
-      y += 1;
-    }
-  }
-  return *this;
+  dayNumber = daysFromCivil(result.tm_year + 1900, result.tm_mon + 1,
+                            result.tm_mday);
 }
 
 Date &Date::addMonth() {
-  m += 1;
+  int y = year(), m = month() + 1;
   if(m > 12) {
     m -= 12;
     y += 1;
   }
-  d = std::min(d, monthLength(y, m));
+  dayNumber = daysFromCivil(y, m, std::min(day(), monthLength(y, m)));
   return *this;
 }
 
 std::string Date::toString() const {
   char buffer[64];
-  snprintf(buffer, sizeof buffer, "%04d-%02d-%02d", y, m, d);
+  snprintf(buffer, sizeof buffer, "%04d-%02d-%02d", year(), month(), day());
   return buffer;
 }
 
@@ -130,19 +116,12 @@ std::string Date::format(const char *fmt) const {
   return buffer;
 }
 
-int Date::toNumber() const {
-  int dayno = 365 * y + y / 4 - y / 100 + y / 400;
-  dayno += mday[m] + (m > 2 && isLeapYear() ? 1 : 0);
-  dayno += d - 1;
-  return dayno;
-}
-
 time_t Date::toTime() const {
   struct tm t;
   memset(&t, 0, sizeof t);
-  t.tm_year = y - 1900;
-  t.tm_mon = m - 1;
-  t.tm_mday = d;
+  t.tm_year = year() - 1900;
+  t.tm_mon = month() - 1;
+  t.tm_mday = day();
   t.tm_isdst = -1;
   time_t r = mktime(&t);
   if(r == -1)
@@ -150,26 +129,25 @@ time_t Date::toTime() const {
   return r;
 }
 
-bool Date::operator<(const Date &that) const {
-  int delta;
-  if((delta = y - that.y)) return delta < 0;
-  if((delta = m - that.m)) return delta < 0;
-  if((delta = d - that.d)) return delta < 0;
-  return false;
-}
+// Today's date, once known
+static bool todayKnown;
+static Date todayCached;
 
-int Date::operator-(const Date &that) const {
-  return toNumber() - that.toNumber();
+Date Date::today() {
+  if(!todayKnown) {
+    // Allow overriding of 'today' form environment for testing
+    const char *override = getenv("RSBACKUP_TODAY");
+    if(override)
+      todayCached = Date(override);
+    else
+      todayCached = Date(time(nullptr));
+    todayKnown = true;
+  }
+  return todayCached;
 }
 
-Date Date::today() {
-  // Allow overriding of 'today' form environment for testing
-  const char *override = getenv("RSBACKUP_TODAY");
-  if(override)
-    return Date(override);
-  time_t now;
-  time(&now);
-  return Date(now);
+void Date::forgetToday() {
+  todayKnown = false;
 }
 
 time_t Date::now() {
@@ -21,15 +21,17 @@
 
 #include <string>
 #include <ctime>
+#include <cstdint>
 
 /** @brief A (proleptic) Gregorian date
  *
- * Don't try years before 1CE.
+ * Represented as a day number, so that comparison and subtraction are
+ * cheap.  Don't try years before 1CE.
  */
 class Date {
 public:
   /** @brief Constructor */
-  Date(): Date(0, 1, 1) {}
+  constexpr Date(): Date(0, 1, 1) {}
 
   /** @brief Constructor
    * @param dateString Date in YYYY-MM-DD format
@@ -37,11 +39,11 @@ public:
   Date(const std::string &dateString);
 
   /** @brief Constructor
-   * @param y_ Year
-   * @param m_ Month from 1
-   * @param d_ Day from 1
+   * @param y Year
+   * @param m Month from 1
+   * @param d Day from 1
    */
-  Date(int y_, int m_, int d_): y(y_), m(m_), d(d_) {}
+  constexpr Date(int y, int m, int d): dayNumber(daysFromCivil(y, m, d)) {}
 
   /** @brief Constructor
    * @param when Moment in time
@@ -56,50 +58,57 @@ public:
   /** @brief Different between two dates in days
    * @param that Other date
    */
-  int operator-(const Date &that) const;
+  constexpr int operator-(const Date &that) const {
+    return dayNumber - that.dayNumber;
+  }
 
   /** @brief Comparison operator
    * @param that Other date
    * @return true if this is less than that
    */
-  bool operator<(const Date &that) const;
+  constexpr bool operator<(const Date &that) const {
+    return dayNumber < that.dayNumber;
+  }
 
   /** @brief Comparison operator
    * @param that Other date
    * @return true if this is equal to that
    */
-  bool operator==(const Date &that) const {
-    return y == that.y && m == that.m && d == that.d;
+  constexpr bool operator==(const Date &that) const {
+    return dayNumber == that.dayNumber;
   }
 
   /** @brief Comparison operator
    * @param that Other date
    * @return true if this is greater than that
    */
-  bool operator>(const Date &that) const { return that < *this; }
+  constexpr bool operator>(const Date &that) const { return that < *this; }
 
   /** @brief Comparison operator
    * @param that Other date
    * @return true if this is less or equal to that
    */
-  bool operator<=(const Date &that) const { return !(*this > that); }
+  constexpr bool operator<=(const Date &that) const { return !(*this > that); }
 
   /** @brief Comparison operator
    * @param that Other date
    * @return true if this is greater than or equal to that
    */
-  bool operator>=(const Date &that) const { return !(*this < that); }
+  constexpr bool operator>=(const Date &that) const { return !(*this < that); }
 
   /** @brief Comparison operator
    * @param that Other date
    * @return true if this is not equal to that
    */
-  bool operator!=(const Date &that) const { return !(*this == that); }
+  constexpr bool operator!=(const Date &that) const { return !(*this == that); }
 
   /** @brief Increment date
    * @return Next day
    */
-  Date &operator++();
+  Date &operator++() {
+    ++dayNumber;
+    return *this;
+  }
 
   /** @brief Advance by 1 month
    * @return @c *this
@@ -121,8 +130,12 @@ public:
 
   /** @brief Convert to day number
    * @return Day number
+   *
+   * Day 0 is 1st January 1970.
    */
-  int toNumber() const;
+  constexpr int toNumber() const {
+    return dayNumber;
+  }
 
   /** @brief Convert to a @c time_t
    * @return @c time_t value of date
@@ -133,9 +146,16 @@ public:
    * @return Today's date
    *
    * Overridden by @c RSBACKUP_TODAY.
+   *
+   * The date is found on the first call and then fixed, so that a run that
+   * crosses midnight sees a consistent date.  Use @ref forgetToday to start a
+   * new run.
    */
   static Date today();
 
+  /** @brief Find today's date afresh on the next call to @ref today */
+  static void forgetToday();
+
   /** @brief Now
    * @return The current time
    *
@@ -154,26 +174,130 @@ public:
    * This is the Gregorian year; unlike the C library it is not offset by
    * 1900.
    */
-  int y;
+  constexpr int year() const {
+    return shiftedYear(dayNumber) + (month() <= 2 ? 1 : 0);
+  }
 
   /** @brief Month
    *
    * 1 = January.
    */
-  int m;
+  constexpr int month() const {
+    return monthFromShifted(shiftedMonth(dayOfEra(dayNumber)));
+  }
 
   /** @brief Day of month
    *
    * Starts from 1.
    */
-  int d;
+  constexpr int day() const {
+    return dayOfShiftedYear(dayOfEra(dayNumber))
+      - (153 * shiftedMonth(dayOfEra(dayNumber)) + 2) / 5 + 1;
+  }
 
 private:
-  /** @brief Test for a leap year
-   * @return @c true iff @ref y is a leap year
+  /** @brief Days since 1st January 1970 */
+  int32_t dayNumber;
+
+  // The civil date conversions follow Howard Hinnant's days_from_civil and
+  // civil_from_days.  Internally, years start on 1st March so that leap days
+  // fall at the end of the year; an era is 400 such years (146097 days).
+  // They are split into single expressions so that they can be constexpr in
+  // C++11.
+
+  /** @brief Days from 0000-03-01 to 1970-01-01 */
+  static constexpr int32_t EPOCH_OFFSET = 719468;
+
+  /** @brief Days in a 400-year era */
+  static constexpr int32_t ERA_DAYS = 146097;
+
+  /** @brief Convert a civil date to a day number
+   * @param y Year
+   * @param m Month (1-12)
+   * @param d Day (1-31)
+   * @return Day number
+   */
+  static constexpr int32_t daysFromCivil(int y, int m, int d) {
+    return daysFromShifted(y - (m <= 2 ? 1 : 0),
+                           (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1);
+  }
+
+  /** @brief Convert a March-based year and day of year to a day number
+   * @param y Year starting in March
+   * @param doy Day within @p y, from 0
+   * @return Day number
+   */
+  static constexpr int32_t daysFromShifted(int y, int doy) {
+    return era(y) * ERA_DAYS
+      + (y - era(y) * 400) * 365 + (y - era(y) * 400) / 4
+      - (y - era(y) * 400) / 100 + doy - EPOCH_OFFSET;
+  }
+
+  /** @brief Find the era containing a March-based year
+   * @param y Year starting in March
+   * @return Era
+   */
+  static constexpr int era(int y) {
+    return (y >= 0 ? y : y - 399) / 400;
+  }
+
+  /** @brief Find the era containing a day number
+   * @param n Day number
+   * @return Era
+   */
+  static constexpr int eraOfDay(int32_t n) {
+    return (n + EPOCH_OFFSET >= 0
+            ? n + EPOCH_OFFSET
+            : n + EPOCH_OFFSET - (ERA_DAYS - 1)) / ERA_DAYS;
+  }
+
+  /** @brief Find the day within its era of a day number
+   * @param n Day number
+   * @return Day of era, from 0
+   */
+  static constexpr int dayOfEra(int32_t n) {
+    return n + EPOCH_OFFSET - eraOfDay(n) * ERA_DAYS;
+  }
+
+  /** @brief Find the year within its era of a day of era
+   * @param doe Day of era
+   * @return Year of era, from 0
+   */
+  static constexpr int yearOfEra(int doe) {
+    return (doe - doe / 1460 + doe / 36524 - doe / (ERA_DAYS - 1)) / 365;
+  }
+
+  /** @brief Find the March-based year of a day number
+   * @param n Day number
+   * @return Year starting in March
+   */
+  static constexpr int shiftedYear(int32_t n) {
+    return yearOfEra(dayOfEra(n)) + eraOfDay(n) * 400;
+  }
+
+  /** @brief Find the day within its March-based year of a day of era
+   * @param doe Day of era
+   * @return Day of year, from 0
+   */
+  static constexpr int dayOfShiftedYear(int doe) {
+    return doe - (365 * yearOfEra(doe) + yearOfEra(doe) / 4
+                  - yearOfEra(doe) / 100);
+  }
+
+  /** @brief Find the March-based month of a day of era
+   * @param doe Day of era
+   * @return Month, with 0 for March
+   */
+  static constexpr int shiftedMonth(int doe) {
+    return (5 * dayOfShiftedYear(doe) + 2) / 153;
+  }
+
+  /** @brief Convert a March-based month to a civil month
+   * @param mp Month, with 0 for March
+   * @return Month (1-12)
    */
-  inline bool isLeapYear() const {
-    return isLeapYear(y);
+  static constexpr int monthFromShifted(int mp) {
+    return mp < 10 ? mp + 3 : mp - 9;
   }
 
   /** @brief Test for a leap year
@@ -205,7 +329,7 @@ private:
  *
  * Formats @p d as if by @ref Date::toString() and writes it to @p os.
  */
-inline std::ostream &operator<<(std::ostream &os, Date &d) {
+inline std::ostream &operator<<(std::ostream &os, const Date &d) {
   return os << d.toString();
 }
 
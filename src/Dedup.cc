@@ -0,0 +1,576 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Dedup.h"
+#include "ThreadedAction.h"
+#include "Conf.h"
+#include "Backup.h"
+#include "Device.h"
+#include "Host.h"
+#include "Volume.h"
+#include "Store.h"
+#include "Database.h"
+#include "Hash.h"
+#include "Defaults.h"
+#include "Errors.h"
+#include "IO.h"
+#include "Utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Temporary name for a new link, before it replaces the original
+#define DEDUP_TEMPORARY ".rsbackup-dedup.tmp"
+
+bool DedupKey::operator<(const DedupKey &that) const {
+  if(size != that.size) return size < that.size;
+  if(hash != that.hash) return hash < that.hash;
+  if(mode != that.mode) return mode < that.mode;
+  if(uid != that.uid) return uid < that.uid;
+  if(gid != that.gid) return gid < that.gid;
+  return mtime < that.mtime;
+}
+
+std::mutex DedupIndex::lock;
+
+DedupIndex::DedupIndex(Database &db, const std::string &device):
+  db(db), device(device) {
+}
+
+// Run a query, retrying if the database is busy
+static void query(const std::string &device,
+                  const std::function<void()> &f) {
+  int retries = 0;
+  for(;;) {
+    try {
+      f();
+      return;
+    } catch(DatabaseBusy &) {
+      // Log a message every second or so
+      if(!(retries++ & 1023))
+        warning(WARNING_DATABASE,
+                "deduplicating %s: retrying database query",
+                device.c_str());
+      // Wait a millisecond and try again
+      usleep(1000);
+    }
+  }
+}
+
+bool DedupIndex::find(const DedupKey &key, DedupEntry &entry) {
+  auto it = changed.find(key);
+  if(it != changed.end()) {
+    entry = it->second;
+    return true;
+  }
+  std::lock_guard<std::mutex> guard(lock);
+  bool found = false;
+  query(device, [&]() {
+      Database::Statement stmt(db,
+                               "SELECT inode,path,host,volume,id"
+                               " FROM dedup_index"
+                               " WHERE device=? AND size=? AND hash=?"
+                               " AND mode=? AND uid=? AND gid=? AND mtime=?",
+                               SQL_STRING, &device,
+                               SQL_INT64, (sqlite_int64)key.size,
+                               SQL_INT64, (sqlite_int64)key.hash,
+                               SQL_INT64, (sqlite_int64)key.mode,
+                               SQL_INT64, (sqlite_int64)key.uid,
+                               SQL_INT64, (sqlite_int64)key.gid,
+                               SQL_INT64, (sqlite_int64)key.mtime,
+                               SQL_END);
+      if((found = stmt.next())) {
+        entry.inode = stmt.get_int64(0);
+        entry.path = stmt.get_string(1);
+        entry.host = stmt.get_string(2);
+        entry.volume = stmt.get_string(3);
+        entry.id = stmt.get_string(4);
+      }
+    });
+  return found;
+}
+
+bool DedupIndex::indexed(ino_t inode, int64_t size, int64_t mtime) {
+  if(contains(changedInodes, std::make_tuple(inode, size, mtime)))
+    return true;
+  std::lock_guard<std::mutex> guard(lock);
+  bool found = false;
+  query(device, [&]() {
+      found = Database::Statement(db,
+                                  "SELECT 1 FROM dedup_index"
+                                  " WHERE device=? AND size=? AND mtime=?"
+                                  " AND inode=?",
+                                  SQL_STRING, &device,
+                                  SQL_INT64, (sqlite_int64)size,
+                                  SQL_INT64, (sqlite_int64)mtime,
+                                  SQL_INT64, (sqlite_int64)inode,
+                                  SQL_END).next();
+    });
+  return found;
+}
+
+void DedupIndex::add(const DedupKey &key, const DedupEntry &entry) {
+  changed[key] = entry;
+  changedInodes.insert(std::make_tuple(entry.inode, key.size, key.mtime));
+}
+
+void DedupIndex::write() {
+  Database::Statement stmt(db);
+  stmt.prepare("INSERT OR REPLACE INTO dedup_index"
+               " (device,size,hash,mode,uid,gid,mtime,inode,"
+               "host,volume,id,path)"
+               " VALUES (?,?,?,?,?,?,?,?,?,?,?,?)",
+               SQL_END);
+  for(auto &c: changed) {
+    const DedupKey &key = c.first;
+    const DedupEntry &entry = c.second;
+    stmt.reset(SQL_STRING, &device,
+               SQL_INT64, (sqlite_int64)key.size,
+               SQL_INT64, (sqlite_int64)key.hash,
+               SQL_INT64, (sqlite_int64)key.mode,
+               SQL_INT64, (sqlite_int64)key.uid,
+               SQL_INT64, (sqlite_int64)key.gid,
+               SQL_INT64, (sqlite_int64)key.mtime,
+               SQL_INT64, (sqlite_int64)entry.inode,
+               SQL_STRING, &entry.host,
+               SQL_STRING, &entry.volume,
+               SQL_STRING, &entry.id,
+               SQL_STRING, &entry.path,
+               SQL_END);
+    stmt.next();
+  }
+  changed.clear();
+  changedInodes.clear();
+}
+
+DedupTree::DedupTree(const std::string &store,
+                     const std::string &host,
+                     const std::string &volume,
+                     const std::string &id,
+                     DedupIndex &index,
+                     int64_t &budget):
+  ParallelWalk(store + PATH_SEP + host + PATH_SEP + volume + PATH_SEP + id),
+  store(store),
+  host(host),
+  volume(volume),
+  id(id),
+  backup(host + PATH_SEP + volume + PATH_SEP + id),
+  index(index),
+  budget(budget) {
+}
+
+DedupTree::~DedupTree() {
+  if(storefd >= 0)
+    close(storefd);
+}
+
+void DedupTree::run(size_t threads) {
+  if((storefd = open(store.c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC)) < 0)
+    throw IOError("opening " + store, errno);
+  walk(threads);
+}
+
+void DedupTree::directory(int dirfd, const std::string &path,
+                          const std::vector<std::string> &names) {
+  for(auto &name: names) {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      if(exhausted)
+        return;
+    }
+    if(name == DEDUP_TEMPORARY)
+      continue;
+    std::string child = join(path, name);
+    struct stat sb;
+    if(fstatat(dirfd, name.c_str(), &sb, AT_SYMLINK_NOFOLLOW) < 0)
+      throw IOError("inspecting " + rootPath(child), errno);
+    if(S_ISDIR(sb.st_mode))
+      descend(child);
+    else if(S_ISREG(sb.st_mode))
+      file(dirfd, name, child, sb);
+  }
+}
+
+bool DedupTree::reserve(int64_t bytes) {
+  std::lock_guard<std::mutex> guard(lock);
+  if(bytes > budget) {
+    exhausted = true;
+    return false;
+  }
+  budget -= bytes;
+  bytesRead += bytes;
+  return true;
+}
+
+void DedupTree::file(int dirfd, const std::string &name,
+                     const std::string &path, const struct stat &sb) {
+  // Files that are already linked were shared by rsync or by an earlier
+  // deduplication
+  if(sb.st_nlink != 1 || sb.st_size < DEDUP_MIN_SIZE)
+    return;
+  DedupKey key;
+  key.size = sb.st_size;
+  key.mode = sb.st_mode;
+  key.uid = sb.st_uid;
+  key.gid = sb.st_gid;
+  key.mtime = static_cast<int64_t>(sb.st_mtim.tv_sec) * 1000000000
+    + sb.st_mtim.tv_nsec;
+  {
+    // Files indexed by an earlier run that ran out of budget
+    std::lock_guard<std::mutex> guard(lock);
+    if(index.indexed(sb.st_ino, key.size, key.mtime))
+      return;
+  }
+  if(!reserve(sb.st_size))
+    return;
+  {
+    FileDescriptor input(openBackupFile(dirfd, name));
+    if(input.fd < 0)
+      throw IOError("opening " + rootPath(path), errno);
+    key.hash = hashFile(input.fd, rootPath(path));
+  }
+  DedupEntry self;
+  self.path = backup + PATH_SEP + path;
+  self.inode = sb.st_ino;
+  self.host = host;
+  self.volume = volume;
+  self.id = id;
+  DedupEntry entry;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    ++hashed;
+    if(!index.find(key, entry)) {
+      index.add(key, self);
+      return;
+    }
+  }
+  // The hash is not cryptographic, so the contents must be compared
+  if(!reserve(2 * key.size))
+    return;
+  bool identical;
+  try {
+    identical = same(dirfd, name, path, key, entry);
+  } catch(IOError &e) {
+    if(e.errno_value != ENOENT)
+      throw;
+    // The indexed file has been pruned
+    identical = false;
+  }
+  if(identical && replace(dirfd, name, path, entry)) {
+    std::lock_guard<std::mutex> guard(lock);
+    ++linked;
+    reclaimed += static_cast<int64_t>(sb.st_blocks) * 512;
+    return;
+  }
+  // The indexed file has gone, changed, or cannot take any more links.  (Or
+  // the hashes collided, in which case this file may as well be indexed
+  // instead.)
+  std::lock_guard<std::mutex> guard(lock);
+  index.add(key, self);
+}
+
+bool DedupTree::same(int dirfd, const std::string &name,
+                     const std::string &path, const DedupKey &key,
+                     const DedupEntry &entry) {
+  const std::string other = store + PATH_SEP + entry.path;
+  FileDescriptor b(openBackupFile(storefd, entry.path));
+  if(b.fd < 0)
+    throw IOError("opening " + other, errno);
+  struct stat sb;
+  if(fstat(b.fd, &sb) < 0)
+    throw IOError("inspecting " + other, errno);
+  if(sb.st_ino != entry.inode
+     || sb.st_size != key.size
+     || sb.st_mode != key.mode
+     || sb.st_uid != key.uid
+     || sb.st_gid != key.gid
+     || (static_cast<int64_t>(sb.st_mtim.tv_sec) * 1000000000
+         + sb.st_mtim.tv_nsec) != key.mtime)
+    return false;
+  FileDescriptor a(openBackupFile(dirfd, name));
+  if(a.fd < 0)
+    throw IOError("opening " + rootPath(path), errno);
+  std::vector<char> abuf(HASH_BUFFER_SIZE), bbuf(HASH_BUFFER_SIZE);
+  off_t offset = 0;
+  for(;;) {
+    ssize_t n = pread(a.fd, &abuf[0], abuf.size(), offset);
+    if(n < 0)
+      throw IOError("reading " + rootPath(path), errno);
+    ssize_t m = pread(b.fd, &bbuf[0], n ? n : 1, offset);
+    if(m < 0)
+      throw IOError("reading " + other, errno);
+    if(m != n || memcmp(&abuf[0], &bbuf[0], n))
+      return false;
+    if(n == 0)
+      return true;
+    posix_fadvise(a.fd, offset, n, POSIX_FADV_DONTNEED);
+    posix_fadvise(b.fd, offset, n, POSIX_FADV_DONTNEED);
+    offset += n;
+  }
+}
+
+bool DedupTree::replace(int dirfd, const std::string &name,
+                        const std::string &path, const DedupEntry &entry) {
+  // Link under a temporary name first, so that the file is never missing.
+  // A run that was interrupted may have left the temporary behind.
+  if(unlinkat(dirfd, DEDUP_TEMPORARY, 0) < 0 && errno != ENOENT)
+    throw IOError("removing temporary link beside " + rootPath(path), errno);
+  if(linkat(storefd, entry.path.c_str(), dirfd, DEDUP_TEMPORARY, 0) < 0) {
+    if(errno == EMLINK)
+      return false;
+    throw IOError("linking " + rootPath(path), errno);
+  }
+  if(renameat(dirfd, DEDUP_TEMPORARY, dirfd, name.c_str()) < 0) {
+    int save_errno = errno;
+    unlinkat(dirfd, DEDUP_TEMPORARY, 0);
+    throw IOError("replacing " + rootPath(path), save_errno);
+  }
+  return true;
+}
+
+/** @brief Deduplicate the queued backups on one device */
+class DedupDevice: public ThreadedAction {
+public:
+  /** @brief Constructor
+   * @param device Device
+   */
+  DedupDevice(const Device *device):
+    ThreadedAction("dedup/" + device->name),
+    device(device),
+    index(config.getdb(), device->name),
+    budget(config.dedupBudget ? config.dedupBudget : INT64_MAX) {
+    uses(device->name);
+  }
+
+  /** @brief Add a backup to deduplicate
+   * @param backup Backup on this device
+   */
+  void add(const Backup *backup) {
+    pending.push_back(Progress(backup));
+  }
+
+private:
+  /** @brief Progress with one backup */
+  struct Progress {
+    /** @brief Constructor
+     * @param backup Backup
+     */
+    Progress(const Backup *backup): backup(backup) {}
+
+    /** @brief Backup */
+    const Backup *backup;
+
+    /** @brief Set when the backup is finished */
+    bool complete = false;
+
+    /** @brief Bytes read */
+    int64_t bytesRead = 0;
+
+    /** @brief Number of files replaced with links */
+    uint64_t linked = 0;
+
+    /** @brief Bytes of disk space freed */
+    int64_t reclaimed = 0;
+  };
+
+  void work() override {
+    for(auto &p: pending) {
+      // Snapshots can't be linked to anything else
+      if(!p.backup->onStoreFilesystem()) {
+        p.complete = true;
+        continue;
+      }
+      const Volume *volume = p.backup->volume;
+      DedupTree tree(device->store->path,
+                     volume->parent->name, volume->name, p.backup->id,
+                     index, budget);
+      tree.run(MAX_DEDUP_THREADS);
+      p.bytesRead = tree.bytesRead;
+      p.linked = tree.linked;
+      p.reclaimed = tree.reclaimed;
+      if(tree.exhausted)
+        break;
+      p.complete = true;
+    }
+  }
+
+  bool finished(std::exception_ptr failure) override {
+    if(failure) {
+      try {
+        std::rethrow_exception(failure);
+      } catch(std::runtime_error &e) {
+        error("deduplicating %s: %s", device->name.c_str(), e.what());
+      }
+    }
+    uint64_t linked = 0, incomplete = 0;
+    int64_t reclaimed = 0, bytesRead = 0;
+    for(auto &p: pending) {
+      linked += p.linked;
+      reclaimed += p.reclaimed;
+      bytesRead += p.bytesRead;
+      if(!p.complete)
+        ++incomplete;
+    }
+    record();
+    if(warning_mask & WARNING_VERBOSE)
+      IO::out.writef("INFO: deduplicated %s: %ju files linked,"
+                     " %jd bytes reclaimed, %jd bytes read\n",
+                     device->name.c_str(), (uintmax_t)linked,
+                     (intmax_t)reclaimed, (intmax_t)bytesRead);
+    if(incomplete && !failure)
+      warning(WARNING_VERBOSE,
+              "deduplication budget for %s exhausted with %ju backups left",
+              device->name.c_str(), (uintmax_t)incomplete);
+    return !failure;
+  }
+
+  /** @brief Record progress in the database */
+  void record() {
+    Database &db = config.getdb();
+    std::lock_guard<std::mutex> guard(DedupIndex::lock);
+    try {
+      db.begin();
+      index.write();
+      for(auto &p: pending) {
+        const Volume *volume = p.backup->volume;
+        Database::Statement(db,
+                            "UPDATE dedup_backup"
+                            " SET complete=?,"
+                            "  bytes_read=bytes_read+?,"
+                            "  linked=linked+?,"
+                            "  reclaimed=reclaimed+?"
+                            " WHERE host=? AND volume=? AND device=? AND id=?",
+                            SQL_INT, p.complete ? 1 : 0,
+                            SQL_INT64, (sqlite_int64)p.bytesRead,
+                            SQL_INT64, (sqlite_int64)p.linked,
+                            SQL_INT64, (sqlite_int64)p.reclaimed,
+                            SQL_STRING, &volume->parent->name,
+                            SQL_STRING, &volume->name,
+                            SQL_STRING, &p.backup->deviceName,
+                            SQL_STRING, &p.backup->id,
+                            SQL_END).next();
+      }
+      db.commit();
+    } catch(DatabaseBusy &) {
+      // The next run will hash the same files again, find them already
+      // linked or indexed, and catch up
+      db.rollback();
+      warning(WARNING_DATABASE, "deduplicating %s: cannot record progress",
+              device->name.c_str());
+    }
+  }
+
+  /** @brief Device */
+  const Device *device;
+
+  /** @brief Content index of device */
+  DedupIndex index;
+
+  /** @brief Remaining budget */
+  int64_t budget;
+
+  /** @brief Backups to deduplicate, oldest first */
+  std::vector<Progress> pending;
+};
+
+void queueDedup(const Backup *backup) {
+  const Volume *volume = backup->volume;
+  Database &db = config.getdb();
+  try {
+    db.begin();
+    Database::Statement(db,
+                        "INSERT OR REPLACE INTO dedup_backup"
+                        " (host,volume,device,id,"
+                        "complete,bytes_read,linked,reclaimed)"
+                        " VALUES (?,?,?,?,0,0,0,0)",
+                        SQL_STRING, &volume->parent->name,
+                        SQL_STRING, &volume->name,
+                        SQL_STRING, &backup->deviceName,
+                        SQL_STRING, &backup->id,
+                        SQL_END).next();
+    db.commit();
+  } catch(DatabaseBusy &) {
+    db.rollback();
+    warning(WARNING_DATABASE,
+            "backup of %s:%s to %s: cannot queue deduplication",
+            volume->parent->name.c_str(),
+            volume->name.c_str(),
+            backup->deviceName.c_str());
+  }
+}
+
+void dedupBackups() {
+  Database &db = config.getdb();
+  if(!db.hasTable("dedup_backup"))
+    return;
+  std::vector<const Backup *> pending;
+  {
+    Database::Statement stmt(db,
+                             "SELECT host,volume,device,id FROM dedup_backup"
+                             " WHERE complete=0 ORDER BY id",
+                             SQL_END);
+    while(stmt.next()) {
+      const Volume *volume = config.findVolume(stmt.get_string(0),
+                                               stmt.get_string(1));
+      if(!volume)
+        continue;
+      const std::string deviceName = stmt.get_string(2);
+      const std::string id = stmt.get_string(3);
+      for(const Backup *backup: volume->backups)
+        if(backup->deviceName == deviceName
+           && backup->id == id
+           && backup->getStatus() == COMPLETE)
+          pending.push_back(backup);
+    }
+  }
+  if(pending.empty())
+    return;
+  config.identifyDevices(Store::Enabled);
+  std::map<std::string, std::unique_ptr<DedupDevice>> devices;
+  for(const Backup *backup: pending) {
+    const Device *device = backup->getDevice();
+    if(!device || !device->store || device->store->state != Store::Enabled)
+      continue;
+    auto &action = devices[device->name];
+    if(!action)
+      action.reset(new DedupDevice(device));
+    action->add(backup);
+  }
+  EventLoop e;
+  ActionList al(&e);
+  for(auto &d: devices)
+    al.add(d.second.get());
+  al.go();
+}
+
+void pruneDedup(Database &db) {
+  if(!db.hasTable("dedup_index"))
+    return;
+  for(const std::string table: {"dedup_index", "dedup_backup"}) {
+    const std::string sql = "DELETE FROM " + table
+      + " WHERE NOT EXISTS (SELECT 1 FROM backup"
+      + "  WHERE backup.host=" + table + ".host"
+      + "  AND backup.volume=" + table + ".volume"
+      + "  AND backup.device=" + table + ".device"
+      + "  AND backup.id=" + table + ".id"
+      + "  AND backup.status!=?)";
+    Database::Statement(db, sql.c_str(), SQL_INT, PRUNED, SQL_END).next();
+  }
+}
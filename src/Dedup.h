@@ -0,0 +1,294 @@
+// -*-C++-*-
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef DEDUP_H
+#define DEDUP_H
+/** @file Dedup.h
+ * @brief Deduplication of identical files across volumes
+ *
+ * @c rsync only hard-links a file to the same file in the previous backup
+ * of the same volume.  Identical files in different volumes, or that have
+ * moved within a volume, are stored separately.
+ *
+ * Deduplication hashes the files in new backups that have only one link,
+ * and looks them up in a per-device index of file contents.  A file whose
+ * contents and metadata match an indexed file is replaced with a hard link
+ * to it.  Otherwise it is added to the index.
+ *
+ * The work done is limited by a budget of bytes read per device per run.
+ * Backups that are not finished within the budget are finished by later
+ * runs.
+ */
+
+#include "ParallelWalk.h"
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <cstdint>
+#include <sys/types.h>
+
+class Backup;
+class Database;
+
+/** @brief Index key for a file
+ *
+ * Files can only be hard-linked together if both their contents and their
+ * metadata are identical.
+ */
+struct DedupKey {
+  /** @brief Size in bytes */
+  int64_t size = 0;
+
+  /** @brief Hash of contents */
+  uint64_t hash = 0;
+
+  /** @brief Mode */
+  mode_t mode = 0;
+
+  /** @brief Owner */
+  uid_t uid = 0;
+
+  /** @brief Group */
+  gid_t gid = 0;
+
+  /** @brief Last modification time in nanoseconds */
+  int64_t mtime = 0;
+
+  /** @brief Ordering on keys */
+  bool operator<(const DedupKey &that) const;
+};
+
+/** @brief An indexed file */
+struct DedupEntry {
+  /** @brief Path relative to store */
+  std::string path;
+
+  /** @brief Inode number */
+  ino_t inode = 0;
+
+  /** @brief Host name of backup containing the file */
+  std::string host;
+
+  /** @brief Volume name of backup containing the file */
+  std::string volume;
+
+  /** @brief ID of backup containing the file */
+  std::string id;
+};
+
+/** @brief Content index of one device
+ *
+ * The index is kept in the database and consulted a file at a time, so it
+ * need not fit in memory.  Entries added by a run are held in memory until
+ * they are written with @ref write.
+ *
+ * Lookups may be made from several threads, including for different
+ * devices, but not concurrently with other use of the database.
+ */
+class DedupIndex {
+public:
+  /** @brief Constructor
+   * @param db Database
+   * @param device Device name
+   */
+  DedupIndex(Database &db, const std::string &device);
+
+  /** @brief Find an indexed file
+   * @param key Key of file
+   * @param entry Where to store the indexed file
+   * @return @c true if a file with key @p key is indexed
+   */
+  bool find(const DedupKey &key, DedupEntry &entry);
+
+  /** @brief Test whether a file is already indexed
+   * @param inode Inode number
+   * @param size Size in bytes
+   * @param mtime Last modification time in nanoseconds
+   * @return @c true if the file is indexed
+   *
+   * Inode numbers are reused once files are deleted, so the size and
+   * modification time must match too.
+   */
+  bool indexed(ino_t inode, int64_t size, int64_t mtime);
+
+  /** @brief Add or replace an entry
+   * @param key Key of file
+   * @param entry Indexed file
+   */
+  void add(const DedupKey &key, const DedupEntry &entry);
+
+  /** @brief Write entries added since last written
+   *
+   * Must be called within a transaction, and holding @ref lock.
+   */
+  void write();
+
+  /** @brief Entries added or replaced since last written */
+  std::map<DedupKey, DedupEntry> changed;
+
+  /** @brief Serializes use of the database by all indexes */
+  static std::mutex lock;
+
+private:
+  /** @brief Database */
+  Database &db;
+
+  /** @brief Device name */
+  std::string device;
+
+  /** @brief Inode numbers, sizes and modification times in @ref changed */
+  std::set<std::tuple<ino_t, int64_t, int64_t>> changedInodes;
+};
+
+/** @brief Deduplicate the files in one backup
+ *
+ * All threads share the index and the budget, under @ref ParallelWalk::lock.
+ */
+class DedupTree: private ParallelWalk {
+public:
+  /** @brief Constructor
+   * @param store Path to store
+   * @param host Host name
+   * @param volume Volume name
+   * @param id Backup ID
+   * @param index Content index of the device
+   * @param budget Remaining bytes that may be read
+   */
+  DedupTree(const std::string &store,
+            const std::string &host,
+            const std::string &volume,
+            const std::string &id,
+            DedupIndex &index,
+            int64_t &budget);
+
+  /** @brief Destructor */
+  ~DedupTree() override;
+
+  /** @brief Deduplicate the backup
+   * @param threads Maximum number of threads to use
+   *
+   * Throws @ref IOError on error.
+   */
+  void run(size_t threads);
+
+  /** @brief Set if the budget ran out before the backup was finished */
+  bool exhausted = false;
+
+  /** @brief Bytes read */
+  int64_t bytesRead = 0;
+
+  /** @brief Number of files hashed */
+  uint64_t hashed = 0;
+
+  /** @brief Number of files replaced with links */
+  uint64_t linked = 0;
+
+  /** @brief Bytes of disk space freed */
+  int64_t reclaimed = 0;
+
+private:
+  void directory(int dirfd, const std::string &path,
+                 const std::vector<std::string> &names) override;
+
+  /** @brief Deduplicate one file
+   * @param dirfd Containing directory
+   * @param name Name within @p dirfd
+   * @param path Path relative to backup
+   * @param sb File information
+   */
+  void file(int dirfd, const std::string &name, const std::string &path,
+            const struct stat &sb);
+
+  /** @brief Reserve part of the budget
+   * @param bytes Bytes to be read
+   * @return @c true if the budget allows it
+   */
+  bool reserve(int64_t bytes);
+
+  /** @brief Compare a file with an indexed file
+   * @param dirfd Containing directory
+   * @param name Name within @p dirfd
+   * @param path Path relative to backup
+   * @param key Key of file
+   * @param entry Indexed file with the same key
+   * @return @c true if the files are identical
+   *
+   * Returns @c false if the indexed file has changed.  Throws @ref IOError
+   * if it has disappeared.
+   */
+  bool same(int dirfd, const std::string &name, const std::string &path,
+            const DedupKey &key, const DedupEntry &entry);
+
+  /** @brief Replace a file with a link to an indexed file
+   * @param dirfd Containing directory
+   * @param name Name within @p dirfd
+   * @param path Path relative to backup
+   * @param entry Indexed file
+   * @return @c true on success, @c false if the indexed file has too many
+   * links
+   */
+  bool replace(int dirfd, const std::string &name, const std::string &path,
+               const DedupEntry &entry);
+
+  /** @brief Path to store */
+  std::string store;
+
+  /** @brief Host name */
+  std::string host;
+
+  /** @brief Volume name */
+  std::string volume;
+
+  /** @brief Backup ID */
+  std::string id;
+
+  /** @brief Path to backup relative to store */
+  std::string backup;
+
+  /** @brief Descriptor for store */
+  int storefd = -1;
+
+  /** @brief Content index */
+  DedupIndex &index;
+
+  /** @brief Remaining budget */
+  int64_t &budget;
+};
+
+/** @brief Queue a new backup for deduplication
+ * @param backup Backup
+ *
+ * The backup will be deduplicated by the next call to @ref dedupBackups.
+ */
+void queueDedup(const Backup *backup);
+
+/** @brief Deduplicate queued backups on available devices
+ *
+ * Each device is processed concurrently, with its own budget.
+ */
+void dedupBackups();
+
+/** @brief Remove index entries for backups that no longer exist
+ * @param db Database
+ *
+ * Pruned backups are included.  Their deduplication progress is removed
+ * too.
+ */
+void pruneDedup(Database &db);
+
+#endif /* DEDUP_H */
@@ -67,12 +67,89 @@
 /** @brief Default maximum inode usage */
 #define DEFAULT_MAX_FILE_USAGE 80
 
+/** @brief Number of days of store measurements used for forecasting */
+#define CAPACITY_FORECAST_DAYS 28
+
+/** @brief Warn about devices forecast to fill within this many days */
+#define CAPACITY_WARNING_DAYS 14
+
+/** @brief Number of recent backups used to predict the size of the next */
+#define CAPACITY_BACKUP_HISTORY 5
+
+/** @brief Number of recent backups used to predict the duration of the next */
+#define SCHEDULE_DURATION_HISTORY 5
+
+/** @brief Maximum number of stores to identify concurrently */
+#define MAX_IDENTIFY_THREADS 8
+
+/** @brief Maximum number of threads used to measure a backup */
+#define MAX_ACCOUNT_THREADS 8
+
+/** @brief Maximum number of threads used to restore a backup */
+#define MAX_RESTORE_THREADS 16
+
+/** @brief Maximum number of threads used to verify each backup */
+#define MAX_VERIFY_THREADS 8
+
+/** @brief Size of reads when hashing files */
+#define HASH_BUFFER_SIZE 1048576
+
+/** @brief Maximum number of threads used to deduplicate each backup */
+#define MAX_DEDUP_THREADS 8
+
+/** @brief Smallest file considered for deduplication */
+#define DEDUP_MIN_SIZE 1
+
+/** @brief Default bytes read per device per run when deduplicating */
+#define DEFAULT_DEDUP_BUDGET (INT64_C(64) << 30)
+
+/** @brief Default interval before a verified file is verified again */
+#define DEFAULT_VERIFY_INTERVAL (28 * 86400)
+
 /** @brief Default log directory */
 #define DEFAULT_LOGS "/var/log/backup"
 
+/** @brief Maximum number of rsync processes per backup */
+#define MAX_SHARDS 64
+
 /** @brief Default SSH timeout */
 #define DEFAULT_SSH_TIMEOUT 60
 
+/** @brief Default and maximum number of @c --link-dest options
+ *
+ * rsync accepts at most 20.
+ */
+#define DEFAULT_MAX_LINK_DEST 20
+
+/** @brief Default way of copying volumes into backups */
+#define DEFAULT_COPY_ENGINE "rsync"
+
+/** @brief Maximum number of threads used by the native copy engine */
+#define MAX_BACKUP_THREADS 16
+
+/** @brief Highest compression level accepted for rsync */
+#define MAX_COMPRESS_LEVEL 22
+
+/** @brief Number of earlier backups considered when tuning rsync */
+#define TUNING_HISTORY 5
+
+/** @brief Least file data a backup must transfer to be used for tuning */
+#define TUNING_MIN_SAMPLE (16 * 1024 * 1024)
+
+/** @brief Transfer rate in bytes/second above which a link counts as fast
+ *
+ * On a fast link, compression and delta-transfer cost more CPU time than
+ * they save in transfer time.
+ */
+#define TUNING_FAST_RATE (50 * 1024 * 1024)
+
+/** @brief Least compression ratio for which compression is worthwhile */
+#define TUNING_MIN_COMPRESSION 1.2
+
+/** @brief Least proportion of transferred file data that delta-transfer
+ * must find in existing files to be worthwhile */
+#define TUNING_MIN_MATCHED 0.1
+
 /** @brief Default days to keep pruning logs */
 #define DEFAULT_KEEP_PRUNE_LOGS 31
 
@@ -125,4 +202,25 @@
 /** @brief MIME boundary string */
 #define MIME_BOUNDARY "a911ebf382e50dffdf966c4acf269d36e48824bb"
 
+/** @brief MIME boundary string for related parts */
+#define MIME_RELATED_BOUNDARY "5e0e7c3f1d0a4b6e9c2f8a7d3b1e6c4f0a9d2b7e"
+
+/** @brief Seconds between scheduled backup and prune passes in daemon mode */
+#define DAEMON_INTERVAL 3600
+
+/** @brief Seconds between checks for configuration changes in daemon mode */
+#define DAEMON_WATCH_INTERVAL 5
+
+/** @brief Seconds between checks for a daemon job finishing */
+#define DAEMON_JOB_INTERVAL 1
+
+/** @brief Seconds a daemon client has to send its request and read the reply */
+#define DAEMON_CLIENT_TIMEOUT 10
+
+/** @brief Maximum number of daemon clients connected at once */
+#define DAEMON_MAX_CLIENTS 16
+
+/** @brief Maximum length of a daemon request */
+#define DAEMON_MAX_REQUEST 4096
+
 #endif /* DEFAULTS_H */
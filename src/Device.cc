@@ -15,9 +15,35 @@
 #include <config.h>
 #include "Conf.h"
 #include "Device.h"
+#include "Capacity.h"
+#include "Errors.h"
+#include "Utils.h"
 
 bool Device::valid(const std::string &name) {
   return name.size() > 0
     && name.at(0) != '-'
     && name.find_first_not_of(DEVICE_VALID) == std::string::npos;
 }
+
+void FreeSpaceLimit::parse(const std::string &s, bool size) {
+  if(s.size() && s.back() == '%') {
+    value = parseInteger(s.substr(0, s.size() - 1), 0, 100);
+    percent = true;
+  } else {
+    value = size ? parseSize(s) : parseInteger(s, 0, INT_MAX);
+    percent = false;
+  }
+}
+
+std::string FreeSpaceLimit::toString() const {
+  return std::to_string(value) + (percent ? "%" : "");
+}
+
+bool Device::needsSpace(const StoreUsage &usage) const {
+  if(usage.freeBytes < minFreeSpace.required(usage.totalBytes))
+    return true;
+  if(usage.totalFiles
+     && usage.freeFiles < minFreeInodes.required(usage.totalFiles))
+    return true;
+  return false;
+}
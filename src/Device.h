@@ -20,8 +20,41 @@
  */
 
 #include <string>
+#include <cstdint>
 
 class Store;
+struct StoreUsage;
+
+/** @brief A free space requirement
+ *
+ * Either an absolute quantity or a percentage of the total.
+ */
+struct FreeSpaceLimit {
+  /** @brief Required quantity or percentage, or 0 for no requirement */
+  int64_t value = 0;
+
+  /** @brief @c true if @ref value is a percentage */
+  bool percent = false;
+
+  /** @brief Parse a limit
+   * @param s Representation of limit
+   * @param size @c true to accept size suffixes
+   *
+   * Throws @ref SyntaxError if @p s is malformed.
+   */
+  void parse(const std::string &s, bool size);
+
+  /** @brief Compute the required quantity
+   * @param total Total quantity available
+   * @return Required quantity
+   */
+  int64_t required(int64_t total) const {
+    return percent ? total * value / 100 : value;
+  }
+
+  /** @brief Convert to string form */
+  std::string toString() const;
+};
 
 /** @brief Represents a backup device */
 class Device {
@@ -40,6 +73,35 @@ public:
    */
   Store *store = nullptr;
 
+  /** @brief Free space to maintain by pruning */
+  FreeSpaceLimit minFreeSpace;
+
+  /** @brief Free inodes to maintain by pruning */
+  FreeSpaceLimit minFreeInodes;
+
+  /** @brief What may be pruned to maintain free space */
+  enum SpacePrune {
+    /** @brief Only backups that the pruning policy would remove */
+    SpacePrunePolicy,
+
+    /** @brief Any backup, oldest first */
+    SpacePruneOldest,
+  };
+
+  /** @brief What may be pruned to maintain free space */
+  SpacePrune spacePrune = SpacePrunePolicy;
+
+  /** @brief Test whether any free space limits are set */
+  bool hasSpaceLimits() const {
+    return minFreeSpace.value || minFreeInodes.value;
+  }
+
+  /** @brief Test whether there is insufficient free space
+   * @param usage Current usage of device
+   * @return @c true if either limit is violated
+   */
+  bool needsSpace(const StoreUsage &usage) const;
+
   /** @brief Validity test for device names
    * @param n Name of device
    * @return true if @p n is a valid device name, else false
@@ -0,0 +1,560 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "rsbackup.h"
+#include "DiskUsage.h"
+#include "Conf.h"
+#include "Backup.h"
+#include "Volume.h"
+#include "Host.h"
+#include "Device.h"
+#include "Store.h"
+#include "Database.h"
+#include "Command.h"
+#include "Errors.h"
+#include "IO.h"
+#include "Utils.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#if HAVE_STATX
+# include <sys/sysmacros.h>
+#endif
+
+// Properties of an inode that matter for accounting
+struct InodeInfo {
+  dev_t dev;
+  ino_t ino;
+  nlink_t nlink;
+  bool directory;
+  int64_t bytes;
+};
+
+// Inspect a directory entry without following symlinks.  Returns false and
+// sets errno on error.
+static bool inspect(int dirfd, const char *name, InodeInfo &info) {
+#if HAVE_STATX
+  struct statx sx;
+  if(statx(dirfd, name, AT_SYMLINK_NOFOLLOW|AT_NO_AUTOMOUNT,
+           STATX_TYPE|STATX_INO|STATX_NLINK|STATX_BLOCKS, &sx) < 0)
+    return false;
+  info.dev = makedev(sx.stx_dev_major, sx.stx_dev_minor);
+  info.ino = sx.stx_ino;
+  info.nlink = sx.stx_nlink;
+  info.directory = S_ISDIR(sx.stx_mode);
+  info.bytes = static_cast<int64_t>(sx.stx_blocks) * 512;
+#else
+  struct stat sb;
+  if(fstatat(dirfd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0)
+    return false;
+  info.dev = sb.st_dev;
+  info.ino = sb.st_ino;
+  info.nlink = sb.st_nlink;
+  info.directory = S_ISDIR(sb.st_mode);
+  info.bytes = static_cast<int64_t>(sb.st_blocks) * 512;
+#endif
+  return true;
+}
+
+// Open a subdirectory.  Returns -1 and sets errno on error.
+static int openDirectory(int dirfd, const char *name) {
+  return openat(dirfd, name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+}
+
+// A directory entry
+struct DirectoryEntry {
+  std::string name;
+  ino_t ino;
+};
+
+// Inode numbers of the entries in a directory of the previous backup
+typedef std::unordered_map<std::string, ino_t> PreviousEntries;
+
+// Multiply-linked inodes already counted.  This is shared by all the
+// walkers of a backup, so that an inode linked from several top-level
+// entries is still only counted once.
+class SeenInodes {
+public:
+  // Return true the first time INO is offered
+  bool first(ino_t ino) {
+    std::lock_guard<std::mutex> guard(lock);
+    return inodes.insert(ino).second;
+  }
+
+private:
+  std::mutex lock;
+  std::unordered_set<ino_t> inodes;
+};
+
+// Walk a single top-level entry of a backup
+class TreeWalker {
+public:
+  TreeWalker(SeenInodes &seen): seen(seen) {}
+
+  // Measure DIRFD/NAME.  PREVFD is the corresponding directory in the
+  // previous backup, or -1.  PREVIOUS lists PREVFD's entries, or is a null
+  // pointer if they have not been read.  PATH is DIRFD's path, for error
+  // messages.
+  void entry(int dirfd, int prevfd, const PreviousEntries *previous,
+             const std::string &path, const char *name);
+
+  // Space used so far
+  BackupSpace space;
+
+private:
+  // Measure everything in DIRFD
+  void walk(int dirfd, int prevfd, const std::string &path);
+
+  // Read the entries in DIRFD
+  void readNames(int dirfd, const std::string &path,
+                 std::vector<DirectoryEntry> &entries);
+
+  // Multiply-linked inodes already counted
+  SeenInodes &seen;
+
+#if HAVE_GETDENTS64
+  // Buffer for directory entries
+  std::vector<char> buffer = std::vector<char>(32768);
+#endif
+};
+
+void TreeWalker::entry(int dirfd, int prevfd,
+                       const PreviousEntries *previous,
+                       const std::string &path, const char *name) {
+  InodeInfo info;
+  if(!inspect(dirfd, name, info))
+    throw IOError("inspecting " + path + PATH_SEP + name, errno);
+  if(info.directory) {
+    // Directories cannot be hard-linked so always belong to this backup
+    space.totalBytes += info.bytes;
+    space.exclusiveBytes += info.bytes;
+    FileDescriptor sub(openDirectory(dirfd, name));
+    if(sub.fd < 0)
+      throw IOError("opening " + path + PATH_SEP + name, errno);
+    FileDescriptor prevsub(prevfd >= 0 ? openDirectory(prevfd, name) : -1);
+    walk(sub.fd, prevsub.fd, path + PATH_SEP + name);
+    return;
+  }
+  // Count each inode once
+  if(info.nlink > 1 && !seen.first(info.ino))
+    return;
+  space.totalBytes += info.bytes;
+  if(info.nlink == 1) {
+    space.exclusiveBytes += info.bytes;
+    return;
+  }
+  // Multiply-linked files are shared if they are the same inode as the same
+  // path in the previous backup.  Otherwise they were first seen here.
+  if(prevfd < 0)
+    space.exclusiveBytes += info.bytes;
+  else {
+    // Most files are unchanged since the previous backup, and the inode
+    // numbers from its directory listing are enough to recognize them.
+    // Anything else is checked properly.
+    if(previous) {
+      auto it = previous->find(name);
+      if(it != previous->end() && it->second == info.ino)
+        return;
+    }
+    InodeInfo prev;
+    if(!inspect(prevfd, name, prev)
+       || prev.ino != info.ino
+       || prev.dev != info.dev)
+      space.exclusiveBytes += info.bytes;
+  }
+}
+
+void TreeWalker::walk(int dirfd, int prevfd, const std::string &path) {
+  std::vector<DirectoryEntry> entries;
+  readNames(dirfd, path, entries);
+  // Directory listings carry inode numbers, so one read of the previous
+  // directory replaces inspecting each hard-linked file in it.  The previous
+  // backup must be on the same filesystem for them to be comparable.
+  PreviousEntries previous;
+  bool havePrevious = false;
+  struct stat dirsb, prevsb;
+  if(prevfd >= 0
+     && fstat(dirfd, &dirsb) == 0
+     && fstat(prevfd, &prevsb) == 0
+     && dirsb.st_dev == prevsb.st_dev) {
+    std::vector<DirectoryEntry> prevEntries;
+    try {
+      readNames(prevfd, path, prevEntries);
+      for(auto &e: prevEntries)
+        previous[e.name] = e.ino;
+      havePrevious = true;
+    } catch(IOError &) {
+      // Fall back to inspecting files individually
+    }
+  }
+  for(auto &e: entries)
+    entry(dirfd, prevfd, havePrevious ? &previous : nullptr, path,
+          e.name.c_str());
+}
+
+void TreeWalker::readNames(int dirfd, const std::string &path,
+                           std::vector<DirectoryEntry> &entries) {
+#if HAVE_GETDENTS64
+  for(;;) {
+    ssize_t n = getdents64(dirfd, &buffer[0], buffer.size());
+    if(n < 0)
+      throw IOError("reading " + path, errno);
+    if(n == 0)
+      break;
+    for(ssize_t pos = 0; pos < n;) {
+      const struct dirent64 *de
+        = reinterpret_cast<const struct dirent64 *>(&buffer[pos]);
+      pos += de->d_reclen;
+      if(strcmp(de->d_name, ".") && strcmp(de->d_name, ".."))
+        entries.push_back({de->d_name, static_cast<ino_t>(de->d_ino)});
+    }
+  }
+#else
+  int fd = dup(dirfd);
+  if(fd < 0)
+    throw IOError("reading " + path, errno);
+  DIR *dp = fdopendir(fd);
+  if(!dp) {
+    close(fd);
+    throw IOError("reading " + path, errno);
+  }
+  struct dirent *de;
+  errno = 0;
+  while((de = readdir(dp))) {
+    if(strcmp(de->d_name, ".") && strcmp(de->d_name, ".."))
+      entries.push_back({de->d_name, de->d_ino});
+    errno = 0;
+  }
+  int save_errno = errno;
+  closedir(dp);
+  if(save_errno)
+    throw IOError("reading " + path, save_errno);
+#endif
+}
+
+std::vector<std::string> listBackupTree(const std::string &path) {
+  std::vector<std::string> files, names;
+  Directory::getFiles(path, files);
+  for(auto &f: files)
+    if(f != "." && f != "..")
+      names.push_back(f);
+  return names;
+}
+
+void measureBackupTree(const std::string &root,
+                       const std::string &previous,
+                       const std::vector<std::string> &names,
+                       const std::function<void(const std::string &,
+                                                const BackupSpace &)> &done) {
+  if(names.empty())
+    return;
+  FileDescriptor rootfd(open(root.c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC));
+  if(rootfd.fd < 0)
+    throw IOError("opening " + root, errno);
+  FileDescriptor prevfd(previous.size()
+                        ? open(previous.c_str(),
+                               O_RDONLY|O_DIRECTORY|O_CLOEXEC)
+                        : -1);
+  // Workers measure entries and queue up the results; this thread records
+  // them, so that the callback need not be thread-safe.
+  std::mutex lock;
+  std::condition_variable cond;
+  std::deque<std::pair<size_t, BackupSpace>> results;
+  std::exception_ptr failure;
+  std::atomic<size_t> next(0);
+  std::atomic<bool> stop(false);
+  SeenInodes seen;
+  size_t nthreads = std::min(names.size(),
+                             static_cast<size_t>(MAX_ACCOUNT_THREADS));
+  size_t running = nthreads;
+  auto worker = [&]() {
+    size_t n;
+    try {
+      while(!stop && (n = next++) < names.size()) {
+        TreeWalker walker(seen);
+        walker.entry(rootfd.fd, prevfd.fd, nullptr, root, names[n].c_str());
+        std::lock_guard<std::mutex> guard(lock);
+        results.push_back({n, walker.space});
+        cond.notify_one();
+      }
+    } catch(...) {
+      std::lock_guard<std::mutex> guard(lock);
+      if(!failure)
+        failure = std::current_exception();
+      stop = true;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    --running;
+    cond.notify_one();
+  };
+  std::vector<std::thread> threads;
+  for(size_t n = 0; n < nthreads; ++n)
+    threads.push_back(std::thread(worker));
+  std::unique_lock<std::mutex> guard(lock);
+  for(;;) {
+    while(results.empty() && running)
+      cond.wait(guard);
+    if(results.empty())
+      break;
+    std::pair<size_t, BackupSpace> result = results.front();
+    results.pop_front();
+    if(stop)
+      continue;
+    guard.unlock();
+    try {
+      done(names[result.first], result.second);
+    } catch(...) {
+      stop = true;
+      guard.lock();
+      if(!failure)
+        failure = std::current_exception();
+      continue;
+    }
+    guard.lock();
+  }
+  guard.unlock();
+  for(auto &t: threads)
+    t.join();
+  if(failure)
+    std::rethrow_exception(failure);
+}
+
+// Run F in a transaction, retrying if the database is busy
+static void transaction(const Backup *backup,
+                        const std::function<void(Database &)> &f) {
+  Database &db = config.getdb();
+  int retries = 0;
+  for(;;) {
+    bool begun = false;
+    try {
+      db.begin();
+      begun = true;
+      f(db);
+      db.commit();
+      return;
+    } catch(DatabaseBusy &) {
+      if(begun)
+        db.rollback();
+      // Log a message every second or so
+      if(!(retries++ & 1023))
+        warning(WARNING_DATABASE,
+                "measuring %s:%s on %s: retrying database update",
+                backup->volume->parent->name.c_str(),
+                backup->volume->name.c_str(),
+                backup->deviceName.c_str());
+      // Wait a millisecond and try again
+      usleep(1000);
+    }
+  }
+}
+
+// Find the backup that BACKUP was most likely linked against
+static const Backup *previousBackup(const Backup *backup) {
+  const Backup *previous = nullptr;
+  for(const Backup *b: backup->volume->backups) {
+    if(b->deviceName == backup->deviceName
+       && b->getStatus() == COMPLETE
+       && *b < *backup)
+      previous = b;
+  }
+  return previous;
+}
+
+void accountBackup(const Backup *backup) {
+  const Volume *volume = backup->volume;
+  const Host *host = volume->parent;
+  BackupSpace space;
+  if(getBackupSpace(config.getdb(), backup, space))
+    return;
+  if(warning_mask & WARNING_VERBOSE)
+    IO::out.writef("INFO: measuring %s:%s on %s\n",
+                   host->name.c_str(),
+                   volume->name.c_str(),
+                   backup->deviceName.c_str());
+  // Note that accounting has started, so it can be resumed if interrupted
+  transaction(backup, [&](Database &db) {
+    Database::Statement(db,
+                        "INSERT OR IGNORE INTO backup_space"
+                        " (host,volume,device,id,"
+                        "total_bytes,exclusive_bytes,complete)"
+                        " VALUES (?,?,?,?,0,0,0)",
+                        SQL_STRING, &host->name,
+                        SQL_STRING, &volume->name,
+                        SQL_STRING, &backup->deviceName,
+                        SQL_STRING, &backup->id,
+                        SQL_END).next();
+  });
+  // Skip whatever was measured before any interruption
+  std::set<std::string> measured;
+  {
+    Database::Statement stmt(config.getdb(),
+                             "SELECT name FROM backup_space_part"
+                             " WHERE host=? AND volume=? AND device=? AND id=?",
+                             SQL_STRING, &host->name,
+                             SQL_STRING, &volume->name,
+                             SQL_STRING, &backup->deviceName,
+                             SQL_STRING, &backup->id,
+                             SQL_END);
+    while(stmt.next())
+      measured.insert(stmt.get_string(0));
+  }
+  const std::string path = backup->backupPath();
+  std::vector<std::string> names;
+  for(auto &name: listBackupTree(path))
+    if(!measured.count(name))
+      names.push_back(name);
+  const Backup *previous = previousBackup(backup);
+  measureBackupTree(path, previous ? previous->backupPath() : "", names,
+                    [&](const std::string &name, const BackupSpace &part) {
+    transaction(backup, [&](Database &db) {
+      Database::Statement(db,
+                          "INSERT OR REPLACE INTO backup_space_part"
+                          " (host,volume,device,id,name,"
+                          "total_bytes,exclusive_bytes)"
+                          " VALUES (?,?,?,?,?,?,?)",
+                          SQL_STRING, &host->name,
+                          SQL_STRING, &volume->name,
+                          SQL_STRING, &backup->deviceName,
+                          SQL_STRING, &backup->id,
+                          SQL_STRING, &name,
+                          SQL_INT64, (sqlite_int64)part.totalBytes,
+                          SQL_INT64, (sqlite_int64)part.exclusiveBytes,
+                          SQL_END).next();
+    });
+  });
+  // Total up the parts
+  transaction(backup, [&](Database &db) {
+    Database::Statement(db,
+                        "UPDATE backup_space"
+                        " SET total_bytes=(SELECT TOTAL(total_bytes)"
+                        "   FROM backup_space_part AS p"
+                        "   WHERE p.host=backup_space.host"
+                        "   AND p.volume=backup_space.volume"
+                        "   AND p.device=backup_space.device"
+                        "   AND p.id=backup_space.id),"
+                        " exclusive_bytes=(SELECT TOTAL(exclusive_bytes)"
+                        "   FROM backup_space_part AS p"
+                        "   WHERE p.host=backup_space.host"
+                        "   AND p.volume=backup_space.volume"
+                        "   AND p.device=backup_space.device"
+                        "   AND p.id=backup_space.id),"
+                        " complete=1"
+                        " WHERE host=? AND volume=? AND device=? AND id=?",
+                        SQL_STRING, &host->name,
+                        SQL_STRING, &volume->name,
+                        SQL_STRING, &backup->deviceName,
+                        SQL_STRING, &backup->id,
+                        SQL_END).next();
+    Database::Statement(db,
+                        "DELETE FROM backup_space_part"
+                        " WHERE host=? AND volume=? AND device=? AND id=?",
+                        SQL_STRING, &host->name,
+                        SQL_STRING, &volume->name,
+                        SQL_STRING, &backup->deviceName,
+                        SQL_STRING, &backup->id,
+                        SQL_END).next();
+  });
+}
+
+void resumeAccounting() {
+  Database &db = config.getdb();
+  if(!db.hasTable("backup_space"))
+    return;
+  std::vector<Backup *> pending;
+  {
+    Database::Statement stmt(db,
+                             "SELECT host,volume,device,id FROM backup_space"
+                             " WHERE complete=0",
+                             SQL_END);
+    while(stmt.next()) {
+      Volume *volume = config.findVolume(stmt.get_string(0),
+                                         stmt.get_string(1));
+      if(!volume)
+        continue;
+      const std::string deviceName = stmt.get_string(2);
+      const std::string id = stmt.get_string(3);
+      for(Backup *backup: volume->backups)
+        if(backup->deviceName == deviceName
+           && backup->id == id
+           && backup->getStatus() == COMPLETE)
+          pending.push_back(backup);
+    }
+  }
+  if(pending.empty())
+    return;
+  config.identifyDevices(Store::Enabled);
+  for(Backup *backup: pending) {
+    Device *device = backup->getDevice();
+    if(!device || !device->store || device->store->state != Store::Enabled)
+      continue;
+    try {
+      accountBackup(backup);
+    } catch(IOError &e) {
+      warning(WARNING_STORE, "%s", e.what());
+    }
+  }
+}
+
+bool getBackupSpace(Database &db, const Backup *backup, BackupSpace &space) {
+  if(!db.hasTable("backup_space"))
+    return false;
+  const Volume *volume = backup->volume;
+  Database::Statement stmt(db,
+                           "SELECT total_bytes,exclusive_bytes FROM backup_space"
+                           " WHERE host=? AND volume=? AND device=? AND id=?"
+                           " AND complete=1",
+                           SQL_STRING, &volume->parent->name,
+                           SQL_STRING, &volume->name,
+                           SQL_STRING, &backup->deviceName,
+                           SQL_STRING, &backup->id,
+                           SQL_END);
+  if(!stmt.next())
+    return false;
+  space.totalBytes = stmt.get_int64(0);
+  space.exclusiveBytes = stmt.get_int64(1);
+  return true;
+}
+
+void getAllBackupSpace(Database &db, BackupSpaceMap &spaces) {
+  if(!db.hasTable("backup_space"))
+    return;
+  Database::Statement stmt(db,
+                           "SELECT host,volume,device,id,"
+                           "total_bytes,exclusive_bytes FROM backup_space"
+                           " WHERE complete=1",
+                           SQL_END);
+  while(stmt.next()) {
+    BackupSpace &space = spaces[BackupSpaceKey(stmt.get_string(0),
+                                               stmt.get_string(1),
+                                               stmt.get_string(2),
+                                               stmt.get_string(3))];
+    space.totalBytes = stmt.get_int64(4);
+    space.exclusiveBytes = stmt.get_int64(5);
+  }
+}
@@ -0,0 +1,132 @@
+// -*-C++-*-
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef DISKUSAGE_H
+#define DISKUSAGE_H
+/** @file DiskUsage.h
+ * @brief Disk usage accounting for hard-linked backups
+ *
+ * Backups share unchanged files with their predecessors via hard links, so
+ * the size of a backup tree says little about what it costs to keep it.
+ * Each new backup is walked once and its allocated space split into:
+ * - exclusive space: inodes with only one link, or first seen in that
+ *   backup (i.e. not hard-linked from the same path in the previous backup)
+ * - shared space: everything else
+ *
+ * Inodes with several links within the backup are only counted once, in
+ * whichever top-level entry reaches them first.  When a measurement is
+ * resumed, links to top-level entries measured before the interruption are
+ * not recognized, and are counted again.
+ *
+ * Since directories are never shared, every backup has to be walked in full.
+ * Hard-linked files are recognized from the inode numbers in the previous
+ * backup's directory listings where possible, rather than by inspecting each
+ * of them.
+ */
+
+#include <string>
+#include <vector>
+#include <map>
+#include <tuple>
+#include <functional>
+#include <cstdint>
+
+class Database;
+class Backup;
+
+/** @brief Space used by (part of) a backup */
+struct BackupSpace {
+  /** @brief Bytes allocated to all inodes */
+  int64_t totalBytes = 0;
+
+  /** @brief Bytes allocated to inodes exclusive to this backup */
+  int64_t exclusiveBytes = 0;
+
+  /** @brief Bytes allocated to inodes shared with an earlier backup */
+  int64_t sharedBytes() const {
+    return totalBytes - exclusiveBytes;
+  }
+
+  /** @brief Accumulate another measurement */
+  BackupSpace &operator+=(const BackupSpace &that) {
+    totalBytes += that.totalBytes;
+    exclusiveBytes += that.exclusiveBytes;
+    return *this;
+  }
+};
+
+/** @brief List the top-level entries of a directory
+ * @param path Directory
+ * @return Sorted list of names, excluding "." and ".."
+ *
+ * Throws @ref IOError on error.
+ */
+std::vector<std::string> listBackupTree(const std::string &path);
+
+/** @brief Measure the space used by a backup tree
+ * @param root Backup directory
+ * @param previous Previous backup directory, or empty string
+ * @param names Top-level entries of @p root to measure
+ * @param done Called in the calling thread as each entry is completed
+ *
+ * Entries are measured concurrently, using up to @ref MAX_ACCOUNT_THREADS
+ * threads.  An inode linked from several of @p names is counted in only one
+ * of them.  Throws @ref IOError on error, after all threads have finished.
+ */
+void measureBackupTree(const std::string &root,
+                       const std::string &previous,
+                       const std::vector<std::string> &names,
+                       const std::function<void(const std::string &,
+                                                const BackupSpace &)> &done);
+
+/** @brief Account for the space used by a backup
+ * @param backup Backup to measure
+ *
+ * The result is recorded in the database.  Progress is recorded per
+ * top-level entry, so an interrupted measurement can be resumed by calling
+ * this function again (see @ref resumeAccounting).
+ */
+void accountBackup(const Backup *backup);
+
+/** @brief Complete any interrupted space accounting
+ *
+ * Only backups on currently identified devices are considered.
+ */
+void resumeAccounting();
+
+/** @brief Retrieve the recorded space used by a backup
+ * @param db Database
+ * @param backup Backup
+ * @param space Where to store result
+ * @return @c true if accounting for @p backup is complete
+ */
+bool getBackupSpace(Database &db, const Backup *backup, BackupSpace &space);
+
+/** @brief Identity of a backup: host, volume, device and ID */
+typedef std::tuple<std::string, std::string, std::string, std::string>
+  BackupSpaceKey;
+
+/** @brief Recorded space used by backups */
+typedef std::map<BackupSpaceKey, BackupSpace> BackupSpaceMap;
+
+/** @brief Retrieve the recorded space used by all measured backups
+ * @param db Database
+ * @param spaces Where to store results
+ *
+ * Only backups whose accounting is complete are included.
+ */
+void getAllBackupSpace(Database &db, BackupSpaceMap &spaces);
+
+#endif /* DISKUSAGE_H */
@@ -453,6 +453,16 @@ public:
      */
     Image(const std::string &url): url(url) {}
 
+    /** @brief Constructor
+     * @param type MIME type of image
+     * @param content Image data
+     *
+     * The image is embedded in the HTML output as a @c data: URL, unless
+     * @ref ident is set.
+     */
+    Image(const std::string &type, const std::string &content):
+      type(type), content(content) {}
+
     /** @brief Render as HTML
      * @param os Output
      */
@@ -463,8 +473,24 @@ public:
      */
     void renderText(std::ostream &os) const override;
 
-    /** @brief URL for this image */
+    /** @brief URL for this image
+     *
+     * Empty for embedded images.
+     */
     std::string url;
+
+    /** @brief MIME type of embedded image */
+    std::string type;
+
+    /** @brief Data for embedded image */
+    std::string content;
+
+    /** @brief Content ID for embedded image
+     *
+     * If this is set then the HTML refers to the image as @c cid:IDENT, and
+     * the image must be sent alongside it as a MIME related part.
+     */
+    std::string ident;
   };
 
   /** @brief The root container for the document */
@@ -193,19 +193,24 @@ void EventLoop::onReadable(EventLoop *, int, const void *, size_t) {
   pid_t pid;
   struct rusage ru;
   int status;
-  while(waiters.size() > 0) {
-    pid = wait4(-1, &status, WNOHANG, &ru);
+  // Only reap our own subprocesses, so that others (for instance background
+  // subprocesses) are left for their owners to collect.
+  auto it = waiters.begin();
+  while(it != waiters.end()) {
+    pid = wait4(it->first, &status, WNOHANG, &ru);
     if(pid < 0) {
-      if(errno != EINTR)
-        throw SystemError("wait4", errno);
+      if(errno == EINTR)
+        continue;
+      throw SystemError("wait4", errno);
     }
-    if(pid <= 0)
-      return;
-    auto it = waiters.find(pid);
-    if(it != waiters.end()) {
-      Reactor *r = it->second;
-      waiters.erase(it);
-      r->onWait(this, pid, status, ru);
+    if(pid == 0) {
+      ++it;
+      continue;
     }
+    Reactor *r = it->second;
+    waiters.erase(it);
+    r->onWait(this, pid, status, ru);
+    // The reactor may have changed the set of waiters
+    it = waiters.begin();
   }
 }
@@ -0,0 +1,188 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Exclude.h"
+
+// Match the character class starting just after the '[' at P against C.
+// Returns a pointer to the closing ']', or null if the class is not
+// terminated.
+static const char *matchClass(const char *p, char c, bool escapes,
+                              bool &matched) {
+  bool negated = false;
+  if(*p == '!' || *p == '^') {
+    negated = true;
+    ++p;
+  }
+  matched = false;
+  // A ']' immediately after the '[' is literal
+  for(bool first = true; *p && (first || *p != ']'); first = false) {
+    char low = *p++;
+    if(low == '\\' && escapes && *p)
+      low = *p++;
+    char high = low;
+    if(*p == '-' && p[1] && p[1] != ']') {
+      ++p;
+      high = *p++;
+      if(high == '\\' && escapes && *p)
+        high = *p++;
+    }
+    if(c >= low && c <= high)
+      matched = true;
+  }
+  if(!*p)
+    return nullptr;
+  // Classes never match '/'
+  matched = matched != negated && c != '/';
+  return p;
+}
+
+static bool match(const char *p, const char *t, bool escapes) {
+  while(*p) {
+    switch(*p) {
+    case '*':
+      if(p[1] == '*') {
+        // "**" matches anything, including '/'
+        while(*p == '*')
+          ++p;
+        for(;; ++t) {
+          if(match(p, t, escapes))
+            return true;
+          if(!*t)
+            return false;
+        }
+      }
+      // '*' matches anything within one component
+      ++p;
+      for(;; ++t) {
+        if(match(p, t, escapes))
+          return true;
+        if(!*t || *t == '/')
+          return false;
+      }
+    case '?':
+      if(!*t || *t == '/')
+        return false;
+      break;
+    case '[': {
+      bool matched;
+      const char *end = *t ? matchClass(p + 1, *t, escapes, matched) : nullptr;
+      if(end) {
+        if(!matched)
+          return false;
+        p = end;
+        break;
+      }
+      // An unterminated class is just a '['
+      if(*t != '[')
+        return false;
+      break;
+    }
+    case '\\':
+      if(escapes && p[1])
+        ++p;
+      // fall through
+    default:
+      if(*p != *t)
+        return false;
+      break;
+    }
+    ++p;
+    ++t;
+  }
+  return !*t;
+}
+
+bool matchPattern(const std::string &pattern, const std::string &path) {
+  // Without wildcards, backslash is an ordinary character
+  if(pattern.find_first_of("*?[") == std::string::npos)
+    return pattern == path;
+  return match(pattern.c_str(), path.c_str(), true);
+}
+
+Exclusions::Exclusions(const std::vector<std::string> &patterns) {
+  for(auto &pattern: patterns) {
+    if(pattern.compare(0, 2, "+ ") == 0)
+      add(pattern.substr(2), true);
+    else if(pattern.compare(0, 2, "- ") == 0)
+      add(pattern.substr(2), false);
+    else
+      add(pattern, false);
+  }
+}
+
+void Exclusions::add(std::string pattern, bool include) {
+  Rule rule;
+  rule.include = include;
+  rule.anchored = pattern.size() && pattern[0] == '/';
+  if(rule.anchored)
+    pattern.erase(0, 1);
+  rule.directoryOnly = false;
+  if(pattern.size() >= 4
+     && pattern.compare(pattern.size() - 4, 4, "/***") == 0) {
+    // Matches the directory itself as well as its contents
+    pattern.erase(pattern.size() - 4);
+    Rule contents = rule;
+    contents.pattern = pattern + "/**";
+    contents.wholePath = true;
+    rule.directoryOnly = true;
+    rule.pattern = pattern;
+    rule.wholePath = rule.anchored
+      || pattern.find('/') != std::string::npos
+      || pattern.find("**") != std::string::npos;
+    rules.push_back(rule);
+    rules.push_back(contents);
+    return;
+  }
+  while(pattern.size() && pattern[pattern.size() - 1] == '/') {
+    rule.directoryOnly = true;
+    pattern.erase(pattern.size() - 1);
+  }
+  if(pattern.empty())
+    return;
+  rule.pattern = pattern;
+  rule.wholePath = rule.anchored
+    || pattern.find('/') != std::string::npos
+    || pattern.find("**") != std::string::npos;
+  rules.push_back(rule);
+}
+
+bool Exclusions::excluded(const std::string &path, bool directory) const {
+  for(auto &rule: rules)
+    if(rule.matches(path, directory))
+      return !rule.include;
+  return false;
+}
+
+bool Exclusions::Rule::matches(const std::string &path, bool directory) const {
+  if(directoryOnly && !directory)
+    return false;
+  if(!wholePath) {
+    size_t slash = path.rfind('/');
+    return matchPattern(pattern,
+                        slash == std::string::npos ? path
+                                                   : path.substr(slash + 1));
+  }
+  if(anchored)
+    return matchPattern(pattern, path);
+  // Unanchored patterns can match any trailing sequence of components
+  for(size_t start = 0;;) {
+    if(matchPattern(pattern, path.substr(start)))
+      return true;
+    size_t slash = path.find('/', start);
+    if(slash == std::string::npos)
+      return false;
+    start = slash + 1;
+  }
+}
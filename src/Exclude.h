@@ -0,0 +1,113 @@
+// -*-C++-*-
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef EXCLUDE_H
+#define EXCLUDE_H
+/** @file Exclude.h
+ * @brief Matching paths against rsync exclusion patterns
+ *
+ * Volumes backed up without rsync must still honor @c exclude directives
+ * with the same meaning that rsync gives them.
+ */
+
+#include <string>
+#include <vector>
+
+/** @brief Match a path against an rsync wildcard pattern
+ * @param pattern Pattern
+ * @param path Path to match
+ * @return @c true if @p pattern matches the whole of @p path
+ *
+ * @c * and @c ? match anything except "/", @c ** matches anything, and
+ * <tt>[...]</tt> matches a character class.  Backslash escapes the following
+ * character, but only if the pattern contains a wildcard.
+ */
+bool matchPattern(const std::string &pattern, const std::string &path);
+
+/** @brief A list of rsync exclusion patterns
+ *
+ * Patterns are interpreted as by rsync's @c --exclude option:
+ * - A leading "/" anchors the pattern to the root of the volume.
+ * - A trailing "/" restricts the pattern to directories.
+ * - A pattern containing "/" or "**" is matched against the whole path,
+ *   or if not anchored, against any trailing sequence of its components.
+ * - Any other pattern is matched against the final component only.
+ * - A trailing "/" followed by "***" matches a directory and everything in
+ *   it.
+ * - A leading "+ " makes the pattern an inclusion and a leading "- " an
+ *   exclusion.  The first pattern to match decides.
+ */
+class Exclusions {
+public:
+  /** @brief Construct an empty list */
+  Exclusions() = default;
+
+  /** @brief Constructor
+   * @param patterns Exclusion patterns, in order
+   */
+  Exclusions(const std::vector<std::string> &patterns);
+
+  /** @brief Test whether a path is excluded
+   * @param path Path relative to the root of the volume
+   * @param directory @c true if @p path is a directory
+   * @return @c true if @p path is excluded
+   */
+  bool excluded(const std::string &path, bool directory) const;
+
+  /** @brief Test whether there are any patterns
+   * @return @c true if nothing can be excluded
+   */
+  bool empty() const {
+    return rules.empty();
+  }
+
+private:
+  /** @brief One parsed pattern */
+  struct Rule {
+    /** @brief Pattern, without any anchoring or trailing "/" */
+    std::string pattern;
+
+    /** @brief @c true for an inclusion, @c false for an exclusion */
+    bool include;
+
+    /** @brief Pattern only matches from the root of the volume */
+    bool anchored;
+
+    /** @brief Pattern only matches directories */
+    bool directoryOnly;
+
+    /** @brief Pattern matches the whole path rather than the final
+     * component */
+    bool wholePath;
+
+    /** @brief Test whether this rule matches a path
+     * @param path Path relative to the root of the volume
+     * @param directory @c true if @p path is a directory
+     * @return @c true if the rule matches
+     */
+    bool matches(const std::string &path, bool directory) const;
+  };
+
+  /** @brief Add a rule
+   * @param pattern Pattern, with any "/" prefix and suffix
+   * @param include @c true for an inclusion
+   */
+  void add(std::string pattern, bool include);
+
+  /** @brief Rules in order */
+  std::vector<Rule> rules;
+};
+
+#endif /* EXCLUDE_H */
@@ -0,0 +1,64 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "rsbackup.h"
+#include "Conf.h"
+#include "Backup.h"
+#include "Host.h"
+#include "Volume.h"
+#include "Catalog.h"
+#include "IO.h"
+#include "Utils.h"
+
+void findFile(const std::string &path) {
+  Database &db = config.getdb();
+  bool found = false;
+  for(auto &h: config.hosts) {
+    const Host *host = h.second;
+    if(!host->selected())
+      continue;
+    for(auto &v: host->volumes) {
+      const Volume *volume = v.second;
+      if(!volume->selected())
+        continue;
+      std::string relative;
+      if(path.size() && path[0] == '/') {
+        if(!catalogRelativePath(volume->path, path, relative))
+          continue;
+      } else
+        relative = catalogPath(path);
+      for(auto &version: findCatalogVersions(db, host->name, volume->name,
+                                             relative)) {
+        char mtime[64];
+        struct tm t;
+        strftime(mtime, sizeof mtime, "%Y-%m-%dT%H:%M:%S",
+                 localtime_r(&version.mtime, &t));
+        IO::out.writef("%s:%s %s %s %s %d %jd %s %s\n",
+                       host->name.c_str(),
+                       volume->name.c_str(),
+                       version.device.c_str(),
+                       version.first.c_str(),
+                       version.last.c_str(),
+                       version.backups,
+                       (intmax_t)version.size,
+                       mtime,
+                       version.flags.c_str());
+        found = true;
+      }
+    }
+  }
+  if(!found)
+    warning(WARNING_VERBOSE, "%s not found in catalog", path.c_str());
+}
@@ -16,14 +16,18 @@
 #include "Document.h"
 #include "Utils.h"
 #include "Errors.h"
+#include "HtmlScan.h"
 #include <ostream>
+#include <sstream>
 #include <cstdio>
 #include <cstdarg>
+#include <cstring>
+#include <langinfo.h>
 
 // HTML support ---------------------------------------------------------------
 
-void Document::quoteHtml(std::ostream &os,
-                         const std::string &s) {
+// Quote S by decoding it completely.  This works in any encoding.
+static void quoteHtmlDecoded(std::ostream &os, const std::string &s) {
   // We need the string in UTF-32 in order to quote it correctly
   std::u32string u;
   toUnicode(u, s);
@@ -45,6 +49,39 @@ void Document::quoteHtml(std::ostream &os,
   }
 }
 
+void Document::quoteHtml(std::ostream &os,
+                         const std::string &s) {
+  // Multibyte encodings other than UTF-8 may use ASCII bytes inside
+  // multibyte characters, so only UTF-8 and ASCII can take the fast path.
+  const char *encoding = nl_langinfo(CODESET);
+  if(strcmp(encoding, "UTF-8") && strcmp(encoding, "ANSI_X3.4-1968")) {
+    quoteHtmlDecoded(os, s);
+    return;
+  }
+  // Copy runs of plain ASCII verbatim and only decode the rest
+  const char *p = s.data(), *end = p + s.size();
+  std::u32string u;
+  while(p < end) {
+    size_t n = htmlPlainPrefix(p, end - p);
+    os.write(p, n);
+    p += n;
+    if(p == end)
+      break;
+    if(!(*p & 0x80)) {
+      os << "&#" << static_cast<unsigned>(*p) << ";";
+      ++p;
+      continue;
+    }
+    const char *q = p;
+    while(q < end && (*q & 0x80))
+      ++q;
+    toUnicode(u, std::string(p, q));
+    for(auto w: u)
+      os << "&#" << w << ";";
+    p = q;
+  }
+}
+
 void Document::Node::renderHtmlOpenTag(std::ostream &os,
                                        const char *name, ...) const {
   va_list ap;
@@ -181,7 +218,16 @@ void Document::Table::renderHtml(std::ostream &os) const {
 
 void Document::Image::renderHtml(std::ostream &os) const {
   renderHtmlOpenTag(os, "p", (char *)nullptr);
-  renderHtmlOpenTag(os, "img", "src", url.c_str(), (char *)nullptr);
+  std::string src = url;
+  if(ident.size())
+    src = "cid:" + ident;
+  else if(src.empty()) {
+    std::stringstream ss;
+    ss << "data:" << type << ";base64,";
+    write_base64(ss, content);
+    src = ss.str();
+  }
+  renderHtmlOpenTag(os, "img", "src", src.c_str(), (char *)nullptr);
   renderHtmlCloseTag(os, "p");
 }
 
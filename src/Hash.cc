@@ -0,0 +1,165 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Hash.h"
+#include "Defaults.h"
+#include "Errors.h"
+#include <algorithm>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+// See https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+
+static const uint64_t PRIME1 = 11400714785074694791ULL;
+static const uint64_t PRIME2 = 14029467366897019727ULL;
+static const uint64_t PRIME3 = 1609587929392839161ULL;
+static const uint64_t PRIME4 = 9650029242287828579ULL;
+static const uint64_t PRIME5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+// Little-endian loads.  Compilers turn these into single loads where that
+// is possible.
+static inline uint64_t read64(const unsigned char *p) {
+  return static_cast<uint64_t>(p[0])
+    | static_cast<uint64_t>(p[1]) << 8
+    | static_cast<uint64_t>(p[2]) << 16
+    | static_cast<uint64_t>(p[3]) << 24
+    | static_cast<uint64_t>(p[4]) << 32
+    | static_cast<uint64_t>(p[5]) << 40
+    | static_cast<uint64_t>(p[6]) << 48
+    | static_cast<uint64_t>(p[7]) << 56;
+}
+
+static inline uint32_t read32(const unsigned char *p) {
+  return static_cast<uint32_t>(p[0])
+    | static_cast<uint32_t>(p[1]) << 8
+    | static_cast<uint32_t>(p[2]) << 16
+    | static_cast<uint32_t>(p[3]) << 24;
+}
+
+static inline uint64_t accumulate(uint64_t acc, uint64_t input) {
+  return rotl(acc + input * PRIME2, 31) * PRIME1;
+}
+
+static inline uint64_t merge(uint64_t acc, uint64_t lane) {
+  return (acc ^ accumulate(0, lane)) * PRIME1 + PRIME4;
+}
+
+XXHash64::XXHash64(uint64_t seed_): seed(seed_) {
+  lanes[0] = seed + PRIME1 + PRIME2;
+  lanes[1] = seed + PRIME2;
+  lanes[2] = seed;
+  lanes[3] = seed - PRIME1;
+}
+
+void XXHash64::update(const void *data, size_t len) {
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  total += len;
+  // Complete a partial stripe
+  if(buffered) {
+    size_t n = std::min(len, sizeof buffer - buffered);
+    memcpy(buffer + buffered, p, n);
+    buffered += n;
+    p += n;
+    len -= n;
+    if(buffered < sizeof buffer)
+      return;
+    for(int i = 0; i < 4; ++i)
+      lanes[i] = accumulate(lanes[i], read64(buffer + 8 * i));
+    buffered = 0;
+  }
+  // Whole stripes.  The four lanes are independent, so the processor can
+  // work on them in parallel.
+  uint64_t v0 = lanes[0], v1 = lanes[1], v2 = lanes[2], v3 = lanes[3];
+  while(len >= 32) {
+    v0 = accumulate(v0, read64(p));
+    v1 = accumulate(v1, read64(p + 8));
+    v2 = accumulate(v2, read64(p + 16));
+    v3 = accumulate(v3, read64(p + 24));
+    p += 32;
+    len -= 32;
+  }
+  lanes[0] = v0;
+  lanes[1] = v1;
+  lanes[2] = v2;
+  lanes[3] = v3;
+  // Keep what is left over for next time
+  memcpy(buffer, p, len);
+  buffered = len;
+}
+
+uint64_t XXHash64::digest() const {
+  uint64_t h;
+  if(total >= 32) {
+    h = rotl(lanes[0], 1) + rotl(lanes[1], 7)
+      + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+    for(int i = 0; i < 4; ++i)
+      h = merge(h, lanes[i]);
+  } else
+    h = seed + PRIME5;
+  h += total;
+  const unsigned char *p = buffer;
+  size_t len = buffered;
+  while(len >= 8) {
+    h = rotl(h ^ accumulate(0, read64(p)), 27) * PRIME1 + PRIME4;
+    p += 8;
+    len -= 8;
+  }
+  if(len >= 4) {
+    h = rotl(h ^ (read32(p) * PRIME1), 23) * PRIME2 + PRIME3;
+    p += 4;
+    len -= 4;
+  }
+  while(len > 0) {
+    h = rotl(h ^ (*p * PRIME5), 11) * PRIME1;
+    ++p;
+    --len;
+  }
+  h ^= h >> 33;
+  h *= PRIME2;
+  h ^= h >> 29;
+  h *= PRIME3;
+  h ^= h >> 32;
+  return h;
+}
+
+uint64_t hashFile(int fd, const std::string &path) {
+  off_t offset = lseek(fd, 0, SEEK_CUR);
+  if(offset < 0)
+    offset = 0;
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  std::vector<char> buffer(HASH_BUFFER_SIZE);
+  XXHash64 h;
+  for(;;) {
+    ssize_t n = read(fd, &buffer[0], buffer.size());
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      throw IOError("reading " + path, errno);
+    }
+    if(n == 0)
+      break;
+    h.update(&buffer[0], n);
+    posix_fadvise(fd, offset, n, POSIX_FADV_DONTNEED);
+    offset += n;
+  }
+  return h.digest();
+}
@@ -0,0 +1,91 @@
+// -*-C++-*-
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef HASH_H
+#define HASH_H
+/** @file Hash.h
+ * @brief Fast content hashing
+ */
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/** @brief Incremental XXH64 hash
+ *
+ * XXH64 is a fast non-cryptographic hash, suitable for detecting accidental
+ * corruption but not deliberate tampering.  Its inner loop keeps four
+ * independent lanes, so it runs at several bytes per cycle; hashing file
+ * contents is limited by disk bandwidth rather than CPU.
+ *
+ * The result for any given input is independent of how it is divided up
+ * between calls to @ref update.
+ */
+class XXHash64 {
+public:
+  /** @brief Constructor
+   * @param seed Seed value
+   */
+  XXHash64(uint64_t seed = 0);
+
+  /** @brief Add data to the hash
+   * @param data Data to add
+   * @param len Number of bytes to add
+   */
+  void update(const void *data, size_t len);
+
+  /** @brief Return the hash of all data added so far */
+  uint64_t digest() const;
+
+  /** @brief Hash a string
+   * @param s String to hash
+   * @param seed Seed value
+   * @return Hash of @p s
+   */
+  static uint64_t hash(const std::string &s, uint64_t seed = 0) {
+    XXHash64 h(seed);
+    h.update(s.data(), s.size());
+    return h.digest();
+  }
+
+private:
+  /** @brief Lane accumulators */
+  uint64_t lanes[4];
+
+  /** @brief Seed */
+  uint64_t seed;
+
+  /** @brief Total bytes hashed */
+  uint64_t total = 0;
+
+  /** @brief Bytes not yet processed */
+  unsigned char buffer[32];
+
+  /** @brief Number of bytes in @ref buffer */
+  size_t buffered = 0;
+};
+
+/** @brief Hash the contents of a file
+ * @param fd File to read
+ * @param path Path to file, for error messages
+ * @return XXH64 hash of the contents from the current position
+ *
+ * The file is read sequentially and dropped from the page cache as it is
+ * read, since it is not expected to be read again soon.  Throws @ref IOError
+ * on error.
+ */
+uint64_t hashFile(int fd, const std::string &path);
+
+#endif /* HASH_H */
@@ -20,9 +20,18 @@
 #include "HistoryGraph.h"
 #include "Errors.h"
 #include "Utils.h"
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <exception>
 #include <limits>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include <cassert>
 #include <regex>
+#include <pangomm/init.h>
 
 HostLabels::HostLabels(Render::Context &ctx): Render::Grid(ctx) {
   unsigned row = 0;
@@ -149,7 +158,7 @@ void HistoryGraphContent::render_vertical_guides() {
   set_source_color(config.colorMonthGuide);
   Date d = earliest;
   while(d <= latest) {
-    d.d = 1;
+    d = Date(d.year(), d.month(), 1);
     d.addMonth();
     Date next = d;
     next.addMonth();
@@ -163,28 +172,33 @@ void HistoryGraphContent::render_vertical_guides() {
 }
 
 void HistoryGraphContent::render_horizontal_guides() {
+  // The first row for each host gets a host guide, the rest volume guides
+  std::vector<double> host_guides, volume_guides;
   unsigned row = 0;
   for(auto host_iterator: config.hosts) {
     Host *host = host_iterator.second;
     if(!host->selected())
       continue;
-    set_source_color(config.colorHostGuide);
+    bool first = true;
     for(auto volume_iterator: host->volumes) {
       Volume *volume = volume_iterator.second;
       if(!volume->selected())
         continue;
-      context.cairo->rectangle(0, row * (row_height + config.verticalPadding),
-                               width, 1);
-      context.cairo->fill();
-      set_source_color(config.colorVolumeGuide);
+      (first ? host_guides : volume_guides)
+        .push_back(row * (row_height + config.verticalPadding));
+      first = false;
       ++row;
     }
   }
+  volume_guides.push_back(row * (row_height + config.verticalPadding)
+                          - config.verticalPadding);
+  set_source_color(config.colorHostGuide);
+  for(double y: host_guides)
+    context.cairo->rectangle(0, y, width, 1);
+  context.cairo->fill();
   set_source_color(config.colorVolumeGuide);
-  context.cairo->rectangle(0,
-                           row * (row_height + config.verticalPadding)
-                             - config.verticalPadding,
-                           width, 1);
+  for(double y: volume_guides)
+    context.cairo->rectangle(0, y, width, 1);
   context.cairo->fill();
 }
 
@@ -193,6 +207,16 @@ void HistoryGraphContent::render_data() {
   double base = floor((row_height + config.verticalPadding - 1
                        - (indicator_height
                           * config.devices.size())) / 2) + 1;
+  // Consecutive backups of a volume on the same device are drawn as a
+  // single run.  Runs are collected per device row and then filled one
+  // color at a time, so the number of fills depends only on the number of
+  // colors, not on the number of backups.
+  const size_t ndevices = config.devices.size();
+  std::vector<std::vector<Run>> runs(ndevices);
+  std::vector<int> first(ndevices), last(ndevices);
+  // Rows outside the clip region (e.g. when rendering in bands) are skipped
+  double clip_x1, clip_y1, clip_x2, clip_y2;
+  context.cairo->get_clip_extents(clip_x1, clip_y1, clip_x2, clip_y2);
   for(auto host_iterator: config.hosts) {
     Host *host = host_iterator.second;
     if(!host->selected())
@@ -201,21 +225,50 @@ void HistoryGraphContent::render_data() {
       Volume *volume = volume_iterator.second;
       if(!volume->selected())
         continue;
+      if(y + row_height < clip_y1 || y > clip_y2) {
+        y += row_height + config.verticalPadding;
+        continue;
+      }
+      std::fill(first.begin(), first.end(), -1);
       for(auto backup: volume->backups) {
-        if(backup->getStatus() == COMPLETE) {
-          double x = (backup->date - earliest) * config.backupIndicatorWidth;
-          auto device_row = device_key.device_row(backup);
-          double offset = base + device_row * indicator_height;
-          set_source_color(device_key.device_color(backup));
-          context.cairo->rectangle(x, y + offset,
-                                   config.backupIndicatorWidth,
-                                   indicator_height);
-          context.cairo->fill();
+        if(backup->getStatus() != COMPLETE)
+          continue;
+        auto device_row = device_key.device_row(backup);
+        int day = backup->date - earliest;
+        if(first[device_row] >= 0) {
+          if(day <= last[device_row] + 1) {
+            last[device_row] = std::max(last[device_row], day);
+            continue;
+          }
+          runs[device_row].push_back({y, first[device_row],
+                                      last[device_row]});
         }
+        first[device_row] = last[device_row] = day;
       }
+      for(size_t device_row = 0; device_row < ndevices; ++device_row)
+        if(first[device_row] >= 0)
+          runs[device_row].push_back({y, first[device_row],
+                                      last[device_row]});
       y += row_height + config.verticalPadding;
     }
   }
+  // Devices may share a color
+  std::map<unsigned, std::vector<unsigned>> colors;
+  for(unsigned device_row = 0; device_row < ndevices; ++device_row)
+    colors[device_key.device_color(device_row)].push_back(device_row);
+  for(auto &c: colors) {
+    set_source_color(device_key.device_color(c.second.front()));
+    for(unsigned device_row: c.second) {
+      double offset = base + device_row * indicator_height;
+      for(const Run &run: runs[device_row])
+        context.cairo->rectangle(run.first * config.backupIndicatorWidth,
+                                 run.y + offset,
+                                 (run.last - run.first + 1)
+                                   * config.backupIndicatorWidth,
+                                 indicator_height);
+    }
+    context.cairo->fill();
+  }
 }
 
 void HistoryGraphContent::render() {
@@ -235,8 +288,7 @@ void TimeLabels::set_extent() {
     int year = -1;
     double limit = 0;
     while(d <= content.latest) {
-      Date next = d;
-      next.d = 1;
+      Date next(d.year(), d.month(), 1);
       next.addMonth();
       double xnext = (next - content.earliest) * config.backupIndicatorWidth;
       auto t = new Render::Text(context, "",
@@ -254,7 +306,7 @@ void TimeLabels::set_extent() {
       static const unsigned nformats = sizeof formats / sizeof *formats;
       unsigned format;
       double x;
-      for(format = (d.y != year ? 0 : 3); format < nformats; ++format) {
+      for(format = (d.year() != year ? 0 : 3); format < nformats; ++format) {
         t->set_text(d.format(formats[format]));
         t->set_extent();
         // At the right hand edge, push back so it fits
@@ -267,7 +319,7 @@ void TimeLabels::set_extent() {
       if(format < nformats) {
         add(t, x, 0);
         limit = x + t->width;
-        year = d.y;
+        year = d.year();
       }
       d = next;
     }
@@ -385,3 +437,138 @@ void HistoryGraph::adjustConfig() {
     return;
   }
 }
+
+void renderHistoryGraphBands(unsigned width,
+                             unsigned height,
+                             unsigned band_height,
+                             unsigned threads,
+                             const HistoryGraphBandCallback &emit) {
+  const unsigned bands = (height + band_height - 1) / band_height;
+  threads = std::max(1U, std::min(threads, bands));
+  const unsigned window = 2 * threads;
+  std::vector<Cairo::RefPtr<Cairo::ImageSurface>> rendered(bands);
+  std::mutex lock;
+  std::condition_variable cond;
+  unsigned next = 0;                    // next band to render
+  unsigned emitted = 0;                 // bands passed to emit
+  bool stop = false;
+  std::exception_ptr failure;
+  auto worker = [&]() {
+    try {
+      Render::Context context;
+      context.cairo
+        = Cairo::Context::create(Cairo::ImageSurface::create(Cairo::FORMAT_ARGB32,
+                                                             1, 1));
+      HistoryGraph graph(context);
+      graph.addParts(config.graphLayout);
+      graph.set_extent();
+      for(;;) {
+        unsigned band;
+        {
+          // Don't get too far ahead of the consumer
+          std::unique_lock<std::mutex> guard(lock);
+          while(!stop && next < bands && next >= emitted + window)
+            cond.wait(guard);
+          if(stop || next >= bands)
+            break;
+          band = next++;
+        }
+        const unsigned top = band * band_height;
+        Cairo::RefPtr<Cairo::ImageSurface> surface
+          = Cairo::ImageSurface::create(Cairo::FORMAT_ARGB32, width,
+                                        std::min(band_height, height - top));
+        context.cairo = Cairo::Context::create(surface);
+        context.cairo->translate(0, -static_cast<double>(top));
+        graph.render();
+        surface->flush();
+        std::lock_guard<std::mutex> guard(lock);
+        rendered[band] = surface;
+        cond.notify_all();
+      }
+    } catch(...) {
+      std::lock_guard<std::mutex> guard(lock);
+      if(!failure)
+        failure = std::current_exception();
+      stop = true;
+      cond.notify_all();
+    }
+  };
+  std::vector<std::thread> pool;
+  for(unsigned n = 0; n < threads; ++n)
+    pool.push_back(std::thread(worker));
+  std::unique_lock<std::mutex> guard(lock);
+  while(!stop && emitted < bands) {
+    if(!rendered[emitted]) {
+      cond.wait(guard);
+      continue;
+    }
+    Cairo::RefPtr<Cairo::ImageSurface> surface = rendered[emitted];
+    rendered[emitted] = Cairo::RefPtr<Cairo::ImageSurface>();
+    guard.unlock();
+    try {
+      emit(surface, emitted * band_height);
+    } catch(...) {
+      guard.lock();
+      if(!failure)
+        failure = std::current_exception();
+      stop = true;
+      cond.notify_all();
+      break;
+    }
+    guard.lock();
+    ++emitted;
+    cond.notify_all();
+  }
+  guard.unlock();
+  for(auto &t: pool)
+    t.join();
+  if(failure)
+    std::rethrow_exception(failure);
+}
+
+Cairo::RefPtr<Cairo::ImageSurface> renderHistoryGraphImage(unsigned width,
+                                                           unsigned height,
+                                                           unsigned threads) {
+  // Several bands per thread keeps the threads busy even if some bands are
+  // much more expensive than others
+  const unsigned bands = 4 * std::max(1U, threads);
+  const unsigned band_height = std::max(1U, (height + bands - 1) / bands);
+  Cairo::RefPtr<Cairo::ImageSurface> surface
+    = Cairo::ImageSurface::create(Cairo::FORMAT_ARGB32, width, height);
+  Cairo::RefPtr<Cairo::Context> cairo = Cairo::Context::create(surface);
+  renderHistoryGraphBands(width, height, band_height, threads,
+                          [&](const Cairo::RefPtr<Cairo::ImageSurface> &band,
+                              unsigned top) {
+                            cairo->set_source(band, 0, top);
+                            cairo->paint();
+                          });
+  surface->flush();
+  return surface;
+}
+
+std::string renderHistoryGraphPng(unsigned threads) {
+  // See rsbackup-graph.cc
+  Pango::init();
+  Render::Context context;
+  context.cairo
+    = Cairo::Context::create(Cairo::ImageSurface::create(Cairo::FORMAT_ARGB32,
+                                                         1, 1));
+  // Use a throwaway graph to work out size
+  HistoryGraph graph0(context);
+  graph0.addParts(config.graphLayout);
+  graph0.set_extent();
+  graph0.adjustConfig();
+  // Lay out the real graph
+  HistoryGraph graph(context);
+  graph.addParts(config.graphLayout);
+  graph.set_extent();
+  Cairo::RefPtr<Cairo::ImageSurface> surface
+    = renderHistoryGraphImage(ceil(graph.width), ceil(graph.height), threads);
+  std::string png;
+  surface->write_to_png_stream([&png](const unsigned char *data,
+                                      unsigned int length) {
+    png.append(reinterpret_cast<const char *>(data), length);
+    return CAIRO_STATUS_SUCCESS;
+  });
+  return png;
+}
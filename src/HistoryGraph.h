@@ -21,6 +21,7 @@
 
 #include "Render.h"
 #include "Conf.h"
+#include <functional>
 
 /** @brief Host name labels */
 class HostLabels: public Render::Grid {
@@ -130,6 +131,18 @@ public:
   }
 
 private:
+  /** @brief A run of consecutive backups of one volume on one device */
+  struct Run {
+    /** @brief Y coordinate of volume row */
+    double y;
+
+    /** @brief First day of run, relative to @ref earliest */
+    int first;
+
+    /** @brief Last day of run, relative to @ref earliest */
+    int last;
+  };
+
   /** @brief Height of a single row
    *
    * Set by @ref set_extent.
@@ -202,4 +215,54 @@ public:
   void render() override;
 };
 
+/** @brief Callback for @ref renderHistoryGraphBands
+ *
+ * The arguments are the rendered band and the Y coordinate of its top edge.
+ */
+typedef std::function<void(const Cairo::RefPtr<Cairo::ImageSurface> &,
+                           unsigned)> HistoryGraphBandCallback;
+
+/** @brief Render the history graph in horizontal bands, in parallel
+ * @param width Width of graph in pixels
+ * @param height Height of graph in pixels
+ * @param band_height Height of each band in pixels
+ * @param threads Number of threads to render with
+ * @param emit Called with each band and the Y coordinate of its top edge
+ *
+ * Widgets and Cairo contexts cannot be shared between threads, so each
+ * thread lays out its own @ref HistoryGraph.  Text extents are cached (see
+ * Render::Text::set_extent) so the layouts all match the caller's.
+ *
+ * @p emit is called in the calling thread, in order from the top.  At most
+ * twice @p threads bands are held in memory at once.
+ */
+void renderHistoryGraphBands(unsigned width,
+                             unsigned height,
+                             unsigned band_height,
+                             unsigned threads,
+                             const HistoryGraphBandCallback &emit);
+
+/** @brief Render the history graph to an image, in parallel
+ * @param width Width of graph in pixels
+ * @param height Height of graph in pixels
+ * @param threads Number of threads to render with
+ * @return Rendered image
+ *
+ * The bands from @ref renderHistoryGraphBands are composited into a single
+ * image surface.
+ */
+Cairo::RefPtr<Cairo::ImageSurface> renderHistoryGraphImage(unsigned width,
+                                                           unsigned height,
+                                                           unsigned threads);
+
+/** @brief Render the history graph as a PNG
+ * @param threads Number of threads to render with
+ * @return PNG image data
+ *
+ * The graph is drawn from the state already loaded into @ref config, for all
+ * selected volumes, using the configured graph layout.  Note that the
+ * indicator size in @ref config is adjusted to meet the target graph width.
+ */
+std::string renderHistoryGraphPng(unsigned threads);
+
 #endif /* HISTORYGRAPH_H */
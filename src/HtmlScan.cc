@@ -0,0 +1,119 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "HtmlScan.h"
+#if __SSE2__
+# include <emmintrin.h>
+#endif
+#if HTML_SCAN_AVX2
+# include <immintrin.h>
+# include <cpuid.h>
+#endif
+
+// Test whether C can be copied verbatim
+static inline bool htmlPlain(unsigned char c) {
+  return c < 127 && c != '&' && c != '<' && c != '"' && c != '\'';
+}
+
+size_t htmlPlainPrefixScalar(const char *s, size_t n) {
+  size_t i = 0;
+  while(i < n && htmlPlain(s[i]))
+    ++i;
+  return i;
+}
+
+#if __SSE2__
+size_t htmlPlainPrefixSSE2(const char *s, size_t n) {
+  const __m128i amp = _mm_set1_epi8('&');
+  const __m128i lt = _mm_set1_epi8('<');
+  const __m128i quot = _mm_set1_epi8('"');
+  const __m128i apos = _mm_set1_epi8('\'');
+  const __m128i del = _mm_set1_epi8(127);
+  size_t i = 0;
+  for(; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+    __m128i special = _mm_or_si128(_mm_cmpeq_epi8(x, amp),
+                                   _mm_cmpeq_epi8(x, lt));
+    special = _mm_or_si128(special, _mm_cmpeq_epi8(x, quot));
+    special = _mm_or_si128(special, _mm_cmpeq_epi8(x, apos));
+    special = _mm_or_si128(special, _mm_cmpeq_epi8(x, del));
+    // The top bit of each byte of x marks non-ASCII bytes
+    int mask = _mm_movemask_epi8(_mm_or_si128(special, x));
+    if(mask)
+      return i + __builtin_ctz(mask);
+  }
+  return i + htmlPlainPrefixScalar(s + i, n - i);
+}
+#endif
+
+#if HTML_SCAN_AVX2
+__attribute__((target("avx2")))
+size_t htmlPlainPrefixAVX2(const char *s, size_t n) {
+  const __m256i amp = _mm256_set1_epi8('&');
+  const __m256i lt = _mm256_set1_epi8('<');
+  const __m256i quot = _mm256_set1_epi8('"');
+  const __m256i apos = _mm256_set1_epi8('\'');
+  const __m256i del = _mm256_set1_epi8(127);
+  size_t i = 0;
+  for(; i + 32 <= n; i += 32) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+    __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(x, amp),
+                                      _mm256_cmpeq_epi8(x, lt));
+    special = _mm256_or_si256(special, _mm256_cmpeq_epi8(x, quot));
+    special = _mm256_or_si256(special, _mm256_cmpeq_epi8(x, apos));
+    special = _mm256_or_si256(special, _mm256_cmpeq_epi8(x, del));
+    unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(special, x));
+    if(mask)
+      return i + __builtin_ctz(mask);
+  }
+  return i + htmlPlainPrefixScalar(s + i, n - i);
+}
+
+bool htmlScanAVX2Supported() {
+  unsigned eax, ebx, ecx, edx;
+  if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return false;
+  if(!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+    return false;
+  // The OS must preserve the YMM registers
+  unsigned xcr0, xcr0high;
+  __asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0high) : "c"(0));
+  if((xcr0 & 6) != 6)
+    return false;
+  if(__get_cpuid_max(0, nullptr) < 7)
+    return false;
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  return ebx & bit_AVX2;
+}
+#endif
+
+// Choose the best implementation
+static size_t (*chooseHtmlPlainPrefix())(const char *, size_t) {
+#if HTML_SCAN_AVX2
+  if(htmlScanAVX2Supported())
+    return htmlPlainPrefixAVX2;
+#endif
+#if __SSE2__
+  return htmlPlainPrefixSSE2;
+#else
+  return htmlPlainPrefixScalar;
+#endif
+}
+
+size_t htmlPlainPrefix(const char *s, size_t n) {
+  static size_t (*const implementation)(const char *, size_t)
+    = chooseHtmlPlainPrefix();
+  return implementation(s, n);
+}
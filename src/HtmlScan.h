@@ -0,0 +1,71 @@
+// -*-C++-*-
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef HTMLSCAN_H
+#define HTMLSCAN_H
+/** @file HtmlScan.h
+ * @brief Fast scanning for characters that need HTML quoting
+ *
+ * A byte is plain if it is ASCII, other than DEL, and not one of @c & @c <
+ * @c " @c '.  Plain bytes can be copied verbatim into HTML output.
+ */
+
+#include <cstddef>
+
+#if defined __x86_64__ && defined __GNUC__
+/** @brief Defined if @ref htmlPlainPrefixAVX2 is available */
+# define HTML_SCAN_AVX2 1
+#endif
+
+/** @brief Find the length of the plain prefix of a string
+ * @param s Start of string
+ * @param n Length of string
+ * @return Offset of the first byte that isn't plain, or @p n
+ *
+ * Uses the fastest implementation supported by the CPU.
+ */
+size_t htmlPlainPrefix(const char *s, size_t n);
+
+/** @brief Find the length of the plain prefix of a string, one byte at a time
+ * @param s Start of string
+ * @param n Length of string
+ * @return Offset of the first byte that isn't plain, or @p n
+ */
+size_t htmlPlainPrefixScalar(const char *s, size_t n);
+
+#if __SSE2__
+/** @brief Find the length of the plain prefix of a string, using SSE2
+ * @param s Start of string
+ * @param n Length of string
+ * @return Offset of the first byte that isn't plain, or @p n
+ */
+size_t htmlPlainPrefixSSE2(const char *s, size_t n);
+#endif
+
+#if HTML_SCAN_AVX2
+/** @brief Find the length of the plain prefix of a string, using AVX2
+ * @param s Start of string
+ * @param n Length of string
+ * @return Offset of the first byte that isn't plain, or @p n
+ *
+ * Only call this if @ref htmlScanAVX2Supported returns @c true.
+ */
+size_t htmlPlainPrefixAVX2(const char *s, size_t n);
+
+/** @brief Test whether the CPU supports AVX2 */
+bool htmlScanAVX2Supported();
+#endif
+
+#endif /* HTMLSCAN_H */
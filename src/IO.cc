@@ -18,6 +18,7 @@
 #include "Subprocess.h"
 #include <cerrno>
 #include <cstdlib>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -145,5 +146,14 @@ void IO::writeError() {
   throw IOError("writing " + path, errno);
 }
 
+int openBackupFile(int dirfd, const std::string &name) {
+  int fd = openat(dirfd, name.c_str(),
+                  O_RDONLY|O_NOFOLLOW|O_CLOEXEC|O_NOATIME);
+  // O_NOATIME is only permitted to the file's owner
+  if(fd < 0 && errno == EPERM)
+    fd = openat(dirfd, name.c_str(), O_RDONLY|O_NOFOLLOW|O_CLOEXEC);
+  return fd;
+}
+
 IO IO::out(stdout, "stdout");
 IO IO::err(stderr, "stderr", true);
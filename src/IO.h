@@ -26,6 +26,7 @@
 
 #include <sys/types.h>
 #include <dirent.h>
+#include <unistd.h>
 
 #include "Subprocess.h"
 
@@ -250,4 +251,41 @@ private:
   std::string path;
 };
 
+/** @brief RAII-friendly file descriptor
+ *
+ * Closes the file descriptor, if valid, on destruction.
+ */
+class FileDescriptor {
+public:
+  /** @brief Constructor
+   * @param fd_ File descriptor, or -1
+   */
+  FileDescriptor(int fd_): fd(fd_) {}
+
+  FileDescriptor(const FileDescriptor &) = delete;
+  FileDescriptor &operator=(const FileDescriptor &) = delete;
+
+  /** @brief Destructor
+   *
+   * Closes @ref fd if it is not negative.
+   */
+  ~FileDescriptor() {
+    if(fd >= 0)
+      ::close(fd);
+  }
+
+  /** @brief File descriptor */
+  const int fd;
+};
+
+/** @brief Open a file in a backup for reading
+ * @param dirfd Containing directory
+ * @param name Name within @p dirfd
+ * @return File descriptor, or -1 with @c errno set on error
+ *
+ * Symbolic links are not followed.  Access times are not updated, if the
+ * caller has permission to prevent it.
+ */
+int openBackupFile(int dirfd, const std::string &name);
+
 #endif /* IO_H */
@@ -26,13 +26,29 @@
 #include "Errors.h"
 #include "Utils.h"
 #include "Database.h"
+#include "Capacity.h"
+#include "DiskUsage.h"
+#include "Dedup.h"
+#include "Schedule.h"
+#include "Action.h"
+#include "BulkRemove.h"
+#include "Snapshot.h"
+#include "Catalog.h"
+#include "Transfer.h"
+#include "Shard.h"
+#include "EventLoop.h"
+#include "TreeCopy.h"
+#include "Tuning.h"
 #include <algorithm>
 #include <cerrno>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <fnmatch.h>
-#include <boost/range/adaptor/reversed.hpp>
 #include <boost/filesystem.hpp>
 
 /** @brief State for a single backup attempt */
@@ -80,12 +96,43 @@ public:
   /** @brief The outcome of the backup */
   Backup *outcome = nullptr;
 
+  /** @brief Store usage before the backup started */
+  StoreUsage usageBefore;
+
+  /** @brief Local backup to replicate, or empty to back up from the host */
+  std::string replicaOf;
+
+  /** @brief Device containing @ref replicaOf */
+  std::string replicaDevice;
+
+  /** @brief Replication subprocess, while it is running */
+  std::unique_ptr<Subprocess> replication;
+
+  /** @brief File receiving replication output */
+  FILE *replicationLog = nullptr;
+
+  /** @brief Catalog of the new backup, while it is being written */
+  std::unique_ptr<CatalogWriter> catalog;
+
+  /** @brief Transfer statistics reported by rsync or the native engine */
+  TransferStats transfer;
+
+  /** @brief rsync options chosen for transfer performance */
+  TransferTuning tuning;
+
+  /** @brief Set if @ref tuning was used */
+  bool tuned = false;
+
   /** @brief Constructor */
   MakeBackup(Volume *volume_, Device *device_);
 
+  /** @brief Destructor */
+  ~MakeBackup();
+
   /** @brief Find the most recent matching backup
    *
-   * Prefers complete backups if available.
+   * Prefers complete backups if available.  This is the first of the backups
+   * chosen by @ref Volume::linkCandidates.
    */
   const Backup *getLastBackup();
 
@@ -100,6 +147,98 @@ public:
    */
   void subprocessIO(Subprocess &sp, bool outputToo = true);
 
+  /** @brief Warn if the backup is not predicted to fit */
+  void checkCapacity();
+
+  /** @brief Record how much space the backup consumed */
+  void recordUsage();
+
+  /** @brief Record how long the backup took */
+  void recordDuration();
+
+  /** @brief Record the transfer statistics reported by rsync */
+  void recordTransfer();
+
+  /** @brief Choose rsync options for transfer performance
+   *
+   * Sets @ref tuning.
+   */
+  void chooseTuning();
+
+  /** @brief Measure the exclusive and shared space used by the backup */
+  void account();
+
+  /** @brief Create the volume directory, .incomplete file and backup
+   * directory
+   * @param options If not null, try to create the backup directory as a
+   * snapshot, and set this to the rsync options to use on success
+   */
+  void createDirectories(std::vector<std::string> *options);
+
+  /** @brief Find earlier backups to hard link unchanged files from
+   * @return Paths to earlier backups, most preferred first
+   *
+   * @ref transfer is updated with the number found.
+   */
+  std::vector<std::string> linkDestinations();
+
+  /** @brief Create the backup directory and its .incomplete file
+   * @param cmd rsync command, updated with options to use the last backup
+   *
+   * If the store supports it, the backup directory is created as a snapshot
+   * of the last backup, for rsync to update in place.  Otherwise it is
+   * created empty, for rsync to fill with hard links to earlier backups.
+   */
+  void createBackupDirectory(std::vector<std::string> &cmd);
+
+  /** @brief Try to create the backup directory as a snapshot
+   * @param lastBackup Backup to snapshot
+   * @param options Set to rsync options to use on success
+   * @return @c true on success
+   */
+  bool snapshotBackup(const Backup *lastBackup,
+                      std::vector<std::string> &options);
+
+  /** @brief Remove the .incomplete file */
+  void removeIncomplete();
+
+  /** @brief Start cataloging the new backup
+   *
+   * On error, @ref catalog is left unset and the backup proceeds without it.
+   */
+  void startCatalog();
+
+  /** @brief Process a line of rsync output
+   * @param line Line of output
+   *
+   * Catalog items are added to @ref catalog, if it is set, and anything else
+   * is logged.
+   */
+  void catalogLine(const std::string &line);
+
+  /** @brief Process a line of rsync output
+   * @param stats Statistics for the rsync that produced @p line
+   * @param line Line of output
+   *
+   * Statistics are added to @p stats.  If cataloging, anything else is
+   * passed to @ref catalogLine, otherwise it is logged if @c --verbose was
+   * given.
+   */
+  void rsyncLine(TransferStats &stats, const std::string &line);
+
+  /** @brief List the top level of the volume
+   * @return Names of the items at the top level of the volume
+   */
+  std::vector<std::string> listSource();
+
+  /** @brief Finish cataloging the new backup */
+  void finishCatalog();
+
+  /** @brief Give up on cataloging the new backup
+   * @param e Reason
+   */
+  void abandonCatalog(const std::runtime_error &e);
+
   /** @brief Run the pre-backup hook if there is one
    * @return Wait status
    */
@@ -110,11 +249,49 @@ public:
    */
   int rsyncBackup();
 
+  /** @brief Test whether to use the native copy engine
+   * @return @c true if the backup should be made by @ref nativeBackup
+   */
+  bool nativeCopy() const;
+
+  /** @brief Copy the volume without rsync to make the backup
+   * @return Wait status
+   */
+  int nativeBackup();
+
   /** @brief Run the post-backup hook if there is one */
   void postBackup();
 
-  /** @brief Perform a backup */
-  void performBackup();
+  /** @brief Create @ref outcome and record that the backup is underway
+   * @param rc Wait status
+   */
+  void createOutcome(int rc);
+
+  /** @brief Record the final state of @ref outcome
+   * @param rc Wait status
+   */
+  void completeOutcome(int rc);
+
+  /** @brief Perform a backup
+   * @return @c true if the backup succeeded
+   */
+  bool performBackup();
+
+  /** @brief Start copying @ref replicaOf to the device
+   *
+   * If @ref replication is set on return then the copy is running in the
+   * background and must be finished with @ref finishReplication.
+   */
+  void startReplication();
+
+  /** @brief Wait for a replication to finish and record the outcome */
+  void finishReplication();
+
+  /** @brief Catalog a replicated backup
+   *
+   * The catalog entries are copied from the backup that was replicated.
+   */
+  void catalogReplica();
 };
 
 MakeBackup::MakeBackup(Volume *volume_, Device *device_):
@@ -133,22 +310,15 @@ MakeBackup::MakeBackup(Volume *volume_, Device *device_):
   sourcePath(volume->path) {
 }
 
+MakeBackup::~MakeBackup() {
+  if(replicationLog)
+    fclose(replicationLog);
+}
+
 // Find a backup to link to.
 const Backup *MakeBackup::getLastBackup() {
-  // Link against the most recent complete backup if possible.
-  for(const Backup *backup: boost::adaptors::reverse(volume->backups)) {
-    if(backup->rc == 0
-       && device->name == backup->deviceName)
-      return backup;
-  }
-  // If there are no complete backups link against the most recent incomplete
-  // one.
-  for(const Backup *backup: boost::adaptors::reverse(volume->backups)) {
-    if(device->name == backup->deviceName)
-      return backup;
-  }
-  // Otherwise there is nothing to link to.
-  return nullptr;
+  std::vector<const Backup *> candidates = volume->linkCandidates(device, 1);
+  return candidates.size() ? candidates[0] : nullptr;
 }
 
 void MakeBackup::hookEnvironment(Subprocess &sp) {
@@ -168,6 +338,333 @@ void MakeBackup::subprocessIO(Subprocess &sp, bool outputToo) {
   sp.capture(2, &log, outputToo ? 1 : -1);
 }
 
+void MakeBackup::checkCapacity() {
+  try {
+    usageBefore.measure(device->store->path);
+  } catch(IOError &e) {
+    warning(WARNING_STORE, "%s", e.what());
+    usageBefore = StoreUsage();
+    return;
+  }
+  int64_t bytes, files;
+  if(!predictBackupUsage(config.getdb(), host->name, volume->name,
+                         device->name, bytes, files))
+    return;
+  if(bytes > usageBefore.freeBytes)
+    warning(WARNING_ALWAYS,
+            "backup of %s:%s to %s predicted to need %jd bytes but only %jd available",
+            host->name.c_str(),
+            volume->name.c_str(),
+            device->name.c_str(),
+            (intmax_t)bytes, (intmax_t)usageBefore.freeBytes);
+  if(usageBefore.totalFiles && files > usageBefore.freeFiles)
+    warning(WARNING_ALWAYS,
+            "backup of %s:%s to %s predicted to need %jd inodes but only %jd available",
+            host->name.c_str(),
+            volume->name.c_str(),
+            device->name.c_str(),
+            (intmax_t)files, (intmax_t)usageBefore.freeFiles);
+}
+
+void MakeBackup::recordUsage() {
+  if(!usageBefore.when)
+    return;
+  StoreUsage usageAfter;
+  try {
+    usageAfter.measure(device->store->path);
+  } catch(IOError &e) {
+    warning(WARNING_STORE, "%s", e.what());
+    return;
+  }
+  // This is only a forecasting aid, so a busy database is not worth waiting
+  // for.
+  try {
+    config.getdb().begin();
+    recordBackupUsage(config.getdb(), outcome, usageBefore, usageAfter);
+    usageAfter.record(config.getdb(), device->name);
+    config.getdb().commit();
+  } catch(DatabaseBusy &) {
+    config.getdb().rollback();
+    warning(WARNING_DATABASE,
+            "backup of %s:%s to %s: cannot record space usage",
+            host->name.c_str(),
+            volume->name.c_str(),
+            device->name.c_str());
+  }
+}
+
+void MakeBackup::recordDuration() {
+  // Like space usage, this is only a forecasting aid
+  try {
+    config.getdb().begin();
+    recordBackupDuration(config.getdb(), outcome, Date::now() - startTime);
+    config.getdb().commit();
+  } catch(DatabaseBusy &) {
+    config.getdb().rollback();
+    warning(WARNING_DATABASE,
+            "backup of %s:%s to %s: cannot record duration",
+            host->name.c_str(),
+            volume->name.c_str(),
+            device->name.c_str());
+  }
+}
+
+void MakeBackup::recordTransfer() {
+  if(!transfer.valid)
+    return;
+  if(warning_mask & WARNING_VERBOSE)
+    IO::out.writef("INFO: %s:%s to %s: %jd/%jd files transferred,"
+                   " %jd bytes literal, %jd bytes matched,"
+                   " %d link-dest directories\n",
+                   host->name.c_str(), volume->name.c_str(),
+                   device->name.c_str(),
+                   (intmax_t)transfer.filesTransferred,
+                   (intmax_t)transfer.files,
+                   (intmax_t)transfer.literalBytes,
+                   (intmax_t)transfer.matchedBytes,
+                   transfer.linkDests);
+  // Like duration, these are only for information and tuning
+  try {
+    config.getdb().begin();
+    transfer.record(config.getdb(), outcome);
+    if(tuned)
+      tuning.record(config.getdb(), outcome);
+    config.getdb().commit();
+  } catch(DatabaseBusy &) {
+    config.getdb().rollback();
+    warning(WARNING_DATABASE,
+            "backup of %s:%s to %s: cannot record transfer statistics",
+            host->name.c_str(),
+            volume->name.c_str(),
+            device->name.c_str());
+  }
+}
+
+void MakeBackup::chooseTuning() {
+  std::vector<TransferRun> history;
+  bool automatic = (volume->rsyncCompress == TRISTATE_AUTO
+                    || volume->rsyncWholeFile == TRISTATE_AUTO
+                    || volume->rsyncFuzzy == TRISTATE_AUTO);
+  if(automatic) {
+    try {
+      history = transferHistory(config.getdb(), host->name, volume->name);
+    } catch(DatabaseError &e) {
+      // Without history, the default choices are made
+      warning(WARNING_DATABASE,
+              "backup of %s:%s to %s: cannot read transfer history: %s",
+              host->name.c_str(),
+              volume->name.c_str(),
+              device->name.c_str(),
+              e.what());
+    }
+  }
+  tuning = chooseTransferTuning(*volume, history);
+  // Algorithms the local rsync doesn't know would make it fail
+  if(tuning.compress && tuning.compressChoice.size()
+     && !RsyncCapabilities::local().supportsCompression(tuning.compressChoice)) {
+    warning(WARNING_ALWAYS, "rsync does not support compression algorithm '%s'",
+            tuning.compressChoice.c_str());
+    tuning.compressChoice.clear();
+  }
+  if(tuning.checksumChoice.size()
+     && !RsyncCapabilities::local().supportsChecksum(tuning.checksumChoice)) {
+    warning(WARNING_ALWAYS, "rsync does not support checksum algorithm '%s'",
+            tuning.checksumChoice.c_str());
+    tuning.checksumChoice.clear();
+  }
+  tuned = true;
+  if(automatic && (warning_mask & WARNING_VERBOSE)) {
+    std::string options;
+    for(auto &option: tuning.rsyncOptions())
+      options += " " + option;
+    IO::out.writef("INFO: %s:%s to %s: tuned from %zu earlier backups:%s\n",
+                   host->name.c_str(), volume->name.c_str(),
+                   device->name.c_str(), history.size(),
+                   options.size() ? options.c_str() : " (none)");
+  }
+}
+
+void MakeBackup::account() {
+  try {
+    accountBackup(outcome);
+  } catch(IOError &e) {
+    // Accounting will be resumed next time
+    warning(WARNING_STORE, "%s", e.what());
+  }
+}
+
+void MakeBackup::createDirectories(std::vector<std::string> *options) {
+  // Create volume directory
+  what = "creating volume directory";
+  boost::filesystem::create_directories(volumePath);
+  // Create the .incomplete flag file
+  what = "creating .incomplete file";
+  IO ifile;
+  ifile.open(incompletePath, "w");
+  ifile.close();
+  // Create backup directory
+  if(!options || !snapshotBackup(getLastBackup(), *options)) {
+    what = "creating backup directory";
+    boost::filesystem::create_directories(backupPath);
+  }
+}
+
+std::vector<std::string> MakeBackup::linkDestinations() {
+  std::vector<std::string> paths;
+  // The first directory with a matching file is used, so the best candidates
+  // come first
+  for(const Backup *backup: volume->linkCandidates(device,
+                                                   volume->maxLinkDest)) {
+    const std::string path = backup->backupPath();
+    if(path == backupPath || !boost::filesystem::is_directory(path))
+      continue;
+    paths.push_back(path);
+    ++transfer.linkDests;
+  }
+  return paths;
+}
+
+void MakeBackup::createBackupDirectory(std::vector<std::string> &cmd) {
+  std::vector<std::string> options;
+  if(command.act) {
+    createDirectories(&options);
+    what = "constructing command";
+  }
+  if(options.empty()) {
+    for(auto &path: linkDestinations())
+      options.push_back("--link-dest=" + path);
+  }
+  if(std::find(options.begin(), options.end(), "--inplace") != options.end()) {
+    // Older rsync refuses to combine --sparse and --inplace
+    cmd.erase(std::remove(cmd.begin(), cmd.end(), "--sparse"), cmd.end());
+  }
+  cmd.insert(cmd.end(), options.begin(), options.end());
+}
+
+bool MakeBackup::snapshotBackup(const Backup *lastBackup,
+                                std::vector<std::string> &options) {
+  if(!device->store->snapshot || lastBackup == nullptr)
+    return false;
+  // If a previous attempt left something behind, just update it
+  if(boost::filesystem::exists(backupPath))
+    return false;
+  const std::string lastPath = lastBackup->backupPath();
+  SnapshotMethod method = device->store->snapshotMethod();
+  std::vector<std::string> cmd;
+  switch(method) {
+  case SnapshotNone:
+    return false;
+  case SnapshotBtrfs:
+    if(!isSubvolume(lastPath)) {
+      // Start a new series of snapshots.  Hard links can't cross subvolumes,
+      // so rsync copies unchanged files from the last backup instead.
+      cmd = createSubvolumeCommand(backupPath);
+      options = { "--copy-dest=" + lastPath };
+      break;
+    }
+    // fall through
+  case SnapshotReflink:
+    cmd = snapshotCommand(method, lastPath, backupPath);
+    options = { "--inplace", "--no-whole-file" };
+    break;
+  }
+  what = "creating snapshot";
+  Subprocess sp("snapshot/"
+                + volume->parent->name + "/"
+                + volume->name + "/"
+                + device->name,
+                cmd);
+  sp.reporting(warning_mask & WARNING_VERBOSE, false);
+  subprocessIO(sp, true);
+  int rc = sp.runAndWait(0);
+  if(!rc)
+    return true;
+  warning(WARNING_STORE, "cannot snapshot %s, falling back to --link-dest: %s",
+          lastPath.c_str(), SubprocessFailed::format(cmd[0], rc).c_str());
+  options.clear();
+  // Remove anything left behind
+  if(boost::filesystem::exists(backupPath)) {
+    what = "removing failed snapshot";
+    BulkRemove remover("remove/"
+                       + volume->parent->name + "/"
+                       + volume->name + "/"
+                       + device->name,
+                       backupPath);
+    remover.runAndWait();
+  }
+  return false;
+}
+
+void MakeBackup::removeIncomplete() {
+  if(unlink(incompletePath.c_str()) < 0)
+    throw IOError("removing " + incompletePath, errno);
+}
+
+void MakeBackup::startCatalog() {
+  const Backup *lastBackup = getLastBackup();
+  catalog.reset(new CatalogWriter(config.getdb(),
+                                  host->name, volume->name, device->name, id,
+                                  lastBackup ? lastBackup->id : ""));
+  try {
+    catalog->start();
+  } catch(std::runtime_error &e) {
+    abandonCatalog(e);
+  }
+}
+
+void MakeBackup::catalogLine(const std::string &line) {
+  CatalogEntry entry;
+  if(parseCatalogLine(line, entry)) {
+    // If the catalog has been abandoned, items are just discarded
+    if(catalog) {
+      try {
+        catalog->add(entry);
+      } catch(std::runtime_error &e) {
+        abandonCatalog(e);
+      }
+    }
+    return;
+  }
+  log += line;
+  log += '\n';
+}
+
+void MakeBackup::rsyncLine(TransferStats &stats, const std::string &line) {
+  if(stats.parse(line))
+    return;
+  if(config.catalog)
+    catalogLine(line);
+  else if(warning_mask & WARNING_VERBOSE) {
+    // Without --verbose, rsync used to be run with --quiet, which --stats
+    // rules out; so drop the informational output that it suppressed.
+    // Errors arrive on stderr and are still logged.
+    log += line;
+    log += '\n';
+  }
+}
+
+void MakeBackup::finishCatalog() {
+  if(!catalog)
+    return;
+  try {
+    catalog->finish();
+    D("cataloged %zu items", catalog->items);
+  } catch(std::runtime_error &e) {
+    abandonCatalog(e);
+  }
+  catalog.reset();
+}
+
+void MakeBackup::abandonCatalog(const std::runtime_error &e) {
+  warning(WARNING_DATABASE,
+          "backup of %s:%s to %s: cannot catalog: %s",
+          host->name.c_str(),
+          volume->name.c_str(),
+          device->name.c_str(),
+          e.what());
+  catalog.reset();
+}
+
 int MakeBackup::preBackup() {
   if(volume->preBackup.size()) {
     std::string output;
@@ -192,23 +689,29 @@ int MakeBackup::preBackup() {
   return 0;
 }
 
+std::vector<std::string> MakeBackup::listSource() {
+  std::vector<std::string> names;
+  Subprocess sp("list/"
+                + volume->parent->name + "/"
+                + volume->name + "/"
+                + device->name,
+                { "rsync", "--list-only", "--dirs",
+                  host->sshPrefix() + sourcePath + "/." });
+  sp.reporting(warning_mask & WARNING_VERBOSE, false);
+  sp.capture(2, &log);
+  sp.captureLines(1, [&names](const std::string &line) {
+    std::string name;
+    if(parseListingLine(line, name))
+      names.push_back(name);
+  });
+  sp.setTimeout(volume->rsyncTimeout);
+  sp.runAndWait();
+  return names;
+}
+
 int MakeBackup::rsyncBackup() {
   int rc;
   try {
-    // Create volume directory
-    if(command.act) {
-      what = "creating volume directory";
-      boost::filesystem::create_directories(volumePath);
-      // Create the .incomplete flag file
-      what = "creating .incomplete file";
-      IO ifile;
-      ifile.open(incompletePath, "w");
-      ifile.close();
-      // Create backup directory
-      what = "creating backup directory";
-      boost::filesystem::create_directories(backupPath);
-      what = "constructing command";
-    }
     // Synthesize command
     std::vector<std::string> cmd = {
       "rsync",
@@ -223,48 +726,102 @@ int MakeBackup::rsyncBackup() {
       // --specials                          preserve special files
       "--sparse",                       // handle spare files efficiently
       "--numeric-ids",                  // don't remap UID/GID by name
-      "--compress",                     // compress during file transfer
-      "--fuzzy",                        // look for similar files
       "--hard-links",                   // preserve hard links
       "--delete",                       // delete extra files in destination
+      "--stats",                        // report transfer statistics
     };
-    if(!(warning_mask & WARNING_VERBOSE))
-      cmd.push_back("--quiet");         // suppress non-errors
+    if(config.catalog) {
+      // List every item for the catalog
+      for(auto &option: catalogRsyncOptions())
+        cmd.push_back(option);
+    }
     if(!volume->traverse)
       cmd.push_back("--one-file-system"); // don't cross mount points
+    // Compression, delta-transfer and so on.  Snapshots add --no-whole-file
+    // later, which overrides --whole-file.
+    chooseTuning();
+    for(auto &option: tuning.rsyncOptions())
+      cmd.push_back(option);
     // Exclusions
     for(auto &exclusion: volume->exclude)
       cmd.push_back("--exclude=" + exclusion);
-    const Backup *lastBackup = getLastBackup();
-    if(lastBackup != nullptr)
-      cmd.push_back("--link-dest=" + lastBackup->backupPath());
-    // Source
-    cmd.push_back(host->sshPrefix() + sourcePath + "/.");
-    // Destination
-    cmd.push_back(backupPath + "/.");
-    // Set up subprocess
-    Subprocess sp("backup/"
-                  + volume->parent->name + "/"
-                  + volume->name + "/"
-                  + device->name,
-                  cmd);
-    sp.reporting(warning_mask & WARNING_VERBOSE, !command.act);
+    // Split the volume between several rsyncs if required
+    std::vector<std::vector<std::string>> filters = { {} };
+    if(volume->sharded()) {
+      what = "listing volume";
+      filters = shardFilters(volume->shardGroups, volume->shards,
+                             volume->shards > 1 ? listSource()
+                                                : std::vector<std::string>());
+    }
+    // Create the backup directory and use the last backup
+    createBackupDirectory(cmd);
+    // Set up subprocesses
+    const std::string name = "backup/"
+      + volume->parent->name + "/"
+      + volume->name + "/"
+      + device->name;
+    std::vector<std::unique_ptr<Subprocess>> shards;
+    std::vector<TransferStats> stats(filters.size());
+    std::vector<std::string> shardErrors(filters.size());
+    for(size_t n = 0; n < filters.size(); ++n) {
+      std::vector<std::string> shardCommand = cmd;
+      shardCommand.insert(shardCommand.end(),
+                          filters[n].begin(), filters[n].end());
+      // Source
+      shardCommand.push_back(host->sshPrefix() + sourcePath + "/.");
+      // Destination
+      shardCommand.push_back(backupPath + "/.");
+      shards.emplace_back(new Subprocess(filters.size() > 1
+                                         ? name + "/" + std::to_string(n)
+                                         : name,
+                                         shardCommand));
+      Subprocess &sp = *shards.back();
+      sp.reporting(warning_mask & WARNING_VERBOSE, !command.act);
+      // With several shards, each one's errors are kept together
+      sp.capture(2, filters.size() > 1 ? &shardErrors[n] : &log);
+      // Process rsync's statistics and any itemized output as they arrive
+      TransferStats *shardStats = &stats[n];
+      sp.captureLines(1, [this, shardStats](const std::string &line) {
+        rsyncLine(*shardStats, line);
+      });
+      sp.setTimeout(volume->rsyncTimeout);
+    }
     if(!command.act)
       return 0;
-    subprocessIO(sp, true);
-    sp.setTimeout(volume->rsyncTimeout);
+    if(config.catalog)
+      startCatalog();
     // Make the backup
-    rc = sp.runAndWait(0);
+    if(shards.size() > 1) {
+      EventLoop e;
+      ActionList al(&e);
+      for(auto &sp: shards)
+        al.add(sp.get());
+      al.go();
+    } else
+      shards[0]->runAndWait(0);
+    // Even a failed backup can be used later, so its catalog is kept
+    finishCatalog();
     what = "rsync";
-    // Suppress exit status 24 "Partial transfer due to vanished source files"
-    if(WIFEXITED(rc) && WEXITSTATUS(rc) == 24) {
-      warning(WARNING_PARTIAL, "partial transfer backing up %s:%s to %s",
-              host->name.c_str(),
-              volume->name.c_str(),
-              device->name.c_str());
-      rc = 0;
+    // The backup is only complete if every shard succeeded
+    rc = 0;
+    for(size_t n = 0; n < shards.size(); ++n) {
+      int shardStatus = shards[n]->getStatus();
+      log += shardErrors[n];
+      transfer.add(stats[n]);
+      // Suppress exit status 24 "Partial transfer due to vanished source
+      // files"
+      if(WIFEXITED(shardStatus) && WEXITSTATUS(shardStatus) == 24) {
+        warning(WARNING_PARTIAL, "partial transfer backing up %s:%s to %s",
+                host->name.c_str(),
+                volume->name.c_str(),
+                device->name.c_str());
+        shardStatus = 0;
+      }
+      if(!rc)
+        rc = shardStatus;
     }
   } catch(std::runtime_error &e) {
+    catalog.reset();
     // Try to handle any other errors the same way as rsync failures.  If we
     // can't even write to the logfile we error out.
     log += "ERROR: ";
@@ -275,10 +832,87 @@ int MakeBackup::rsyncBackup() {
     rc = 255;
   }
   // If the backup completed, remove the 'incomplete' flag file
-  if(!rc) {
-    if(unlink(incompletePath.c_str()) < 0)
-      throw IOError("removing " + incompletePath, errno);
+  if(!rc)
+    removeIncomplete();
+  return rc;
+}
+
+bool MakeBackup::nativeCopy() const {
+  // The native engine can only read local files
+  return volume->copyEngine == "native" && host->sshPrefix().empty();
+}
+
+int MakeBackup::nativeBackup() {
+  int rc;
+  try {
+    if(!command.act) {
+      warning(WARNING_VERBOSE, "WOULD COPY %s TO %s",
+              sourcePath.c_str(), backupPath.c_str());
+      return 0;
+    }
+    // Snapshots are not used; unchanged files are linked instead
+    createDirectories(nullptr);
+    what = "copying";
+    TreeCopy copy(sourcePath, backupPath);
+    copy.linkDests = linkDestinations();
+    copy.exclude = volume->exclude;
+    copy.oneFileSystem = !volume->traverse;
+    // A previous attempt today may have left a partial backup to update
+    copy.mirror = true;
+    copy.skipVanished = true;
+    // Catalog items as they are copied, one thread at a time
+    std::mutex catalogLock;
+    if(config.catalog) {
+      startCatalog();
+      copy.onItem = [this, &catalogLock](const std::string &path,
+                                         const struct stat &sb,
+                                         bool transferred) {
+        std::lock_guard<std::mutex> guard(catalogLock);
+        if(!catalog)
+          return;
+        CatalogEntry entry;
+        entry.flags = catalogFlags(sb, transferred);
+        entry.size = sb.st_size;
+        entry.mtime = sb.st_mtime;
+        entry.path = path;
+        try {
+          catalog->add(entry);
+        } catch(std::runtime_error &e) {
+          abandonCatalog(e);
+        }
+      };
+    }
+    try {
+      copy.run(MAX_BACKUP_THREADS);
+    } catch(...) {
+      // Even a failed backup can be used later, so its catalog is kept
+      finishCatalog();
+      throw;
+    }
+    finishCatalog();
+    // Report the same statistics that rsync would
+    transfer.valid = true;
+    transfer.files = copy.files + copy.directories + copy.linked + copy.links;
+    transfer.filesTransferred = copy.files;
+    transfer.totalSize = copy.totalBytes;
+    transfer.transferredSize = copy.bytes;
+    transfer.literalBytes = copy.bytes;
+    if(copy.vanished)
+      warning(WARNING_PARTIAL, "partial transfer backing up %s:%s to %s",
+              host->name.c_str(),
+              volume->name.c_str(),
+              device->name.c_str());
+    rc = 0;
+  } catch(std::runtime_error &e) {
+    catalog.reset();
+    log += "ERROR: ";
+    log += e.what();
+    log += "\n";
+    rc = 255;
   }
+  // If the backup completed, remove the 'incomplete' flag file
+  if(!rc)
+    removeIncomplete();
   return rc;
 }
 
@@ -298,13 +932,22 @@ void MakeBackup::postBackup() {
   }
 }
 
-void MakeBackup::performBackup() {
+bool MakeBackup::performBackup() {
+  // Check there is likely to be enough space
+  checkCapacity();
   // Run the pre-backup hook
   what = "preBackup";
   int rc = preBackup();
   if(!rc)
-    rc = rsyncBackup();
-  // Put together the outcome
+    rc = nativeCopy() ? nativeBackup() : rsyncBackup();
+  createOutcome(rc);
+  // Run the post-backup hook
+  postBackup();
+  completeOutcome(rc);
+  return rc == 0;
+}
+
+void MakeBackup::createOutcome(int rc) {
   outcome = new Backup();
   outcome->rc = rc;
   outcome->time = startTime;
@@ -320,12 +963,15 @@ void MakeBackup::performBackup() {
     outcome->insert(config.getdb(), true/*replace*/);
     config.getdb().commit();
   }
-  // Run the post-backup hook
-  postBackup();
+}
+
+void MakeBackup::completeOutcome(int rc) {
   if(!command.act) {
     delete outcome;
+    outcome = nullptr;
     return;
   }
+  outcome->rc = rc;
   // Get the logfile
   // TODO we could perhaps share with Conf::readState() here
   outcome->contents = log;
@@ -374,6 +1020,147 @@ void MakeBackup::performBackup() {
       continue;
     }
   }
+  recordTransfer();
+  if(!rc) {
+    recordUsage();
+    account();
+    recordDuration();
+    if(config.dedup)
+      queueDedup(outcome);
+  }
+}
+
+void MakeBackup::startReplication() {
+  checkCapacity();
+  int rc = 0;
+  try {
+    // The source has already been filtered, and is local, so exclusions,
+    // compression and so on are not needed.
+    std::vector<std::string> cmd = {
+      "rsync",
+      "--archive",
+      "--sparse",
+      "--numeric-ids",
+      "--hard-links",
+      "--delete",
+    };
+    if(!(warning_mask & WARNING_VERBOSE))
+      cmd.push_back("--quiet");
+    // Build on this device's own previous backup
+    createBackupDirectory(cmd);
+    if(config.catalog && command.act)
+      startCatalog();
+    cmd.push_back(replicaOf + "/.");
+    cmd.push_back(backupPath + "/.");
+    replication.reset(new Subprocess("replicate/"
+                                     + volume->parent->name + "/"
+                                     + volume->name + "/"
+                                     + device->name,
+                                     cmd));
+    replication->reporting(warning_mask & WARNING_VERBOSE, !command.act);
+    if(command.act) {
+      // Output can't be captured from a background subprocess, so it goes to
+      // a temporary file.
+      what = "creating replication log";
+      if(!(replicationLog = tmpfile()))
+        throw IOError("creating temporary file", errno);
+      int fd = fileno(replicationLog);
+      if(fcntl(fd, F_SETFD, FD_CLOEXEC) < 0)
+        throw IOError("setting FD_CLOEXEC", errno);
+      int childfd = dup(fd);
+      if(childfd < 0)
+        throw IOError("duplicating file descriptor", errno);
+      replication->addChildFD(2, childfd, -1, 1);
+      what = "rsync";
+      replication->runBackground();
+    }
+  } catch(std::runtime_error &e) {
+    log += "ERROR: ";
+    log += e.what();
+    log += "\n";
+    rc = 255;
+  }
+  createOutcome(rc);
+  if(rc || !command.act) {
+    replication.reset();
+    catalog.reset();
+    completeOutcome(rc);
+  }
+}
+
+void MakeBackup::finishReplication() {
+  int rc;
+  try {
+    rc = replication->waitBackground(0);
+    if(fseek(replicationLog, 0, SEEK_SET) < 0)
+      throw IOError("rewinding replication log", errno);
+    char buffer[4096];
+    size_t n;
+    while((n = fread(buffer, 1, sizeof buffer, replicationLog)) > 0)
+      log.append(buffer, n);
+    if(ferror(replicationLog))
+      throw IOError("reading replication log", errno);
+    if(!rc)
+      removeIncomplete();
+  } catch(std::runtime_error &e) {
+    log += "ERROR: ";
+    log += e.what();
+    log += "\n";
+    rc = 255;
+  }
+  replication.reset();
+  // Only a complete replica is known to match its source
+  if(!rc)
+    catalogReplica();
+  catalog.reset();
+  completeOutcome(rc);
+}
+
+void MakeBackup::catalogReplica() {
+  if(!catalog)
+    return;
+  try {
+    Database::Statement stmt(config.getdb(),
+                             "SELECT path,size,mtime,flags FROM catalog"
+                             " WHERE host=? AND volume=? AND device=?"
+                             " AND first_id<=? AND last_id>=?",
+                             SQL_STRING, &host->name,
+                             SQL_STRING, &volume->name,
+                             SQL_STRING, &replicaDevice,
+                             SQL_STRING, &id,
+                             SQL_STRING, &id,
+                             SQL_END);
+    while(stmt.next()) {
+      CatalogEntry entry;
+      entry.path = stmt.get_string(0);
+      entry.size = stmt.get_int64(1);
+      entry.mtime = stmt.get_int64(2);
+      entry.flags = stmt.get_string(3);
+      catalog->add(entry);
+    }
+  } catch(std::runtime_error &e) {
+    abandonCatalog(e);
+  }
+  finishCatalog();
+}
+
+/** @brief Backups made from hosts during this run
+ *
+ * Only used with @c replicate-locally.  Keys are volumes, values are the
+ * backups' paths and devices.
+ */
+static std::map<Volume *, std::pair<std::string, std::string>>
+  replicationSources;
+
+/** @brief Replication running in the background, if any */
+static std::unique_ptr<MakeBackup> replicating;
+
+// Wait for any background replication to finish
+static void finishReplication() {
+  if(replicating) {
+    replicating->finishReplication();
+    replicating.reset();
+  }
 }
 
 // Backup VOLUME onto DEVICE.
@@ -381,16 +1168,157 @@ void MakeBackup::performBackup() {
 // device->store is assumed to be set.
 static void backupVolume(Volume *volume, Device *device) {
   Host *host = volume->parent;
+  // Make space if necessary.  Any replication must finish first, since it may
+  // be linking against backups that would be pruned.
+  if(device->hasSpaceLimits()) {
+    finishReplication();
+    pruneForSpace({device});
+  }
+  std::unique_ptr<MakeBackup> mb(new MakeBackup(volume, device));
+  auto it = replicationSources.find(volume);
+  if(it != replicationSources.end()) {
+    if(warning_mask & WARNING_VERBOSE)
+      IO::out.writef("INFO: replicate %s:%s to %s\n",
+                     host->name.c_str(), volume->name.c_str(),
+                     device->name.c_str());
+    // Only one replication at a time, so local disks aren't overloaded
+    finishReplication();
+    mb->replicaOf = it->second.first;
+    mb->replicaDevice = it->second.second;
+    mb->startReplication();
+    if(mb->replication)
+      replicating = std::move(mb);
+    return;
+  }
   if(warning_mask & WARNING_VERBOSE)
     IO::out.writef("INFO: backup %s:%s to %s\n",
                    host->name.c_str(), volume->name.c_str(),
                    device->name.c_str());
-  MakeBackup mb(volume, device);
-  mb.performBackup();
+  if(mb->performBackup() && config.replicateLocally)
+    replicationSources[volume] = { mb->backupPath, device->name };
+}
+
+/** @brief Backups to make within a backup window */
+class BackupWindow {
+public:
+  /** @brief Constructor
+   * @param seconds Length of window
+   *
+   * The window starts now.
+   */
+  BackupWindow(int64_t seconds): seconds(seconds) {
+    getMonotonicTime(started);
+  }
+
+  /** @brief Add a backup to make
+   * @param volume Volume to back up
+   * @param device Target device
+   */
+  void add(Volume *volume, Device *device);
+
+  /** @brief Make as many backups as will fit */
+  void run();
+
+  /** @brief Return the number of seconds left in the window */
+  int64_t remaining() const {
+    struct timespec now;
+    getMonotonicTime(now);
+    return seconds - (now - started).tv_sec;
+  }
+
+  /** @brief Number of backups deferred */
+  int deferred = 0;
+
+private:
+  /** @brief Length of window */
+  int64_t seconds;
+
+  /** @brief Start of window */
+  struct timespec started;
+
+  /** @brief Today's date */
+  Date today = Date::today();
+
+  /** @brief Backups to make */
+  std::vector<PendingBackup> pending;
+};
+
+/** @brief A backup within a backup window
+ *
+ * Completes synchronously, either having made the backup or having decided
+ * that it would not finish within the window.
+ */
+class WindowedBackup: public Action {
+public:
+  /** @brief Constructor
+   * @param window Containing window
+   * @param pb Backup to make
+   */
+  WindowedBackup(BackupWindow *window, const PendingBackup &pb):
+    Action("backup/" + pb.volume->parent->name
+           + "/" + pb.volume->name
+           + "/" + pb.device->name),
+    window(window),
+    pb(pb) {
+  }
+
+  void go(EventLoop *, ActionList *al) override {
+    Host *host = pb.volume->parent;
+    int64_t left = window->remaining();
+    if(pb.estimate > left) {
+      if(warning_mask & WARNING_VERBOSE)
+        IO::out.writef("INFO: deferring %s:%s to %s:"
+                       " predicted to take %jds, %jds of window left\n",
+                       host->name.c_str(),
+                       pb.volume->name.c_str(),
+                       pb.device->name.c_str(),
+                       (intmax_t)pb.estimate,
+                       (intmax_t)std::max<int64_t>(left, 0));
+      ++window->deferred;
+      al->completed(this, false);
+      return;
+    }
+    backupVolume(pb.volume, pb.device);
+    al->completed(this, true);
+  }
+
+private:
+  /** @brief Containing window */
+  BackupWindow *window;
+
+  /** @brief Backup to make */
+  PendingBackup pb;
+};
+
+void BackupWindow::add(Volume *volume, Device *device) {
+  PendingBackup pb;
+  pb.volume = volume;
+  pb.device = device;
+  pb.overdue = backupOverdue(volume, device, today);
+  if(!predictBackupDuration(config.getdb(), volume->parent->name,
+                            volume->name, device->name, pb.estimate))
+    pb.estimate = -1;
+  pending.push_back(pb);
+}
+
+void BackupWindow::run() {
+  orderBackups(pending);
+  // Backups run synchronously, so there is no event loop; the action list
+  // dispatches them in priority order.
+  ActionList al(nullptr);
+  std::vector<std::unique_ptr<WindowedBackup>> actions;
+  for(size_t n = 0; n < pending.size(); ++n) {
+    actions.emplace_back(new WindowedBackup(this, pending[n]));
+    actions.back()->set_priority(static_cast<int>(pending.size() - n));
+    al.add(actions.back().get());
+  }
+  al.go();
+  if(deferred)
+    warning(WARNING_VERBOSE, "%d backups deferred to next run", deferred);
 }
 
 // Backup VOLUME
-static void backupVolume(Volume *volume) {
+static void backupVolume(Volume *volume, BackupWindow *window) {
   Host *host = volume->parent;
   char buffer[1024];
   for(auto &d: config.devices) {
@@ -398,9 +1326,12 @@ static void backupVolume(Volume *volume) {
     switch(volume->needsBackup(device)) {
     case BackupRequired:
       config.identifyDevices(Store::Enabled);
-      if(device->store && device->store->state == Store::Enabled)
-        backupVolume(volume, device);
-      else if(warning_mask & WARNING_STORE) {
+      if(device->store && device->store->state == Store::Enabled) {
+        if(window)
+          window->add(volume, device);
+        else
+          backupVolume(volume, device);
+      } else if(warning_mask & WARNING_STORE) {
         config.identifyDevices(Store::Disabled);
         if(device->store)
           switch(device->store->state) {
@@ -452,7 +1383,7 @@ static void backupVolume(Volume *volume) {
 }
 
 // Backup HOST
-static void backupHost(Host *host) {
+static void backupHost(Host *host, BackupWindow *window) {
   // Do a quick check for unavailable hosts
   if(!host->available()) {
     if(host->alwaysUp) {
@@ -468,7 +1399,7 @@ static void backupHost(Host *host) {
   for(auto &v: host->volumes) {
     Volume *volume = v.second;
     if(volume->selected())
-      backupVolume(volume);
+      backupVolume(volume, window);
   }
 }
 
@@ -491,6 +1422,36 @@ void makeBackups() {
       hosts.push_back(host);
   }
   std::sort(hosts.begin(), hosts.end(), order_host);
-  for(Host *h: hosts)
-    backupHost(h);
+  // Make space on any devices that need it before starting
+  std::vector<Device *> limitedDevices;
+  for(auto &d: config.devices)
+    if(d.second->hasSpaceLimits())
+      limitedDevices.push_back(d.second);
+  if(hosts.size() && limitedDevices.size()) {
+    config.identifyDevices(Store::Enabled);
+    pruneForSpace(limitedDevices);
+  }
+  // With a backup window, decide what to back up before starting
+  std::unique_ptr<BackupWindow> window;
+  if(config.backupWindow)
+    window.reset(new BackupWindow(config.backupWindow));
+  try {
+    for(Host *h: hosts)
+      backupHost(h, window.get());
+    if(window)
+      window->run();
+    finishReplication();
+  } catch(...) {
+    // Don't leave a replication behind for a later run to trip over
+    replicating.reset();
+    replicationSources.clear();
+    throw;
+  }
+  replicationSources.clear();
+  // Finish measuring any backups that were interrupted last time
+  if(hosts.size() && command.act)
+    resumeAccounting();
+  // Link identical files across volumes
+  if(hosts.size() && command.act && config.dedup)
+    dedupBackups();
 }
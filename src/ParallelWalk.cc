@@ -0,0 +1,131 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "ParallelWalk.h"
+#include "Defaults.h"
+#include "Errors.h"
+#include "IO.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+ParallelWalk::ParallelWalk(const std::string &root_): root(root_) {
+}
+
+ParallelWalk::~ParallelWalk() {
+  if(rootfd >= 0)
+    close(rootfd);
+}
+
+void ParallelWalk::walk(size_t threads) {
+  if(rootfd < 0
+     && (rootfd = open(root.c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC)) < 0)
+    throw IOError("opening " + root, errno);
+  queue.push_back("");
+  std::vector<std::thread> pool;
+  for(size_t n = 0; n < std::max(threads, static_cast<size_t>(1)); ++n)
+    pool.push_back(std::thread([this]() { worker(); }));
+  for(auto &t: pool)
+    t.join();
+  if(failure)
+    std::rethrow_exception(failure);
+}
+
+void ParallelWalk::descend(const std::string &path) {
+  std::lock_guard<std::mutex> guard(lock);
+  queue.push_back(path);
+  cond.notify_one();
+}
+
+std::string ParallelWalk::rootPath(const std::string &path) const {
+  return path.empty() ? root : root + PATH_SEP + path;
+}
+
+std::string ParallelWalk::join(const std::string &path,
+                               const std::string &name) {
+  return path.empty() ? name : path + PATH_SEP + name;
+}
+
+void ParallelWalk::worker() {
+  std::unique_lock<std::mutex> guard(lock);
+  for(;;) {
+    while(queue.empty() && active && !failure)
+      cond.wait(guard);
+    // Stop on error, or when there is no more work and none in progress that
+    // could generate more
+    if(failure || queue.empty())
+      break;
+    std::string path = queue.front();
+    queue.pop_front();
+    ++active;
+    guard.unlock();
+    try {
+      visit(path);
+      guard.lock();
+    } catch(...) {
+      guard.lock();
+      if(!failure)
+        failure = std::current_exception();
+    }
+    --active;
+    cond.notify_all();
+  }
+}
+
+void ParallelWalk::visit(const std::string &path) {
+  FileDescriptor dir(openat(rootfd, path.empty() ? "." : path.c_str(),
+                            O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC));
+  if(dir.fd < 0) {
+    if(errno == ENOENT && path.size() && missing(path))
+      return;
+    throw IOError("opening " + rootPath(path), errno);
+  }
+  directory(dir.fd, path, listDirectory(dir.fd, rootPath(path)));
+}
+
+bool ParallelWalk::missing(const std::string &) {
+  return false;
+}
+
+std::vector<std::string> ParallelWalk::listDirectory(int dirfd,
+                                                     const std::string &what) {
+  std::vector<std::string> names;
+  int fd = dup(dirfd);
+  if(fd < 0)
+    throw IOError("reading " + what, errno);
+  // fdopendir shares the file position, so start from the beginning
+  DIR *dp = fdopendir(fd);
+  if(!dp) {
+    close(fd);
+    throw IOError("reading " + what, errno);
+  }
+  rewinddir(dp);
+  struct dirent *de;
+  errno = 0;
+  while((de = readdir(dp))) {
+    if(strcmp(de->d_name, ".") && strcmp(de->d_name, ".."))
+      names.push_back(de->d_name);
+    errno = 0;
+  }
+  int save_errno = errno;
+  closedir(dp);
+  if(save_errno)
+    throw IOError("reading " + what, save_errno);
+  return names;
+}
@@ -0,0 +1,140 @@
+// -*-C++-*-
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef PARALLELWALK_H
+#define PARALLELWALK_H
+/** @file ParallelWalk.h
+ * @brief Multi-threaded directory tree traversal
+ */
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <exception>
+#include <condition_variable>
+
+/** @brief Walk a directory tree using several threads
+ *
+ * Worker threads share a queue of directories.  Each directory is read by
+ * one worker, which passes its contents to @ref directory; subclasses call
+ * @ref descend for the subdirectories they want to visit.
+ */
+class ParallelWalk {
+public:
+  /** @brief Constructor
+   * @param root Path to root of tree
+   */
+  ParallelWalk(const std::string &root);
+
+  ParallelWalk(const ParallelWalk &) = delete;
+  ParallelWalk &operator=(const ParallelWalk &) = delete;
+
+  /** @brief Destructor */
+  virtual ~ParallelWalk();
+
+  /** @brief Walk the tree
+   * @param threads Maximum number of threads to use
+   *
+   * Returns when every directory queued by @ref descend has been visited.
+   * Throws @ref IOError on error, or rethrows the first exception raised by
+   * @ref directory, after all threads have finished.
+   */
+  void walk(size_t threads);
+
+protected:
+  /** @brief Called for each directory
+   * @param dirfd Directory descriptor
+   * @param path Path relative to root ("" for the root itself)
+   * @param names Names of the directory's contents, excluding "." and ".."
+   *
+   * Called concurrently from worker threads.
+   */
+  virtual void directory(int dirfd, const std::string &path,
+                         const std::vector<std::string> &names) = 0;
+
+  /** @brief Called when a queued directory no longer exists
+   * @param path Path relative to root
+   * @return @c true to carry on, @c false to report an error
+   *
+   * Called concurrently from worker threads.  The default implementation
+   * returns @c false.
+   */
+  virtual bool missing(const std::string &path);
+
+  /** @brief Queue a subdirectory to be visited
+   * @param path Path relative to root
+   */
+  void descend(const std::string &path);
+
+  /** @brief Full path of an item
+   * @param path Path relative to root
+   * @return Path including root
+   */
+  std::string rootPath(const std::string &path) const;
+
+  /** @brief Join a relative directory path and a name
+   * @param path Path relative to root ("" for the root itself)
+   * @param name Name within @p path
+   * @return Path relative to root
+   */
+  static std::string join(const std::string &path, const std::string &name);
+
+  /** @brief Read the names in a directory
+   * @param dirfd Directory descriptor
+   * @param what Path for error messages
+   * @return Names of the directory's contents, excluding "." and ".."
+   */
+  static std::vector<std::string> listDirectory(int dirfd,
+                                                const std::string &what);
+
+  /** @brief Path to root of tree */
+  std::string root;
+
+  /** @brief Descriptor for root of tree
+   *
+   * Valid during @ref walk.
+   */
+  int rootfd = -1;
+
+  /** @brief Protects shared state
+   *
+   * Subclasses may use this for their own shared state too.
+   */
+  std::mutex lock;
+
+private:
+  /** @brief Worker thread */
+  void worker();
+
+  /** @brief Read and visit one directory
+   * @param path Path relative to root
+   */
+  void visit(const std::string &path);
+
+  /** @brief Signalled when @ref queue or @ref active changes */
+  std::condition_variable cond;
+
+  /** @brief Directories waiting to be visited */
+  std::deque<std::string> queue;
+
+  /** @brief Number of directories being visited */
+  size_t active = 0;
+
+  /** @brief First exception raised by a worker */
+  std::exception_ptr failure;
+};
+
+#endif /* PARALLELWALK_H */
@@ -0,0 +1,109 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "PngWriter.h"
+#include "IO.h"
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+// Size at which IDAT chunks are written
+static const size_t IDAT_SIZE = 65536;
+
+// Append a 32-bit big-endian integer
+static void put32(std::string &s, uint32_t n) {
+  s += static_cast<char>(n >> 24);
+  s += static_cast<char>(n >> 16);
+  s += static_cast<char>(n >> 8);
+  s += static_cast<char>(n);
+}
+
+PngWriter::PngWriter(IO &out_, unsigned width_, unsigned height_):
+  out(out_),
+  width(width_),
+  height(height_) {
+  if(width == 0 || height == 0)
+    throw std::logic_error("PngWriter: empty image");
+  memset(&zs, 0, sizeof zs);
+  if(deflateInit(&zs, Z_DEFAULT_COMPRESSION) != Z_OK)
+    throw std::runtime_error("deflateInit failed");
+  out.write(std::string("\x89PNG\r\n\x1a\n", 8));
+  std::string ihdr;
+  put32(ihdr, width);
+  put32(ihdr, height);
+  ihdr += '\x08';                       // bit depth
+  ihdr += '\x02';                       // color type: RGB
+  ihdr += '\x00';                       // compression method
+  ihdr += '\x00';                       // filter method
+  ihdr += '\x00';                       // interlace method: none
+  chunk("IHDR", ihdr);
+}
+
+PngWriter::~PngWriter() {
+  deflateEnd(&zs);
+}
+
+void PngWriter::writeRow(const uint8_t *rgb) {
+  if(rows >= height)
+    throw std::logic_error("PngWriter::writeRow: too many rows");
+  static const uint8_t filter = 0;      // filter type: none
+  compress(&filter, 1, Z_NO_FLUSH);
+  compress(rgb, 3 * static_cast<size_t>(width), Z_NO_FLUSH);
+  ++rows;
+}
+
+void PngWriter::finish() {
+  if(rows != height)
+    throw std::logic_error("PngWriter::finish: too few rows");
+  compress(nullptr, 0, Z_FINISH);
+  if(compressed.size())
+    chunk("IDAT", compressed);
+  compressed.clear();
+  chunk("IEND", "");
+  out.flush();
+}
+
+void PngWriter::chunk(const char *type, const std::string &data) {
+  std::string header;
+  put32(header, data.size());
+  header.append(type, 4);
+  uLong crc = crc32(0, reinterpret_cast<const Bytef *>(type), 4);
+  crc = crc32(crc, reinterpret_cast<const Bytef *>(data.data()), data.size());
+  std::string trailer;
+  put32(trailer, crc);
+  out.write(header);
+  out.write(data);
+  out.write(trailer);
+}
+
+void PngWriter::compress(const uint8_t *data, size_t len, int flush) {
+  uint8_t buffer[16384];
+  zs.next_in = const_cast<Bytef *>(data);
+  zs.avail_in = len;
+  int rc;
+  do {
+    zs.next_out = buffer;
+    zs.avail_out = sizeof buffer;
+    rc = deflate(&zs, flush);
+    if(rc == Z_STREAM_ERROR)
+      throw std::runtime_error("deflate failed");
+    compressed.append(reinterpret_cast<char *>(buffer),
+                      sizeof buffer - zs.avail_out);
+    if(compressed.size() >= IDAT_SIZE) {
+      chunk("IDAT", compressed);
+      compressed.clear();
+    }
+  } while(zs.avail_out == 0 || (flush == Z_FINISH && rc != Z_STREAM_END));
+}
@@ -0,0 +1,96 @@
+// -*-C++-*-
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef PNGWRITER_H
+#define PNGWRITER_H
+/** @file PngWriter.h
+ * @brief Streaming PNG encoder
+ */
+
+#include <string>
+#include <cstdint>
+#include <zlib.h>
+
+class IO;
+
+/** @brief Streaming PNG encoder
+ *
+ * Writes an 8-bit RGB PNG one row at a time, so that an arbitrarily large
+ * image can be produced without ever holding all of it in memory.
+ */
+class PngWriter {
+public:
+  /** @brief Constructor
+   * @param out Destination
+   * @param width Width of image in pixels
+   * @param height Height of image in pixels
+   *
+   * The PNG header is written immediately.
+   */
+  PngWriter(IO &out, unsigned width, unsigned height);
+
+  PngWriter(const PngWriter &) = delete;
+  PngWriter &operator=(const PngWriter &) = delete;
+
+  /** @brief Destructor */
+  ~PngWriter();
+
+  /** @brief Write one row
+   * @param rgb Red, green and blue bytes for each pixel in the row
+   */
+  void writeRow(const uint8_t *rgb);
+
+  /** @brief Complete the image
+   *
+   * Must be called after all the rows have been written.
+   */
+  void finish();
+
+private:
+  /** @brief Write a chunk
+   * @param type Chunk type
+   * @param data Chunk contents
+   */
+  void chunk(const char *type, const std::string &data);
+
+  /** @brief Compress data into @ref compressed
+   * @param data Start of data
+   * @param len Length of data
+   * @param flush Flush mode for @c deflate()
+   *
+   * Complete @c IDAT chunks are written as @ref compressed fills up.
+   */
+  void compress(const uint8_t *data, size_t len, int flush);
+
+  /** @brief Destination */
+  IO &out;
+
+  /** @brief Width in pixels */
+  unsigned width;
+
+  /** @brief Height in pixels */
+  unsigned height;
+
+  /** @brief Number of rows written so far */
+  unsigned rows = 0;
+
+  /** @brief Compression state */
+  z_stream zs;
+
+  /** @brief Compressed data not yet written */
+  std::string compressed;
+};
+
+#endif /* PNGWRITER_H */
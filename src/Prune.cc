@@ -27,6 +27,10 @@
 #include "Database.h"
 #include "Prune.h"
 #include "BulkRemove.h"
+#include "Capacity.h"
+#include "Catalog.h"
+#include "Dedup.h"
+#include "Verify.h"
 #include <algorithm>
 #include <regex>
 #include <sys/types.h>
@@ -106,16 +110,6 @@ void validatePrunePolicy(const Volume *volume) {
   policy->validate(volume);
 }
 
-void backupPrunable(std::vector<Backup *> &onDevice,
-                    std::map<Backup *, std::string> &prune,
-                    int total) {
-  if(onDevice.size() == 0)
-    return;
-  const Volume *volume = onDevice.at(0)->volume;
-  const PrunePolicy *policy = PrunePolicy::find(volume->prunePolicy);
-  policy->prunable(onDevice, prune, total);
-}
-
 PrunePolicy::policies_type *PrunePolicy::policies;
 
 // Remove old and incomplete backups
@@ -175,6 +169,9 @@ void pruneBackups() {
 }
 
 static void findObsoleteBackups(std::vector<Backup *> &obsoleteBackups) {
+  // All ages are computed relative to the same day, even if the run crosses
+  // midnight
+  const Date today = Date::today();
   for(auto &h: config.hosts) {
     const Host *host = h.second;
     if(!host->selected())
@@ -215,10 +212,15 @@ static void findObsoleteBackups(std::vector<Backup *> &obsoleteBackups) {
           break;
         }
       }
+      if(onDevices.size() == 0)
+        continue;
+      // Parse the pruning parameters once per volume
+      const PrunePolicy *policy = PrunePolicy::find(volume->prunePolicy);
+      std::unique_ptr<PruneParameters> parameters = policy->parse(volume);
       for(auto &od: onDevices) {
         std::vector<Backup *> &onDevice = od.second;
         std::map<Backup *, std::string> prune;
-        backupPrunable(onDevice, prune, total);
+        policy->prunable(onDevice, prune, total, parameters.get(), today);
         for(auto &p: prune) {
           Backup *backup = p.first;
           backup->contents = p.second;
@@ -230,6 +232,148 @@ static void findObsoleteBackups(std::vector<Backup *> &obsoleteBackups) {
   }
 }
 
+// Order in which backups are removed to make space: those that the volume's
+// pruning policy would remove anyway come first, then the oldest.
+static bool spaceOrder(const SpaceCandidate &a, const SpaceCandidate &b) {
+  if(a.prunable != b.prunable)
+    return a.prunable;
+  return a.backup->date < b.backup->date;
+}
+
+void findSpaceCandidates(const Device *device, const Date &today,
+                         std::vector<SpaceCandidate> &candidates) {
+  for(auto &h: config.hosts) {
+    const Host *host = h.second;
+    for(auto &v: host->volumes) {
+      const Volume *volume = v.second;
+      if(volume->prunePolicy == "never")
+        continue;
+      std::vector<Backup *> onDevice;
+      for(Backup *backup: volume->backups)
+        if(backup->getStatus() == COMPLETE
+           && backup->deviceName == device->name)
+          onDevice.push_back(backup);
+      const PrunePolicy *policy = PrunePolicy::find(volume->prunePolicy);
+      const size_t minBackups
+        = parseInteger(policy->get(volume, "min-backups", DEFAULT_MIN_BACKUPS),
+                       1);
+      if(onDevice.size() <= minBackups)
+        continue;
+      std::map<Backup *, std::string> prune;
+      std::unique_ptr<PruneParameters> parameters = policy->parse(volume);
+      policy->prunable(onDevice, prune, onDevice.size(), parameters.get(),
+                       today);
+      // The most recent backup is never a candidate
+      onDevice.pop_back();
+      std::vector<SpaceCandidate> fromVolume;
+      for(Backup *backup: onDevice) {
+        bool prunable = contains(prune, backup);
+        if(prunable || device->spacePrune == Device::SpacePruneOldest)
+          fromVolume.push_back({backup, prunable});
+      }
+      // Only the first few in removal order can go without leaving too few
+      std::sort(fromVolume.begin(), fromVolume.end(), spaceOrder);
+      const size_t allowed = onDevice.size() + 1 - minBackups;
+      if(fromVolume.size() > allowed)
+        fromVolume.resize(allowed);
+      candidates.insert(candidates.end(), fromVolume.begin(), fromVolume.end());
+    }
+  }
+}
+
+// Choose the next backup to remove to make space on a device, and remove it
+// from the candidates.
+static Backup *findSpaceVictim(std::vector<SpaceCandidate> &candidates) {
+  auto victim = std::min_element(candidates.begin(), candidates.end(),
+                                 spaceOrder);
+  if(victim == candidates.end())
+    return nullptr;
+  Backup *backup = victim->backup;
+  candidates.erase(victim);
+  return backup;
+}
+
+void pruneForSpace(const std::vector<Device *> &devices) {
+  const Date today = Date::today();
+  std::vector<Device *> pending;
+  std::map<const Device *, std::vector<SpaceCandidate>> candidates;
+  for(Device *device: devices)
+    if(device->hasSpaceLimits()
+       && device->store
+       && device->store->state == Store::Enabled) {
+      pending.push_back(device);
+      findSpaceCandidates(device, today, candidates[device]);
+    }
+  while(pending.size()) {
+    std::vector<Backup *> victims;
+    for(auto it = pending.begin(); it != pending.end();) {
+      Device *device = *it;
+      StoreUsage usage;
+      Backup *victim = nullptr;
+      try {
+        usage.measure(device->store->path);
+        if(device->needsSpace(usage)) {
+          victim = findSpaceVictim(candidates[device]);
+          if(!victim)
+            warning(WARNING_ALWAYS,
+                    "device %s is short of space but has nothing left to prune",
+                    device->name.c_str());
+        }
+      } catch(IOError &e) {
+        warning(WARNING_STORE, "%s", e.what());
+      }
+      if(!victim) {
+        it = pending.erase(it);
+        continue;
+      }
+      char buffer[256];
+      if(usage.freeBytes < device->minFreeSpace.required(usage.totalBytes))
+        snprintf(buffer, sizeof buffer,
+                 "free space %jd bytes below limit %s",
+                 (intmax_t)usage.freeBytes,
+                 device->minFreeSpace.toString().c_str());
+      else
+        snprintf(buffer, sizeof buffer,
+                 "free inodes %jd below limit %s",
+                 (intmax_t)usage.freeFiles,
+                 device->minFreeInodes.toString().c_str());
+      victim->contents = buffer;
+      victims.push_back(victim);
+      ++it;
+    }
+    if(victims.size() == 0)
+      break;
+    if(command.act)
+      markObsoleteBackups(victims);
+    std::vector<RemovableBackup> removableBackups;
+    findRemovableBackups(victims, removableBackups);
+    // Nothing actually changes in dry-run mode, so stop after the first round
+    if(!command.act)
+      break;
+    // Removal is concurrent across devices
+    EventLoop e;
+    ActionList al(&e);
+    for(auto &removable: removableBackups) {
+      removable.initialize();
+      al.add(&removable.bulkRemover);
+    }
+    al.go();
+    checkRemovalErrors(removableBackups);
+    commitRemovals(removableBackups);
+    for(auto &removable: removableBackups) {
+      if(removable.bulkRemover.getStatus() == 0)
+        removable.backup->volume->removeBackup(removable.backup);
+      else {
+        // Don't keep trying a device where removal fails
+        auto it = std::find(pending.begin(), pending.end(),
+                            config.findDevice(removable.backup->deviceName));
+        if(it != pending.end())
+          pending.erase(it);
+      }
+    }
+  }
+}
+
 static void markObsoleteBackups(std::vector<Backup *> obsoleteBackups) {
   config.getdb().begin();
   for(Backup *b: obsoleteBackups) {
@@ -338,6 +482,43 @@ void prunePruneLogs() {
                                            - config.keepPruneLogs * 86400),
                       SQL_END);
 
+  if(command.act) {
+    // Delete space usage records for backups that no longer exist
+    Database::Statement(config.getdb(),
+                        "DELETE FROM backup_usage"
+                        " WHERE NOT EXISTS (SELECT 1 FROM backup"
+                        "  WHERE backup.host=backup_usage.host"
+                        "  AND backup.volume=backup_usage.volume"
+                        "  AND backup.device=backup_usage.device"
+                        "  AND backup.id=backup_usage.id)",
+                        SQL_END).next();
+    for(const std::string table: {"backup_space", "backup_space_part",
+                                  "backup_duration", "backup_transfer",
+                                  "backup_tuning"}) {
+      const std::string sql = "DELETE FROM " + table
+        + " WHERE NOT EXISTS (SELECT 1 FROM backup"
+        + "  WHERE backup.host=" + table + ".host"
+        + "  AND backup.volume=" + table + ".volume"
+        + "  AND backup.device=" + table + ".device"
+        + "  AND backup.id=" + table + ".id)";
+      Database::Statement(config.getdb(), sql.c_str(), SQL_END).next();
+    }
+    pruneCatalog(config.getdb());
+    pruneDedup(config.getdb());
+    pruneVerify(config.getdb());
+
+    // Delete store measurements too old to use for forecasting, but keep
+    // the most recent measurement for each device
+    Database::Statement(config.getdb(),
+                        "DELETE FROM store_usage"
+                        " WHERE time < ?"
+                        " AND time < (SELECT MAX(time) FROM store_usage AS s"
+                        "  WHERE s.device=store_usage.device)",
+                        SQL_INT64, (int64_t)(Date::now()
+                                             - CAPACITY_FORECAST_DAYS * 86400),
+                        SQL_END).next();
+  }
+
   // Delete pre-sqlitification pruning logs
   // TODO: one day this code can be removed.
   Date today = Date::today();
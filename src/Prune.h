@@ -22,11 +22,24 @@
 
 #include <vector>
 #include <map>
+#include <memory>
 #include <string>
+#include "Date.h"
 
 class Backup;
+class Device;
 class Volume;
 
+/** @brief Parsed parameters for a pruning policy
+ *
+ * Each policy defines its own subclass, produced by PrunePolicy::parse().
+ */
+class PruneParameters {
+public:
+  /** @brief Destructor */
+  virtual ~PruneParameters() = default;
+};
+
 /** @brief Base class for pruning policies
  */
 class PrunePolicy {
@@ -37,10 +50,21 @@ public:
    */
   PrunePolicy(const std::string &name);
 
+  /** @brief Parse the pruning parameters for a volume
+   * @param volume Volume to parse parameters for
+   * @return Parsed parameters
+   *
+   * Throws @ref ConfigError if the parameters are not valid.
+   */
+  virtual std::unique_ptr<PruneParameters> parse(const Volume *volume)
+    const = 0;
+
   /** @brief Validate a pruning policy
    * @param volume Volume to validate
    */
-  virtual void validate(const Volume *volume) const = 0;
+  void validate(const Volume *volume) const {
+    parse(volume);
+  }
 
   /** @brief Get a parameter value
    * @param volume Volume to validate
@@ -60,15 +84,19 @@ public:
 
   /** @brief Identify prunable backups
    * @param onDevice Surviving backups of same volume on same device
-   * @param total Number of backups anywhere
    * @param prune Map of backups to prune to reason strings
+   * @param total Number of backups anywhere
+   * @param parameters Parameters from parse()
+   * @param today Today's date
    *
    * @p total does not include backups on other devices that have "only just"
    * been selected for pruning.
    */
   virtual void prunable(std::vector<Backup *> &onDevice,
                         std::map<Backup *, std::string> &prune,
-                        int total) const = 0;
+                        int total,
+                        const PruneParameters *parameters,
+                        const Date &today) const = 0;
 
   /** @brief Find a prune policy by name
    * @param name Name of policy
@@ -89,14 +117,31 @@ private:
  */
 void validatePrunePolicy(const Volume *volume);
 
-/** @brief Identify prunable backups
- * @param onDevice Number of backups of same volume on same device
- * @param prune Map of backups to prune to reason strings
- * @param total Number of backups anywhere
-  */
-void backupPrunable(std::vector<Backup *> &onDevice,
-                    std::map<Backup *, std::string> &prune,
-                    int total);
+/** @brief A backup that could be removed to make space on a device */
+struct SpaceCandidate {
+  /** @brief The backup */
+  Backup *backup;
+
+  /** @brief @c true if the volume's pruning policy would remove it anyway */
+  bool prunable;
+};
+
+/** @brief Find the backups that could be removed to make space on a device
+ * @param device Device that is short of space
+ * @param today Today's date
+ * @param candidates Where to append the candidates
+ *
+ * Candidates are complete backups that the volume's pruning policy would
+ * remove or, if the device has @c space-prune @c oldest, any complete backup.
+ * Volumes with the @c never policy are left alone, at least @c min-backups
+ * backups of each volume are kept, and the most recent backup of each volume
+ * is never a candidate.
+ *
+ * Pruning policies are evaluated once per volume here, since they may be
+ * expensive (for instance running an external program).
+ */
+void findSpaceCandidates(const Device *device, const Date &today,
+                         std::vector<SpaceCandidate> &candidates);
 
 /** @brief Identify the bucket for a backup
  * @param w Decay window
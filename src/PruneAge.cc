@@ -25,27 +25,44 @@ class PruneAge: public PrunePolicy {
 public:
   PruneAge(): PrunePolicy("age") {}
 
-  void validate(const Volume *volume) const override {
-    parseInteger(get(volume, "prune-age", DEFAULT_PRUNE_AGE), 1);
-    parseInteger(get(volume, "min-backups", DEFAULT_MIN_BACKUPS), 1);
-  }
+  /** @brief Parsed parameters for the @c age policy */
+  struct Parameters: public PruneParameters {
+    /** @brief Minimum age of a prunable backup */
+    int pruneAge;
 
-  void prunable(std::vector<Backup *> &onDevice,
-                std::map<Backup *, std::string> &prune,
-                int) const override {
-    const Volume *volume = onDevice.at(0)->volume;
+    /** @brief Minimum number of backups to keep on each device */
+    int minBackups;
+  };
+
+  std::unique_ptr<PruneParameters> parse(const Volume *volume)
+    const override {
     int pruneAge = parseInteger(get(volume, "prune-age", DEFAULT_PRUNE_AGE),
                                 1);
     int minBackups = parseInteger(get(volume, "min-backups", DEFAULT_MIN_BACKUPS),
                                   1);
+    Parameters *p = new Parameters();
+    p->pruneAge = pruneAge;
+    p->minBackups = minBackups;
+    return std::unique_ptr<PruneParameters>(p);
+  }
+
+  void prunable(std::vector<Backup *> &onDevice,
+                std::map<Backup *, std::string> &prune,
+                int,
+                const PruneParameters *parameters,
+                const Date &today) const override {
+    const Parameters *p = static_cast<const Parameters *>(parameters);
+    const int pruneAge = p->pruneAge;
+    const size_t minBackups = p->minBackups;
+    const int todayNumber = today.toNumber();
     size_t left = onDevice.size();
     for(Backup *backup: onDevice) {
-      int age = Date::today() - backup->date;
+      int age = todayNumber - backup->date.toNumber();
       // Keep backups that are young enough
       if(age <= pruneAge)
         continue;
       // Keep backups that are on underpopulated devices
-      if(left <= static_cast<unsigned>(minBackups))
+      if(left <= minBackups)
         continue;
       std::ostringstream ss;
       ss << "age " << age
@@ -31,17 +31,23 @@ class PruneDecay: public PrunePolicy {
 public:
   PruneDecay(): PrunePolicy("decay") {}
 
-  void validate(const Volume *volume) const override {
-    parseInteger(get(volume, "decay-start", DEFAULT_DECAY_START), 1);
-    parseInteger(get(volume, "decay-window", DEFAULT_DECAY_WINDOW), 1);
-    parseInteger(get(volume, "decay-scale", DEFAULT_DECAY_SCALE), 2);
-    parseInteger(get(volume, "decay-limit", DEFAULT_PRUNE_AGE), 1);
-  }
+  /** @brief Parsed parameters for the @c decay policy */
+  struct Parameters: public PruneParameters {
+    /** @brief Age at which decay starts */
+    int decayStart;
 
-  void prunable(std::vector<Backup *> &onDevice,
-                std::map<Backup *, std::string> &prune,
-                int) const override {
-    const Volume *volume = onDevice.at(0)->volume;
+    /** @brief Size of the first bucket */
+    int decayWindow;
+
+    /** @brief Ratio between successive bucket sizes */
+    int decayScale;
+
+    /** @brief Age beyond which backups are unconditionally pruned */
+    int decayLimit;
+  };
+
+  std::unique_ptr<PruneParameters> parse(const Volume *volume)
+    const override {
     int decayStart = parseInteger(get(volume, "decay-start", DEFAULT_DECAY_START),
                                 1);
     int decayWindow = parseInteger(get(volume, "decay-window", DEFAULT_DECAY_WINDOW),
@@ -50,13 +56,36 @@ public:
                                   2);
     int decayLimit = parseInteger(get(volume, "decay-limit", DEFAULT_PRUNE_AGE),
                                   1);
+    Parameters *p = new Parameters();
+    p->decayStart = decayStart;
+    p->decayWindow = decayWindow;
+    p->decayScale = decayScale;
+    p->decayLimit = decayLimit;
+    return std::unique_ptr<PruneParameters>(p);
+  }
+
+  void prunable(std::vector<Backup *> &onDevice,
+                std::map<Backup *, std::string> &prune,
+                int,
+                const PruneParameters *parameters,
+                const Date &today) const override {
+    const Parameters *p = static_cast<const Parameters *>(parameters);
+    const int decayStart = p->decayStart;
+    const int decayWindow = p->decayWindow;
+    const int decayScale = p->decayScale;
+    const int decayLimit = p->decayLimit;
     if(onDevice.size() == 1)
       return;
+    const int todayNumber = today.toNumber();
+    // Bucket number of each backup, or -1 if it is not subject to decay.
+    // Computed once since prune_decay_bucket() is relatively expensive.
+    std::vector<int> buckets(onDevice.size(), -1);
     // Map of bucket numbers to oldest backup in the bucket.  These will be
     // presderved.
     std::map<int, int> oldest;
-    for(Backup *backup: onDevice) {
-      int age = Date::today() - backup->date;
+    for(size_t n = 0; n < onDevice.size(); ++n) {
+      Backup *backup = onDevice[n];
+      int age = todayNumber - backup->date.toNumber();
       // Keep backups that are young enough
       int a = age - decayStart;
       if(a <= 0)
@@ -72,6 +101,7 @@ public:
       }
       // Assign backups to buckets
       int bucket = prune_decay_bucket(decayWindow, decayScale, a);
+      buckets[n] = bucket;
       // Track the oldest backup in this bucket
       auto bucket_iterator = oldest.find(bucket);
       if(bucket_iterator == oldest.end())
@@ -84,13 +114,12 @@ public:
     }
     // Now that we know what the oldest backup in each bucket is, we can prune
     // the rest.
-    for(Backup *backup: onDevice) {
-      int age = Date::today() - backup->date;
-      // Keep backups that are young enough
-      int a = age - decayStart;
-      if(a <= 0 || age > decayLimit)
+    for(size_t n = 0; n < onDevice.size(); ++n) {
+      int bucket = buckets[n];
+      if(bucket < 0)
         continue;
-      int bucket = prune_decay_bucket(decayWindow, decayScale, a);
+      Backup *backup = onDevice[n];
+      int age = todayNumber - backup->date.toNumber();
       auto bucket_iterator = oldest.find(bucket);
       assert(bucket_iterator != oldest.end());
       int oldest_in_this_bucket = bucket_iterator->second;
@@ -31,7 +31,14 @@ class PruneExec: public PrunePolicy {
 public:
   PruneExec(): PrunePolicy("exec") {}
 
-  void validate(const Volume *volume) const override {
+  /** @brief Parsed parameters for the @c exec policy */
+  struct Parameters: public PruneParameters {
+    /** @brief Path to pruning program */
+    std::string path;
+  };
+
+  std::unique_ptr<PruneParameters> parse(const Volume *volume)
+    const override {
     const std::string &path = get(volume, "path");
     if(access(path.c_str(), X_OK) < 0)
       throw ConfigError("cannot execute pruning policy "
@@ -41,22 +48,28 @@ public:
         if(ch != '_' && !isalnum(ch))
           throw ConfigError("invalid pruning parameter '" + p.first
                             + "' for executable policies");
+    Parameters *p = new Parameters();
+    p->path = path;
+    return std::unique_ptr<PruneParameters>(p);
   }
 
   void prunable(std::vector<Backup *> &onDevice,
                 std::map<Backup *, std::string> &prune,
-                int total) const override {
+                int total,
+                const PruneParameters *parameters,
+                const Date &today) const override {
     char buffer[64];
+    const Parameters *p = static_cast<const Parameters *>(parameters);
     const Volume *volume = onDevice.at(0)->volume;
-    std::vector<std::string> command = { get(volume, "path") };
+    std::vector<std::string> command = { p->path };
     Subprocess sp(command);
-    for(auto &p: volume->pruneParameters)
-      sp.setenv("PRUNE_" + p.first, p.second);
+    for(auto &pp: volume->pruneParameters)
+      sp.setenv("PRUNE_" + pp.first, pp.second);
     std::stringstream ss;
     for(size_t i = 0; i < onDevice.size(); ++i) {
       if(i)
         ss << ' ';
-      ss << Date::today() - onDevice[i]->date;
+      ss << today - onDevice[i]->date;
     }
     sp.setenv("PRUNE_ONDEVICE", ss.str());
     snprintf(buffer, sizeof buffer, "%d", total);
@@ -80,7 +93,7 @@ public:
       int age = parseInteger(agestr, 0, INT_MAX);
       bool found = false;
       for(Backup *backup: onDevice) {
-        if(Date::today() - backup->date == age) {
+        if(today - backup->date == age) {
           if(contains(prune, backup))
             throw InvalidPruneList("duplicate entry in prune list");
           prune[backup] = reason;
@@ -21,10 +21,14 @@ class PruneNever: public PrunePolicy {
 public:
   PruneNever(): PrunePolicy("never") {}
 
-  void validate(const Volume *) const override {}
+  std::unique_ptr<PruneParameters> parse(const Volume *) const override {
+    return std::unique_ptr<PruneParameters>(new PruneParameters());
+  }
 
   void prunable(std::vector<Backup *> &,
                 std::map<Backup *, std::string> &,
-                int) const override {
+                int,
+                const PruneParameters *,
+                const Date &) const override {
   }
 } prune_never;
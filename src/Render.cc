@@ -15,6 +15,8 @@
 #include <config.h>
 #include "Render.h"
 #include "Utils.h"
+#include <map>
+#include <mutex>
 
 #include <pangomm/layout.h>
 
@@ -155,32 +157,61 @@ Render::Text::Text(Context &context,
                    const std::string &f):
   Colored(context, c),
   text(t),
+  font_name(f),
   font(f) {
 }
 
 void Render::Text::set_text(const std::string &t) {
   text = t;
+  layout_ready = false;
   changed();
 }
 
 void Render::Text::set_font(const std::string &f) {
+  font_name = f;
   font = Pango::FontDescription(f);
+  layout_ready = false;
   changed();
 }
 
-void Render::Text::set_extent() {
+// Measured text extents, indexed by font and text
+static std::mutex text_extents_lock;
+static std::map<std::pair<std::string, std::string>,
+                std::pair<double, double>> text_extents;
+
+void Render::Text::prepare_layout() {
   if(!layout)
     layout = Pango::Layout::create(context.cairo);
-  layout->set_text(text);
-  layout->set_font_description(font);
+  if(!layout_ready) {
+    layout->set_text(text);
+    layout->set_font_description(font);
+    layout_ready = true;
+  }
+}
+
+void Render::Text::set_extent() {
+  const auto key = std::make_pair(font_name, text);
+  {
+    std::lock_guard<std::mutex> guard(text_extents_lock);
+    auto it = text_extents.find(key);
+    if(it != text_extents.end()) {
+      width = it->second.first;
+      height = it->second.second;
+      return;
+    }
+  }
+  prepare_layout();
   Pango::Rectangle ink, logical;
   layout->get_pixel_extents(ink, logical);
   width = ceil(logical.get_width());
   height = ceil(logical.get_height());
+  std::lock_guard<std::mutex> guard(text_extents_lock);
+  text_extents[key] = std::make_pair(width, height);
 }
 
 void Render::Text::render() {
   Colored::render();
+  prepare_layout();
   context.cairo->move_to(0, 0);
   layout->show_in_cairo_context(context.cairo);
 }
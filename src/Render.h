@@ -296,18 +296,33 @@ namespace Render {
      */
     void set_font(const std::string &f);
 
+    /** @brief Set @ref width and @ref height
+     *
+     * Text extents are cached by font and text, so each distinct label is
+     * only measured once, however many widgets display it and in whichever
+     * thread.
+     */
     void set_extent() override;
     void render() override;
 
   private:
+    /** @brief Make sure @ref layout reflects the current text and font */
+    void prepare_layout();
+
     /** @brief Text to render */
     std::string text;
 
+    /** @brief Font description string */
+    std::string font_name;
+
     /** @brief Font */
     Pango::FontDescription font;
 
     /** @brief Pango layout for text */
     Glib::RefPtr<Pango::Layout> layout;
+
+    /** @brief True if @ref layout reflects @ref text and @ref font */
+    bool layout_ready = false;
   };
 
   /** @brief Filled rectangular widget */
@@ -25,12 +25,15 @@
 #include "Database.h"
 #include "Report.h"
 #include "Utils.h"
-#include "Subprocess.h"
 #include "Errors.h"
+#include "DiskUsage.h"
+#include "HistoryGraph.h"
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <stdexcept>
 #include <sstream>
+#include <thread>
 #include <boost/range/adaptor/reversed.hpp>
 
 // Split up a color into RGB components
@@ -68,6 +71,15 @@ void Report::compute() {
   devices_unknown = config.unknownDevices.size();
   hosts_unknown = config.unknownHosts.size();
   volumes_unknown = 0;
+  devices_filling = 0;
+  forecasts.clear();
+  for(auto &d: config.devices) {
+    CapacityForecast &forecast = forecasts[d.first];
+    forecast.compute(config.getdb(), d.first);
+    int days = forecast.daysUntilFull();
+    if(days >= 0 && days <= CAPACITY_WARNING_DAYS)
+      ++devices_filling;
+  }
   for(auto &h: config.hosts) {
     const Host *host = h.second;
     volumes_unknown += host->unknownVolumes.size();
@@ -141,6 +153,15 @@ void Report::warnings() {
              backups_failed);
     l->entry(buffer);
   }
+  for(auto &f: forecasts) {
+    int days = f.second.daysUntilFull();
+    if(days >= 0 && days <= CAPACITY_WARNING_DAYS) {
+      snprintf(buffer, sizeof buffer,
+               "WARNING: device %s is forecast to be full in %d days.",
+               f.first.c_str(), days);
+      l->entry(buffer);
+    }
+  }
   d.append(l);
 }
 
@@ -152,6 +173,7 @@ int Report::warningCount() const {
   if(backups_partial) ++warnings;
   if(backups_out_of_date) ++warnings;
   if(backups_failed) ++warnings;
+  warnings += devices_filling;
   return warnings;
 }
 
@@ -356,29 +378,157 @@ void Report::pruneLogs(const std::string &days) {
 }
 
 void Report::historyGraph() {
-  std::string history_png;
-  std::string rg = Subprocess::pathSearch("rsbackup-graph");
-  if(rg.size() == 0)
+  // The graph covers every volume, not just those selected for backup or
+  // pruning
+  std::vector<Volume *> selected;
+  size_t volumes = 0;
+  for(auto &h: config.hosts)
+    for(auto &v: h.second->volumes) {
+      ++volumes;
+      if(v.second->selected())
+        selected.push_back(v.second);
+    }
+  if(volumes == 0)
     return;
-  std::vector<std::string> cmd = {
-    "rsbackup-graph",
-    "-c", configPath,
-    "-D", database,
-    "-o-",
-  };
-  if(debug)
-    cmd.push_back("-d");
-  Subprocess sp(cmd);
-  sp.capture(1, &history_png);
-  sp.runAndWait();
-  if(history_png.size()) {
-    std::stringstream ss;
-    ss << "data:image/png;base64,";
-    write_base64(ss, history_png);
-    Document::Image *image = new Document::Image(ss.str());
-    image->style = "history";
-    d.append(image);
+  config.selectVolume("*", "*", true);
+  std::string history_png
+    = renderHistoryGraphPng(std::max(1U, std::thread::hardware_concurrency()));
+  config.selectVolume("*", "*", false);
+  for(Volume *volume: selected)
+    volume->select(true);
+  Document::Image *image = new Document::Image("image/png", history_png);
+  image->style = "history";
+  d.append(image);
+  images.push_back(image);
+}
+
+// Format a byte or inode count for human consumption
+static std::string formatCount(double n, const char *unit) {
+  static const char *const prefixes[] = { "", "K", "M", "G", "T", "P" };
+  size_t p = 0;
+  while(fabs(n) >= 1024 && p + 1 < sizeof prefixes / sizeof *prefixes) {
+    n /= 1024;
+    ++p;
+  }
+  char buffer[64];
+  snprintf(buffer, sizeof buffer, p ? "%.1f%s%s" : "%.0f%s%s",
+           n, prefixes[p], unit);
+  return buffer;
+}
+
+// Generate the device capacity table
+void Report::capacity() {
+  Document::Table *t = new Document::Table();
+
+  t->addHeadingCell(new Document::Cell("Device"));
+  t->addHeadingCell(new Document::Cell("Measured"));
+  t->addHeadingCell(new Document::Cell("Size"));
+  t->addHeadingCell(new Document::Cell("Free"));
+  t->addHeadingCell(new Document::Cell("Free inodes"));
+  t->addHeadingCell(new Document::Cell("Growth/day"));
+  t->addHeadingCell(new Document::Cell("Full in"));
+  t->newRow();
+
+  for(auto &f: forecasts) {
+    const CapacityForecast &forecast = f.second;
+    t->addCell(new Document::Cell(f.first));
+    if(!forecast.latest.when) {
+      t->addCell(new Document::Cell("never", 6, 1));
+      t->newRow();
+      continue;
+    }
+    char timestr[64];
+    time_t when = forecast.latest.when;
+    strftime(timestr, sizeof timestr, "%Y-%m-%d", localtime(&when));
+    t->addCell(new Document::Cell(timestr));
+    t->addCell(new Document::Cell(formatCount(forecast.latest.totalBytes,
+                                              "B")));
+    t->addCell(new Document::Cell(formatCount(forecast.latest.freeBytes,
+                                              "B")));
+    t->addCell(new Document::Cell(formatCount(forecast.latest.freeFiles,
+                                              "")));
+    t->addCell(new Document::Cell(forecast.growthKnown
+                                  ? formatCount(forecast.bytesPerDay, "B")
+                                  : "unknown"));
+    int days = forecast.daysUntilFull();
+    if(days >= 0) {
+      Document::Cell *c = t->addCell(new Document::Cell(new Document::String(days)));
+      if(days <= CAPACITY_WARNING_DAYS)
+        c->style = "bad";
+    } else
+      t->addCell(new Document::Cell(forecast.growthKnown ? "never" : "unknown"));
+    t->newRow();
+  }
+
+  d.append(t);
+}
+
+// Generate the backup space table
+void Report::space() {
+  Document::Table *t = new Document::Table();
+
+  t->addHeadingCell(new Document::Cell("Host", 1, 2));
+  t->addHeadingCell(new Document::Cell("Volume", 1, 2));
+  t->addHeadingCell(new Document::Cell("Device", 1, 2));
+  t->addHeadingCell(new Document::Cell("Newest backup", 4, 1));
+  t->addHeadingCell(new Document::Cell("All backups", 2, 1));
+  t->newRow();
+  t->addHeadingCell(new Document::Cell("Date"));
+  t->addHeadingCell(new Document::Cell("Size"));
+  t->addHeadingCell(new Document::Cell("Exclusive"));
+  t->addHeadingCell(new Document::Cell("Shared"));
+  t->addHeadingCell(new Document::Cell("Measured"));
+  t->addHeadingCell(new Document::Cell("Exclusive"));
+  t->newRow();
+
+  BackupSpaceMap spaces;
+  getAllBackupSpace(config.getdb(), spaces);
+  for(auto &h: config.hosts) {
+    const Host *host = h.second;
+    for(auto &v: host->volumes) {
+      const Volume *volume = v.second;
+      for(auto &d: config.devices) {
+        const Device *device = d.second;
+        const Backup *newest = nullptr;
+        BackupSpace newestSpace;
+        int measured = 0;
+        // The total exclusive space is what the volume costs on this device,
+        // as of when each backup was measured.
+        int64_t exclusiveBytes = 0;
+        for(const Backup *backup: volume->backups) {
+          if(backup->deviceName != device->name
+             || backup->getStatus() != COMPLETE)
+            continue;
+          auto it = spaces.find(BackupSpaceKey(host->name, volume->name,
+                                               device->name, backup->id));
+          if(it == spaces.end())
+            continue;
+          const BackupSpace &space = it->second;
+          ++measured;
+          exclusiveBytes += space.exclusiveBytes;
+          newest = backup;
+          newestSpace = space;
+        }
+        if(!measured)
+          continue;
+        t->addCell(new Document::Cell(host->name));
+        t->addCell(new Document::Cell(volume->name));
+        t->addCell(new Document::Cell(device->name));
+        t->addCell(new Document::Cell(newest->date.toString()));
+        t->addCell(new Document::Cell(formatCount(newestSpace.totalBytes,
+                                                  "B")));
+        t->addCell(new Document::Cell(formatCount(newestSpace.exclusiveBytes,
+                                                  "B")));
+        t->addCell(new Document::Cell(formatCount(newestSpace.sharedBytes(),
+                                                  "B")));
+        t->addCell(new Document::Cell(new Document::String(measured)));
+        t->addCell(new Document::Cell(formatCount(exclusiveBytes, "B")));
+        t->newRow();
+      }
+    }
   }
+
+  d.append(t);
 }
 
 void Report::section(const std::string &n) {
@@ -404,6 +554,8 @@ void Report::section(const std::string &n) {
   else if(name == "logs") logs();
   else if(name == "prune-logs") pruneLogs(value);
   else if(name == "history-graph") historyGraph();
+  else if(name == "capacity") capacity();
+  else if(name == "space") space();
   else if(name == "h1") d.heading(value, 1);
   else if(name == "h2") d.heading(value, 2);
   else if(name == "h3") d.heading(value, 3);
@@ -413,6 +565,22 @@ void Report::section(const std::string &n) {
   // Update Conf.cc and rsbackup.5 if any new names added
 }
 
+// Set the HTML stylesheet
+void Report::setStyleSheet() {
+  if(config.stylesheet.size()) {
+    IO ssf;
+    ssf.open(config.stylesheet, "r");
+    ssf.readall(d.htmlStyleSheet);
+  } else
+    d.htmlStyleSheet = stylesheet;
+  // Include user colors in the stylesheet
+  std::stringstream ss;
+  ss << "td.bad { background-color: #" << config.colorBad << " }\n";
+  ss << "td.good { background-color: #" << config.colorGood << " }\n";
+  ss << "span.bad { color: #" << config.colorBad << " }\n";
+  d.htmlStyleSheet += ss.str();
+}
+
 // Generate the full report
 void Report::generate() {
   if(::setenv("RSBACKUP_DATE",
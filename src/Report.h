@@ -20,6 +20,9 @@
  */
 
 #include "Document.h"
+#include "Capacity.h"
+#include <map>
+#include <vector>
 
 class Volume;
 class Backup;
@@ -35,6 +38,9 @@ public:
    */
   Report(Document &d_): d(d_) {}
 
+  /** @brief Set the document's HTML stylesheet from the configuration */
+  void setStyleSheet();
+
   /** @brief Generate the report and set counters */
   void generate();
 
@@ -59,6 +65,12 @@ public:
   /** @brief Number of unknown volumes */
   int volumes_unknown = 0;
 
+  /** @brief Number of devices forecast to fill soon */
+  int devices_filling = 0;
+
+  /** @brief Images embedded in the report */
+  std::vector<Document::Image *> images;
+
 private:
   /** @brief Split up a color into RGB components */
   static void unpackColor(unsigned color, int rgb[3]);
@@ -96,11 +108,17 @@ private:
   /** @brief Generate backup history graphic */
   void historyGraph();
 
+  /** @brief Generate the device capacity table */
+  void capacity();
+
+  /** @brief Generate the backup space table */
+  void space();
+
   /** @brief Generate a named report section */
   void section(const std::string &name);
 
-  /** @brief Current backup history */
-  std::string history_png;
+  /** @brief Capacity forecasts for each device */
+  std::map<std::string, CapacityForecast> forecasts;
 };
 
 #endif /* REPORT_H */
@@ -0,0 +1,155 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "rsbackup.h"
+#include "Restore.h"
+#include "Command.h"
+#include "Conf.h"
+#include "Backup.h"
+#include "Device.h"
+#include "Host.h"
+#include "Volume.h"
+#include "Store.h"
+#include "Catalog.h"
+#include "TreeCopy.h"
+#include "Subprocess.h"
+#include "Errors.h"
+#include "Utils.h"
+#include <cerrno>
+#include <sys/stat.h>
+
+void parseRestoreSource(const std::string &spec,
+                        std::string &host,
+                        std::string &volume,
+                        std::string &path) {
+  // The path may itself contain colons
+  size_t first = spec.find(':');
+  if(first == std::string::npos)
+    throw CommandError("invalid restore source '" + spec + "'");
+  size_t second = spec.find(':', first + 1);
+  host = spec.substr(0, first);
+  if(second == std::string::npos) {
+    volume = spec.substr(first + 1);
+    path.clear();
+  } else {
+    volume = spec.substr(first + 1, second - (first + 1));
+    path = spec.substr(second + 1);
+  }
+  if(!Host::valid(host))
+    throw CommandError("invalid host name '" + host + "'");
+  if(!Volume::valid(volume))
+    throw CommandError("invalid volume name '" + volume + "'");
+}
+
+bool isRemoteDestination(const std::string &destination) {
+  size_t colon = destination.find(':');
+  return colon != std::string::npos && colon < destination.find('/');
+}
+
+const Backup *chooseRestoreBackup(const Volume *volume, const Date &date) {
+  for(auto it = volume->backups.rbegin(); it != volume->backups.rend(); ++it) {
+    const Backup *backup = *it;
+    if(backup->getStatus() != COMPLETE || date < backup->date)
+      continue;
+    const Device *device = backup->getDevice();
+    if(device && device->store)
+      return backup;
+  }
+  return nullptr;
+}
+
+// Restore to another host with rsync
+static void restoreRemote(const std::string &name,
+                          const std::string &source, bool directory,
+                          const std::string &destination) {
+  std::vector<std::string> cmd = {
+    "rsync",
+    "--archive",
+    "--sparse",
+    "--numeric-ids",
+    "--hard-links",
+    directory ? source + "/." : source,
+    destination,
+  };
+  Subprocess sp(name, cmd);
+  sp.reporting(warning_mask & WARNING_VERBOSE, !command.act);
+  if(!command.act)
+    return;
+  sp.runAndWait();
+}
+
+// Restore to this host
+static void restoreLocal(const std::string &source, bool directory,
+                         std::string destination) {
+  struct stat sb;
+  // A single file can be restored into an existing directory
+  if(!directory
+     && stat(destination.c_str(), &sb) == 0
+     && S_ISDIR(sb.st_mode))
+    destination += PATH_SEP + source.substr(source.rfind('/') + 1);
+  if(!command.act) {
+    warning(WARNING_VERBOSE, "WOULD COPY %s TO %s",
+            source.c_str(), destination.c_str());
+    return;
+  }
+  TreeCopy copy(source, destination);
+  copy.run(MAX_RESTORE_THREADS);
+  warning(WARNING_VERBOSE,
+          "restored %ju files, %ju directories, %ju links, %ju bytes",
+          (uintmax_t)copy.files, (uintmax_t)copy.directories,
+          (uintmax_t)copy.links, (uintmax_t)copy.bytes);
+  if(copy.skipped)
+    warning(WARNING_ALWAYS, "%ju items not restored to %s",
+            (uintmax_t)copy.skipped, destination.c_str());
+}
+
+void restoreBackup() {
+  std::string hostName, volumeName, path;
+  parseRestoreSource(*command.restore, hostName, volumeName, path);
+  Volume *volume = config.findVolume(hostName, volumeName);
+  if(!volume)
+    throw CommandError("no such volume as " + hostName + ":" + volumeName);
+  std::string relative;
+  if(path.size() && path[0] == '/') {
+    if(!catalogRelativePath(volume->path, path, relative))
+      throw CommandError(path + " is not in " + hostName + ":" + volumeName);
+  } else
+    relative = catalogPath(path);
+  Date date = command.date ? Date(*command.date) : Date::today();
+  config.readState();
+  config.identifyDevices(Store::Enabled);
+  const Backup *backup = chooseRestoreBackup(volume, date);
+  if(!backup)
+    throw CommandError("no complete backup of " + hostName + ":" + volumeName
+                       + " on or before " + date.toString()
+                       + " is available");
+  std::string source = backup->backupPath();
+  if(relative != ".")
+    source += PATH_SEP + relative;
+  struct stat sb;
+  if(lstat(source.c_str(), &sb) < 0)
+    throw IOError("inspecting " + source, errno);
+  const std::string &destination = *command.to;
+  warning(WARNING_VERBOSE, "restoring %s:%s:%s from %s on %s to %s",
+          hostName.c_str(), volumeName.c_str(), relative.c_str(),
+          backup->id.c_str(), backup->deviceName.c_str(),
+          destination.c_str());
+  if(isRemoteDestination(destination))
+    restoreRemote("restore/" + hostName + "/" + volumeName + "/"
+                  + backup->deviceName,
+                  source, S_ISDIR(sb.st_mode), destination);
+  else
+    restoreLocal(source, S_ISDIR(sb.st_mode), destination);
+}
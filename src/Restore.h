@@ -0,0 +1,62 @@
+// -*-C++-*-
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef RESTORE_H
+#define RESTORE_H
+/** @file Restore.h
+ * @brief Restoring from backups
+ *
+ * The restore itself is performed by @ref restoreBackup.
+ */
+
+#include "Date.h"
+#include <string>
+
+class Backup;
+class Volume;
+
+/** @brief Parse the argument to @c --restore
+ * @param spec Argument, @c HOST:VOLUME or @c HOST:VOLUME:PATH
+ * @param host Where to store host name
+ * @param volume Where to store volume name
+ * @param path Where to store path, or "" if not specified
+ *
+ * Throws @ref CommandError if @p spec is malformed.
+ */
+void parseRestoreSource(const std::string &spec,
+                        std::string &host,
+                        std::string &volume,
+                        std::string &path);
+
+/** @brief Test whether a restore destination is on another host
+ * @param destination Destination path
+ * @return @c true if @p destination has the form @c [USER@]HOST:PATH
+ *
+ * As with @c rsync, a destination is remote if it has a colon before any
+ * slash.
+ */
+bool isRemoteDestination(const std::string &destination);
+
+/** @brief Choose the backup to restore from
+ * @param volume Volume to restore
+ * @param date Date to restore to
+ * @return Most recent complete backup on or before @p date, or null pointer
+ *
+ * Only backups on available devices are considered; the most recent is
+ * chosen regardless of device.
+ */
+const Backup *chooseRestoreBackup(const Volume *volume, const Date &date);
+
+#endif /* RESTORE_H */
@@ -0,0 +1,89 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Schedule.h"
+#include "Conf.h"
+#include "Backup.h"
+#include "Volume.h"
+#include "Host.h"
+#include "Device.h"
+#include "Database.h"
+#include "Defaults.h"
+#include <algorithm>
+#include <cmath>
+
+double backupOverdue(const Volume *volume, const Device *device,
+                     const Date &today) {
+  const Volume::PerDevice *pd = volume->findDevice(device->name);
+  if(!pd)
+    return HUGE_VAL;
+  return static_cast<double>(today - pd->newest)
+    / std::max(volume->maxAge, 1);
+}
+
+void orderBackups(std::vector<PendingBackup> &pending) {
+  std::sort(pending.begin(), pending.end(),
+            [](const PendingBackup &a, const PendingBackup &b) {
+              const Host *ha = a.volume->parent, *hb = b.volume->parent;
+              if(ha->priority != hb->priority)
+                return ha->priority > hb->priority;
+              if(a.overdue != b.overdue)
+                return a.overdue > b.overdue;
+              if(ha->name != hb->name)
+                return ha->name < hb->name;
+              if(a.volume->name != b.volume->name)
+                return a.volume->name < b.volume->name;
+              return a.device->name < b.device->name;
+            });
+}
+
+void recordBackupDuration(Database &db, const Backup *backup,
+                          int64_t seconds) {
+  Database::Statement(db,
+                      "INSERT OR REPLACE INTO backup_duration"
+                      " (host,volume,device,id,seconds)"
+                      " VALUES (?,?,?,?,?)",
+                      SQL_STRING, &backup->volume->parent->name,
+                      SQL_STRING, &backup->volume->name,
+                      SQL_STRING, &backup->deviceName,
+                      SQL_STRING, &backup->id,
+                      SQL_INT64, (sqlite_int64)seconds,
+                      SQL_END).next();
+}
+
+bool predictBackupDuration(Database &db,
+                           const std::string &host,
+                           const std::string &volume,
+                           const std::string &device,
+                           int64_t &seconds) {
+  if(!db.hasTable("backup_duration"))
+    return false;
+  Database::Statement stmt(db,
+                           "SELECT seconds FROM backup_duration"
+                           " WHERE host=? AND volume=? AND device=?"
+                           " ORDER BY id DESC LIMIT ?",
+                           SQL_STRING, &host,
+                           SQL_STRING, &volume,
+                           SQL_STRING, &device,
+                           SQL_INT, SCHEDULE_DURATION_HISTORY,
+                           SQL_END);
+  bool found = false;
+  seconds = 0;
+  while(stmt.next()) {
+    seconds = std::max<int64_t>(seconds, stmt.get_int64(0));
+    found = true;
+  }
+  return found;
+}
@@ -0,0 +1,94 @@
+//-*-C++-*-
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+/** @file Schedule.h
+ * @brief Scheduling backups within a backup window
+ */
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+class Database;
+class Backup;
+class Volume;
+class Device;
+class Date;
+
+/** @brief A backup waiting to be scheduled */
+struct PendingBackup {
+  /** @brief Volume to back up */
+  Volume *volume;
+
+  /** @brief Target device */
+  Device *device;
+
+  /** @brief How overdue the backup is
+   *
+   * See @ref backupOverdue.
+   */
+  double overdue;
+
+  /** @brief Predicted duration in seconds, or -1 if unknown */
+  int64_t estimate;
+};
+
+/** @brief Compute how overdue a backup is
+ * @param volume Volume
+ * @param device Device
+ * @param today Today's date
+ * @return Days since the most recent complete backup divided by @c max-age
+ *
+ * The result is 1 when the most recent backup is exactly @c max-age days old,
+ * and @c HUGE_VAL if there is no complete backup of @p volume on @p device.
+ */
+double backupOverdue(const Volume *volume, const Device *device,
+                     const Date &today);
+
+/** @brief Put pending backups into the order they should be attempted
+ * @param pending Backups to order
+ *
+ * Backups of higher priority hosts come first.  Within a priority, the most
+ * overdue backups come first.  Ties are broken by name.
+ */
+void orderBackups(std::vector<PendingBackup> &pending);
+
+/** @brief Record how long a backup took
+ * @param db Database
+ * @param backup Backup
+ * @param seconds Elapsed time, including hooks
+ */
+void recordBackupDuration(Database &db, const Backup *backup, int64_t seconds);
+
+/** @brief Predict how long a backup will take
+ * @param db Database
+ * @param host Host name
+ * @param volume Volume name
+ * @param device Device name
+ * @param seconds Where to store the predicted duration
+ * @return @c true if a prediction was possible
+ *
+ * The prediction is the longest of the last few backups of the volume to the
+ * device.
+ */
+bool predictBackupDuration(Database &db,
+                           const std::string &host,
+                           const std::string &volume,
+                           const std::string &device,
+                           int64_t &seconds);
+
+#endif /* SCHEDULE_H */
@@ -0,0 +1,127 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Shard.h"
+#include "Utils.h"
+#include <algorithm>
+#include <set>
+#include <cstring>
+#include <fnmatch.h>
+
+bool parseListingLine(const std::string &line, std::string &name) {
+  // Permissions, size, date and time are followed by a single space and the
+  // name
+  size_t pos = 0;
+  for(int field = 0; field < 4; ++field) {
+    while(pos < line.size() && line[pos] == ' ')
+      ++pos;
+    size_t start = pos;
+    while(pos < line.size() && line[pos] != ' ')
+      ++pos;
+    if(pos == start || pos >= line.size())
+      return false;
+    if(field == 0
+       && (pos != 10 || !strchr("-dlcbps", line[0])))
+      return false;
+  }
+  std::string raw = line.substr(pos + 1);
+  if(line[0] == 'l') {
+    size_t arrow = raw.find(" -> ");
+    if(arrow != std::string::npos)
+      raw.erase(arrow);
+  }
+  name = unescapeRsync(raw);
+  return name.size() && name != ".";
+}
+
+std::string filterPattern(const std::string &name) {
+  // Backslashes are only escapes in patterns that contain wildcards
+  if(name.find_first_of("*?[") == std::string::npos)
+    return name;
+  std::string pattern;
+  for(char c: name) {
+    if(strchr("*?[\\", c))
+      pattern += '\\';
+    pattern += c;
+  }
+  return pattern;
+}
+
+std::vector<std::vector<std::string>>
+shardFilters(const std::vector<std::vector<std::string>> &groups,
+             int count,
+             const std::vector<std::string> &names) {
+  std::vector<std::vector<std::string>> result;
+  // Paths belonging to explicit groups
+  std::vector<std::string> claimed;
+  for(auto &group: groups) {
+    // Directories containing the paths must be included, but not the rest of
+    // their contents
+    std::vector<std::string> parents, filters;
+    std::set<std::string> seen;
+    for(auto &path: group) {
+      for(size_t slash = path.find('/'); slash != std::string::npos;
+          slash = path.find('/', slash + 1)) {
+        std::string parent = path.substr(0, slash);
+        if(seen.insert(parent).second)
+          parents.push_back(parent);
+      }
+      claimed.push_back(path);
+    }
+    for(auto &parent: parents)
+      filters.push_back("--include=/" + parent + "/");
+    for(auto &path: group)
+      filters.push_back("--include=/" + path);
+    for(auto &parent: parents)
+      filters.push_back("--exclude=/" + parent + "/*");
+    filters.push_back("--exclude=/*");
+    result.push_back(filters);
+  }
+  // Divide up the top-level names that are not in any group
+  std::vector<std::string> remaining;
+  for(auto &name: names) {
+    bool found = false;
+    for(auto &path: claimed)
+      if(path.find('/') == std::string::npos
+         && fnmatch(path.c_str(), name.c_str(), 0) == 0)
+        found = true;
+    if(!found)
+      remaining.push_back(name);
+  }
+  std::sort(remaining.begin(), remaining.end());
+  count = std::max(count, 1);
+  std::vector<std::vector<std::string>> parts(count);
+  for(size_t n = 0; n < remaining.size(); ++n)
+    parts[n % count].push_back(filterPattern(remaining[n]));
+  std::vector<std::string> excludes;
+  for(auto &path: claimed)
+    excludes.push_back("--exclude=/" + path);
+  for(int n = 0; n + 1 < count; ++n) {
+    if(parts[n].empty())
+      continue;
+    std::vector<std::string> filters = excludes;
+    for(auto &pattern: parts[n])
+      filters.push_back("--include=/" + pattern);
+    filters.push_back("--exclude=/*");
+    result.push_back(filters);
+  }
+  // The last shard takes everything else
+  std::vector<std::string> filters = excludes;
+  for(int n = 0; n + 1 < count; ++n)
+    for(auto &pattern: parts[n])
+      filters.push_back("--exclude=/" + pattern);
+  result.push_back(filters);
+  return result;
+}
@@ -0,0 +1,75 @@
+// -*-C++-*-
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef SHARD_H
+#define SHARD_H
+/** @file Shard.h
+ * @brief Splitting a backup between several rsync processes
+ *
+ * A single rsync process builds its file list in one thread and transfers
+ * over one connection, which limits how fast a volume with very many files
+ * can be backed up.  A volume can instead be divided into shards, each
+ * backed up by its own rsync into the same backup directory at the same
+ * time.
+ *
+ * Each shard runs over the whole volume, with filter rules that confine it
+ * to its own part.  rsync does not descend into excluded directories, so
+ * each shard only walks its own part of the volume, and only deletes and
+ * links files within it.
+ *
+ * Explicitly configured groups of paths each get a shard.  Everything else
+ * is divided between the remaining shards by top-level name.  The last of
+ * these shards excludes what all the others include, rather than including
+ * particular names, so that anything created after the volume was listed is
+ * still backed up.
+ */
+
+#include <string>
+#include <vector>
+
+/** @brief Parse a line of <tt>rsync --list-only</tt> output
+ * @param line Line of output
+ * @param name Set to the name of the item
+ * @return @c true if @p line describes an item other than "."
+ *
+ * Characters escaped by rsync as <tt>\#ooo</tt> are restored.  For symbolic
+ * links the link target is removed.
+ */
+bool parseListingLine(const std::string &line, std::string &name);
+
+/** @brief Convert a file name to an rsync filter pattern that matches it
+ * @param name File name
+ * @return Pattern matching @p name
+ */
+std::string filterPattern(const std::string &name);
+
+/** @brief Compute the filter options for each shard
+ * @param groups Groups of paths, each backed up by a shard of its own
+ * @param count Number of shards to back up everything else
+ * @param names Top-level names in the volume, if @p count exceeds 1
+ * @return rsync filter options for each shard
+ *
+ * Paths in @p groups are relative to the root of the volume and may
+ * contain rsync wildcards, but not "**".
+ *
+ * Shards that would have nothing to back up are omitted, so the result may
+ * have fewer than <tt>groups.size() + count</tt> members.
+ */
+std::vector<std::vector<std::string>>
+shardFilters(const std::vector<std::vector<std::string>> &groups,
+             int count,
+             const std::vector<std::string> &names);
+
+#endif /* SHARD_H */
@@ -0,0 +1,121 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Snapshot.h"
+#include "Subprocess.h"
+#include "Defaults.h"
+#include "Utils.h"
+#include <cstdlib>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#if HAVE_SYS_VFS_H
+# include <sys/vfs.h>
+#endif
+#if HAVE_LINUX_FS_H
+# include <linux/fs.h>
+#endif
+
+// From linux/magic.h
+#define BTRFS_SUPER_MAGIC 0x9123683E
+
+// Inode number of the root of every btrfs subvolume
+#define BTRFS_FIRST_FREE_OBJECTID 256
+
+const char *snapshotMethodName(SnapshotMethod method) {
+  switch(method) {
+  case SnapshotNone: return "none";
+  case SnapshotBtrfs: return "btrfs";
+  case SnapshotReflink: return "reflink";
+  }
+  return "unknown";
+}
+
+// Test whether PATH is on btrfs
+static bool isBtrfs(const std::string &path) {
+#if HAVE_SYS_VFS_H
+  struct statfs sfs;
+  if(statfs(path.c_str(), &sfs) < 0)
+    return false;
+  return static_cast<unsigned long>(sfs.f_type) == BTRFS_SUPER_MAGIC;
+#else
+  (void)path;
+  return false;
+#endif
+}
+
+// Test whether files in PATH can be reflinked
+static bool canReflink(const std::string &path) {
+#ifdef FICLONE
+  std::string src = path + PATH_SEP + ".rsbackup-reflink-XXXXXX";
+  std::string dst = src;
+  int srcfd = mkstemp(&src[0]);
+  if(srcfd < 0)
+    return false;
+  bool ok = false;
+  int dstfd = mkstemp(&dst[0]);
+  if(dstfd >= 0) {
+    ok = write(srcfd, "x", 1) == 1 && ioctl(dstfd, FICLONE, srcfd) == 0;
+    close(dstfd);
+    unlink(dst.c_str());
+  }
+  close(srcfd);
+  unlink(src.c_str());
+  D("canReflink %s: %s", path.c_str(), ok ? "yes" : "no");
+  return ok;
+#else
+  (void)path;
+  return false;
+#endif
+}
+
+SnapshotMethod detectSnapshotMethod(const std::string &path) {
+  if(isBtrfs(path) && Subprocess::pathSearch("btrfs").size())
+    return SnapshotBtrfs;
+  if(canReflink(path))
+    return SnapshotReflink;
+  return SnapshotNone;
+}
+
+bool isSubvolume(const std::string &path) {
+  struct stat sb;
+  if(lstat(path.c_str(), &sb) < 0 || !S_ISDIR(sb.st_mode))
+    return false;
+  return sb.st_ino == BTRFS_FIRST_FREE_OBJECTID && isBtrfs(path);
+}
+
+std::vector<std::string> snapshotCommand(SnapshotMethod method,
+                                         const std::string &from,
+                                         const std::string &to) {
+  switch(method) {
+  case SnapshotBtrfs:
+    return { "btrfs", "subvolume", "snapshot", from, to };
+  case SnapshotReflink:
+    return { "cp", "--archive", "--reflink=always", from, to };
+  case SnapshotNone:
+    break;
+  }
+  throw std::logic_error("snapshotCommand");
+}
+
+std::vector<std::string> createSubvolumeCommand(const std::string &path) {
+  return { "btrfs", "subvolume", "create", path };
+}
+
+std::vector<std::string> deleteSubvolumeCommand(const std::string &path) {
+  return { "btrfs", "subvolume", "delete", path };
+}
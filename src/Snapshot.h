@@ -0,0 +1,83 @@
+// -*-C++-*-
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+/** @file Snapshot.h
+ * @brief Filesystem-native snapshots of backups
+ */
+
+#include <string>
+#include <vector>
+
+/** @brief Ways of creating a new backup from the previous one */
+enum SnapshotMethod {
+  /** @brief Fresh directory, with unchanged files hard-linked by rsync */
+  SnapshotNone,
+
+  /** @brief btrfs subvolume snapshot */
+  SnapshotBtrfs,
+
+  /** @brief Reflink clone */
+  SnapshotReflink,
+};
+
+/** @brief Return the name of a snapshot method
+ * @param method Snapshot method
+ * @return Name of @p method
+ */
+const char *snapshotMethodName(SnapshotMethod method);
+
+/** @brief Find the best snapshot method supported by a filesystem
+ * @param path Directory within the filesystem
+ * @return Snapshot method to use
+ *
+ * btrfs is detected from the filesystem type, and requires the @c btrfs
+ * command.  Reflink support is detected by trying to clone a temporary file
+ * in @p path.  If neither is available, returns @ref SnapshotNone.
+ */
+SnapshotMethod detectSnapshotMethod(const std::string &path);
+
+/** @brief Test whether a path is a btrfs subvolume
+ * @param path Path to test
+ * @return @c true if @p path is the root of a btrfs subvolume
+ */
+bool isSubvolume(const std::string &path);
+
+/** @brief Construct a command to create a snapshot
+ * @param method Snapshot method
+ * @param from Existing directory
+ * @param to New directory, which must not exist
+ * @return Command to create @p to as a snapshot of @p from
+ *
+ * For @ref SnapshotBtrfs, @p from must be a subvolume.
+ */
+std::vector<std::string> snapshotCommand(SnapshotMethod method,
+                                         const std::string &from,
+                                         const std::string &to);
+
+/** @brief Construct a command to create an empty btrfs subvolume
+ * @param path New subvolume, which must not exist
+ * @return Command to create @p path
+ */
+std::vector<std::string> createSubvolumeCommand(const std::string &path);
+
+/** @brief Construct a command to delete a btrfs subvolume
+ * @param path Subvolume to delete
+ * @return Command to delete @p path
+ */
+std::vector<std::string> deleteSubvolumeCommand(const std::string &path);
+
+#endif /* SNAPSHOT_H */
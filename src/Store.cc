@@ -24,24 +24,58 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
-// Identify the device on this store, if any
-void Store::identify() {
+// Read the device ID from this store
+void Store::probe() {
+  if(probed)
+    return;
+  probed = true;
   IO *f = nullptr;
   try {
-    struct stat sb;
+    try {
+      struct stat sb;
+
+      if(stat(path.c_str(), &sb) < 0)
+        throw BadStore("store '" + path + "' does not exist");
+      probedOwner = sb.st_uid;
+      probedMode = sb.st_mode;
+      // Read the device name
+      f = new IO();
+      f->open(path + PATH_SEP + "device-id", "r");
+      if(!f->readline(probedDeviceName))
+        throw BadStore("store '" + path + "' has a malformed device-id");
+      probedFile = f;
+      // Measure free space while we're here.  Failure is not fatal.
+      try {
+        usage.measure(path);
+      } catch(IOError &) {
+        usage = StoreUsage();
+      }
+    } catch(IOError &e) {
+      // Re-throw with the appropriate error type
+      if(e.errno_value == ENOENT)
+        throw UnavailableStore(e.what());
+      else
+        throw BadStore(e.what());
+    }
+  } catch(...) {
+    delete f;
+    failure = std::current_exception();
+  }
+}
 
-    if(device)
-      return;                     // already identified
-    if(stat(path.c_str(), &sb) < 0)
-      throw BadStore("store '" + path + "' does not exist");
+// Identify the device on this store, if any
+void Store::identify() {
+  if(device)
+    return;                     // already identified
+  if(!probed) {
     // Make sure backup devices are mounted
     preDeviceAccess();
-    // Read the device name
-    f = new IO();
-    f->open(path + PATH_SEP + "device-id", "r");
-    std::string deviceName;
-    if(!f->readline(deviceName))
-      throw BadStore("store '" + path + "' has a malformed device-id");
+    probe();
+  }
+  if(failure)
+    std::rethrow_exception(failure);
+  try {
+    const std::string &deviceName = probedDeviceName;
     // See if it exists
     auto devices_iterator = config.devices.find(deviceName);
     if(devices_iterator == config.devices.end())
@@ -58,9 +92,9 @@ void Store::identify() {
                             + "'");
     if(!config.publicStores) {
       // Verify permissions
-      if(sb.st_uid)
+      if(probedOwner)
         throw BadStore("store '" + path + "' not owned by root");
-      if(sb.st_mode & 077)
+      if(probedMode & 077)
         throw BadStore("store '" + path + "' is not private");
     }
     device = foundDevice;
@@ -68,15 +102,38 @@ void Store::identify() {
     // On success, leave a file open on the store to stop it being unmounted
     // while we it's a potential destination for backups; but close it before
     // unmounting.
-    closeOnUnmount(f);
-  } catch(IOError &e) {
-    // Re-throw with the appropriate error type
-    if(e.errno_value == ENOENT)
-      throw UnavailableStore(e.what());
-    else
-      throw BadStore(e.what());
+    closeOnUnmount(probedFile);
+    probedFile = nullptr;
   } catch(...) {
-    delete f;
+    delete probedFile;
+    probedFile = nullptr;
+    failure = std::current_exception();
     throw;
   }
 }
+
+void Store::forget() {
+  if(device) {
+    device->store = nullptr;
+    device = nullptr;
+  }
+  probed = false;
+  probedDeviceName.clear();
+  delete probedFile;
+  probedFile = nullptr;
+  failure = nullptr;
+  usage = StoreUsage();
+  snapshotDetected = false;
+}
+
+SnapshotMethod Store::snapshotMethod() {
+  if(!snapshotDetected) {
+    detectedSnapshotMethod = detectSnapshotMethod(path);
+    snapshotDetected = true;
+    if(warning_mask & WARNING_VERBOSE)
+      IO::out.writef("INFO: store %s snapshot method: %s\n",
+                     path.c_str(),
+                     snapshotMethodName(detectedSnapshotMethod));
+  }
+  return detectedSnapshotMethod;
+}
@@ -20,8 +20,13 @@
  */
 
 #include <string>
+#include <exception>
+#include <sys/types.h>
+#include "Capacity.h"
+#include "Snapshot.h"
 
 class Device;
+class IO;
 
 /** @brief Represents a store
  *
@@ -55,12 +60,79 @@ public:
   /** @brief State of this store */
   State state = Enabled;
 
+  /** @brief Create new backups as snapshots of the previous one, if possible
+   *
+   * Corresponds to the @c snapshot option of @c store.
+   */
+  bool snapshot = false;
+
+  /** @brief Return the snapshot method supported by this store
+   * @return Snapshot method
+   *
+   * The result is cached until forget() is called.
+   */
+  SnapshotMethod snapshotMethod();
+
   /** @brief Identify the device mounted here
    * @throw BadStore
    * @throw FatalStoreError
    * @throw UnavailableStore
+   *
+   * If probe() has not already been called, it is called first.  The outcome
+   * is recorded, so calling this again will not access the store again.
    */
   void identify();
+
+  /** @brief Read the device ID from this store
+   *
+   * This performs the filesystem accesses needed by identify(), but does not
+   * consult or modify any shared state, so it is safe to call concurrently for
+   * different stores.  Errors are recorded and reported by identify().
+   *
+   * The caller is responsible for calling preDeviceAccess() first.
+   */
+  void probe();
+
+  /** @brief Set once probe() has been called */
+  bool probed = false;
+
+  /** @brief Forget the outcome of probe() and identify()
+   *
+   * The next call to identify() will access the store again.  The caller is
+   * responsible for calling postDeviceAccess() first.
+   */
+  void forget();
+
+  /** @brief Space and inode usage measured by probe()
+   *
+   * @c usage.when is 0 if the measurement failed.
+   */
+  StoreUsage usage;
+
+private:
+  /** @brief Device ID read by probe() */
+  std::string probedDeviceName;
+
+  /** @brief Owner of the store */
+  uid_t probedOwner = 0;
+
+  /** @brief Permissions of the store */
+  mode_t probedMode = 0;
+
+  /** @brief Open device-id file
+   *
+   * Passed to closeOnUnmount() on success.
+   */
+  IO *probedFile = nullptr;
+
+  /** @brief Exception raised by probe() or identify(), if any */
+  std::exception_ptr failure;
+
+  /** @brief Set once the snapshot method has been detected */
+  bool snapshotDetected = false;
+
+  /** @brief Detected snapshot method */
+  SnapshotMethod detectedSnapshotMethod = SnapshotNone;
 };
 
 #endif /* STORE_H */
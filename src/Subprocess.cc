@@ -21,6 +21,7 @@
 #include <csignal>
 #include <cerrno>
 #include <cstdlib>
+#include <cstring>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/time.h>
@@ -41,6 +42,8 @@ Subprocess::~Subprocess() {
     try {
       if(eventloop)
         wait(0);
+      else if(background)
+        waitBackground(0);
     } catch(...) {
     }
   }
@@ -68,14 +71,29 @@ void Subprocess::capture(int childFD, std::string *s, int otherChildFD) {
   captures[p[0]] = s;
 }
 
+void Subprocess::captureLines(int childFD, const LineHandler &handler) {
+  int p[2];
+  if(pipe(p) < 0)
+    throw IOError("creating pipe", errno);
+  addChildFD(childFD, p[1], p[0]);
+  lineCaptures[p[0]].handler = handler;
+}
+
 pid_t Subprocess::run() {
   assert(!eventloop);
   eventloop = new EventLoop();
-  return launch(eventloop);
+  return launch();
 }
 
-pid_t Subprocess::launch(EventLoop *e) {
-  assert(e);                            // EventLoop must already exist
+pid_t Subprocess::runBackground() {
+  assert(!eventloop);
+  if(captures.size() || lineCaptures.size())
+    throw std::logic_error("Subprocess::runBackground with captured output");
+  background = true;
+  return launch();
+}
+
+pid_t Subprocess::launch() {
   if(pid >= 0)
     throw std::logic_error("Subprocess::run but already running");
   // Report if necessary
@@ -152,9 +170,28 @@ pid_t Subprocess::launch(EventLoop *e) {
 }
 
 void Subprocess::onReadable(EventLoop *e, int fd, const void *ptr, size_t n) {
-  if(n)
+  auto it = lineCaptures.find(fd);
+  if(it != lineCaptures.end()) {
+    LineCapture &lc = it->second;
+    const char *s = static_cast<const char *>(ptr), *end = s + n;
+    const char *nl;
+    while((nl = static_cast<const char *>(memchr(s, '\n', end - s)))) {
+      if(lc.partial.size()) {
+        lc.partial.append(s, nl - s);
+        lc.handler(lc.partial);
+        lc.partial.clear();
+      } else
+        lc.handler(std::string(s, nl - s));
+      s = nl + 1;
+    }
+    lc.partial.append(s, end - s);
+    if(!n && lc.partial.size()) {
+      lc.handler(lc.partial);
+      lc.partial.clear();
+    }
+  } else if(n)
     captures[fd]->append((char *)ptr, n);
-  else
+  if(!n)
     e->cancelRead(fd);
 }
 
@@ -170,8 +207,11 @@ void Subprocess::onTimeout(EventLoop *, const struct timespec &) {
 
 void Subprocess::onWait(EventLoop *, pid_t, int status, const struct rusage &) {
   this->status = status;
-  if(actionlist)
+  if(actionlist) {
+    // The process has been reaped, so the destructor must not kill it
+    pid = -1;
     actionlist->completed(this, getActionStatus());
+  }
 }
 
 bool Subprocess::getActionStatus() const {
@@ -183,6 +223,8 @@ void Subprocess::setup(EventLoop *e) {
     throw std::logic_error("Subprocess::setup but not running");
   for(auto &c: captures)
     e->whenReadable(c.first, static_cast<Reactor *>(this));
+  for(auto &c: lineCaptures)
+    e->whenReadable(c.first, static_cast<Reactor *>(this));
   if(timeout > 0) {
     struct timespec timeLimit;
     getMonotonicTime(timeLimit);
@@ -202,6 +244,11 @@ int Subprocess::wait(unsigned waitBehavior) {
   delete eventloop;
   eventloop = nullptr;
   pid = -1;
+  checkStatus(waitBehavior);
+  return status;
+}
+
+void Subprocess::checkStatus(unsigned waitBehavior) const {
   if(waitBehavior & THROW_ON_ERROR) {
     if(WIFEXITED(status) && WEXITSTATUS(status))
       throw SubprocessFailed(cmd[0], status);
@@ -214,12 +261,24 @@ int Subprocess::wait(unsigned waitBehavior) {
     if(WIFSIGNALED(status) && WTERMSIG(status) == SIGPIPE)
       throw SubprocessFailed(cmd[0], status);
   }
+}
+
+int Subprocess::waitBackground(unsigned waitBehavior) {
+  if(!background)
+    throw std::logic_error("Subprocess::waitBackground but not in background");
+  while(waitpid(pid, &status, 0) < 0) {
+    if(errno != EINTR)
+      throw SystemError("waitpid", errno);
+  }
+  background = false;
+  pid = -1;
+  checkStatus(waitBehavior);
   return status;
 }
 
 void Subprocess::go(EventLoop *e, ActionList *al) {
   actionlist = al;
-  launch(e);
+  launch();
   setup(e);
 }
 
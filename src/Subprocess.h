@@ -22,6 +22,7 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <functional>
 #include <sys/types.h>
 #include "EventLoop.h"
 #include "Action.h"
@@ -132,6 +133,22 @@ public:
    */
   void capture(int childFD, std::string *s, int otherChildFD=-1);
 
+  /** @brief Type of a line handler
+   *
+   * Called with each line of output, without its newline.
+   */
+  typedef std::function<void(const std::string &)> LineHandler;
+
+  /** @brief Process output from the child a line at a time
+   * @param childFD Child file descriptor to read
+   * @param handler Called for each line of output
+   *
+   * Lines are passed to @p handler as they arrive, so output need not be held
+   * in memory.  A final line with no newline is passed on when the child
+   * closes @p childFD.
+   */
+  void captureLines(int childFD, const LineHandler &handler);
+
   /** @brief Set an environment variable in the child
    * @param name Environment variable name
    * @param value Environment variable value
@@ -192,6 +209,26 @@ public:
     return wait(waitBehaviour);
   }
 
+  /** @brief Start subprocess in the background
+   * @return Process ID
+   *
+   * No event loop is used, so other subprocesses may be run (including with
+   * @ref runAndWait) while this one is still going.  Output cannot be
+   * captured; use @ref addChildFD to send it to a file instead.  The timeout
+   * is not enforced.
+   *
+   * The subprocess must be collected with @ref waitBackground.
+   */
+  pid_t runBackground();
+
+  /** @brief Wait for a background subprocess
+   * @param waitBehaviour How to check exit status
+   * @return Wait status
+   *
+   * @p waitBehaviour is as for @ref wait.
+   */
+  int waitBackground(unsigned waitBehaviour = THROW_ON_ERROR|THROW_ON_CRASH);
+
   /** @brief Return the wait status
    * @return Wait status
    *
@@ -269,11 +306,32 @@ private:
    */
   std::map<int, std::string *> captures;
 
+  /** @brief Line-at-a-time output from the child */
+  struct LineCapture {
+    /** @brief Handler for complete lines */
+    LineHandler handler;
+
+    /** @brief Incomplete final line */
+    std::string partial;
+  };
+
+  /** @brief Outputs to process a line at a time
+   *
+   * Keys are file descriptors to read from.
+   */
+  std::map<int, LineCapture> lineCaptures;
+
   /** @brief Launch subprocess
-   * @param e Event loop
    * @return Process ID
    */
-  pid_t launch(EventLoop *e);
+  pid_t launch();
+
+  /** @brief Check a wait status
+   * @param waitBehaviour How to check exit status
+   *
+   * Throws @ref SubprocessFailed as described for @ref wait.
+   */
+  void checkStatus(unsigned waitBehaviour) const;
 
   /** @brief Setup event loop integration
    * @param e Event loop
@@ -302,6 +360,9 @@ private:
   /** @brief Private event loop */
   EventLoop *eventloop = nullptr;
 
+  /** @brief Set if running in the background */
+  bool background = false;
+
   /** @brief True if the command has been logged */
   bool reported = false;
 
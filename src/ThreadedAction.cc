@@ -0,0 +1,73 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "ThreadedAction.h"
+#include "Errors.h"
+#include "Utils.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+ThreadedAction::~ThreadedAction() {
+  if(thread.joinable())
+    thread.join();
+}
+
+void ThreadedAction::go(EventLoop *e, ActionList *al) {
+  if(!e) {
+    try {
+      work();
+    } catch(...) {
+      failure = std::current_exception();
+    }
+    al->completed(this, finished(failure));
+    return;
+  }
+  int p[2];
+  if(pipe(p) < 0)
+    throw SystemError("pipe", errno);
+  fcntl(p[0], F_SETFD, FD_CLOEXEC);
+  fcntl(p[1], F_SETFD, FD_CLOEXEC);
+  nonblock(p[0]);
+  actionList = al;
+  e->whenReadable(p[0], this);
+  // The thread closes the write end when it is done, so the event loop sees
+  // end of file
+  int done = p[1];
+  thread = std::thread([this, done]() {
+      try {
+        work();
+      } catch(...) {
+        failure = std::current_exception();
+      }
+      close(done);
+    });
+}
+
+void ThreadedAction::onReadable(EventLoop *e, int fd, const void *, size_t n) {
+  if(n == 0)
+    complete(e, fd);
+}
+
+void ThreadedAction::onReadError(EventLoop *e, int fd, int) {
+  complete(e, fd);
+}
+
+void ThreadedAction::complete(EventLoop *e, int fd) {
+  e->cancelRead(fd);
+  close(fd);
+  thread.join();
+  actionList->completed(this, finished(failure));
+}
@@ -0,0 +1,90 @@
+// -*-C++-*-
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef THREADEDACTION_H
+#define THREADEDACTION_H
+/** @file ThreadedAction.h
+ * @brief Actions that run in a background thread
+ */
+
+#include "Action.h"
+#include "EventLoop.h"
+#include <exception>
+#include <thread>
+
+/** @brief An action that does blocking work in a background thread
+ *
+ * This allows work that blocks, such as reading files, to run concurrently
+ * with other actions in the same @ref ActionList.  The thread signals its
+ * completion to the event loop through a pipe, and the action is then
+ * completed in the event loop's thread.
+ *
+ * If the @ref ActionList has no event loop then the work is done
+ * synchronously instead.
+ */
+class ThreadedAction: public Action, private Reactor {
+public:
+  /** @brief Constructor
+   * @param name Action name
+   */
+  ThreadedAction(const std::string &name): Action(name) {}
+
+  /** @brief Destructor
+   *
+   * Waits for the background thread if it is still running.
+   */
+  ~ThreadedAction() override;
+
+  void go(EventLoop *e, ActionList *al) override;
+
+protected:
+  /** @brief Do the work
+   *
+   * Called in a background thread, so it must not use any shared state
+   * without appropriate locking.  Any exception it raises is passed to @ref
+   * finished.
+   */
+  virtual void work() = 0;
+
+  /** @brief Called when the work is finished
+   * @param failure Exception raised by @ref work, or a null pointer
+   * @return @c true if the action succeeded
+   *
+   * Called in the event loop's thread.
+   */
+  virtual bool finished(std::exception_ptr failure) = 0;
+
+private:
+  void onReadable(EventLoop *e, int fd, const void *ptr, size_t n) override;
+
+  void onReadError(EventLoop *e, int fd, int errno_value) override;
+
+  /** @brief Wait for the thread and complete the action
+   * @param e Event loop
+   * @param fd Read end of completion pipe
+   */
+  void complete(EventLoop *e, int fd);
+
+  /** @brief Background thread */
+  std::thread thread;
+
+  /** @brief Exception raised by @ref work */
+  std::exception_ptr failure;
+
+  /** @brief Containing action list */
+  ActionList *actionList = nullptr;
+};
+
+#endif /* THREADEDACTION_H */
@@ -0,0 +1,162 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Transfer.h"
+#include "Conf.h"
+#include "Backup.h"
+#include "Volume.h"
+#include "Host.h"
+#include "Database.h"
+#include <cctype>
+
+/** @brief A recorded statistic */
+struct TransferField {
+  /** @brief Start of the line, including the colon */
+  const char *prefix;
+
+  /** @brief Where to store the value */
+  int64_t TransferStats::*value;
+};
+
+// rsync 3.1 and later report "regular files transferred"; older versions
+// just say "files transferred".
+static const TransferField fields[] = {
+  { "Number of files:", &TransferStats::files },
+  { "Number of regular files transferred:", &TransferStats::filesTransferred },
+  { "Number of files transferred:", &TransferStats::filesTransferred },
+  { "Total file size:", &TransferStats::totalSize },
+  { "Total transferred file size:", &TransferStats::transferredSize },
+  { "Literal data:", &TransferStats::literalBytes },
+  { "Matched data:", &TransferStats::matchedBytes },
+  { "Total bytes sent:", &TransferStats::bytesSent },
+  { "Total bytes received:", &TransferStats::bytesReceived },
+};
+
+// Statistics that are not recorded
+static const char *const ignored[] = {
+  "Number of created files:",
+  "Number of deleted files:",
+  "File list size:",
+  "File list generation time:",
+  "File list transfer time:",
+  "sent ",
+  "total size is ",
+};
+
+static bool startsWith(const std::string &line, const char *prefix) {
+  return line.compare(0, std::string::traits_type::length(prefix), prefix)
+    == 0;
+}
+
+bool TransferStats::parse(const std::string &line) {
+  if(line.empty())
+    return true;
+  for(auto &field: fields) {
+    if(!startsWith(line, field.prefix))
+      continue;
+    // Numbers may have thousands separators
+    size_t pos = std::string::traits_type::length(field.prefix);
+    while(pos < line.size() && line[pos] == ' ')
+      ++pos;
+    int64_t n = 0;
+    bool digits = false;
+    for(; pos < line.size(); ++pos) {
+      if(isdigit(static_cast<unsigned char>(line[pos]))) {
+        n = n * 10 + (line[pos] - '0');
+        digits = true;
+      } else if(line[pos] != ',')
+        break;
+    }
+    if(digits) {
+      this->*field.value = n;
+      valid = true;
+    }
+    return true;
+  }
+  for(auto prefix: ignored)
+    if(startsWith(line, prefix))
+      return true;
+  return false;
+}
+
+void TransferStats::add(const TransferStats &that) {
+  if(!that.valid)
+    return;
+  files += that.files;
+  filesTransferred += that.filesTransferred;
+  totalSize += that.totalSize;
+  transferredSize += that.transferredSize;
+  literalBytes += that.literalBytes;
+  matchedBytes += that.matchedBytes;
+  bytesSent += that.bytesSent;
+  bytesReceived += that.bytesReceived;
+  valid = true;
+}
+
+void TransferStats::record(Database &db, const Backup *backup) const {
+  Database::Statement(db,
+                      "INSERT OR REPLACE INTO backup_transfer"
+                      " (host,volume,device,id,link_dests,files,"
+                      "files_transferred,total_size,transferred_size,"
+                      "literal_bytes,matched_bytes,bytes_sent,bytes_received)"
+                      " VALUES (?,?,?,?,?,?,?,?,?,?,?,?,?)",
+                      SQL_STRING, &backup->volume->parent->name,
+                      SQL_STRING, &backup->volume->name,
+                      SQL_STRING, &backup->deviceName,
+                      SQL_STRING, &backup->id,
+                      SQL_INT, linkDests,
+                      SQL_INT64, (sqlite_int64)files,
+                      SQL_INT64, (sqlite_int64)filesTransferred,
+                      SQL_INT64, (sqlite_int64)totalSize,
+                      SQL_INT64, (sqlite_int64)transferredSize,
+                      SQL_INT64, (sqlite_int64)literalBytes,
+                      SQL_INT64, (sqlite_int64)matchedBytes,
+                      SQL_INT64, (sqlite_int64)bytesSent,
+                      SQL_INT64, (sqlite_int64)bytesReceived,
+                      SQL_END).next();
+}
+
+bool TransferStats::retrieve(Database &db,
+                             const std::string &host,
+                             const std::string &volume,
+                             const std::string &device,
+                             const std::string &id) {
+  if(!db.hasTable("backup_transfer"))
+    return false;
+  Database::Statement stmt(db,
+                           "SELECT link_dests,files,files_transferred,"
+                           "total_size,transferred_size,literal_bytes,"
+                           "matched_bytes,bytes_sent,bytes_received"
+                           " FROM backup_transfer"
+                           " WHERE host=? AND volume=? AND device=? AND id=?",
+                           SQL_STRING, &host,
+                           SQL_STRING, &volume,
+                           SQL_STRING, &device,
+                           SQL_STRING, &id,
+                           SQL_END);
+  if(!stmt.next())
+    return false;
+  linkDests = stmt.get_int(0);
+  files = stmt.get_int64(1);
+  filesTransferred = stmt.get_int64(2);
+  totalSize = stmt.get_int64(3);
+  transferredSize = stmt.get_int64(4);
+  literalBytes = stmt.get_int64(5);
+  matchedBytes = stmt.get_int64(6);
+  bytesSent = stmt.get_int64(7);
+  bytesReceived = stmt.get_int64(8);
+  valid = true;
+  return true;
+}
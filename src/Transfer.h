@@ -0,0 +1,102 @@
+// -*-C++-*-
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef TRANSFER_H
+#define TRANSFER_H
+/** @file Transfer.h
+ * @brief Transfer statistics reported by rsync
+ *
+ * Backups are made with @c rsync @c --stats and the statistics recorded in
+ * the database, so that the effect of options such as the number of @c
+ * --link-dest directories can be measured.
+ */
+
+#include <string>
+#include <cstdint>
+
+class Database;
+class Backup;
+
+/** @brief Statistics for one backup */
+struct TransferStats {
+  /** @brief True if any statistics have been parsed */
+  bool valid = false;
+
+  /** @brief Number of @c --link-dest directories passed to rsync */
+  int linkDests = 0;
+
+  /** @brief Number of files in the source, including directories */
+  int64_t files = 0;
+
+  /** @brief Number of regular files transferred */
+  int64_t filesTransferred = 0;
+
+  /** @brief Total size of files in the source */
+  int64_t totalSize = 0;
+
+  /** @brief Total size of files transferred */
+  int64_t transferredSize = 0;
+
+  /** @brief Bytes of file data that had to be sent */
+  int64_t literalBytes = 0;
+
+  /** @brief Bytes of file data reconstructed from existing files */
+  int64_t matchedBytes = 0;
+
+  /** @brief Bytes sent by the client */
+  int64_t bytesSent = 0;
+
+  /** @brief Bytes received by the client */
+  int64_t bytesReceived = 0;
+
+  /** @brief Parse a line of rsync output
+   * @param line Line of output, without the newline
+   * @return @c true if @p line is part of the statistics
+   *
+   * Lines that are part of the statistics, but not ones that are recorded,
+   * still return @c true, so that the caller can discard them.  Blank lines
+   * are treated the same way.
+   */
+  bool parse(const std::string &line);
+
+  /** @brief Add statistics from another rsync to these
+   * @param that Statistics to add
+   *
+   * @ref linkDests is not changed.
+   */
+  void add(const TransferStats &that);
+
+  /** @brief Record the statistics in the database
+   * @param db Database
+   * @param backup Backup the statistics belong to
+   */
+  void record(Database &db, const Backup *backup) const;
+
+  /** @brief Retrieve the statistics for a backup
+   * @param db Database
+   * @param host Host name
+   * @param volume Volume name
+   * @param device Device name
+   * @param id Backup ID
+   * @return @c true if statistics were found
+   */
+  bool retrieve(Database &db,
+                const std::string &host,
+                const std::string &volume,
+                const std::string &device,
+                const std::string &id);
+};
+
+#endif /* TRANSFER_H */
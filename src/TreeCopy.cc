@@ -0,0 +1,496 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "TreeCopy.h"
+#include "Defaults.h"
+#include "Errors.h"
+#include "IO.h"
+#include "Utils.h"
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#if HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
+
+// Size of buffer used when the kernel cannot copy data for us
+#define COPY_BUFFER_SIZE 131072
+
+// Split PATH into its parent directory and final component
+static void splitPath(const std::string &path,
+                      std::string &parent,
+                      std::string &name) {
+  size_t end = path.size();
+  while(end > 1 && path[end - 1] == '/')
+    --end;
+  size_t slash = path.rfind('/', end - 1);
+  if(slash == std::string::npos) {
+    parent = ".";
+    name = path.substr(0, end);
+  } else {
+    parent = slash ? path.substr(0, slash) : "/";
+    name = path.substr(slash + 1, end - slash - 1);
+  }
+}
+
+// Open a directory relative to DIRFD.  Returns -1 and sets errno on error.
+static int openDirectory(int dirfd, const std::string &name) {
+  return openat(dirfd, name.empty() ? "." : name.c_str(),
+                O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+}
+
+// Open a directory relative to DIRFD without following any symbolic links
+// on the way.  Returns -1 and sets errno on error.
+static int openBeneath(int dirfd, const std::string &path) {
+  int fd = openDirectory(dirfd, "");
+  size_t pos = 0;
+  while(fd >= 0 && pos < path.size()) {
+    size_t slash = path.find('/', pos);
+    if(slash == std::string::npos)
+      slash = path.size();
+    int next = openDirectory(fd, path.substr(pos, slash - pos));
+    int save_errno = errno;
+    close(fd);
+    errno = save_errno;
+    fd = next;
+    pos = slash + 1;
+  }
+  return fd;
+}
+
+TreeCopy::TreeCopy(const std::string &source,
+                   const std::string &destination_):
+  ParallelWalk(source),
+  preserveOwnership(geteuid() == 0),
+  files(0),
+  directories(0),
+  links(0),
+  bytes(0),
+  linked(0),
+  totalBytes(0),
+  removed(0),
+  vanished(0),
+  skipped(0),
+  destination(destination_) {
+}
+
+TreeCopy::~TreeCopy() {
+  if(destinationRoot >= 0)
+    close(destinationRoot);
+  for(int fd: linkRoots)
+    close(fd);
+}
+
+void TreeCopy::run(size_t threads) {
+  struct stat sb;
+  if(lstat(root.c_str(), &sb) < 0)
+    throw IOError("inspecting " + root, errno);
+  if(!S_ISDIR(sb.st_mode)) {
+    // A single item
+    std::string sourceParent, sourceName, destinationParent, destinationName;
+    splitPath(root, sourceParent, sourceName);
+    splitPath(destination, destinationParent, destinationName);
+    FileDescriptor sourceDir(openDirectory(AT_FDCWD, sourceParent));
+    if(sourceDir.fd < 0)
+      throw IOError("opening " + sourceParent, errno);
+    FileDescriptor destinationDir(openDirectory(AT_FDCWD, destinationParent));
+    if(destinationDir.fd < 0)
+      throw IOError("opening " + destinationParent, errno);
+    item(sourceDir.fd, sourceName, destinationDir.fd, destinationName, "", sb);
+    return;
+  }
+  if(mkdir(destination.c_str(), 0700) < 0 && errno != EEXIST)
+    throw IOError("creating " + destination, errno);
+  if((destinationRoot = openDirectory(AT_FDCWD, destination)) < 0)
+    throw IOError("opening " + destination, errno);
+  // Earlier copies that have gone away are just not used
+  for(auto &path: linkDests) {
+    int fd = openDirectory(AT_FDCWD, path);
+    if(fd >= 0)
+      linkRoots.push_back(fd);
+  }
+  exclusions = Exclusions(exclude);
+  rootDevice = sb.st_dev;
+  pendingDirectories.push_back({"", sb});
+  ++directories;
+  walk(threads);
+  // Hard links can only be made once their targets exist
+  for(auto &link: pendingLinks) {
+    replace(destinationRoot, link.first, link.first);
+    if(linkat(destinationRoot, link.second.c_str(),
+              destinationRoot, link.first.c_str(), 0) < 0)
+      throw IOError("linking " + destinationPath(link.first), errno);
+    ++links;
+  }
+  // Directory times can only be set once their contents are complete
+  for(auto it = pendingDirectories.rbegin(); it != pendingDirectories.rend();
+      ++it)
+    setMetadata(destinationRoot, it->first.empty() ? "." : it->first,
+                it->second, it->first);
+}
+
+void TreeCopy::directory(int dirfd, const std::string &path,
+                         const std::vector<std::string> &names) {
+  FileDescriptor destinationDir(openDirectory(destinationRoot, path));
+  if(destinationDir.fd < 0)
+    throw IOError("opening " + destinationPath(path), errno);
+  // The same directory in each earlier copy, where it exists
+  std::vector<std::unique_ptr<FileDescriptor>> linkFds;
+  std::vector<int> linkDirs;
+  for(int fd: linkRoots) {
+    linkFds.emplace_back(new FileDescriptor(openBeneath(fd, path)));
+    linkDirs.push_back(linkFds.back()->fd);
+  }
+  std::vector<std::string> copied;
+  for(auto &name: names) {
+    std::string child = join(path, name);
+    struct stat sb;
+    if(fstatat(dirfd, name.c_str(), &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+      if(errno == ENOENT && skipVanished) {
+        ++vanished;
+        continue;
+      }
+      throw IOError("inspecting " + rootPath(child), errno);
+    }
+    if(!exclusions.empty() && exclusions.excluded(child, S_ISDIR(sb.st_mode)))
+      continue;
+    item(dirfd, name, destinationDir.fd, name, child, sb, linkDirs);
+    copied.push_back(name);
+  }
+  if(mirror)
+    removeExtra(destinationDir.fd, path, copied);
+}
+
+bool TreeCopy::missing(const std::string &) {
+  if(!skipVanished)
+    return false;
+  ++vanished;
+  return true;
+}
+
+void TreeCopy::item(int sourceDir, const std::string &sourceName,
+                    int destinationDir, const std::string &destinationName,
+                    const std::string &path, const struct stat &sb,
+                    const std::vector<int> &linkDirs) {
+  const char *in = sourceName.c_str(), *out = destinationName.c_str();
+  switch(sb.st_mode & S_IFMT) {
+  case S_IFDIR: {
+    if(mkdirat(destinationDir, out, 0700) < 0) {
+      struct stat existing;
+      if(errno != EEXIST)
+        throw IOError("creating " + destinationPath(path), errno);
+      if(fstatat(destinationDir, out, &existing, AT_SYMLINK_NOFOLLOW) < 0)
+        throw IOError("inspecting " + destinationPath(path), errno);
+      if(!S_ISDIR(existing.st_mode)) {
+        replace(destinationDir, destinationName, path);
+        if(mkdirat(destinationDir, out, 0700) < 0)
+          throw IOError("creating " + destinationPath(path), errno);
+      }
+    }
+    ++directories;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      pendingDirectories.push_back({path, sb});
+    }
+    if(onItem)
+      onItem(path, sb, true);
+    // Mount points are copied, but not their contents
+    if(!oneFileSystem || sb.st_dev == rootDevice)
+      descend(path);
+    return;
+  }
+  case S_IFREG: {
+    totalBytes += sb.st_size;
+    // Copy each multiply-linked inode once, and link to the copy thereafter
+    if(destinationRoot >= 0 && sb.st_nlink > 1) {
+      bool first;
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        auto r = inodes.insert({{sb.st_dev, sb.st_ino}, path});
+        first = r.second;
+        if(!first)
+          pendingLinks.push_back({path, r.first->second});
+      }
+      if(!first) {
+        if(onItem)
+          onItem(path, sb, false);
+        return;
+      }
+    }
+    if(linkUnchanged(linkDirs, destinationDir, destinationName, path, sb)) {
+      ++linked;
+      if(onItem)
+        onItem(path, sb, false);
+      return;
+    }
+    FileDescriptor input(openat(sourceDir, in, O_RDONLY|O_NOFOLLOW|O_CLOEXEC));
+    if(input.fd < 0) {
+      if(errno == ENOENT && skipVanished) {
+        ++vanished;
+        return;
+      }
+      throw IOError("opening " + rootPath(path), errno);
+    }
+    replace(destinationDir, destinationName, path);
+    int fd = openat(destinationDir, out,
+                    O_WRONLY|O_CREAT|O_EXCL|O_NOFOLLOW|O_CLOEXEC, 0600);
+    if(fd < 0)
+      throw IOError("creating " + destinationPath(path), errno);
+    {
+      FileDescriptor output(fd);
+      copyData(input.fd, output.fd, sb.st_size, path);
+    }
+    break;
+  }
+  case S_IFLNK: {
+    std::vector<char> target(sb.st_size + 1);
+    ssize_t n;
+    // The link may have changed since it was inspected
+    while((n = readlinkat(sourceDir, in, &target[0], target.size()))
+          >= static_cast<ssize_t>(target.size()))
+      target.resize(target.size() * 2);
+    if(n < 0) {
+      if(errno == ENOENT && skipVanished) {
+        ++vanished;
+        return;
+      }
+      throw IOError("reading " + rootPath(path), errno);
+    }
+    target[n] = 0;
+    replace(destinationDir, destinationName, path);
+    if(symlinkat(&target[0], destinationDir, out) < 0)
+      throw IOError("creating " + destinationPath(path), errno);
+    break;
+  }
+  case S_IFCHR:
+  case S_IFBLK:
+    if(!preserveOwnership) {
+      ++skipped;
+      return;
+    }
+    // fall through
+  case S_IFIFO:
+  case S_IFSOCK:
+    replace(destinationDir, destinationName, path);
+    if(mknodat(destinationDir, out, sb.st_mode & (S_IFMT|0600), sb.st_rdev)
+       < 0)
+      throw IOError("creating " + destinationPath(path), errno);
+    break;
+  default:
+    ++skipped;
+    return;
+  }
+  ++files;
+  setMetadata(destinationDir, destinationName, sb, path);
+  if(onItem)
+    onItem(path, sb, true);
+}
+
+bool TreeCopy::linkUnchanged(const std::vector<int> &linkDirs,
+                             int destinationDir, const std::string &name,
+                             const std::string &path, const struct stat &sb) {
+  const char *n = name.c_str();
+  struct stat copy;
+  // A file left by an interrupted copy may already be up to date
+  if(mirror
+     && fstatat(destinationDir, n, &copy, AT_SYMLINK_NOFOLLOW) == 0
+     && unchanged(sb, copy))
+    return true;
+  // The first earlier copy with a matching file wins
+  for(int dir: linkDirs) {
+    if(dir < 0
+       || fstatat(dir, n, &copy, AT_SYMLINK_NOFOLLOW) < 0
+       || !unchanged(sb, copy))
+      continue;
+    replace(destinationDir, name, path);
+    if(linkat(dir, n, destinationDir, n, 0) == 0)
+      return true;
+    // Too many links, or a different filesystem: copy instead
+    if(errno == EMLINK || errno == EXDEV)
+      return false;
+    throw IOError("linking " + destinationPath(path), errno);
+  }
+  return false;
+}
+
+bool TreeCopy::unchanged(const struct stat &sb,
+                         const struct stat &copy) const {
+  return S_ISREG(copy.st_mode)
+    && copy.st_size == sb.st_size
+    && copy.st_mtim.tv_sec == sb.st_mtim.tv_sec
+    && copy.st_mtim.tv_nsec == sb.st_mtim.tv_nsec
+    && (copy.st_mode & 07777) == (sb.st_mode & 07777)
+    && (!preserveOwnership
+        || (copy.st_uid == sb.st_uid && copy.st_gid == sb.st_gid));
+}
+
+void TreeCopy::removeExtra(int destinationDir, const std::string &path,
+                           const std::vector<std::string> &keep) {
+  std::set<std::string> wanted(keep.begin(), keep.end());
+  for(auto &name: listDirectory(destinationDir, destinationPath(path))) {
+    if(contains(wanted, name))
+      continue;
+    std::string child = join(path, name);
+    struct stat sb;
+    if(fstatat(destinationDir, name.c_str(), &sb, AT_SYMLINK_NOFOLLOW) < 0)
+      throw IOError("inspecting " + destinationPath(child), errno);
+    // Excluded items are protected from removal
+    if(!exclusions.empty() && exclusions.excluded(child, S_ISDIR(sb.st_mode)))
+      continue;
+    removeTree(destinationDir, name, child);
+    ++removed;
+  }
+}
+
+void TreeCopy::removeTree(int dir, const std::string &name,
+                          const std::string &path) {
+  if(unlinkat(dir, name.c_str(), 0) == 0 || errno == ENOENT)
+    return;
+  if(errno != EISDIR && errno != EPERM)
+    throw IOError("removing " + destinationPath(path), errno);
+  FileDescriptor sub(openDirectory(dir, name));
+  if(sub.fd < 0)
+    throw IOError("opening " + destinationPath(path), errno);
+  for(auto &child: listDirectory(sub.fd, destinationPath(path)))
+    removeTree(sub.fd, child, join(path, child));
+  if(unlinkat(dir, name.c_str(), AT_REMOVEDIR) < 0)
+    throw IOError("removing " + destinationPath(path), errno);
+}
+
+void TreeCopy::copyData(int in, int out, off_t size, const std::string &path) {
+  off_t pos = 0;
+  while(pos < size) {
+    off_t data = pos, hole = size;
+#ifdef SEEK_HOLE
+    // Skip over holes, so that sparse files remain sparse
+    if((data = lseek(in, pos, SEEK_DATA)) < 0) {
+      if(errno == ENXIO)
+        break;                          // the rest of the file is a hole
+      data = pos;
+    } else if((hole = lseek(in, data, SEEK_HOLE)) < 0)
+      hole = size;
+#endif
+    if(data >= size)
+      break;
+    hole = std::min(hole, size);
+    copyRange(in, out, data, hole - data, path);
+    pos = hole;
+  }
+  // Extend the file over any trailing hole
+  if(ftruncate(out, size) < 0)
+    throw IOError("writing " + destinationPath(path), errno);
+}
+
+void TreeCopy::copyRange(int in, int out, off_t offset, off_t length,
+                         const std::string &path) {
+  off_t inOffset = offset, outOffset = offset, end = offset + length;
+#if HAVE_COPY_FILE_RANGE
+  // Copy in the kernel, or even share extents, if the filesystems support it
+  while(inOffset < end) {
+    ssize_t n = copy_file_range(in, &inOffset, out, &outOffset,
+                                end - inOffset, 0);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      if(errno == EXDEV || errno == ENOSYS || errno == EINVAL
+         || errno == EOPNOTSUPP)
+        break;
+      throw IOError("copying " + rootPath(path), errno);
+    }
+    if(n == 0)
+      return;                           // source has shrunk
+    bytes += n;
+  }
+#endif
+#if HAVE_SYS_SENDFILE_H
+  // Copy in the kernel
+  if(inOffset < end && lseek(out, outOffset, SEEK_SET) < 0)
+    throw IOError("writing " + destinationPath(path), errno);
+  while(inOffset < end) {
+    ssize_t n = sendfile(out, in, &inOffset, end - inOffset);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      if(errno == EINVAL || errno == ENOSYS)
+        break;
+      throw IOError("copying " + rootPath(path), errno);
+    }
+    if(n == 0)
+      return;
+    outOffset += n;
+    bytes += n;
+  }
+#endif
+  std::vector<char> buffer;
+  while(inOffset < end) {
+    if(buffer.empty())
+      buffer.resize(COPY_BUFFER_SIZE);
+    ssize_t n = pread(in, &buffer[0],
+                      std::min(static_cast<off_t>(buffer.size()),
+                               end - inOffset),
+                      inOffset);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      throw IOError("reading " + rootPath(path), errno);
+    }
+    if(n == 0)
+      return;
+    for(ssize_t written = 0; written < n;) {
+      ssize_t w = pwrite(out, &buffer[written], n - written,
+                         outOffset + written);
+      if(w < 0) {
+        if(errno == EINTR)
+          continue;
+        throw IOError("writing " + destinationPath(path), errno);
+      }
+      written += w;
+    }
+    inOffset += n;
+    outOffset += n;
+    bytes += n;
+  }
+}
+
+void TreeCopy::replace(int dir, const std::string &name,
+                       const std::string &path) {
+  if(mirror) {
+    removeTree(dir, name, path);
+    return;
+  }
+  if(unlinkat(dir, name.c_str(), 0) < 0 && errno != ENOENT)
+    throw IOError("removing " + destinationPath(path), errno);
+}
+
+void TreeCopy::setMetadata(int dir, const std::string &name,
+                           const struct stat &sb, const std::string &path) {
+  const char *n = name.c_str();
+  if(preserveOwnership
+     && fchownat(dir, n, sb.st_uid, sb.st_gid, AT_SYMLINK_NOFOLLOW) < 0)
+    throw IOError("setting ownership of " + destinationPath(path), errno);
+  // Symlink permissions are not meaningful, and cannot be set on Linux
+  if(!S_ISLNK(sb.st_mode) && fchmodat(dir, n, sb.st_mode & 07777, 0) < 0)
+    throw IOError("setting permissions of " + destinationPath(path), errno);
+  struct timespec times[2] = { sb.st_atim, sb.st_mtim };
+  if(utimensat(dir, n, times, AT_SYMLINK_NOFOLLOW) < 0)
+    throw IOError("setting times of " + destinationPath(path), errno);
+}
+
+std::string TreeCopy::destinationPath(const std::string &path) const {
+  return path.empty() ? destination : destination + PATH_SEP + path;
+}
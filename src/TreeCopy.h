@@ -0,0 +1,279 @@
+// -*-C++-*-
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef TREECOPY_H
+#define TREECOPY_H
+/** @file TreeCopy.h
+ * @brief Parallel local copying of file trees
+ */
+
+#include "ParallelWalk.h"
+#include "Exclude.h"
+#include <functional>
+#include <map>
+#include <atomic>
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/** @brief Copy a file tree, preserving as much as possible
+ *
+ * The effect is similar to @c rsync @c --archive @c --hard-links @c --sparse
+ * @c --numeric-ids with a local destination.  Directories are read and files
+ * copied by several threads at once; file data is copied in the kernel where
+ * possible, using @c copy_file_range or @c sendfile, and holes in sparse
+ * files are preserved.
+ *
+ * Existing files in the destination are replaced.  Files in the destination
+ * that are not in the source are left alone, unless @ref mirror is set.
+ *
+ * With @ref linkDests set the effect is like @c rsync @c --link-dest: files
+ * that are unchanged since an earlier copy are hard linked to it rather
+ * than copied.
+ */
+class TreeCopy: private ParallelWalk {
+public:
+  /** @brief Constructor
+   * @param source Path to copy from
+   * @param destination Path to copy to
+   *
+   * If @p source is a directory then its contents are copied into @p
+   * destination, which is created if necessary.  Otherwise @p source is
+   * copied to @p destination.
+   */
+  TreeCopy(const std::string &source, const std::string &destination);
+
+  TreeCopy(const TreeCopy &) = delete;
+  TreeCopy &operator=(const TreeCopy &) = delete;
+
+  /** @brief Destructor */
+  ~TreeCopy() override;
+
+  /** @brief Perform the copy
+   * @param threads Maximum number of threads to use
+   *
+   * Throws @ref IOError on error, after all threads have finished.
+   */
+  void run(size_t threads);
+
+  /** @brief Preserve file ownership
+   *
+   * The default is @c true if running as root.  If it is @c false then
+   * device files are not copied either.
+   */
+  bool preserveOwnership;
+
+  /** @brief Earlier copies of the source, most preferred first
+   *
+   * A regular file with the same size, modification time, permissions and
+   * (if @ref preserveOwnership is set) ownership as the corresponding file
+   * in one of these directories is hard linked to it instead of being
+   * copied.  Only used when the source is a directory.
+   */
+  std::vector<std::string> linkDests;
+
+  /** @brief Exclusion patterns
+   *
+   * Interpreted as by @ref Exclusions, relative to the source.  Excluded
+   * items are not copied, and excluded directories are not descended into.
+   */
+  std::vector<std::string> exclude;
+
+  /** @brief Don't descend into directories on other filesystems
+   *
+   * Mount points are still created, but empty.
+   */
+  bool oneFileSystem = false;
+
+  /** @brief Make the destination an exact copy of the source
+   *
+   * Items in the destination that are not in the source, and not excluded,
+   * are removed.  Regular files already in the destination that match the
+   * source are left alone.  Use this when the destination is the result of
+   * an earlier, interrupted copy.
+   */
+  bool mirror = false;
+
+  /** @brief Tolerate items that vanish during the copy
+   *
+   * If @c false, an item that disappears from the source between its
+   * directory being read and it being copied is an error.  If @c true it is
+   * counted in @ref vanished and otherwise ignored.
+   */
+  bool skipVanished = false;
+
+  /** @brief Called for each item copied
+   *
+   * The arguments are the path relative to the source, the status of the
+   * source item, and @c true if the data was copied or @c false if a regular
+   * file was hard linked or left alone.  Called concurrently from worker
+   * threads.
+   */
+  std::function<void(const std::string &, const struct stat &, bool)> onItem;
+
+  /** @brief Number of files, symlinks and special files copied */
+  std::atomic<uint64_t> files;
+
+  /** @brief Number of directories copied */
+  std::atomic<uint64_t> directories;
+
+  /** @brief Number of additional hard links created */
+  std::atomic<uint64_t> links;
+
+  /** @brief Number of bytes of file data copied */
+  std::atomic<uint64_t> bytes;
+
+  /** @brief Number of regular files hard linked from @ref linkDests or left
+   * alone because they were already present */
+  std::atomic<uint64_t> linked;
+
+  /** @brief Total size of the regular files in the source */
+  std::atomic<uint64_t> totalBytes;
+
+  /** @brief Number of items removed from the destination by @ref mirror */
+  std::atomic<uint64_t> removed;
+
+  /** @brief Number of items that vanished during the copy */
+  std::atomic<uint64_t> vanished;
+
+  /** @brief Number of items that could not be copied
+   *
+   * Device files are skipped if @ref preserveOwnership is @c false.
+   */
+  std::atomic<uint64_t> skipped;
+
+private:
+  /** @brief Path to copy to */
+  std::string destination;
+
+  /** @brief Directory descriptor for @ref destination, if the source is a
+   * directory */
+  int destinationRoot = -1;
+
+  /** @brief Directory descriptors for @ref linkDests that could be opened */
+  std::vector<int> linkRoots;
+
+  /** @brief Parsed form of @ref exclude */
+  Exclusions exclusions;
+
+  /** @brief Device containing the source */
+  dev_t rootDevice = 0;
+
+  void directory(int dirfd, const std::string &path,
+                 const std::vector<std::string> &names) override;
+
+  bool missing(const std::string &path) override;
+
+  /** @brief Try to hard link an unchanged file from an earlier copy
+   * @param linkDirs Directory descriptors within @ref linkRoots, or -1
+   * @param destinationDir Destination directory descriptor
+   * @param name Name within each directory
+   * @param path Path relative to the roots
+   * @param sb Status of source item
+   * @return @c true if the file was linked
+   */
+  bool linkUnchanged(const std::vector<int> &linkDirs,
+                     int destinationDir, const std::string &name,
+                     const std::string &path, const struct stat &sb);
+
+  /** @brief Remove items from the destination that are not in the source
+   * @param destinationDir Destination directory descriptor
+   * @param path Path relative to the roots
+   * @param keep Names to keep
+   */
+  void removeExtra(int destinationDir, const std::string &path,
+                   const std::vector<std::string> &keep);
+
+  /** @brief Remove an item from the destination, recursively
+   * @param dir Directory descriptor
+   * @param name Name within @p dir
+   * @param path Path for error messages
+   */
+  void removeTree(int dir, const std::string &name, const std::string &path);
+
+  /** @brief Test whether a source item is unchanged from a copy
+   * @param sb Status of source item
+   * @param copy Status of copy
+   * @return @c true if @p copy can stand for the source item
+   */
+  bool unchanged(const struct stat &sb, const struct stat &copy) const;
+
+  /** @brief Copy one item
+   * @param sourceDir Source directory descriptor
+   * @param sourceName Name within @p sourceDir
+   * @param destinationDir Destination directory descriptor
+   * @param destinationName Name within @p destinationDir
+   * @param path Path relative to the roots
+   * @param sb Status of source item
+   * @param linkDirs Directory descriptors within @ref linkRoots, or -1
+   */
+  void item(int sourceDir, const std::string &sourceName,
+            int destinationDir, const std::string &destinationName,
+            const std::string &path, const struct stat &sb,
+            const std::vector<int> &linkDirs = {});
+
+  /** @brief Copy the contents of a regular file
+   * @param in Source descriptor
+   * @param out Destination descriptor
+   * @param size Size of file
+   * @param path Path for error messages
+   */
+  void copyData(int in, int out, off_t size, const std::string &path);
+
+  /** @brief Copy a range of a regular file
+   * @param in Source descriptor
+   * @param out Destination descriptor
+   * @param offset Start of range
+   * @param length Length of range
+   * @param path Path for error messages
+   */
+  void copyRange(int in, int out, off_t offset, off_t length,
+                 const std::string &path);
+
+  /** @brief Remove a non-directory from the destination, if it exists
+   * @param dir Directory descriptor
+   * @param name Name within @p dir
+   * @param path Path for error messages
+   *
+   * If @ref mirror is set then a directory is removed too.
+   */
+  void replace(int dir, const std::string &name, const std::string &path);
+
+  /** @brief Set ownership and times of a copied item
+   * @param dir Directory descriptor
+   * @param name Name within @p dir
+   * @param sb Status of source item
+   * @param path Path for error messages
+   */
+  void setMetadata(int dir, const std::string &name, const struct stat &sb,
+                   const std::string &path);
+
+  /** @brief Full path of an item in the destination */
+  std::string destinationPath(const std::string &path) const;
+
+  /** @brief Multiply-linked inodes seen so far, and the first path to each */
+  std::map<std::pair<dev_t, ino_t>, std::string> inodes;
+
+  /** @brief Hard links to create once all files are copied
+   *
+   * The first member is the new link and the second its target.
+   */
+  std::vector<std::pair<std::string, std::string>> pendingLinks;
+
+  /** @brief Directories whose metadata must be set once they are complete */
+  std::vector<std::pair<std::string, struct stat>> pendingDirectories;
+};
+
+#endif /* TREECOPY_H */
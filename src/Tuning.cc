@@ -0,0 +1,261 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Tuning.h"
+#include "Conf.h"
+#include "Backup.h"
+#include "Volume.h"
+#include "Host.h"
+#include "Database.h"
+#include "Subprocess.h"
+#include "Utils.h"
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+
+void RsyncCapabilities::parse(const std::string &output) {
+  std::istringstream is(output);
+  std::string line;
+  std::vector<std::string> *list = nullptr;
+  while(std::getline(is, line)) {
+    char v[64];
+    int p;
+    if(sscanf(line.c_str(), "rsync version %63s protocol version %d",
+              v, &p) == 2) {
+      version = v;
+      protocol = p;
+      continue;
+    }
+    if(line.empty() || line[0] != ' ') {
+      // Section headings are followed by indented lists
+      if(line == "Checksum list:")
+        list = &checksums;
+      else if(line == "Compress list:")
+        list = &compressors;
+      else
+        list = nullptr;
+      continue;
+    }
+    if(!list)
+      continue;
+    std::istringstream words(line);
+    std::string word;
+    while(words >> word)
+      if(word[0] != '(')
+        list->push_back(word);
+  }
+}
+
+bool RsyncCapabilities::supportsChecksum(const std::string &name) const {
+  return std::find(checksums.begin(), checksums.end(), name)
+    != checksums.end();
+}
+
+bool RsyncCapabilities::supportsCompression(const std::string &name) const {
+  return std::find(compressors.begin(), compressors.end(), name)
+    != compressors.end();
+}
+
+// Run rsync --version
+static RsyncCapabilities probeRsync() {
+  RsyncCapabilities capabilities;
+  std::string output, errors;
+  try {
+    Subprocess sp("rsync-version", { "rsync", "--version" });
+    sp.capture(1, &output);
+    sp.capture(2, &errors);
+    if(sp.runAndWait(0) == 0)
+      capabilities.parse(output);
+  } catch(std::runtime_error &e) {
+    D("rsync --version: %s", e.what());
+  }
+  D("rsync version '%s' protocol %d, %zu checksums, %zu compressors",
+    capabilities.version.c_str(), capabilities.protocol,
+    capabilities.checksums.size(), capabilities.compressors.size());
+  return capabilities;
+}
+
+const RsyncCapabilities &RsyncCapabilities::local() {
+  static const RsyncCapabilities capabilities = probeRsync();
+  return capabilities;
+}
+
+std::vector<std::string> TransferTuning::rsyncOptions() const {
+  std::vector<std::string> options;
+  if(compress) {
+    options.push_back("--compress");
+    if(compressChoice.size())
+      options.push_back("--compress-choice=" + compressChoice);
+    if(compressLevel >= 0)
+      options.push_back("--compress-level=" + std::to_string(compressLevel));
+  }
+  if(wholeFile)
+    options.push_back("--whole-file");
+  if(fuzzy)
+    options.push_back("--fuzzy");
+  if(checksumChoice.size())
+    options.push_back("--checksum-choice=" + checksumChoice);
+  return options;
+}
+
+void TransferTuning::record(Database &db, const Backup *backup) const {
+  Database::Statement(db,
+                      "INSERT OR REPLACE INTO backup_tuning"
+                      " (host,volume,device,id,compress,compress_choice,"
+                      "compress_level,whole_file,fuzzy,checksum_choice)"
+                      " VALUES (?,?,?,?,?,?,?,?,?,?)",
+                      SQL_STRING, &backup->volume->parent->name,
+                      SQL_STRING, &backup->volume->name,
+                      SQL_STRING, &backup->deviceName,
+                      SQL_STRING, &backup->id,
+                      SQL_INT, compress ? 1 : 0,
+                      SQL_STRING, &compressChoice,
+                      SQL_INT, compressLevel,
+                      SQL_INT, wholeFile ? 1 : 0,
+                      SQL_INT, fuzzy ? 1 : 0,
+                      SQL_STRING, &checksumChoice,
+                      SQL_END).next();
+}
+
+std::vector<TransferRun> transferHistory(Database &db,
+                                         const std::string &host,
+                                         const std::string &volume,
+                                         size_t limit) {
+  std::vector<TransferRun> history;
+  if(!db.hasTable("backup_transfer")
+     || !db.hasTable("backup_duration")
+     || !db.hasTable("backup_tuning"))
+    return history;
+  Database::Statement stmt(db,
+                           "SELECT t.link_dests,t.files,t.files_transferred,"
+                           "t.total_size,t.transferred_size,t.literal_bytes,"
+                           "t.matched_bytes,t.bytes_sent,t.bytes_received,"
+                           "d.seconds,"
+                           "u.compress,u.compress_choice,u.compress_level,"
+                           "u.whole_file,u.fuzzy,u.checksum_choice"
+                           " FROM backup_transfer t"
+                           " JOIN backup_duration d"
+                           "  ON d.host=t.host AND d.volume=t.volume"
+                           "  AND d.device=t.device AND d.id=t.id"
+                           " JOIN backup_tuning u"
+                           "  ON u.host=t.host AND u.volume=t.volume"
+                           "  AND u.device=t.device AND u.id=t.id"
+                           " WHERE t.host=? AND t.volume=?"
+                           " ORDER BY t.id DESC LIMIT ?",
+                           SQL_STRING, &host,
+                           SQL_STRING, &volume,
+                           SQL_INT, static_cast<int>(limit),
+                           SQL_END);
+  while(stmt.next()) {
+    TransferRun run;
+    run.stats.valid = true;
+    run.stats.linkDests = stmt.get_int(0);
+    run.stats.files = stmt.get_int64(1);
+    run.stats.filesTransferred = stmt.get_int64(2);
+    run.stats.totalSize = stmt.get_int64(3);
+    run.stats.transferredSize = stmt.get_int64(4);
+    run.stats.literalBytes = stmt.get_int64(5);
+    run.stats.matchedBytes = stmt.get_int64(6);
+    run.stats.bytesSent = stmt.get_int64(7);
+    run.stats.bytesReceived = stmt.get_int64(8);
+    run.seconds = stmt.get_int64(9);
+    run.tuning.compress = stmt.get_int(10) != 0;
+    run.tuning.compressChoice = stmt.get_string(11);
+    run.tuning.compressLevel = stmt.get_int(12);
+    run.tuning.wholeFile = stmt.get_int(13) != 0;
+    run.tuning.fuzzy = stmt.get_int(14) != 0;
+    run.tuning.checksumChoice = stmt.get_string(15);
+    history.push_back(run);
+  }
+  return history;
+}
+
+// Return true if the link is known to be fast
+static bool fastLink(const std::vector<TransferRun> &history) {
+  for(auto &run: history) {
+    // Backups that transferred little spent most of their time listing files
+    if(run.seconds <= 0 || run.stats.transferredSize < TUNING_MIN_SAMPLE)
+      continue;
+    return run.stats.transferredSize / run.seconds >= TUNING_FAST_RATE;
+  }
+  return false;
+}
+
+// Return false if compression is known not to help
+static bool compressible(const std::vector<TransferRun> &history) {
+  for(auto &run: history) {
+    if(!run.tuning.compress || run.stats.literalBytes < TUNING_MIN_SAMPLE
+       || run.stats.bytesReceived <= 0)
+      continue;
+    return static_cast<double>(run.stats.literalBytes)
+      / run.stats.bytesReceived >= TUNING_MIN_COMPRESSION;
+  }
+  return true;
+}
+
+// Return false if delta-transfer is known not to help
+static bool deltaUseful(const std::vector<TransferRun> &history) {
+  for(auto &run: history) {
+    if(run.tuning.wholeFile || run.stats.transferredSize < TUNING_MIN_SAMPLE)
+      continue;
+    return static_cast<double>(run.stats.matchedBytes)
+      / run.stats.transferredSize >= TUNING_MIN_MATCHED;
+  }
+  return true;
+}
+
+TransferTuning chooseTransferTuning(const ConfBase &conf,
+                                    const std::vector<TransferRun> &history) {
+  TransferTuning tuning;
+  bool fast = fastLink(history);
+  switch(conf.rsyncCompress) {
+  case TRISTATE_FALSE:
+    tuning.compress = false;
+    break;
+  case TRISTATE_TRUE:
+    tuning.compress = true;
+    break;
+  case TRISTATE_AUTO:
+    tuning.compress = !fast && compressible(history);
+    break;
+  }
+  tuning.compressChoice = conf.rsyncCompressChoice;
+  tuning.compressLevel = conf.rsyncCompressLevel;
+  switch(conf.rsyncWholeFile) {
+  case TRISTATE_FALSE:
+    tuning.wholeFile = false;
+    break;
+  case TRISTATE_TRUE:
+    tuning.wholeFile = true;
+    break;
+  case TRISTATE_AUTO:
+    tuning.wholeFile = fast || !deltaUseful(history);
+    break;
+  }
+  switch(conf.rsyncFuzzy) {
+  case TRISTATE_FALSE:
+    tuning.fuzzy = false;
+    break;
+  case TRISTATE_TRUE:
+    tuning.fuzzy = true;
+    break;
+  case TRISTATE_AUTO:
+    // Fuzzy matching only finds a basis for delta-transfer
+    tuning.fuzzy = !tuning.wholeFile && !fast;
+    break;
+  }
+  tuning.checksumChoice = conf.rsyncChecksumChoice;
+  return tuning;
+}
@@ -0,0 +1,154 @@
+// -*-C++-*-
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef TUNING_H
+#define TUNING_H
+/** @file Tuning.h
+ * @brief Choosing rsync options that affect transfer performance
+ *
+ * Compression and delta-transfer save bandwidth at the cost of CPU time.
+ * On a fast local network they make backups slower; on a slow link they
+ * make them faster.  They can be configured for each host or volume, or
+ * chosen automatically from the statistics of earlier backups.
+ */
+
+#include "Transfer.h"
+#include "Defaults.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+class ConfBase;
+
+/** @brief What the local rsync supports */
+struct RsyncCapabilities {
+  /** @brief Version, e.g. "3.2.3", or "" if unknown */
+  std::string version;
+
+  /** @brief Protocol version, or 0 if unknown */
+  int protocol = 0;
+
+  /** @brief Checksum algorithms, if rsync lists them */
+  std::vector<std::string> checksums;
+
+  /** @brief Compression algorithms, if rsync lists them */
+  std::vector<std::string> compressors;
+
+  /** @brief Parse the output of <tt>rsync --version</tt>
+   * @param output Output of <tt>rsync --version</tt>
+   *
+   * Annotations in parentheses are ignored.
+   */
+  void parse(const std::string &output);
+
+  /** @brief Test whether a checksum algorithm is supported
+   * @param name Algorithm name
+   * @return @c true if @c --checksum-choice=name can be used
+   */
+  bool supportsChecksum(const std::string &name) const;
+
+  /** @brief Test whether a compression algorithm is supported
+   * @param name Algorithm name
+   * @return @c true if @c --compress-choice=name can be used
+   */
+  bool supportsCompression(const std::string &name) const;
+
+  /** @brief Get the capabilities of the local rsync
+   * @return Capabilities
+   *
+   * rsync is only run the first time this is called; the result is cached
+   * thereafter.  If rsync cannot be run then nothing is supported.
+   */
+  static const RsyncCapabilities &local();
+};
+
+/** @brief rsync options that affect transfer performance */
+struct TransferTuning {
+  /** @brief Compress data in transit */
+  bool compress = true;
+
+  /** @brief Compression algorithm, or "" to negotiate one */
+  std::string compressChoice;
+
+  /** @brief Compression level, or -1 for the default */
+  int compressLevel = -1;
+
+  /** @brief Copy whole files rather than using delta-transfer */
+  bool wholeFile = false;
+
+  /** @brief Look for similar files to use as a basis */
+  bool fuzzy = true;
+
+  /** @brief Checksum algorithm, or "" to negotiate one */
+  std::string checksumChoice;
+
+  /** @brief Construct rsync options
+   * @return Options to add to the rsync command
+   */
+  std::vector<std::string> rsyncOptions() const;
+
+  /** @brief Record the tuning used for a backup
+   * @param db Database
+   * @param backup Backup the tuning belongs to
+   */
+  void record(Database &db, const Backup *backup) const;
+};
+
+/** @brief The outcome of one earlier backup */
+struct TransferRun {
+  /** @brief Transfer statistics */
+  TransferStats stats;
+
+  /** @brief How long the backup took in seconds */
+  int64_t seconds = 0;
+
+  /** @brief Tuning the backup used */
+  TransferTuning tuning;
+};
+
+/** @brief Retrieve recent backups of a volume
+ * @param db Database
+ * @param host Host name
+ * @param volume Volume name
+ * @param limit Maximum number of backups to return
+ * @return Backups to any device, most recent first
+ *
+ * Only backups with recorded statistics, duration and tuning are returned.
+ */
+std::vector<TransferRun> transferHistory(Database &db,
+                                         const std::string &host,
+                                         const std::string &volume,
+                                         size_t limit = TUNING_HISTORY);
+
+/** @brief Choose the tuning for a backup
+ * @param conf Configuration for the volume
+ * @param history Recent backups of the volume, most recent first
+ * @return Tuning to use
+ *
+ * Settings configured as @c auto are chosen as follows:
+ * - A link is fast if the most recent backup that transferred enough data
+ *   to judge by did so at @ref TUNING_FAST_RATE or more.
+ * - Compression is used unless the link is fast, or the most recent
+ *   compressed backup found that the data did not compress well.
+ * - Delta-transfer is used unless the link is fast, or the most recent
+ *   backup that used it found little existing data to reuse.
+ * - Fuzzy matching is used only with delta-transfer, and not on a fast link.
+ *
+ * With no suitable history, the choices are the same as the defaults.
+ */
+TransferTuning chooseTransferTuning(const ConfBase &conf,
+                                    const std::vector<TransferRun> &history);
+
+#endif /* TUNING_H */
@@ -22,6 +22,7 @@
 #include <string>
 #include <vector>
 #include <climits>
+#include <cstdint>
 #include <cassert>
 #include <ctime>
 #include <cmath>
@@ -100,6 +101,28 @@ double parseFloat(const std::string &s,
                   double min = -std::numeric_limits<double>::max(),
                   double max = std::numeric_limits<double>::max());
 
+/** @brief Parse a size
+ * @param s Representation of size
+ * @return Size in bytes
+ * @throws SyntaxError if the @p s doesn't represent a size
+ * @throws SyntaxError if the value is out of range
+ *
+ * The size may be followed by @c K, @c M, @c G or @c T to multiply it by
+ * successive powers of 1024.
+ */
+int64_t parseSize(const std::string &s);
+
+/** @brief Parse a time interval
+ * @param s Representation of time interval
+ * @return Number of seconds
+ * @throws SyntaxError if the @p s doesn't represent a time interval
+ * @throws SyntaxError if the value is out of range
+ *
+ * The interval may be followed by @c s, @c m, @c h or @c d to give it in
+ * seconds, minutes, hours or days.  The default is seconds.
+ */
+int64_t parseTimeInterval(const std::string &s);
+
 /** @brief Split and parse a list represented as a string
  * @param bits Destination for components of the string
  * @param line String to parse
@@ -307,6 +330,16 @@ std::string substitute(const std::string &s,
                        std::string::size_type pos = 0,
                        std::string::size_type n = std::string::npos);
 
+/** @brief Decode a file name as written by rsync
+ * @param s File name from rsync's output
+ * @return @p s with @c \\#ooo escapes replaced by the bytes they stand for
+ *
+ * rsync writes non-printable bytes in file names (and, depending on the
+ * locale and options, bytes with the top bit set) as a backslash, a hash
+ * and three octal digits.
+ */
+std::string unescapeRsync(const std::string &s);
+
 /** @brief Get a timestamp for the current time
  * @param now Where to store timestamp
  *
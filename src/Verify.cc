@@ -0,0 +1,363 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "rsbackup.h"
+#include "Verify.h"
+#include "ThreadedAction.h"
+#include "Command.h"
+#include "Conf.h"
+#include "Backup.h"
+#include "Device.h"
+#include "Host.h"
+#include "Volume.h"
+#include "Store.h"
+#include "Database.h"
+#include "Hash.h"
+#include "Defaults.h"
+#include "Errors.h"
+#include "IO.h"
+#include "Utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+bool verifyNeeded(const VerifiedInode &known, int64_t size, int64_t mtime,
+                  int64_t now, int64_t interval) {
+  return known.size != size
+    || known.mtime != mtime
+    || now - known.verified >= interval;
+}
+
+VerifyTree::VerifyTree(const std::string &root,
+                       const VerifiedInodes *known,
+                       int64_t now,
+                       int64_t interval):
+  ParallelWalk(root),
+  known(known),
+  now(now),
+  interval(interval) {
+}
+
+void VerifyTree::run(size_t threads) {
+  walk(threads);
+}
+
+void VerifyTree::directory(int dirfd, const std::string &path,
+                           const std::vector<std::string> &names) {
+  for(auto &name: names) {
+    std::string child = join(path, name);
+    struct stat sb;
+    if(fstatat(dirfd, name.c_str(), &sb, AT_SYMLINK_NOFOLLOW) < 0)
+      throw IOError("inspecting " + rootPath(child), errno);
+    if(S_ISDIR(sb.st_mode))
+      descend(child);
+    else if(S_ISREG(sb.st_mode))
+      file(dirfd, name, child, sb);
+  }
+}
+
+void VerifyTree::file(int dirfd, const std::string &name,
+                      const std::string &path, const struct stat &sb) {
+  int64_t mtime = static_cast<int64_t>(sb.st_mtim.tv_sec) * 1000000000
+    + sb.st_mtim.tv_nsec;
+  const VerifiedInode *previous = nullptr;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    ++files;
+    // Each inode is only considered once, however many links it has
+    if(!seen.insert(sb.st_ino).second)
+      return;
+  }
+  if(known) {
+    auto it = known->find(sb.st_ino);
+    if(it != known->end()) {
+      previous = &it->second;
+      // A newer backup has already dealt with this inode
+      if(previous->recorded)
+        return;
+      if(!verifyNeeded(*previous, sb.st_size, mtime, now, interval)) {
+        // Tie the record to this backup, so it outlives older ones
+        std::lock_guard<std::mutex> guard(lock);
+        results[sb.st_ino] = *previous;
+        return;
+      }
+    }
+  }
+  VerifiedInode v;
+  v.size = sb.st_size;
+  v.mtime = mtime;
+  v.verified = now;
+  try {
+    v.hash = hashFile(dirfd, name, path);
+  } catch(IOError &e) {
+    std::lock_guard<std::mutex> guard(lock);
+    unreadable.push_back(e.what());
+    return;
+  }
+  std::lock_guard<std::mutex> guard(lock);
+  ++hashed;
+  bytes += sb.st_size;
+  // A change in size or modification time means the inode has been reused
+  // for a new file.  Without one, a changed hash means corruption.
+  if(previous
+     && previous->size == v.size
+     && previous->mtime == v.mtime
+     && previous->hash != v.hash) {
+    corrupted.push_back(path);
+    return;
+  }
+  results[sb.st_ino] = v;
+}
+
+uint64_t VerifyTree::hashFile(int dirfd, const std::string &name,
+                              const std::string &path) {
+  FileDescriptor input(openBackupFile(dirfd, name));
+  if(input.fd < 0)
+    throw IOError("opening " + rootPath(path), errno);
+  return ::hashFile(input.fd, rootPath(path));
+}
+
+/** @brief Verify one backup */
+class VerifyBackup: public ThreadedAction {
+public:
+  /** @brief Constructor
+   * @param backup Backup to verify
+   * @param known Verification state of the backup's device, or null pointer
+   * @param now Current time
+   */
+  VerifyBackup(const Backup *backup, VerifiedInodes *known, int64_t now):
+    ThreadedAction("verify/" + backup->volume->parent->name + "/"
+                   + backup->volume->name + "/"
+                   + backup->deviceName + "/"
+                   + backup->id),
+    backup(backup),
+    known(known),
+    tree(backup->backupPath(), known, now, config.verifyInterval),
+    now(now) {
+    // Reading one device from two places at once would only slow both down
+    uses(backup->deviceName);
+  }
+
+  /** @brief Return the time of the backup */
+  time_t time() const {
+    return backup->time;
+  }
+
+private:
+  void work() override {
+    tree.run(MAX_VERIFY_THREADS);
+  }
+
+  bool finished(std::exception_ptr failure) override {
+    std::string path = backup->backupPath();
+    if(failure) {
+      try {
+        std::rethrow_exception(failure);
+      } catch(std::runtime_error &e) {
+        error("verifying %s: %s", path.c_str(), e.what());
+      }
+      return false;
+    }
+    for(auto &p: tree.corrupted)
+      error("verifying %s: %s has changed", path.c_str(), p.c_str());
+    for(auto &m: tree.unreadable)
+      error("verifying %s: %s", path.c_str(), m.c_str());
+    warning(WARNING_VERBOSE,
+            "verified %s: %ju files, %ju hashed, %ju bytes",
+            path.c_str(), (uintmax_t)tree.files, (uintmax_t)tree.hashed,
+            (uintmax_t)tree.bytes);
+    // Older backups on the same device need not consider these inodes again
+    if(known)
+      for(auto &r: tree.results) {
+        VerifiedInode &v = (*known)[r.first];
+        v = r.second;
+        v.recorded = true;
+      }
+    record();
+    return tree.corrupted.size() == 0 && tree.unreadable.size() == 0;
+  }
+
+  /** @brief Record the results in the database */
+  void record() {
+    Database &db = config.getdb();
+    int problems = tree.corrupted.size() + tree.unreadable.size();
+    int retries = 0;
+    for(;;) {
+      bool begun = false;
+      try {
+        db.begin();
+        begun = true;
+        if(known) {
+          Database::Statement stmt(db);
+          stmt.prepare("INSERT OR REPLACE INTO verify_inode"
+                       " (device,inode,size,mtime,hash,verified,"
+                       "host,volume,id)"
+                       " VALUES (?,?,?,?,?,?,?,?,?)",
+                       SQL_END);
+          for(auto &r: tree.results) {
+            stmt.reset(SQL_STRING, &backup->deviceName,
+                       SQL_INT64, (sqlite_int64)r.first,
+                       SQL_INT64, (sqlite_int64)r.second.size,
+                       SQL_INT64, (sqlite_int64)r.second.mtime,
+                       SQL_INT64, (sqlite_int64)r.second.hash,
+                       SQL_INT64, (sqlite_int64)r.second.verified,
+                       SQL_STRING, &backup->volume->parent->name,
+                       SQL_STRING, &backup->volume->name,
+                       SQL_STRING, &backup->id,
+                       SQL_END);
+            stmt.next();
+          }
+        }
+        Database::Statement(db,
+                            "INSERT OR REPLACE INTO verify_backup"
+                            " (host,volume,device,id,time,files,bytes,errors)"
+                            " VALUES (?,?,?,?,?,?,?,?)",
+                            SQL_STRING, &backup->volume->parent->name,
+                            SQL_STRING, &backup->volume->name,
+                            SQL_STRING, &backup->deviceName,
+                            SQL_STRING, &backup->id,
+                            SQL_INT64, (sqlite_int64)now,
+                            SQL_INT64, (sqlite_int64)tree.files,
+                            SQL_INT64, (sqlite_int64)tree.bytes,
+                            SQL_INT, problems,
+                            SQL_END).next();
+        db.commit();
+        break;
+      } catch(DatabaseBusy &) {
+        if(begun)
+          db.rollback();
+        // Log a message every second or so
+        if(!(retries++ & 1023))
+          warning(WARNING_DATABASE, "verifying %s: retrying database update",
+                  backup->backupPath().c_str());
+        // Wait a millisecond and try again
+        usleep(1000);
+      } catch(...) {
+        if(begun)
+          db.rollback();
+        throw;
+      }
+    }
+  }
+
+  /** @brief Backup to verify */
+  const Backup *backup;
+
+  /** @brief Verification state of the device */
+  VerifiedInodes *known;
+
+  /** @brief Tree verifier */
+  VerifyTree tree;
+
+  /** @brief Current time */
+  int64_t now;
+};
+
+void readVerifiedInodes(Database &db, const std::string &device,
+                        VerifiedInodes &known) {
+  // Once the backup that an inode was verified in has been pruned, the inode
+  // number may have been reused, so the row can't be trusted.
+  Database::Statement stmt(db,
+                           "SELECT v.inode,v.size,v.mtime,v.hash,v.verified"
+                           " FROM verify_inode AS v JOIN backup AS b"
+                           " ON b.host=v.host AND b.volume=v.volume"
+                           " AND b.device=v.device AND b.id=v.id"
+                           " WHERE v.device=? AND b.status!=?"
+                           " ORDER BY v.verified",
+                           SQL_STRING, &device,
+                           SQL_INT, PRUNED,
+                           SQL_END);
+  while(stmt.next()) {
+    VerifiedInode &v = known[stmt.get_int64(0)];
+    v.size = stmt.get_int64(1);
+    v.mtime = stmt.get_int64(2);
+    v.hash = stmt.get_int64(3);
+    v.verified = stmt.get_int64(4);
+  }
+}
+
+void verifyBackups() {
+  config.readState();
+  config.identifyDevices(Store::Enabled);
+  const int64_t now = Date::now();
+  std::map<std::string, VerifiedInodes> known;
+  std::vector<std::unique_ptr<VerifyBackup>> actions;
+  for(auto &h: config.hosts) {
+    const Host *host = h.second;
+    if(!host->selected())
+      continue;
+    for(auto &v: host->volumes) {
+      const Volume *volume = v.second;
+      if(!volume->selected())
+        continue;
+      for(const Backup *backup: volume->backups) {
+        const Device *device = backup->getDevice();
+        if(backup->getStatus() != COMPLETE
+           || !device
+           || !device->store
+           || device->store->state != Store::Enabled)
+          continue;
+        if(!command.act) {
+          warning(WARNING_VERBOSE, "WOULD VERIFY %s",
+                  backup->backupPath().c_str());
+          continue;
+        }
+        VerifiedInodes *deviceInodes = nullptr;
+        if(backup->onStoreFilesystem()) {
+          if(!contains(known, device->name))
+            readVerifiedInodes(config.getdb(), device->name,
+                               known[device->name]);
+          deviceInodes = &known[device->name];
+        }
+        actions.push_back(std::unique_ptr<VerifyBackup>(
+            new VerifyBackup(backup, deviceInodes, now)));
+      }
+    }
+  }
+  // Devices are verified concurrently, and the backups on each device one at
+  // a time, newest first.  So each inode's record is tied to the newest
+  // backup containing it, and survives the pruning of older ones.
+  std::stable_sort(actions.begin(), actions.end(),
+                   [](const std::unique_ptr<VerifyBackup> &a,
+                      const std::unique_ptr<VerifyBackup> &b) {
+                     return a->time() > b->time();
+                   });
+  EventLoop e;
+  ActionList al(&e);
+  for(size_t n = 0; n < actions.size(); ++n) {
+    actions[n]->set_priority(static_cast<int>(actions.size() - n));
+    al.add(actions[n].get());
+  }
+  al.go();
+}
+
+void pruneVerify(Database &db) {
+  if(!db.hasTable("verify_inode"))
+    return;
+  for(const std::string table: {"verify_inode", "verify_backup"}) {
+    const std::string sql = "DELETE FROM " + table
+      + " WHERE NOT EXISTS (SELECT 1 FROM backup"
+      + "  WHERE backup.host=" + table + ".host"
+      + "  AND backup.volume=" + table + ".volume"
+      + "  AND backup.device=" + table + ".device"
+      + "  AND backup.id=" + table + ".id"
+      + "  AND backup.status!=?)";
+    Database::Statement(db, sql.c_str(), SQL_INT, PRUNED, SQL_END).next();
+  }
+}
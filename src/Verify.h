@@ -0,0 +1,196 @@
+// -*-C++-*-
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef VERIFY_H
+#define VERIFY_H
+/** @file Verify.h
+ * @brief Verification of backup contents
+ *
+ * Verification hashes the contents of every file in a backup.  The hash of
+ * each inode is recorded in the database, so that later verifications can
+ * detect files that have changed on the device without their size or
+ * modification time changing.
+ *
+ * Unchanged files are hard-linked between backups on the same device, so
+ * most inodes are shared by many backups.  An inode that has been verified
+ * recently is not hashed again, so after the first verification of a device
+ * only new files and those due for reverification are read.
+ *
+ * The verification itself is performed by @ref verifyBackups.
+ */
+
+#include "ParallelWalk.h"
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <sys/types.h>
+
+class Database;
+
+/** @brief Verification state of an inode */
+struct VerifiedInode {
+  /** @brief Size in bytes */
+  int64_t size = 0;
+
+  /** @brief Last modification time in nanoseconds */
+  int64_t mtime = 0;
+
+  /** @brief Hash of contents */
+  uint64_t hash = 0;
+
+  /** @brief Time when last verified */
+  int64_t verified = 0;
+
+  /** @brief Whether a newer backup has already recorded the inode
+   *
+   * This is set during a verification run, and is never read from the
+   * database.
+   */
+  bool recorded = false;
+};
+
+/** @brief Verification state of the inodes of one device */
+typedef std::map<ino_t, VerifiedInode> VerifiedInodes;
+
+/** @brief Verify the files in a single tree
+ *
+ * Each regular file is either skipped, if it is in @ref known and has been
+ * verified recently, or hashed.  If a hashed file has the same size and
+ * modification time as recorded in @ref known but a different hash then its
+ * contents have changed behind our back, and it is reported in @ref
+ * corrupted.
+ *
+ * Inodes that @ref known marks as already recorded are ignored altogether.
+ * Every other inode, whether hashed or skipped, is reported in @ref results,
+ * so that its record can be tied to this tree's backup.
+ *
+ * The contents of each inode are hashed at most once per verification.
+ */
+class VerifyTree: private ParallelWalk {
+public:
+  /** @brief Constructor
+   * @param root Path to root of tree
+   * @param known Verification state from previous runs, or null pointer
+   * @param now Current time
+   * @param interval Age at which an inode must be verified again
+   *
+   * @p known is only read, and must not be modified during @ref run.
+   */
+  VerifyTree(const std::string &root,
+             const VerifiedInodes *known,
+             int64_t now,
+             int64_t interval);
+
+  /** @brief Verify the tree
+   * @param threads Maximum number of threads to use
+   *
+   * Throws @ref IOError if the tree cannot be read.  Errors reading
+   * individual files are recorded in @ref unreadable instead.
+   */
+  void run(size_t threads);
+
+  /** @brief Inodes to be recorded against this tree
+   *
+   * This includes inodes that were skipped because they were verified
+   * recently, but not those found to be corrupted.
+   */
+  VerifiedInodes results;
+
+  /** @brief Paths of files whose contents have changed */
+  std::vector<std::string> corrupted;
+
+  /** @brief Error messages for files that could not be read */
+  std::vector<std::string> unreadable;
+
+  /** @brief Number of files found */
+  uint64_t files = 0;
+
+  /** @brief Number of files hashed */
+  uint64_t hashed = 0;
+
+  /** @brief Number of bytes hashed */
+  uint64_t bytes = 0;
+
+private:
+  void directory(int dirfd, const std::string &path,
+                 const std::vector<std::string> &names) override;
+
+  /** @brief Verify one regular file
+   * @param dirfd Containing directory
+   * @param name Name within @p dirfd
+   * @param path Path relative to root
+   * @param sb File information
+   */
+  void file(int dirfd, const std::string &name, const std::string &path,
+            const struct stat &sb);
+
+  /** @brief Hash the contents of a file
+   * @param dirfd Containing directory
+   * @param name Name within @p dirfd
+   * @param path Path relative to root
+   * @return Hash of contents
+   */
+  uint64_t hashFile(int dirfd, const std::string &name,
+                    const std::string &path);
+
+  /** @brief Verification state from previous runs */
+  const VerifiedInodes *known;
+
+  /** @brief Current time */
+  int64_t now;
+
+  /** @brief Reverification interval */
+  int64_t interval;
+
+  /** @brief Inodes claimed by some thread */
+  std::set<ino_t> seen;
+};
+
+/** @brief Test whether an inode needs to be hashed
+ * @param known Recorded state
+ * @param size Current size
+ * @param mtime Current modification time in nanoseconds
+ * @param now Current time
+ * @param interval Reverification interval
+ * @return @c true if the inode must be hashed
+ *
+ * The inode must be hashed if it has changed since it was recorded, or if
+ * it was last verified @p interval or more seconds ago.
+ */
+bool verifyNeeded(const VerifiedInode &known, int64_t size, int64_t mtime,
+                  int64_t now, int64_t interval);
+
+/** @brief Read the verification state of a device
+ * @param db Database
+ * @param device Device name
+ * @param known Where to store the verification state
+ *
+ * Each inode is recorded with the newest backup that contained it when it
+ * was last verified.  Records whose backup has been pruned are ignored,
+ * since the inode number may since have been reused for a different file.
+ */
+void readVerifiedInodes(Database &db, const std::string &device,
+                        VerifiedInodes &known);
+
+/** @brief Remove verification records for backups that no longer exist
+ * @param db Database
+ *
+ * Pruned backups are included.
+ */
+void pruneVerify(Database &db);
+
+#endif /* VERIFY_H */
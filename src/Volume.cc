@@ -24,6 +24,7 @@
 #include <cstdio>
 #include <ostream>
 #include <fnmatch.h>
+#include <boost/range/adaptor/reversed.hpp>
 
 Volume::Volume(Host *parent_,
                const std::string &name_,
@@ -102,6 +103,11 @@ bool Volume::removeBackup(const Backup *backup) {
   return false;
 }
 
+void Volume::forgetBackups() {
+  deleteAll(backups);
+  calculate();
+}
+
 const Backup *Volume::mostRecentBackup(const Device *device) const {
   const Backup *result = nullptr;
   for(const Backup *backup: backups) {
@@ -171,6 +177,34 @@ bool Volume::available() const {
   return true;
 }
 
+std::vector<const Backup *> Volume::linkCandidates(const Device *device,
+                                                   size_t limit) const {
+  std::vector<const Backup *> newer, complete, incomplete;
+  for(const Backup *backup: boost::adaptors::reverse(backups)) {
+    if(backup->deviceName != device->name)
+      continue;
+    int status = backup->getStatus();
+    if(status == PRUNING || status == PRUNED)
+      continue;
+    if(backup->rc == 0)
+      complete.push_back(backup);
+    else if(complete.empty())
+      newer.push_back(backup);
+    else
+      incomplete.push_back(backup);
+  }
+  std::vector<const Backup *> result;
+  if(complete.size())
+    result.push_back(complete[0]);
+  result.insert(result.end(), newer.begin(), newer.end());
+  if(complete.size())
+    result.insert(result.end(), complete.begin() + 1, complete.end());
+  result.insert(result.end(), incomplete.begin(), incomplete.end());
+  if(result.size() > limit)
+    result.resize(limit);
+  return result;
+}
+
 BackupRequirement Volume::needsBackup(Device *device) {
   switch(fnmatch(devicePattern.c_str(), device->name.c_str(),
                  FNM_NOESCAPE)) {
@@ -233,6 +267,18 @@ void Volume::write(std::ostream &os, int step, bool verbose) const {
   d(os, "# Check that volume is a mount point before performing backup", step);
   d(os, "#  check-mounted true|false", step);
   os << indent(step) << "check-mounted " << (checkMounted ? "true" : "false") << '\n';
+  d(os, "", step);
+
+  d(os, "# Number of rsync processes for paths not in a shard", step);
+  d(os, "#  shards COUNT", step);
+  if(shards != 1)
+    os << indent(step) << "shards " << shards << '\n';
+  d(os, "", step);
+
+  d(os, "# Paths to back up with an rsync process of their own", step);
+  d(os, "#  shard PATH ...", step);
+  for(auto &group: shardGroups)
+    os << indent(step) << "shard " << quote(group) << '\n';
 }
 
 ConfBase *Volume::getParent() const {
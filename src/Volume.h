@@ -79,6 +79,19 @@ public:
   /** @brief Check that root path is a mount point before backing up */
   bool checkMounted = false;
 
+  /** @brief Number of rsync processes for paths not in @ref shardGroups
+   *
+   * Corresponds to @c shards. */
+  int shards = 1;
+
+  /** @brief Groups of paths that are backed up by an rsync process each
+   *
+   * Corresponds to @c shard. */
+  std::vector<std::vector<std::string>> shardGroups;
+
+  /** @brief Return true if the backup is split between several rsyncs */
+  bool sharded() const { return shards > 1 || shardGroups.size(); }
+
   /** @brief Return true if volume is selected */
   bool selected() const { return isSelected; }
 
@@ -144,6 +157,9 @@ public:
   /** @brief Remove a backup */
   bool removeBackup(const Backup *backup);
 
+  /** @brief Remove all backups */
+  void forgetBackups();
+
   /** @brief Find the most recent backup
    * @param device If not null pointer, only consider backups from this device
    * @return Most recent backup or null pointer
@@ -156,6 +172,20 @@ public:
    */
   const Backup *mostRecentFailedBackup(const Device *device = nullptr) const;
 
+  /** @brief Choose earlier backups for rsync to link against
+   * @param device Device the new backup will be made on
+   * @param limit Maximum number of backups to return
+   * @return Candidate backups, best first
+   *
+   * The most recent complete backup comes first, followed by any newer
+   * incomplete backups, since they may contain files added since.  Older
+   * complete and then older incomplete backups fill any remaining places,
+   * most recent first, so that files which have come back after a failure
+   * or a move can still be found.  Backups being pruned are never returned.
+   */
+  std::vector<const Backup *> linkCandidates(const Device *device,
+                                             size_t limit) const;
+
   /** @brief Identify whether this volume needs backing up on a particular device
    * @param device Target device
    * @return Volume state
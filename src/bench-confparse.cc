@@ -0,0 +1,90 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Conf.h"
+#include "Command.h"
+#include "IO.h"
+#include "Utils.h"
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+// Time parsing a large generated configuration, of the kind produced by
+// tooling for a large fleet
+int main() {
+  const size_t target = 100000;
+  const int volumesPerHost = 10;
+  const char *tmpdir;
+  char *dir;
+
+  tmpdir = getenv("TMPDIR");
+  if(!tmpdir)
+    tmpdir = "/tmp";
+  if(asprintf(&dir, "%s/XXXXXX", tmpdir) < 0 || !mkdtemp(dir)) {
+    perror("creating temporary directory");
+    return 1;
+  }
+  configPath = std::string(dir) + "/config";
+
+  std::stringstream ss;
+  size_t lines = 0, hosts = 0;
+  ss << "# Generated configuration\n"
+     << "store /store\n"
+     << "device device0\n"
+     << "device device1\n"
+     << "max-age 3\n"
+     << "prune-parameter prune-age 30\n";
+  lines += 6;
+  while(lines < target) {
+    ss << "\n"
+       << "host host" << hosts << "\n"
+       << "  hostname host" << hosts << ".example.com\n"
+       << "  ssh-timeout 60\n";
+    lines += 4;
+    for(int v = 0; v < volumesPerHost; ++v) {
+      ss << "  volume volume" << v << " \"/srv/volume " << v << "\"\n"
+         << "    exclude /lost+found   # not interesting\n"
+         << "    exclude \"*.tmp\"\n"
+         << "    prune-parameter min-backups 2\n";
+      lines += 4;
+    }
+    ++hosts;
+  }
+  {
+    IO f;
+    f.open(configPath, "w");
+    f.write(ss.str());
+    f.close();
+  }
+
+  struct timespec started, finished;
+  getMonotonicTime(started);
+  config.read();
+  getMonotonicTime(finished);
+  struct timespec elapsed = finished - started;
+  printf("%zu lines, %zu hosts: %.3fs\n", lines, hosts,
+         elapsed.tv_sec + elapsed.tv_nsec / 1000000000.0);
+
+  if(config.hosts.size() != hosts) {
+    fprintf(stderr, "ERROR: parsed %zu hosts, expected %zu\n",
+            config.hosts.size(), hosts);
+    return 1;
+  }
+
+  remove(configPath.c_str());
+  remove(dir);
+  free(dir);
+  return 0;
+}
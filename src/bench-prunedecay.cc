@@ -0,0 +1,56 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Prune.h"
+#include "Conf.h"
+#include "Backup.h"
+#include "Volume.h"
+#include "Host.h"
+#include "Utils.h"
+#include <cstdio>
+#include <cstdlib>
+
+// Time pruning a large synthetic backup history in one go
+int main(int argc, char **argv) {
+  const size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+  Host *host = new Host(&config, "host");
+  Volume *volume = new Volume(host, "volume", "/volume");
+  volume->prunePolicy = "decay";
+  volume->pruneParameters["decay-limit"] = "100000000";
+  // One backup per day, the most recent one yesterday
+  std::vector<Backup> backups(count);
+  std::vector<Backup *> onDevice;
+  Date d(100, 1, 1);
+  for(auto &backup: backups) {
+    backup.date = d;
+    backup.deviceName = "device";
+    backup.volume = volume;
+    onDevice.push_back(&backup);
+    ++d;
+  }
+  const Date today = d;
+  const PrunePolicy *policy = PrunePolicy::find(volume->prunePolicy);
+  struct timespec start, finish;
+  getMonotonicTime(start);
+  std::unique_ptr<PruneParameters> parameters = policy->parse(volume);
+  std::map<Backup *, std::string> prune;
+  policy->prunable(onDevice, prune, count, parameters.get(), today);
+  getMonotonicTime(finish);
+  struct timespec elapsed = finish - start;
+  printf("pruned %zu/%zu backups in %.3fs\n",
+         prune.size(), count,
+         elapsed.tv_sec + elapsed.tv_nsec / 1000000000.0);
+  return 0;
+}
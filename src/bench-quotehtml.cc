@@ -0,0 +1,83 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Document.h"
+#include "Utils.h"
+#include <cstdio>
+#include <clocale>
+#include <sstream>
+
+// The original implementation of Document::quoteHtml
+static void referenceQuoteHtml(std::ostream &os, const std::string &s) {
+  std::u32string u;
+  toUnicode(u, s);
+  for(auto w: u) {
+    switch(w) {
+    default:
+      if(w >= 127) {
+      case '&':
+      case '<':
+      case '"':
+      case '\'':
+        os << "&#" << w << ";";
+        break;
+      } else
+        os << (char)w;
+    }
+  }
+}
+
+// Time F over S
+template<typename F> static double timeQuote(F f, const std::string &s,
+                                             std::string &output) {
+  struct timespec started, finished;
+  std::stringstream ss;
+  getMonotonicTime(started);
+  f(ss, s);
+  getMonotonicTime(finished);
+  output = ss.str();
+  struct timespec elapsed = finished - started;
+  return elapsed.tv_sec + elapsed.tv_nsec / 1000000000.0;
+}
+
+// Time quoting a large log, as seen with --logs all
+int main() {
+  if(!setlocale(LC_CTYPE, "C.UTF-8")
+     && !setlocale(LC_CTYPE, "en_US.UTF-8")
+     && !setlocale(LC_CTYPE, "en_GB.UTF-8")) {
+    fprintf(stderr, "ERROR: cannot find a UTF-8 locale\n");
+    return 1;
+  }
+  std::string log;
+  for(int line = 0; log.size() < 16 * 1024 * 1024; ++line) {
+    char buffer[256];
+    snprintf(buffer, sizeof buffer,
+             "rsync: send_files failed to open \"/home/user/files/%d.dat\":"
+             " Permission denied (13)\n", line);
+    log += buffer;
+    if(line % 64 == 0)
+      log += "file name with <angle> & caf\xc3\xa9\n";
+  }
+  std::string expected, got;
+  double reference = timeQuote(referenceQuoteHtml, log, expected);
+  double current = timeQuote(Document::quoteHtml, log, got);
+  if(got != expected) {
+    fprintf(stderr, "ERROR: output differs from the original\n");
+    return 1;
+  }
+  printf("%zu bytes: reference %.3fs, current %.3fs\n",
+         log.size(), reference, current);
+  return 0;
+}
@@ -0,0 +1,45 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "rsbackup.h"
+#include "Errors.h"
+#include "Utils.h"
+#include <cstdlib>
+#include <cerrno>
+
+// Convert a string into a size, with an optional K/M/G/T suffix, throwing a
+// SyntaxError if it is malformed or out of range.
+int64_t parseSize(const std::string &s) {
+  errno = 0;
+  const char *sc = s.c_str();
+  char *e;
+  long long n = strtoll(sc, &e, 10);
+  if(errno)
+    throw SyntaxError("invalid size '" + s + "': " + strerror(errno));
+  if(e == sc || n < 0)
+    throw SyntaxError("invalid size '" + s + "'");
+  int shift = 0;
+  switch(*e) {
+  case 'k': case 'K': shift = 10; ++e; break;
+  case 'm': case 'M': shift = 20; ++e; break;
+  case 'g': case 'G': shift = 30; ++e; break;
+  case 't': case 'T': shift = 40; ++e; break;
+  }
+  if(*e)
+    throw SyntaxError("invalid size '" + s + "'");
+  if(n > (INT64_MAX >> shift))
+    throw SyntaxError("size '" + s + "' out of range");
+  return static_cast<int64_t>(n) << shift;
+}
@@ -0,0 +1,45 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "rsbackup.h"
+#include "Errors.h"
+#include "Utils.h"
+#include <cstdlib>
+#include <cerrno>
+
+// Convert a string into a number of seconds, with an optional s/m/h/d
+// suffix, throwing a SyntaxError if it is malformed or out of range.
+int64_t parseTimeInterval(const std::string &s) {
+  errno = 0;
+  const char *sc = s.c_str();
+  char *e;
+  long long n = strtoll(sc, &e, 10);
+  if(errno)
+    throw SyntaxError("invalid time interval '" + s + "': " + strerror(errno));
+  if(e == sc || n < 0)
+    throw SyntaxError("invalid time interval '" + s + "'");
+  int64_t unit = 1;
+  switch(*e) {
+  case 's': unit = 1; ++e; break;
+  case 'm': unit = 60; ++e; break;
+  case 'h': unit = 3600; ++e; break;
+  case 'd': unit = 86400; ++e; break;
+  }
+  if(*e)
+    throw SyntaxError("invalid time interval '" + s + "'");
+  if(n > INT64_MAX / unit)
+    throw SyntaxError("time interval '" + s + "' out of range");
+  return static_cast<int64_t>(n) * unit;
+}
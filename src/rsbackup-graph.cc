@@ -16,13 +16,23 @@
 #include <getopt.h>
 #include "Conf.h"
 #include "Backup.h"
+#include "Volume.h"
+#include "Host.h"
+#include "Device.h"
 #include "Command.h"
 #include "Selection.h"
 #include "IO.h"
 #include "HistoryGraph.h"
 #include "Errors.h"
 #include "Utils.h"
+#include "PngWriter.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <thread>
+#include <vector>
 
+#include <cairomm/surface.h>
 #include <pangomm/init.h>
 
 static const struct option options[] = {
@@ -32,6 +42,10 @@ static const struct option options[] = {
   { "debug", no_argument, nullptr, 'd' },
   { "database", required_argument, nullptr, 'D' },
   { "output", required_argument, nullptr, 'o' },
+  { "format", required_argument, nullptr, 'f' },
+  { "tile-height", required_argument, nullptr, 'T' },
+  { "threads", required_argument, nullptr, 'j' },
+  { "benchmark", no_argument, nullptr, 'B' },
   { nullptr, 0, nullptr, 0 }
 };
 
@@ -45,6 +59,10 @@ static const char *graphHelpString() {
 "  --debug, -d             Debug output\n"
 "  --database, -D PATH     Override database path\n"
 "  --output, -o PATH       Output filename\n"
+"  --format, -f FORMAT     Output format: png (default) or svg\n"
+"  --tile-height, -T ROWS  Render PNG output ROWS pixels at a time\n"
+"  --threads, -j COUNT     Render with COUNT threads (default: one per CPU)\n"
+"  --benchmark, -B         Time rendering of a synthetic set of backups\n"
 "  --help, -h              Display usage message\n"
 "  --version, -V           Display version number\n"
 "\n"
@@ -71,12 +89,126 @@ static Cairo::ErrorStatus stdout_write_func(const unsigned char *data,
   return CAIRO_STATUS_SUCCESS;
 }
 
+// Pick a band height that spreads the work evenly over the threads
+static void writePng(HistoryGraph &graph,
+                     const std::string &output,
+                     unsigned threads) {
+  Cairo::RefPtr<Cairo::ImageSurface> surface
+    = renderHistoryGraphImage(ceil(graph.width), ceil(graph.height), threads);
+  if(output == "-")
+    surface->write_to_png_stream(&stdout_write_func);
+  else
+    surface->write_to_png(output);
+}
+
+// Write the graph as a PNG, rendering a band of rows at a time so that
+// memory use does not depend on the size of the graph
+static void writeTiledPng(HistoryGraph &graph,
+                          const std::string &output,
+                          unsigned tileHeight,
+                          unsigned threads) {
+  const unsigned width = ceil(graph.width), height = ceil(graph.height);
+  IO file;
+  if(output != "-")
+    file.open(output, "w");
+  IO &out = output == "-" ? IO::out : file;
+  PngWriter png(out, width, height);
+  std::vector<uint8_t> row(3 * width);
+  renderHistoryGraphBands(width, height, tileHeight, threads,
+                          [&](const Cairo::RefPtr<Cairo::ImageSurface> &band,
+                              unsigned) {
+    const unsigned char *data = band->get_data();
+    for(int y = 0; y < band->get_height(); ++y) {
+      const uint32_t *pixels
+        = reinterpret_cast<const uint32_t *>(data + y * band->get_stride());
+      for(unsigned x = 0; x < width; ++x) {
+        row[3 * x] = pixels[x] >> 16;
+        row[3 * x + 1] = pixels[x] >> 8;
+        row[3 * x + 2] = pixels[x];
+      }
+      png.writeRow(&row[0]);
+    }
+  });
+  png.finish();
+  if(output != "-")
+    file.close();
+}
+
+// Write the graph as SVG
+static void writeSvg(HistoryGraph &graph,
+                     Render::Context &context,
+                     const std::string &output) {
+  Cairo::RefPtr<Cairo::SvgSurface> surface
+    = (output == "-"
+       ? Cairo::SvgSurface::create_for_stream(&stdout_write_func,
+                                              graph.width, graph.height)
+       : Cairo::SvgSurface::create(output, graph.width, graph.height));
+  context.cairo = Cairo::Context::create(surface);
+  graph.render();
+  surface->finish();
+}
+
+// Add a synthetic backup
+static void syntheticBackup(Volume *volume, const Date &date,
+                            const std::string &deviceName) {
+  Backup *backup = new Backup();
+  backup->date = date;
+  backup->id = date.toString();
+  backup->deviceName = deviceName;
+  // The graph doesn't need the volume's totals, which Volume::addBackup()
+  // and Backup::setStatus() would recalculate for every backup
+  backup->setStatus(COMPLETE);
+  backup->volume = volume;
+  volume->backups.insert(backup);
+}
+
+// Populate the configuration with a synthetic fleet of backups: three years
+// of backups of 500 volumes, to one device daily and another weekly.
+static void syntheticFleet() {
+  const int hosts = 50, volumes = 10, days = 3 * 365;
+  config.devices["daily"] = new Device("daily");
+  config.devices["weekly"] = new Device("weekly");
+  const Date today = Date::today();
+  const Date start(today.year() - 3, today.month(),
+                   std::min(today.day(),
+                            Date::monthLength(today.year() - 3,
+                                              today.month())));
+  unsigned seed = 1;
+  for(int h = 0; h < hosts; ++h) {
+    Host *host = new Host(&config, "host" + std::to_string(h));
+    for(int v = 0; v < volumes; ++v) {
+      Volume *volume = new Volume(host,
+                                  "volume" + std::to_string(v),
+                                  "/volume" + std::to_string(v));
+      Date d = start;
+      for(int day = 0; day < days; ++day, ++d) {
+        // The daily backup is missed now and then
+        seed = seed * 1103515245 + 12345;
+        if((seed >> 16) % 16)
+          syntheticBackup(volume, d, "daily");
+        if(day % 7 == h % 7)
+          syntheticBackup(volume, d, "weekly");
+      }
+    }
+  }
+}
+
+// Seconds between two times
+static double elapsed(const struct timespec &from,
+                      const struct timespec &to) {
+  struct timespec d = to - from;
+  return d.tv_sec + d.tv_nsec / 1000000000.0;
+}
+
 int main(int argc, char **argv) {
   try {
 
     int n;
-    const char *output = "rsbackup.png";
+    std::string output, format = "png";
+    unsigned tileHeight = 0;
+    unsigned threads = std::max(1U, std::thread::hardware_concurrency());
     VolumeSelections selections;
+    bool benchmark = false;
 
     // Override debug
     if(getenv("RSBACKUP_DEBUG"))
@@ -88,7 +220,7 @@ int main(int argc, char **argv) {
     // Parse options
     optind = 1;
     while((n = getopt_long(argc, (char *const *)argv,
-                           "+hVdc:D:o:", options, nullptr)) >= 0) {
+                           "+hVdc:D:o:f:T:j:B", options, nullptr)) >= 0) {
       switch(n) {
       case 'h': help();
       case 'V': version();
@@ -96,17 +228,30 @@ int main(int argc, char **argv) {
       case 'd': debug = true; break;
       case 'D': database = optarg; break;
       case 'o': output = optarg; break;
+      case 'f': format = optarg; break;
+      case 'T': tileHeight = parseInteger(optarg, 0, INT_MAX); break;
+      case 'j': threads = parseInteger(optarg, 1, INT_MAX); break;
+      case 'B': benchmark = true; break;
       default: exit(1);
       }
     }
 
+    if(format != "png" && format != "svg")
+      throw CommandError("unrecognized output format '" + format + "'");
+    if(output.empty())
+      output = "rsbackup." + format;
+
     if(optind < argc)
       for(n = optind; n < argc; ++n)
         selections.add(argv[n]);
 
-    config.read();
-    config.validate();
-    config.readState();
+    if(benchmark)
+      syntheticFleet();
+    else {
+      config.read();
+      config.validate();
+      config.readState();
+    }
     selections.select(config);
 
     // Eliminates segfault with "Failed to wrap object of type
@@ -118,6 +263,8 @@ int main(int argc, char **argv) {
 
     // Rendering context
     Render::Context context;
+    struct timespec started, laidOut, rendered;
+    getMonotonicTime(started);
 
     // Use a throwaway graph and surface to work out size
     Cairo::RefPtr<Cairo::Surface> surface
@@ -133,17 +280,32 @@ int main(int argc, char **argv) {
     HistoryGraph graph(context);
     graph.addParts(config.graphLayout);
     graph.set_extent();
-    // Create the real surface
-    surface = Cairo::ImageSurface::create(Cairo::FORMAT_ARGB32,
-                                          ceil(graph.width),
-                                          ceil(graph.height));
-    context.cairo = Cairo::Context::create(surface);
-    graph.render();
+    getMonotonicTime(laidOut);
+
+    if(benchmark) {
+      renderHistoryGraphImage(ceil(graph.width), ceil(graph.height), threads);
+      getMonotonicTime(rendered);
+      size_t volumes = 0, backups = 0;
+      for(auto &h: config.hosts)
+        for(auto &v: h.second->volumes) {
+          ++volumes;
+          backups += v.second->backups.size();
+        }
+      IO::out.writef("%zu volumes, %zu backups, %.0fx%.0f pixels\n",
+                     volumes, backups, graph.width, graph.height);
+      IO::out.writef("layout: %.3fs\n", elapsed(started, laidOut));
+      IO::out.writef("render: %.3fs (%u threads)\n",
+                     elapsed(laidOut, rendered), threads);
+      IO::out.close();
+      return 0;
+    }
 
-    if(std::string(output) == "-")
-      surface->write_to_png_stream(&stdout_write_func);
+    if(format == "svg")
+      writeSvg(graph, context, output);
+    else if(tileHeight)
+      writeTiledPng(graph, output, tileHeight, threads);
     else
-      surface->write_to_png(output);
+      writePng(graph, output, threads);
     return 0;
   } catch(Error &e) {
     error("%s", e.what());
@@ -26,6 +26,7 @@
 #include "DeviceAccess.h"
 #include "Utils.h"
 #include "Report.h"
+#include "Daemon.h"
 #include <cstdio>
 #include <cstdlib>
 #include <cerrno>
@@ -64,13 +65,19 @@ int main(int argc, char **argv) {
       }
     }
 
+    // Run as a daemon
+    if(command.daemonSocket)
+      runDaemon(*command.daemonSocket, argv);
+
     // Take the lock, if one is defined.
     FileLock lockFile(config.lock);
     if((command.backup
         || command.prune
         || command.pruneIncomplete
+        || command.verify
         || command.retireDevice
-        || command.retire)
+        || command.retire
+        || command.restore)
        && config.lock.size()) {
       D("attempting to acquire lockfile %s", config.lock.c_str());
       if(!lockFile.acquire(command.wait)) {
@@ -83,7 +90,8 @@ int main(int argc, char **argv) {
     }
 
     // Select volumes
-    if(command.backup || command.prune || command.pruneIncomplete)
+    if(command.backup || command.prune || command.pruneIncomplete
+       || command.verify || command.find)
       command.selections.select(config);
 
     // Execute commands
@@ -97,6 +105,12 @@ int main(int argc, char **argv) {
       pruneBackups();
     if(command.prune)
       prunePruneLogs();
+    if(command.verify)
+      verifyBackups();
+    if(command.find)
+      findFile(*command.find);
+    if(command.restore)
+      restoreBackup();
 
     // Run post-access hook
     postDeviceAccess();
@@ -106,19 +120,8 @@ int main(int argc, char **argv) {
       config.readState();
 
       Document d;
-      if(config.stylesheet.size()) {
-        IO ssf;
-        ssf.open(config.stylesheet, "r");
-        ssf.readall(d.htmlStyleSheet);
-      } else
-        d.htmlStyleSheet = stylesheet;
-      // Include user colors in the stylesheet
-      std::stringstream ss;
-      ss << "td.bad { background-color: #" << config.colorBad << " }\n";
-      ss << "td.good { background-color: #" << config.colorGood << " }\n";
-      ss << "span.bad { color: #" << config.colorBad << " }\n";
-      d.htmlStyleSheet += ss.str();
       Report report(d);
+      report.setStyleSheet();
       report.generate();
       std::stringstream htmlStream, textStream;
       if(command.html || command.email)
@@ -173,10 +176,42 @@ int main(int argc, char **argv) {
         body << textStream.str();
         body << "\n";
         body << "--" MIME_BOUNDARY "\n";
-        body << "Content-Type: text/html\n";
-        body << "\n";
-        body << htmlStream.str();
-        body << "\n";
+        if(report.images.size()) {
+          // Send images as related parts rather than data: URLs, which many
+          // mail clients refuse to display
+          for(size_t n = 0; n < report.images.size(); ++n)
+            report.images[n]->ident = "image" + std::to_string(n)
+              + "@rsbackup";
+          std::stringstream emailHtmlStream;
+          d.renderHtml(emailHtmlStream);
+          body << "Content-Type: multipart/related; boundary="
+            MIME_RELATED_BOUNDARY "\n";
+          body << "\n";
+          body << "--" MIME_RELATED_BOUNDARY "\n";
+          body << "Content-Type: text/html\n";
+          body << "\n";
+          body << emailHtmlStream.str();
+          body << "\n";
+          for(auto image: report.images) {
+            body << "--" MIME_RELATED_BOUNDARY "\n";
+            body << "Content-Type: " << image->type << "\n";
+            body << "Content-Transfer-Encoding: base64\n";
+            body << "Content-ID: <" << image->ident << ">\n";
+            body << "Content-Disposition: inline\n";
+            body << "\n";
+            std::stringstream encoded;
+            write_base64(encoded, image->content);
+            const std::string &e = encoded.str();
+            for(size_t pos = 0; pos < e.size(); pos += 76)
+              body << e.substr(pos, 76) << "\n";
+          }
+          body << "--" MIME_RELATED_BOUNDARY "--\n";
+        } else {
+          body << "Content-Type: text/html\n";
+          body << "\n";
+          body << htmlStream.str();
+          body << "\n";
+        }
         body << "--" MIME_BOUNDARY "--\n";
         e.setContent(body.str());
         e.send();
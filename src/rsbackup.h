@@ -23,6 +23,7 @@
 #include <string>
 
 class Document;
+class Device;
 
 /** @brief Make backups */
 void makeBackups();
@@ -36,9 +37,31 @@ void retireDevices();
 /** @brief Prune backups */
 void pruneBackups();
 
+/** @brief Prune backups to maintain free space
+ * @param devices Devices to consider
+ *
+ * Devices with a free space or free inode limit that is not met have their
+ * backups pruned until it is met, or nothing more can be pruned.
+ */
+void pruneForSpace(const std::vector<Device *> &devices);
+
 /** @brief Prune redundant logs */
 void prunePruneLogs();
 
+/** @brief Verify the contents of backups of selected volumes */
+void verifyBackups();
+
+/** @brief List the cataloged backups of selected volumes containing a file
+ * @param path Absolute path, or path relative to volume roots
+ */
+void findFile(const std::string &path);
+
+/** @brief Restore from a backup
+ *
+ * The source, date and destination are taken from @ref command.
+ */
+void restoreBackup();
+
 /** @brief HTML stylesheet */
 extern char stylesheet[];
 
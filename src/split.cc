@@ -23,59 +23,67 @@
 // line.
 void split(std::vector<std::string> &bits, const std::string &line,
            size_t *indent) {
-  bits.clear();
-  std::string::size_type pos = 0;
-  std::string s;
-  char c;
+  // Tokens overwrite the existing contents of bits, so that their storage is
+  // reused from one line to the next
+  size_t count = 0;
+  auto token = [&]() -> std::string & {
+    if(count == bits.size())
+      bits.emplace_back();
+    std::string &s = bits[count++];
+    s.clear();
+    return s;
+  };
+  const char *pos = line.data(), *const limit = pos + line.size();
   if(indent) {
     size_t i = 0;
-    while(pos < line.size()
-          && ((c = line.at(pos)) == ' '
-              || c == '\t')) {
-      if(c == ' ')
+    for(; pos < limit && (*pos == ' ' || *pos == '\t'); ++pos) {
+      if(*pos == ' ')
         ++i;
       else
         i = (i+8) & ~static_cast<size_t>(7);
-      ++pos;
     }
     *indent = i;
   }
-  while(pos < line.size()) {
-    c = line.at(pos);
-    switch(c) {
+  while(pos < limit) {
+    switch(*pos) {
     case ' ': case '\t': case '\r': case '\f':
       ++pos;
       break;
     case '#':
+      bits.resize(count);
       return;
-    case '"':
-      s.clear();
+    case '"': {
+      std::string &s = token();
       ++pos;
-      while(pos < line.size() && line.at(pos) != '"') {
-        if(line.at(pos) == '\\') {
-          ++pos;
-          if(pos >= line.size())
-            throw SyntaxError("unterminated string");
-        }
-        s += line.at(pos);
-        ++pos;
+      for(;;) {
+        const char *end = pos;
+        while(end < limit && *end != '"' && *end != '\\')
+          ++end;
+        s.append(pos, end - pos);
+        if(end >= limit)
+          throw SyntaxError("unterminated string");
+        pos = end + 1;
+        if(*end == '"')
+          break;
+        // Backslash escapes the next character
+        if(pos >= limit)
+          throw SyntaxError("unterminated string");
+        s += *pos++;
       }
-      if(pos >= line.size())
-        throw SyntaxError("unterminated string");
-      ++pos;
-      bits.push_back(s);
       break;
+    }
     case '\\':
       throw SyntaxError("unquoted backslash");
-    default:
-      s.clear();
-      while(pos < line.size() && !isspace(line.at(pos))
-            && line.at(pos) != '"' && line.at(pos) != '\\') {
-        s += line.at(pos);
-        ++pos;
-      }
-      bits.push_back(s);
+    default: {
+      const char *end = pos;
+      while(end < limit && !isspace(static_cast<unsigned char>(*end))
+            && *end != '"' && *end != '\\')
+        ++end;
+      token().assign(pos, end - pos);
+      pos = end;
       break;
     }
+    }
   }
+  bits.resize(count);
 }
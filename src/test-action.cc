@@ -16,6 +16,11 @@
 #include "Utils.h"
 #include "EventLoop.h"
 #include "Action.h"
+#include "ThreadedAction.h"
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <unistd.h>
 
 static int action_number;
 
@@ -281,6 +286,116 @@ static void test_action_priority() {
   assert(d.acted == 1);
 }
 
+class IncompleteAction: public Action {
+public:
+  IncompleteAction(const std::string &n): Action(n) {
+  }
+
+  void go(EventLoop *, ActionList *) override {
+  }
+};
+
+static void test_action_synchronous() {
+  ActionList al(nullptr);
+  SimpleAction a("a"), b("b"), c("c");
+  a.set_priority(1);
+  b.set_priority(3);
+  c.set_priority(2);
+  al.add(&a);
+  al.add(&b);
+  al.add(&c);
+  action_number = 0;
+  al.go();
+  assert(a.acted == 3);
+  assert(b.acted == 1);
+  assert(c.acted == 2);
+
+  ActionList bl(nullptr);
+  IncompleteAction i("i");
+  bl.add(&i);
+  try {
+    bl.go();
+    assert(!"unexpectedly succeeded");
+  } catch(std::logic_error &) {
+  }
+}
+
+class DepthAction: public Action {
+public:
+  DepthAction(const std::string &n): Action(n) {
+  }
+
+  void go(EventLoop *, ActionList *al) override {
+    char here;
+    depth = &here;
+    al->completed(this, true);
+  }
+
+  const char *depth = nullptr;
+};
+
+// Synchronous actions must not nest inside one another
+static void test_action_synchronous_depth() {
+  ActionList al(nullptr);
+  std::vector<std::unique_ptr<DepthAction>> as;
+  for(int n = 0; n < 100; ++n) {
+    as.emplace_back(new DepthAction("a" + std::to_string(n)));
+    al.add(as.back().get());
+  }
+  al.go();
+  for(auto &a: as)
+    assert(a->depth == as.front()->depth);
+}
+
+class SleepAction: public ThreadedAction {
+public:
+  SleepAction(const std::string &n, bool fail = false):
+    ThreadedAction(n), fail(fail) {
+  }
+
+  void work() override {
+    usleep(20000);
+    if(fail)
+      throw std::runtime_error("failed");
+    worked = true;
+  }
+
+  bool finished(std::exception_ptr failure) override {
+    acted = ++action_number;
+    failed = !!failure;
+    return !failure;
+  }
+
+  bool fail;
+  bool worked = false;
+  bool failed = false;
+  int acted = 0;
+};
+
+static void test_action_threaded() {
+  SleepAction a("a"), b("b", true), c("c");
+  EventLoop e;
+  ActionList al(&e);
+  al.add(&a);
+  a.uses("r1");
+  al.add(&b);
+  b.uses("r2");
+  al.add(&c);
+  c.after("a", ACTION_SUCCEEDED);
+  action_number = 0;
+  al.go();
+  assert(a.worked && !a.failed);
+  assert(!b.worked && b.failed);
+  assert(c.worked && !c.failed);
+  assert(c.acted > a.acted);
+
+  ActionList bl(nullptr);
+  SleepAction d("d");
+  bl.add(&d);
+  bl.go();
+  assert(d.worked);
+}
+
 int main() {
   //debug = true;
   test_action_simple();
@@ -290,5 +405,8 @@ int main() {
   test_action_glob();
   test_action_glob_status();
   test_action_priority();
+  test_action_synchronous();
+  test_action_synchronous_depth();
+  test_action_threaded();
   return 0;
 }
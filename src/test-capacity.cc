@@ -0,0 +1,81 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Conf.h"
+#include "Command.h"
+#include "Capacity.h"
+#include "Database.h"
+#include "Date.h"
+#include <cassert>
+#include <cmath>
+
+static const int64_t GB = 1024LL * 1024 * 1024;
+
+int main() {
+  database = ":memory:";
+  Database &db = config.getdb();
+  const time_t now = Date::now();
+
+  // No measurements
+  CapacityForecast f;
+  f.compute(db, "dev");
+  assert(f.latest.when == 0);
+  assert(f.daysUntilFull() == -1);
+
+  // One measurement is not enough to estimate growth
+  StoreUsage u;
+  u.when = now - 2 * 86400;
+  u.totalBytes = 100 * GB;
+  u.freeBytes = 50 * GB;
+  u.totalFiles = 1000000;
+  u.freeFiles = 900000;
+  u.record(db, "dev");
+  f.compute(db, "dev");
+  assert(f.latest.when == u.when);
+  assert(!f.growthKnown);
+  assert(f.daysUntilFull() == -1);
+
+  // 5GB/day growth
+  u.when += 86400;
+  u.freeBytes -= 5 * GB;
+  u.record(db, "dev");
+  u.when += 86400;
+  u.freeBytes -= 5 * GB;
+  u.record(db, "dev");
+  f.compute(db, "dev");
+  assert(f.growthKnown);
+  assert(fabs(f.bytesPerDay - 5 * GB) < 1);
+  assert(f.filesPerDay == 0);
+  assert(f.daysUntilFull() == 8);
+
+  // Inodes running out faster
+  u.when += 86400;
+  u.freeBytes -= 5 * GB;
+  u.freeFiles = 0;
+  u.record(db, "dev");
+  f.compute(db, "dev");
+  assert(f.daysUntilFull() == 0);
+
+  // Measurements of other devices are independent
+  f.compute(db, "other");
+  assert(f.latest.when == 0);
+
+  // Measuring a real filesystem
+  StoreUsage r;
+  r.measure(".");
+  assert(r.when != 0);
+  assert(r.totalBytes >= r.freeBytes);
+  return 0;
+}
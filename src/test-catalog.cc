@@ -0,0 +1,248 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Catalog.h"
+#include "Conf.h"
+#include "Command.h"
+#include "Backup.h"
+#include <cassert>
+#include <cstring>
+
+static void test_parse() {
+  CatalogEntry e;
+  assert(parseCatalogLine(">f+++++++++ 1234 2017/03/02-10:11:12 etc/foo bar",
+                          e));
+  assert(e.flags == ">f+++++++++");
+  assert(e.size == 1234);
+  struct tm t;
+  localtime_r(&e.mtime, &t);
+  assert(t.tm_year == 117 && t.tm_mon == 2 && t.tm_mday == 2);
+  assert(t.tm_hour == 10 && t.tm_min == 11 && t.tm_sec == 12);
+  assert(e.path == "etc/foo bar");
+  assert(!e.deleted());
+
+  assert(parseCatalogLine(".d          4096 2017/03/02-10:11:12 ./", e));
+  assert(e.flags == ".d         ");
+  assert(e.path == ".");
+
+  assert(parseCatalogLine("hf          0 2017/03/02-10:11:12 etc/empty", e));
+  assert(e.size == 0);
+  assert(e.path == "etc/empty");
+
+  // rsync escapes non-printable and non-ASCII bytes; paths are stored raw,
+  // as the native copy engine records them
+  assert(parseCatalogLine(">f+++++++++ 5 2017/03/02-10:11:12"
+                          " home/caf\\#303\\#251/a\\#012b", e));
+  assert(e.path == "home/caf\xc3\xa9/a\nb");
+
+  assert(parseCatalogLine("*deleting   0 1970/01/01-00:00:00 etc/old/", e));
+  assert(e.deleted());
+  assert(e.path == "etc/old");
+
+  assert(!parseCatalogLine("", e));
+  assert(!parseCatalogLine("skipping non-regular file \"dev/null\"", e));
+  assert(!parseCatalogLine("rsync: connection unexpectedly closed", e));
+  assert(!parseCatalogLine(">f+++++++++ 1234", e));
+  assert(!parseCatalogLine(">f+++++++++ x 2017/03/02-10:11:12 foo", e));
+  assert(!parseCatalogLine(">f+++++++++ 1 2017/03/02 10:11:12 foo", e));
+  assert(!parseCatalogLine(">f+++++++++ 1 2017/03/02-10:11:12 ", e));
+
+  struct stat sb;
+  memset(&sb, 0, sizeof sb);
+  sb.st_mode = S_IFREG|0644;
+  assert(catalogFlags(sb, true) == ">f+++++++++");
+  assert(catalogFlags(sb, false) == ".f         ");
+  sb.st_mode = S_IFDIR|0755;
+  assert(catalogFlags(sb, true) == "cd+++++++++");
+  sb.st_mode = S_IFLNK|0777;
+  assert(catalogFlags(sb, true) == "cL+++++++++");
+}
+
+static void test_paths() {
+  assert(catalogPath("etc/foo") == "etc/foo");
+  assert(catalogPath("/etc/foo/") == "etc/foo");
+  assert(catalogPath("./etc") == "etc");
+  assert(catalogPath("./") == ".");
+  assert(catalogPath("") == ".");
+
+  std::string r;
+  assert(catalogRelativePath("/home", "/home/rjk/.profile", r));
+  assert(r == "rjk/.profile");
+  assert(catalogRelativePath("/home/", "/home", r));
+  assert(r == ".");
+  assert(!catalogRelativePath("/home", "/homer/x", r));
+  assert(!catalogRelativePath("/home", "/etc/passwd", r));
+  assert(catalogRelativePath("/", "/etc/passwd", r));
+  assert(r == "etc/passwd");
+}
+
+static void addBackup(Database &db, const std::string &id) {
+  Database::Statement(db,
+                      "INSERT INTO backup"
+                      " (host,volume,device,id,time,pruned,rc,status,log)"
+                      " VALUES ('h','v','d',?,0,0,0,?,'')",
+                      SQL_STRING, &id,
+                      SQL_INT, COMPLETE,
+                      SQL_END).next();
+}
+
+static void catalogBackup(Database &db, const std::string &id,
+                          const std::string &basis,
+                          const std::vector<const char *> &lines) {
+  addBackup(db, id);
+  CatalogWriter w(db, "h", "v", "d", id, basis);
+  w.start();
+  for(const char *line: lines) {
+    CatalogEntry e;
+    assert(parseCatalogLine(line, e));
+    w.add(e);
+  }
+  w.finish();
+  assert(w.items == lines.size());
+}
+
+static void test_writer() {
+  Database &db = config.getdb();
+  catalogBackup(db, "2017-01-01", "", {
+      "cd+++++++++ 4096 2017/01/01-00:00:00 ./",
+      ">f+++++++++ 10 2017/01/01-00:00:00 a",
+      ">f+++++++++ 20 2017/01/01-00:00:00 b",
+    });
+  catalogBackup(db, "2017-01-02", "2017-01-01", {
+      ".d          4096 2017/01/01-00:00:00 ./",
+      "hf          10 2017/01/01-00:00:00 a",
+      ">f.st...... 25 2017/01/02-00:00:00 b",
+    });
+  // a is deleted
+  catalogBackup(db, "2017-01-03", "2017-01-02", {
+      ".d          4096 2017/01/01-00:00:00 ./",
+      "hf          25 2017/01/02-00:00:00 b",
+    });
+  // a comes back
+  catalogBackup(db, "2017-01-04", "2017-01-03", {
+      ".d          4096 2017/01/01-00:00:00 ./",
+      ">f+++++++++ 10 2017/01/01-00:00:00 a",
+      "hf          25 2017/01/02-00:00:00 b",
+    });
+
+  std::vector<CatalogVersion> a = findCatalogVersions(db, "h", "v", "a");
+  assert(a.size() == 2);
+  assert(a[0].device == "d");
+  assert(a[0].first == "2017-01-01");
+  assert(a[0].last == "2017-01-02");
+  assert(a[0].backups == 2);
+  assert(a[0].size == 10);
+  assert(a[0].flags == ">f+++++++++");
+  assert(a[1].first == "2017-01-04");
+  assert(a[1].last == "2017-01-04");
+
+  std::vector<CatalogVersion> b = findCatalogVersions(db, "h", "v", "b");
+  assert(b.size() == 2);
+  assert(b[0].first == "2017-01-01" && b[0].last == "2017-01-01");
+  assert(b[0].size == 20);
+  assert(b[1].first == "2017-01-02" && b[1].last == "2017-01-04");
+  assert(b[1].backups == 3);
+  assert(b[1].size == 25);
+
+  std::vector<CatalogVersion> root = findCatalogVersions(db, "h", "v", ".");
+  assert(root.size() == 1);
+  assert(root[0].backups == 4);
+
+  assert(findCatalogVersions(db, "h", "v", "c").size() == 0);
+  assert(findCatalogVersions(db, "h", "w", "a").size() == 0);
+
+  // Retrying a backup replaces its catalog
+  CatalogWriter w(db, "h", "v", "d", "2017-01-04", "2017-01-03");
+  w.start();
+  CatalogEntry e;
+  assert(parseCatalogLine("hf          25 2017/01/02-00:00:00 b", e));
+  w.add(e);
+  w.finish();
+  a = findCatalogVersions(db, "h", "v", "a");
+  assert(a.size() == 1);
+  assert(a[0].last == "2017-01-02");
+  b = findCatalogVersions(db, "h", "v", "b");
+  assert(b.size() == 2);
+  assert(b[1].last == "2017-01-04");
+  root = findCatalogVersions(db, "h", "v", ".");
+  assert(root[0].last == "2017-01-03");
+
+  // An abandoned catalog leaves no trace
+  {
+    CatalogWriter w(db, "h", "v", "d", "2017-01-05", "2017-01-04");
+    w.start();
+    assert(parseCatalogLine("hf          25 2017/01/02-00:00:00 b", e));
+    w.add(e);
+  }
+  b = findCatalogVersions(db, "h", "v", "b");
+  assert(b[1].last == "2017-01-04");
+
+  // Nothing is written to the database until the catalog is finished, so
+  // other writers are not locked out while a backup is made
+  {
+    addBackup(db, "2017-01-05");
+    CatalogWriter w(db, "h", "v", "d", "2017-01-05", "2017-01-04");
+    w.start();
+    CatalogEntry n;
+    n.flags = ">f+++++++++";
+    n.size = 3;
+    n.mtime = 1000;
+    n.path = "new\nline";
+    w.add(n);
+    db.begin();
+    db.commit();
+    assert(findCatalogVersions(db, "h", "v", "new\nline").size() == 0);
+    w.finish();
+    std::vector<CatalogVersion> nl
+      = findCatalogVersions(db, "h", "v", "new\nline");
+    assert(nl.size() == 1);
+    assert(nl[0].first == "2017-01-05");
+    assert(nl[0].size == 3);
+    assert(nl[0].mtime == 1000);
+    assert(nl[0].flags == ">f+++++++++");
+  }
+  b = findCatalogVersions(db, "h", "v", "b");
+  assert(b[1].last == "2017-01-04");
+
+  // Pruned backups are not reported, and versions that only they contain
+  // are removed
+  Database::Statement(db,
+                      "UPDATE backup SET status=? WHERE id='2017-01-02'",
+                      SQL_INT, PRUNED,
+                      SQL_END).next();
+  b = findCatalogVersions(db, "h", "v", "b");
+  assert(b.size() == 2);
+  assert(b[1].first == "2017-01-03");
+  assert(b[1].backups == 2);
+  Database::Statement(db,
+                      "DELETE FROM backup WHERE id<='2017-01-02'",
+                      SQL_END).next();
+  pruneCatalog(db);
+  a = findCatalogVersions(db, "h", "v", "a");
+  assert(a.size() == 0);
+  b = findCatalogVersions(db, "h", "v", "b");
+  assert(b.size() == 1);
+  Database::Statement count(db, "SELECT COUNT(*) FROM catalog", SQL_END);
+  assert(count.next());
+  assert(count.get_int(0) == 3);
+}
+
+int main() {
+  database = ":memory:";
+  test_parse();
+  test_paths();
+  test_writer();
+  return 0;
+}
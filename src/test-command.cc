@@ -70,6 +70,17 @@ static void test_action_prune_incomplete(void) {
   assert(c.pruneIncomplete == true);
 }
 
+static void test_action_verify(void) {
+  static const char *argv[] = { "rsbackup", "--verify", "A:B", nullptr };
+  Command c;
+  assert(c.verify == false);
+  c.parse(3, argv);
+  assert(c.verify == true);
+  assert(c.selections.size() == 1);
+  assert(c.selections[0].host == "A");
+  assert(c.selections[0].volume == "B");
+}
+
 static void test_action_retire(void) {
   static const char *argv[] = { "rsbackup", "--retire", "VOLUME", nullptr };
   Command c;
@@ -121,6 +132,89 @@ static void test_action_dump_config(void) {
   }
 }
 
+static void test_action_daemon(void) {
+  static const char *argv[] = { "rsbackup", "--daemon", "SOCKET", "JUNK",
+                                nullptr };
+  Command c;
+  assert(c.daemonSocket == nullptr);
+  c.parse(3, argv);
+  assert(c.daemonSocket != nullptr);
+  assert(*c.daemonSocket == "SOCKET");
+
+  Command d;
+  try {
+    d.parse(4, argv);
+    assert(!"unexpectedly succeeded");
+  } catch(CommandError &e) {
+  }
+}
+
+static void test_action_find(void) {
+  static const char *argv[] = { "rsbackup", "--find", "/etc/passwd", "A:B",
+                                nullptr };
+  Command c;
+  assert(c.find == nullptr);
+  c.parse(4, argv);
+  assert(c.find != nullptr);
+  assert(*c.find == "/etc/passwd");
+  assert(c.selections.size() == 1);
+  assert(c.selections[0].host == "A");
+  assert(c.selections[0].volume == "B");
+
+  static const char *argv2[] = { "rsbackup", "--prune", "--find", "/etc",
+                                 nullptr };
+  Command d;
+  try {
+    d.parse(4, argv2);
+    assert(!"unexpectedly succeeded");
+  } catch(CommandError &e) {
+    assert(std::string(e.what()).find("cannot be used with any other action")
+           != std::string::npos);
+  }
+}
+
+static void test_action_restore(void) {
+  static const char *argv[] = { "rsbackup", "--restore", "A:B:/etc",
+                                "--to", "/tmp/restore",
+                                "--date", "2017-03-01", nullptr };
+  Command c;
+  assert(c.restore == nullptr);
+  c.parse(7, argv);
+  assert(c.restore != nullptr);
+  assert(*c.restore == "A:B:/etc");
+  assert(*c.to == "/tmp/restore");
+  assert(*c.date == "2017-03-01");
+
+  static const char *argv2[] = { "rsbackup", "--restore", "A:B", nullptr };
+  Command d;
+  try {
+    d.parse(3, argv2);
+    assert(!"unexpectedly succeeded");
+  } catch(CommandError &e) {
+    assert(std::string(e.what()).find("requires --to") != std::string::npos);
+  }
+
+  static const char *argv3[] = { "rsbackup", "--backup", "--to", "/tmp",
+                                 nullptr };
+  Command e;
+  try {
+    e.parse(4, argv3);
+    assert(!"unexpectedly succeeded");
+  } catch(CommandError &e) {
+    assert(std::string(e.what()).find("only be used with --restore")
+           != std::string::npos);
+  }
+
+  static const char *argv4[] = { "rsbackup", "--restore", "A:B", "--to", "/x",
+                                 "A:C", nullptr };
+  Command f;
+  try {
+    f.parse(6, argv4);
+    assert(!"unexpectedly succeeded");
+  } catch(CommandError &e) {
+  }
+}
+
 static void test_action_none(void) {
   static const char *argv[] = { "rsbackup", nullptr };
   Command c;
@@ -168,6 +262,16 @@ static void test_action_incompatible(void) {
     assert(std::string(e.what()).find("cannot be used with any other action")
            != std::string::npos);
   }
+  try {
+    static const char *argv[] = { "rsbackup", "--daemon", "SOCKET", "--prune",
+                                  nullptr };
+    Command c;
+    c.parse(4, argv);
+    assert(!"unexpectedly succeeded");
+  } catch(CommandError &e) {
+    assert(std::string(e.what()).find("cannot be used with any other action")
+           != std::string::npos);
+  }
 
 }
 
@@ -244,9 +348,13 @@ int main() {
   test_action_email();
   test_action_prune();
   test_action_prune_incomplete();
+  test_action_verify();
   test_action_retire();
   test_action_retire_device();
   test_action_dump_config();
+  test_action_daemon();
+  test_action_find();
+  test_action_restore();
   test_action_none();
   test_action_incompatible();
   test_selection();
@@ -0,0 +1,193 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "ConfCache.h"
+#include "Command.h"
+#include "Conf.h"
+#include "Errors.h"
+#include "IO.h"
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/time.h>
+
+static void create(const std::string &path, const std::string &contents) {
+  IO f;
+  f.open(path, "w");
+  f.write(contents);
+  f.close();
+}
+
+// Set a file's modification time
+static void settime(const std::string &path, time_t when) {
+  struct timeval tv[2];
+  tv[0].tv_sec = tv[1].tv_sec = when;
+  tv[0].tv_usec = tv[1].tv_usec = 0;
+  assert(utimes(path.c_str(), tv) == 0);
+}
+
+// Cache a file as Conf::readOneFile would
+static void cacheFile(ConfCache &cache, const std::string &path,
+                      const std::vector<std::string> &contents) {
+  struct stat sb;
+  assert(!cache.findFile(path, sb));
+  uint64_t hash = ConfCache::HASH_INIT;
+  std::vector<ConfLine> lines;
+  int lineno = 0;
+  for(auto &line: contents) {
+    hash = ConfCache::hashLine(hash, line);
+    lines.push_back({++lineno, 0, {line}});
+  }
+  cache.addFile(path, sb, hash, std::move(lines));
+}
+
+int main() {
+  const char *tmpdir;
+  char *dir;
+
+  tmpdir = getenv("TMPDIR");
+  if(!tmpdir)
+    tmpdir = "/tmp";
+  assert(asprintf(&dir, "%s/XXXXXX", tmpdir) > 0);
+  assert(mkdtemp(dir));
+  const std::string cachePath = std::string(dir) + "/cache";
+  const std::string root = std::string(dir) + "/config";
+  const std::string other = std::string(dir) + "/other";
+  const std::string incdir = std::string(dir) + "/include.d";
+  struct stat sb;
+
+  create(root, "alpha\nbeta\n");
+  create(other, "gamma\n");
+  assert(mkdir(incdir.c_str(), 0777) == 0);
+  create(incdir + "/one", "one\n");
+  settime(root, 1000000000);
+  settime(other, 1000000000);
+
+  // Nothing cached yet
+  {
+    ConfCache cache(cachePath);
+    cache.load(root);
+    assert(!cache.current());
+    cacheFile(cache, root, {"alpha", "beta"});
+    cacheFile(cache, other, {"gamma"});
+    assert(!cache.findDirectory(root, sb));
+    assert(!cache.findDirectory(incdir, sb));
+    cache.addDirectory(incdir, sb, {"one"});
+    assert(!cache.current());
+    cache.save();
+  }
+
+  // Everything cached
+  {
+    ConfCache cache(cachePath);
+    cache.load(root);
+    const std::vector<ConfLine> *lines = cache.findFile(root, sb);
+    assert(lines);
+    assert(lines->size() == 2);
+    assert((*lines)[0].lineno == 1);
+    assert((*lines)[0].bits.size() == 1);
+    assert((*lines)[0].bits[0] == "alpha");
+    assert((*lines)[1].bits[0] == "beta");
+    // A file can be found twice
+    assert(cache.findFile(root, sb));
+    assert(cache.findFile(other, sb));
+    const std::vector<std::string> *files = cache.findDirectory(incdir, sb);
+    assert(files);
+    assert(files->size() == 1);
+    assert((*files)[0] == "one");
+    assert(cache.current());
+    cache.save();
+  }
+
+  // A cache for a different root is ignored
+  {
+    ConfCache cache(cachePath);
+    cache.load(other);
+    assert(!cache.findFile(other, sb));
+    assert(!cache.current());
+  }
+
+  // Touching a file doesn't invalidate it
+  settime(root, 1000000100);
+  {
+    ConfCache cache(cachePath);
+    cache.load(root);
+    assert(cache.findFile(root, sb));
+    assert(cache.findFile(other, sb));
+    assert(cache.findDirectory(incdir, sb));
+    assert(cache.current());
+  }
+
+  // Modifying a file does invalidate it
+  create(other, "delta\n");
+  settime(other, 1000000200);
+  {
+    ConfCache cache(cachePath);
+    cache.load(root);
+    assert(cache.findFile(root, sb));
+    assert(!cache.findFile(other, sb));
+    assert(!cache.current());
+  }
+
+  // Removing a file from a directory invalidates the directory
+  unlink((incdir + "/one").c_str());
+  {
+    ConfCache cache(cachePath);
+    cache.load(root);
+    assert(!cache.findDirectory(incdir, sb));
+    assert(!cache.current());
+  }
+
+  // Malformed caches are ignored
+  create(cachePath, "junk");
+  {
+    ConfCache cache(cachePath);
+    cache.load(root);
+    assert(!cache.findFile(root, sb));
+  }
+
+  // A configuration read from the cache is still validated
+  const std::string script = std::string(dir) + "/pruner";
+  create(script, "#! /bin/sh\n");
+  assert(chmod(script.c_str(), 0755) == 0);
+  create(root,
+         "prune-policy exec\n"
+         "prune-parameter path " + script + "\n"
+         "host host1\n"
+         "  volume volume1 /volume1\n");
+  configPath = root;
+  configCachePath = std::string(dir) + "/conf-cache";
+  {
+    Conf c;
+    c.read();
+    c.validate();
+  }
+  assert(chmod(script.c_str(), 0644) == 0);
+  {
+    Conf c;
+    c.read();
+    try {
+      c.validate();
+      assert(!"unexpectedly succeeded");
+    } catch(ConfigError &) {
+    }
+  }
+
+  int r = system(("rm -rf " + (std::string)dir).c_str());
+  (void)r;                              // Work around GCC/Glibc stupidity
+  free(dir);
+  return 0;
+}
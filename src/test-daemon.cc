@@ -0,0 +1,263 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "rsbackup.h"
+#include "Daemon.h"
+#include "Command.h"
+#include "Conf.h"
+#include "Backup.h"
+#include "Volume.h"
+#include "Defaults.h"
+#include "IO.h"
+#include "Errors.h"
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+static void create(const std::string &path, const std::string &contents) {
+  IO f;
+  f.open(path, "w");
+  f.write(contents);
+  f.close();
+}
+
+static bool exists(const std::string &path) {
+  struct stat sb;
+  return stat(path.c_str(), &sb) == 0;
+}
+
+static void address(const std::string &path, struct sockaddr_un &addr) {
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  assert(path.size() < sizeof addr.sun_path);
+  strcpy(addr.sun_path, path.c_str());
+}
+
+// Connect to the daemon, waiting for it to start listening
+static int connectTo(const std::string &path) {
+  struct sockaddr_un addr;
+  address(path, addr);
+  for(int tries = 0; tries < 1000; ++tries) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    if(connect(fd, reinterpret_cast<struct sockaddr *>(&addr),
+               sizeof addr) == 0)
+      return fd;
+    assert(errno == ENOENT || errno == ECONNREFUSED);
+    close(fd);
+    usleep(10000);
+  }
+  assert(!"daemon did not start");
+  return -1;
+}
+
+static void send(int fd, const std::string &s) {
+  assert(write(fd, s.data(), s.size()) == (ssize_t)s.size());
+}
+
+static std::string receive(int fd) {
+  std::string reply;
+  char buffer[1024];
+  ssize_t n;
+  while((n = read(fd, buffer, sizeof buffer)) > 0)
+    reply.append(buffer, n);
+  assert(n == 0);
+  close(fd);
+  return reply;
+}
+
+// Send one request and return the whole reply
+static std::string request(const std::string &path,
+                           const std::string &line) {
+  int fd = connectTo(path);
+  send(fd, line);
+  return receive(fd);
+}
+
+static bool endsWith(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size()
+    && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Run a daemon in a child process
+static pid_t startDaemon(const std::string &path, char **argv) {
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if(pid == 0) {
+    int status = 0;
+    try {
+      Daemon d(path, argv);
+      d.run();
+    } catch(std::runtime_error &e) {
+      fprintf(stderr, "daemon: %s\n", e.what());
+      status = 1;
+    }
+    _exit(status);
+  }
+  return pid;
+}
+
+static int finished(pid_t pid) {
+  int status;
+  assert(waitpid(pid, &status, 0) == pid);
+  assert(WIFEXITED(status));
+  return WEXITSTATUS(status);
+}
+
+static void test_socket(const std::string &root,
+                        const std::string &configText) {
+  const std::string path = root + "/socket";
+  const std::string backups = root + "/store/host1/volume1/";
+  // Restarting runs the command line, which just reports that it was run
+  char *args[] = {
+    (char *)"sh", (char *)"-c", (char *)"exit 42", nullptr
+  };
+
+  // The pass at startup blocks in the access hook until 'go' exists
+  assert(unlink((root + "/go").c_str()) == 0);
+  setenv("RSBACKUP_TODAY", "2017-07-03", 1);
+  pid_t pid = startDaemon(path, args);
+
+  // Only one job runs at a time
+  assert(request(path, "backup\n") == "error: busy\n");
+
+  // A client that has not finished its request does not hold up others
+  const std::string status = "host1:volume1 device1 2 2017-07-02\nok\n";
+  int slow = connectTo(path);
+  send(slow, "sta");
+  time_t started = time(nullptr);
+  assert(request(path, "status\n") == status);
+  assert(time(nullptr) - started < DAEMON_CLIENT_TIMEOUT / 2);
+  send(slow, "tus\n");
+  assert(receive(slow) == status);
+
+  // Reports
+  std::string text = request(path, "report text\n");
+  assert(text.size() > 3 && endsWith(text, "\nok\n"));
+  std::string html = request(path, "report html\n");
+  assert(html.find("<html") != std::string::npos && endsWith(html, "ok\n"));
+  assert(request(path, "report pdf\n") == "error: usage: report text|html\n");
+
+  // Bad requests
+  assert(request(path, "frobnicate\n") == "error: unknown command 'frobnicate'\n");
+  assert(request(path, "\n") == "error: empty request\n");
+
+  // A second daemon refuses to take over a live socket
+  try {
+    Daemon other(path, nullptr);
+    other.run();
+    assert(!"unexpectedly succeeded");
+  } catch(CommandError &) {
+  }
+
+  // An invalid configuration is not reloaded
+  create(root + "/config", "no-such-directive\n");
+  assert(request(path, "reload\n")
+         == "error: new configuration is not valid\n");
+
+  // Quitting waits for the job, then removes the socket
+  create(root + "/go", "");
+  assert(request(path, "quit\n") == "ok\n");
+  assert(finished(pid) == 0);
+  assert(exists(backups + "2017-07-03/file"));
+  assert(!exists(path));
+
+  // A stale socket is replaced
+  struct sockaddr_un addr;
+  address(path, addr);
+  int stale = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert(stale >= 0);
+  assert(bind(stale, reinterpret_cast<struct sockaddr *>(&addr),
+              sizeof addr) == 0);
+  close(stale);
+  create(root + "/config", configText);
+  pid = startDaemon(path, args);
+
+  // A valid configuration is reloaded by re-executing the command line
+  assert(request(path, "reload\n") == "ok\n");
+  assert(finished(pid) == 42);
+}
+
+int main() {
+  const char *tmpdir;
+  char *dir;
+
+  tmpdir = getenv("TMPDIR");
+  if(!tmpdir)
+    tmpdir = "/tmp";
+  assert(asprintf(&dir, "%s/XXXXXX", tmpdir) > 0);
+  assert(mkdtemp(dir));
+  const std::string root = dir;
+  assert(mkdir((root + "/store").c_str(), 0700) == 0);
+  assert(mkdir((root + "/logs").c_str(), 0700) == 0);
+  assert(mkdir((root + "/volume").c_str(), 0700) == 0);
+  create(root + "/store/device-id", "device1\n");
+  create(root + "/volume/file", "contents\n");
+  create(root + "/go", "");
+  const std::string configText =
+    "store " + root + "/store\n"
+    "device device1\n"
+    "logs " + root + "/logs\n"
+    "report title:Backups summary\n"
+    "pre-access-hook sh -c \"while ! test -e " + root + "/go; do sleep 0.1; done\"\n"
+    "host host1\n"
+    "  hostname localhost\n"
+    "  copy-engine native\n"
+    "  volume volume1 " + root + "/volume\n";
+  create(root + "/config", configText);
+  configPath = root + "/config";
+  config.read();
+  config.validate();
+  const std::string backups = root + "/store/host1/volume1/";
+
+  Daemon d(root + "/socket", nullptr);
+  // The first pass makes today's backup
+  setenv("RSBACKUP_TODAY", "2017-07-01", 1);
+  assert(d.scheduled());
+  // Only one job runs at a time
+  assert(!d.scheduled());
+  assert(d.wait() == 0);
+  assert(exists(backups + "2017-07-01/file"));
+
+  // Another pass on the same day has nothing to do
+  assert(d.scheduled());
+  assert(d.wait() == 0);
+
+  // After midnight, the next pass makes a new backup
+  setenv("RSBACKUP_TODAY", "2017-07-02", 1);
+  assert(d.scheduled());
+  assert(d.wait() == 0);
+  assert(exists(backups + "2017-07-02/file"));
+
+  // The daemon sees the backups the jobs made
+  config.readState();
+  const Volume *volume = config.findVolume("host1", "volume1");
+  assert(volume->completed == 2);
+
+  // Nothing left to wait for
+  assert(d.wait() == 0);
+
+  test_socket(root, configText);
+
+  assert(system(("rm -rf " + root).c_str()) == 0);
+  return 0;
+}
@@ -76,11 +76,39 @@ static void test_retrieve() {
   }
 }
 
+static void test_reset() {
+  Database d(DBPATH);
+  Database::Statement s(d,
+                        "UPDATE t SET s = ? WHERE i = ?",
+                        SQL_CSTRING, "nought",
+                        SQL_INT, 0,
+                        SQL_END);
+  assert(!s.next());
+  assert(d.changes() == 1);
+  s.reset(SQL_CSTRING, "two",
+          SQL_INT, 2,
+          SQL_END);
+  assert(!s.next());
+  assert(d.changes() == 0);
+  s.reset(SQL_CSTRING, "uno",
+          SQL_INT, 1,
+          SQL_END);
+  assert(!s.next());
+  assert(d.changes() == 1);
+  Database::Statement q(d, "SELECT s FROM t ORDER BY i", SQL_END);
+  assert(q.next());
+  assert(q.get_string(0) == "nought");
+  assert(q.next());
+  assert(q.get_string(0) == "uno");
+  assert(!q.next());
+}
+
 int main() {
   unlink(DBPATH);
   test_create();
   test_populate();
   test_retrieve();
+  test_reset();
   unlink(DBPATH);
   return 0;
 }
@@ -17,6 +17,7 @@
 #include "Errors.h"
 #include <cassert>
 #include <cstdio>
+#include <cstdlib>
 #include <sstream>
 
 #define assert_throws(expr, except) do {        \
@@ -30,9 +31,9 @@
 int main() {
   Date d("1997-03-02");
   assert(d.toString() == "1997-03-02");
-  assert(d.toNumber() == (1997*365+(1997/4)-(1997/100)+(1997/400)
-                          +31+28
-                          +2-1));
+  assert(d.toNumber() == (1997-1970)*365+(1997-1969)/4
+                         +31+28
+                         +2-1);
   Date dd(d.toTime());
   assert(d.toString() == dd.toString());
   std::stringstream s;
@@ -40,16 +41,31 @@ int main() {
   assert(s.str() == "1997-03-02");
   Date e("1998-03-02");
   assert(e.toString() == "1998-03-02");
-  assert(e.toNumber() == (1998*365+(1997/4)-(1997/100)+(1997/400)
-                          +31+28
-                          +2-1));
+  assert(e.toNumber() == (1998-1970)*365+(1998-1969)/4
+                         +31+28
+                         +2-1);
   assert(e - d == 365);
   Date ee(e.toTime());
   assert(e.toString() == ee.toString());
   Date f;
   assert(f.toString() == "0000-01-01");
+  assert(Date("1970-01-01").toNumber() == 0);
+  assert(Date("1969-12-31").toNumber() == -1);
+  static_assert(Date(1970, 1, 1).toNumber() == 0, "epoch");
+  static_assert(Date(2000, 3, 1) - Date(2000, 2, 28) == 2, "leap day");
+  static_assert(Date(2100, 3, 1) - Date(2100, 2, 28) == 1, "no leap day");
+  static_assert(Date(2016, 2, 29).year() == 2016, "year");
+  static_assert(Date(2016, 2, 29).month() == 2, "month");
+  static_assert(Date(2016, 2, 29).day() == 29, "day");
   Date t = Date::today();
   printf("today = %s = %d\n", t.toString().c_str(), t.toNumber());
+  assert(setenv("RSBACKUP_TODAY", "1980-01-01", 1) == 0);
+  assert(Date::today() == t);
+  Date::forgetToday();
+  assert(Date::today() == Date("1980-01-01"));
+  assert(unsetenv("RSBACKUP_TODAY") == 0);
+  Date::forgetToday();
+  assert(Date::today() == t);
   Date tt(t.toTime());
   assert(t.toString() == tt.toString());
   assert(Date("1997-03-01") < Date("1997-03-02"));
@@ -74,6 +90,7 @@ int main() {
   assert_throws(Date("2012-01-32"), InvalidDate);
   assert_throws(Date("2011-02-29"), InvalidDate);
   assert_throws(Date("0x100-02-29"), InvalidDate);
+  assert_throws(Date("10000-01-01"), InvalidDate);
   assert_throws(Date("2147483648-02-01"), InvalidDate);
   assert_throws(Date("9223372036854775808-02-21"), InvalidDate);
 
@@ -124,6 +141,11 @@ int main() {
   } subtract_tests[] = {
     { "2015-12-01", "2015-11-01", 30 },
     { "2016-02-01", "2016-01-01", 31 },
+    { "2016-03-01", "2015-03-01", 366 },
+    { "2017-03-01", "2016-03-01", 365 },
+    { "2001-01-01", "2000-01-01", 366 },
+    { "2101-01-01", "2100-01-01", 365 },
+    { "2017-01-01", "1970-01-01", 17167 },
   };
   for(auto &t: subtract_tests) {
     Date a = t.a;
@@ -135,5 +157,13 @@ int main() {
     assert(delta == t.delta);
   }
 
+  // Round trip every day over a few centuries
+  Date r(1899, 12, 31);
+  for(int n = r.toNumber(); n < Date(2201, 1, 1).toNumber(); ++n, ++r) {
+    assert(r.toNumber() == n);
+    assert(Date(r.toString()) == r);
+    assert(Date(r.year(), r.month(), r.day()) == r);
+  }
+
   return 0;
 }
@@ -0,0 +1,238 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Dedup.h"
+#include "Backup.h"
+#include "Command.h"
+#include "Conf.h"
+#include "Database.h"
+#include "Errors.h"
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static void create(const std::string &path, const std::string &contents,
+                   mode_t mode = 0644) {
+  int fd = open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0600);
+  assert(fd >= 0);
+  assert(write(fd, contents.data(), contents.size())
+         == (ssize_t)contents.size());
+  assert(fchmod(fd, mode) == 0);
+  struct timespec times[2] = { { 1000, 0 }, { 2000, 0 } };
+  assert(futimens(fd, times) == 0);
+  close(fd);
+}
+
+static void mkdirs(const std::string &path) {
+  int r = system(("mkdir -p " + path).c_str());
+  assert(r == 0);
+}
+
+static ino_t inode(const std::string &path) {
+  struct stat sb;
+  assert(lstat(path.c_str(), &sb) == 0);
+  return sb.st_ino;
+}
+
+// Write new index entries to the database
+static void flush(DedupIndex &index) {
+  Database &db = config.getdb();
+  db.begin();
+  index.write();
+  db.commit();
+}
+
+// Count index entries in the database
+static int indexed() {
+  Database::Statement stmt(config.getdb(),
+                           "SELECT COUNT(*) FROM dedup_index", SQL_END);
+  assert(stmt.next());
+  return stmt.get_int(0);
+}
+
+static void test_dedup(const std::string &store) {
+  const std::string x(10000, 'x'), y = "y\n";
+  std::string z = x;
+  z[5000] = 'z';
+  mkdirs(store + "/h1/v/1/d");
+  create(store + "/h1/v/1/a", x);
+  create(store + "/h1/v/1/b", y);
+  create(store + "/h1/v/1/d/c", x);
+  create(store + "/h1/v/1/empty", "");
+  DedupIndex index(config.getdb(), "d");
+  int64_t budget = INT64_MAX;
+
+  // Identical files within a backup are linked
+  DedupTree first(store, "h1", "v", "1", index, budget);
+  first.run(4);
+  assert(!first.exhausted);
+  assert(first.hashed == 3);
+  assert(first.linked == 1);
+  assert(first.reclaimed > 0);
+  assert(first.bytesRead == 2 * 10000 + 2 + 2 * 10000);
+  assert(inode(store + "/h1/v/1/a") == inode(store + "/h1/v/1/d/c"));
+  assert(index.changed.size() == 2);
+  flush(index);
+  assert(index.changed.size() == 0);
+  assert(indexed() == 2);
+
+  // Files already indexed are not read again
+  DedupTree again(store, "h1", "v", "1", index, budget);
+  again.run(4);
+  assert(again.hashed == 0);
+  assert(again.bytesRead == 0);
+
+  // ...and across volumes, if their metadata matches
+  mkdirs(store + "/h2/v/1");
+  create(store + "/h2/v/1/a", x);
+  create(store + "/h2/v/1/mode", x, 0600);
+  create(store + "/h2/v/1/z", z);
+  create(store + "/h2/v/1/linked", y);
+  assert(link((store + "/h2/v/1/linked").c_str(),
+              (store + "/h2/v/1/linked2").c_str()) == 0);
+  DedupTree second(store, "h2", "v", "1", index, budget);
+  second.run(4);
+  assert(second.hashed == 3);
+  assert(second.linked == 1);
+  assert(inode(store + "/h2/v/1/a") == inode(store + "/h1/v/1/a"));
+  assert(inode(store + "/h2/v/1/mode") != inode(store + "/h1/v/1/a"));
+  assert(inode(store + "/h2/v/1/z") != inode(store + "/h1/v/1/a"));
+  assert(inode(store + "/h2/v/1/linked") != inode(store + "/h1/v/1/b"));
+  flush(index);
+  assert(indexed() == 4);
+
+  // If the indexed file has gone, the new one replaces it in the index
+  assert(unlink((store + "/h1/v/1/a").c_str()) == 0);
+  assert(unlink((store + "/h1/v/1/d/c").c_str()) == 0);
+  mkdirs(store + "/h3/v/1");
+  create(store + "/h3/v/1/a", x);
+  DedupTree third(store, "h3", "v", "1", index, budget);
+  third.run(4);
+  assert(third.hashed == 1);
+  assert(third.linked == 0);
+  assert(index.changed.size() == 1);
+  const DedupEntry &replaced = index.changed.begin()->second;
+  assert(replaced.path == "h3/v/1/a");
+  assert(replaced.host == "h3");
+  assert(replaced.id == "1");
+  assert(replaced.inode == inode(store + "/h3/v/1/a"));
+  flush(index);
+  assert(indexed() == 4);
+
+  // A new file that reuses the inode number of an indexed file is still
+  // deduplicated
+  mkdirs(store + "/h5/v/1");
+  create(store + "/h5/v/1/a", x);
+  create(store + "/h5/v/1/b", std::string(5000, 'r'));
+  Database::Statement(config.getdb(),
+                      "UPDATE dedup_index SET inode=?"
+                      " WHERE path='h3/v/1/a'",
+                      SQL_INT64, (sqlite_int64)inode(store + "/h5/v/1/b"),
+                      SQL_END).next();
+  assert(!index.indexed(inode(store + "/h5/v/1/b"), 5000, 2000000000000LL));
+  DedupTree fifth(store, "h5", "v", "1", index, budget);
+  fifth.run(4);
+  assert(fifth.hashed == 2);
+  // ...the stale entry is not used, and is replaced
+  assert(fifth.linked == 0);
+  assert(inode(store + "/h5/v/1/a") != inode(store + "/h3/v/1/a"));
+  flush(index);
+  assert(indexed() == 5);
+  assert(index.indexed(inode(store + "/h5/v/1/b"), 5000, 2000000000000LL));
+
+  // A temporary left behind by an interrupted run does not get in the way
+  mkdirs(store + "/h6/v/1");
+  create(store + "/h6/v/1/a", x);
+  create(store + "/h6/v/1/.rsbackup-dedup.tmp", y);
+  DedupTree sixth(store, "h6", "v", "1", index, budget);
+  sixth.run(4);
+  assert(sixth.linked == 1);
+  assert(inode(store + "/h6/v/1/a") == inode(store + "/h5/v/1/a"));
+  assert(access((store + "/h6/v/1/.rsbackup-dedup.tmp").c_str(), F_OK) < 0);
+  flush(index);
+
+  // The budget is respected
+  mkdirs(store + "/h4/v/1");
+  create(store + "/h4/v/1/a", x);
+  create(store + "/h4/v/1/b", std::string(20000, 'b'));
+  budget = 15000;
+  DedupTree fourth(store, "h4", "v", "1", index, budget);
+  fourth.run(1);
+  assert(fourth.exhausted);
+  assert(fourth.linked == 0);
+  assert(budget >= 0);
+  assert(fourth.bytesRead + budget == 15000);
+
+  // Errors are reported
+  try {
+    DedupTree missing(store, "missing", "v", "1", index, budget);
+    missing.run(4);
+    assert(!"unexpectedly succeeded");
+  } catch(IOError &e) {
+    assert(e.errno_value == ENOENT);
+  }
+}
+
+// Add a backup record
+static void addBackup(const std::string &host, int status) {
+  const std::string volume = "v", device = "d", id = "1";
+  Database::Statement(config.getdb(),
+                      "INSERT INTO backup (host,volume,device,id,status)"
+                      " VALUES (?,?,?,?,?)",
+                      SQL_STRING, &host,
+                      SQL_STRING, &volume,
+                      SQL_STRING, &device,
+                      SQL_STRING, &id,
+                      SQL_INT, status,
+                      SQL_END).next();
+}
+
+static void test_prune() {
+  // Entries for removed and pruned backups go
+  addBackup("h2", COMPLETE);
+  addBackup("h3", PRUNED);
+  addBackup("h5", COMPLETE);
+  pruneDedup(config.getdb());
+  Database::Statement stmt(config.getdb(),
+                           "SELECT DISTINCT host FROM dedup_index"
+                           " ORDER BY host",
+                           SQL_END);
+  assert(stmt.next());
+  assert(stmt.get_string(0) == "h2");
+  assert(stmt.next());
+  assert(stmt.get_string(0) == "h5");
+  assert(!stmt.next());
+}
+
+int main() {
+  const char *tmpdir;
+  char *dir;
+  tmpdir = getenv("TMPDIR");
+  if(!tmpdir)
+    tmpdir = "/tmp";
+  assert(asprintf(&dir, "%s/XXXXXX", tmpdir) > 0);
+  assert(mkdtemp(dir));
+  database = ":memory:";
+  test_dedup(dir);
+  test_prune();
+  int r = system(("rm -rf " + (std::string)dir).c_str());
+  (void)r;                              // Work around GCC/Glibc stupidity
+  free(dir);
+  return 0;
+}
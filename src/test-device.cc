@@ -15,6 +15,8 @@
 #include <config.h>
 #include "Conf.h"
 #include "Device.h"
+#include "Capacity.h"
+#include "Errors.h"
 #include <getopt.h>
 #include <cassert>
 
@@ -27,5 +29,36 @@ int main() {
   assert(!Device::valid("\x80"));
   assert(!Device::valid(" "));
   assert(!Device::valid("\x1F"));
+
+  Device d("d");
+  StoreUsage u;
+  u.totalBytes = 1000;
+  u.freeBytes = 100;
+  u.totalFiles = 1000;
+  u.freeFiles = 500;
+  assert(!d.needsSpace(u));
+  d.minFreeSpace.parse("10%", true);
+  assert(d.minFreeSpace.percent && d.minFreeSpace.value == 10);
+  assert(d.minFreeSpace.toString() == "10%");
+  assert(!d.needsSpace(u));
+  d.minFreeSpace.parse("1K", true);
+  assert(!d.minFreeSpace.percent && d.minFreeSpace.value == 1024);
+  assert(d.minFreeSpace.toString() == "1024");
+  assert(d.needsSpace(u));
+  d.minFreeSpace.parse("0", true);
+  d.minFreeInodes.parse("501", false);
+  assert(d.needsSpace(u));
+  d.minFreeInodes.parse("50%", false);
+  assert(!d.needsSpace(u));
+  try {
+    d.minFreeInodes.parse("1K", false);
+    assert(!"unexpectedly succeeded");
+  } catch(SyntaxError &) {
+  }
+  try {
+    d.minFreeSpace.parse("101%", true);
+    assert(!"unexpectedly succeeded");
+  } catch(SyntaxError &) {
+  }
   return 0;
 }
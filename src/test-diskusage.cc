@@ -0,0 +1,175 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "DiskUsage.h"
+#include "Command.h"
+#include "Conf.h"
+#include "Database.h"
+#include "Errors.h"
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static void create(const std::string &path, size_t size) {
+  int fd = open(path.c_str(), O_WRONLY|O_CREAT, 0666);
+  assert(fd >= 0);
+  std::string contents(size, 'x');
+  assert(write(fd, contents.data(), size) == (ssize_t)size);
+  close(fd);
+}
+
+static int64_t allocated(const std::string &path) {
+  struct stat sb;
+  assert(lstat(path.c_str(), &sb) == 0);
+  return (int64_t)sb.st_blocks * 512;
+}
+
+static void test_spaces() {
+  database = ":memory:";
+  Database &db = config.getdb();
+  BackupSpaceMap spaces;
+  getAllBackupSpace(db, spaces);
+  assert(spaces.empty());
+  db.execute("INSERT INTO backup_space"
+             " (host,volume,device,id,total_bytes,exclusive_bytes,complete)"
+             " VALUES ('h','v','d','1',100,10,1),"
+             " ('h','v','d','2',200,20,0)");
+  // Only complete measurements are returned
+  getAllBackupSpace(db, spaces);
+  assert(spaces.size() == 1);
+  const BackupSpace &space = spaces[BackupSpaceKey("h", "v", "d", "1")];
+  assert(space.totalBytes == 100);
+  assert(space.exclusiveBytes == 10);
+}
+
+int main() {
+  const char *tmpdir;
+  char *dir;
+
+  tmpdir = getenv("TMPDIR");
+  if(!tmpdir)
+    tmpdir = "/tmp";
+  assert(asprintf(&dir, "%s/XXXXXX", tmpdir) > 0);
+  assert(mkdtemp(dir));
+  const std::string prev = std::string(dir) + "/prev";
+  const std::string cur = std::string(dir) + "/cur";
+
+  // Previous backup
+  assert(mkdir(prev.c_str(), 0777) == 0);
+  assert(mkdir((prev + "/d").c_str(), 0777) == 0);
+  create(prev + "/d/old", 20000);
+  // A different file that happens to have the same name as one in the new
+  // backup
+  create(prev + "/d/twice", 1000);
+
+  // New backup, sharing d/old with the previous one
+  assert(mkdir(cur.c_str(), 0777) == 0);
+  assert(mkdir((cur + "/d").c_str(), 0777) == 0);
+  assert(link((prev + "/d/old").c_str(), (cur + "/d/old").c_str()) == 0);
+  create(cur + "/d/new", 30000);
+  create(cur + "/d/twice", 40000);
+  assert(link((cur + "/d/twice").c_str(), (cur + "/d/again").c_str()) == 0);
+  create(cur + "/top", 5000);
+
+  std::vector<std::string> names = listBackupTree(cur);
+  assert(names.size() == 2);
+  assert(names[0] == "d");
+  assert(names[1] == "top");
+
+  const int64_t dirBytes = allocated(cur + "/d");
+  const int64_t oldBytes = allocated(cur + "/d/old");
+  const int64_t newBytes = allocated(cur + "/d/new");
+  const int64_t twiceBytes = allocated(cur + "/d/twice");
+  const int64_t topBytes = allocated(cur + "/top");
+
+  // Measure against the previous backup
+  std::map<std::string, BackupSpace> parts;
+  measureBackupTree(cur, prev, names,
+                    [&](const std::string &name, const BackupSpace &space) {
+                      assert(!parts.count(name));
+                      parts[name] = space;
+                    });
+  assert(parts.size() == 2);
+  assert(parts["d"].totalBytes
+         == dirBytes + oldBytes + newBytes + twiceBytes);
+  assert(parts["d"].exclusiveBytes == dirBytes + newBytes + twiceBytes);
+  assert(parts["d"].sharedBytes() == oldBytes);
+  assert(parts["top"].totalBytes == topBytes);
+  assert(parts["top"].exclusiveBytes == topBytes);
+  BackupSpace total;
+  for(auto &p: parts)
+    total += p.second;
+  assert(total.totalBytes == dirBytes + oldBytes + newBytes + twiceBytes
+         + topBytes);
+
+  // Without a previous backup, multiply-linked files are first seen here
+  parts.clear();
+  measureBackupTree(cur, "", {"d"},
+                    [&](const std::string &name, const BackupSpace &space) {
+                      parts[name] = space;
+                    });
+  assert(parts.size() == 1);
+  assert(parts["d"].sharedBytes() == 0);
+
+  // A file linked from two top-level entries is counted once
+  const std::string cross = std::string(dir) + "/cross";
+  assert(mkdir(cross.c_str(), 0777) == 0);
+  assert(mkdir((cross + "/a").c_str(), 0777) == 0);
+  assert(mkdir((cross + "/b").c_str(), 0777) == 0);
+  create(cross + "/a/f", 50000);
+  assert(link((cross + "/a/f").c_str(), (cross + "/b/f").c_str()) == 0);
+  const int64_t crossBytes = allocated(cross + "/a/f");
+  parts.clear();
+  measureBackupTree(cross, "", listBackupTree(cross),
+                    [&](const std::string &name, const BackupSpace &space) {
+                      parts[name] = space;
+                    });
+  assert(parts.size() == 2);
+  total = BackupSpace();
+  for(auto &p: parts)
+    total += p.second;
+  assert(total.totalBytes == allocated(cross + "/a") + allocated(cross + "/b")
+         + crossBytes);
+  assert(total.exclusiveBytes == total.totalBytes);
+
+  // Nothing to measure
+  measureBackupTree(cur, prev, {},
+                    [&](const std::string &, const BackupSpace &) {
+                      assert(!"unexpected callback");
+                    });
+
+  // Errors are reported
+  try {
+    measureBackupTree(cur, prev, {"missing"},
+                      [&](const std::string &, const BackupSpace &) {
+                        assert(!"unexpected callback");
+                      });
+    assert(!"unexpectedly succeeded");
+  } catch(IOError &e) {
+    assert(e.errno_value == ENOENT);
+  }
+
+  test_spaces();
+
+  int r = system(("rm -rf " + (std::string)dir).c_str());
+  (void)r;                              // Work around GCC/Glibc stupidity
+  free(dir);
+  return 0;
+}
@@ -0,0 +1,85 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Exclude.h"
+#include <cassert>
+
+static void test_match() {
+  assert(matchPattern("abc", "abc"));
+  assert(!matchPattern("abc", "abcd"));
+  assert(matchPattern("a*c", "abbbc"));
+  assert(matchPattern("a*c", "ac"));
+  assert(!matchPattern("a*c", "a/c"));
+  assert(matchPattern("a**c", "a/b/c"));
+  assert(matchPattern("a?c", "abc"));
+  assert(!matchPattern("a?c", "a/c"));
+  assert(matchPattern("*.o", "x.o"));
+  assert(!matchPattern("*.o", "x.c"));
+  assert(matchPattern("[abc]x", "bx"));
+  assert(!matchPattern("[abc]x", "dx"));
+  assert(matchPattern("[a-c]x", "cx"));
+  assert(matchPattern("[!a-c]x", "dx"));
+  assert(!matchPattern("[!a-c]x", "ax"));
+  assert(!matchPattern("[!a-c]x", "/x"));
+  assert(matchPattern("[]]", "]"));
+  assert(matchPattern("[", "["));
+  // Backslash only escapes if there are wildcards
+  assert(matchPattern("\\*", "*"));
+  assert(!matchPattern("\\*", "x"));
+  assert(matchPattern("a\\b", "a\\b"));
+  assert(!matchPattern("a\\b", "ab"));
+}
+
+static void test_exclusions() {
+  // Unanchored names match the final component anywhere
+  Exclusions e({ "*.o", "cache/", "/top", "tmp/*.swp", "/var/**/log",
+                 "junk/***" });
+  assert(e.excluded("x.o", false));
+  assert(e.excluded("a/b/x.o", false));
+  assert(!e.excluded("a/b/x.c", false));
+  // Trailing "/" is directories only
+  assert(e.excluded("a/cache", true));
+  assert(!e.excluded("a/cache", false));
+  // Leading "/" anchors
+  assert(e.excluded("top", false));
+  assert(!e.excluded("a/top", false));
+  // Patterns with "/" match trailing components
+  assert(e.excluded("tmp/a.swp", false));
+  assert(e.excluded("home/tmp/a.swp", false));
+  assert(!e.excluded("home/xtmp/a.swp", false));
+  assert(!e.excluded("tmp/a/b.swp", false));
+  assert(e.excluded("var/lib/x/log", true));
+  assert(!e.excluded("usr/var/lib/log", true));
+  // "/***" matches the directory and its contents
+  assert(e.excluded("junk", true));
+  assert(e.excluded("a/junk/b/c", false));
+  assert(!e.excluded("junk", false));
+  assert(!e.empty());
+
+  // The first match decides
+  Exclusions f({ "+ keep.o", "- *.o", "/" });
+  assert(!f.excluded("keep.o", false));
+  assert(f.excluded("lose.o", false));
+  assert(!f.excluded("x", true));
+
+  assert(Exclusions().empty());
+  assert(Exclusions(std::vector<std::string>()).empty());
+}
+
+int main() {
+  test_match();
+  test_exclusions();
+  return 0;
+}
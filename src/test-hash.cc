@@ -0,0 +1,41 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Hash.h"
+#include <algorithm>
+#include <cassert>
+
+int main() {
+  // Reference values from the xxHash implementation
+  assert(XXHash64::hash("") == 0xef46db3751d8e999ULL);
+  assert(XXHash64::hash("abc") == 0x44bc2cf5ad770999ULL);
+  assert(XXHash64::hash("Nobody inspects the spammish repetition")
+         == 0xfbcea83c8a378bf1ULL);
+
+  // The result doesn't depend on how the input is divided up
+  std::string s;
+  for(int n = 0; n < 1000; ++n)
+    s += static_cast<char>(n * 7);
+  for(size_t size: { 1, 3, 31, 32, 33, 100 }) {
+    XXHash64 h;
+    for(size_t pos = 0; pos < s.size(); pos += size)
+      h.update(s.data() + pos, std::min(size, s.size() - pos));
+    assert(h.digest() == XXHash64::hash(s));
+  }
+
+  // The seed matters
+  assert(XXHash64::hash(s, 1) != XXHash64::hash(s));
+  return 0;
+}
@@ -0,0 +1,44 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Errors.h"
+#include "Utils.h"
+#include <cassert>
+
+#define assert_throws(expr, except) do {        \
+  try {                                         \
+    (expr);                                     \
+    assert(!"unexpected succeeded");            \
+  } catch(except &e) {                          \
+  }                                             \
+} while(0)
+
+int main(void) {
+  assert(parseSize("0") == 0);
+  assert(parseSize("100") == 100);
+  assert(parseSize("1k") == 1024);
+  assert(parseSize("2K") == 2048);
+  assert(parseSize("3M") == 3 * 1024 * 1024);
+  assert(parseSize("4G") == 4LL * 1024 * 1024 * 1024);
+  assert(parseSize("5T") == 5LL * 1024 * 1024 * 1024 * 1024);
+  assert_throws(parseSize(""), SyntaxError);
+  assert_throws(parseSize("junk"), SyntaxError);
+  assert_throws(parseSize("-1"), SyntaxError);
+  assert_throws(parseSize("1X"), SyntaxError);
+  assert_throws(parseSize("1KB"), SyntaxError);
+  assert_throws(parseSize("99999999999999999999"), SyntaxError);
+  assert_throws(parseSize("9999999999T"), SyntaxError);
+  return 0;
+}
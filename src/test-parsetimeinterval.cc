@@ -0,0 +1,43 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Errors.h"
+#include "Utils.h"
+#include <cassert>
+
+#define assert_throws(expr, except) do {        \
+  try {                                         \
+    (expr);                                     \
+    assert(!"unexpected succeeded");            \
+  } catch(except &e) {                          \
+  }                                             \
+} while(0)
+
+int main(void) {
+  assert(parseTimeInterval("0") == 0);
+  assert(parseTimeInterval("100") == 100);
+  assert(parseTimeInterval("5s") == 5);
+  assert(parseTimeInterval("2m") == 120);
+  assert(parseTimeInterval("6h") == 21600);
+  assert(parseTimeInterval("7d") == 604800);
+  assert_throws(parseTimeInterval(""), SyntaxError);
+  assert_throws(parseTimeInterval("junk"), SyntaxError);
+  assert_throws(parseTimeInterval("-1"), SyntaxError);
+  assert_throws(parseTimeInterval("1H"), SyntaxError);
+  assert_throws(parseTimeInterval("1hr"), SyntaxError);
+  assert_throws(parseTimeInterval("99999999999999999999"), SyntaxError);
+  assert_throws(parseTimeInterval("999999999999999999d"), SyntaxError);
+  return 0;
+}
@@ -0,0 +1,101 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "PngWriter.h"
+#include "IO.h"
+#include <cassert>
+#include <cstdio>
+#include <vector>
+#include <unistd.h>
+
+static uint32_t get32(const std::string &s, size_t pos) {
+  return (static_cast<uint32_t>(static_cast<uint8_t>(s[pos])) << 24)
+    | (static_cast<uint32_t>(static_cast<uint8_t>(s[pos + 1])) << 16)
+    | (static_cast<uint32_t>(static_cast<uint8_t>(s[pos + 2])) << 8)
+    | static_cast<uint32_t>(static_cast<uint8_t>(s[pos + 3]));
+}
+
+static void test(unsigned width, unsigned height) {
+  const char *path = "pngwriter.tmp";
+  // Write a gradient
+  std::string expected;
+  {
+    IO f;
+    f.open(path, "w");
+    PngWriter png(f, width, height);
+    std::vector<uint8_t> row(3 * width);
+    for(unsigned y = 0; y < height; ++y) {
+      for(unsigned x = 0; x < width; ++x) {
+        row[3 * x] = x;
+        row[3 * x + 1] = y;
+        row[3 * x + 2] = x ^ y;
+      }
+      png.writeRow(&row[0]);
+      expected += '\0';
+      expected.append(reinterpret_cast<char *>(&row[0]), row.size());
+    }
+    png.finish();
+    f.close();
+  }
+  std::string contents;
+  {
+    IO f;
+    f.open(path, "r");
+    f.readall(contents);
+  }
+  unlink(path);
+  // Check the structure
+  assert(contents.compare(0, 8, "\x89PNG\r\n\x1a\n") == 0);
+  size_t pos = 8;
+  std::string idat, types;
+  while(pos < contents.size()) {
+    uint32_t len = get32(contents, pos);
+    std::string type = contents.substr(pos + 4, 4);
+    std::string data = contents.substr(pos + 8, len);
+    uLong crc = crc32(0, reinterpret_cast<const Bytef *>(type.data()), 4);
+    crc = crc32(crc, reinterpret_cast<const Bytef *>(data.data()), len);
+    assert(get32(contents, pos + 8 + len) == crc);
+    if(type == "IHDR") {
+      assert(len == 13);
+      assert(get32(data, 0) == width);
+      assert(get32(data, 4) == height);
+      assert(data[8] == 8);
+      assert(data[9] == 2);
+    } else if(type == "IDAT")
+      idat += data;
+    if(types.empty() || type != types.substr(types.size() - 4))
+      types += type;
+    pos += 12 + len;
+  }
+  assert(pos == contents.size());
+  assert(types == "IHDRIDATIEND");
+  // Check the image data
+  std::vector<Bytef> image(expected.size() + 1);
+  uLongf imageLen = image.size();
+  assert(uncompress(&image[0], &imageLen,
+                    reinterpret_cast<const Bytef *>(idat.data()),
+                    idat.size()) == Z_OK);
+  assert(imageLen == expected.size());
+  assert(std::string(reinterpret_cast<char *>(&image[0]), imageLen)
+         == expected);
+}
+
+int main() {
+  test(1, 1);
+  test(17, 3);
+  // Big enough to need several IDAT chunks
+  test(256, 1024);
+  return 0;
+}
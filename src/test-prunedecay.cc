@@ -14,8 +14,13 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <config.h>
 #include "Prune.h"
+#include "Conf.h"
+#include "Backup.h"
+#include "Volume.h"
+#include "Host.h"
 #include <cassert>
 #include <cstdio>
+#include <set>
 
 static const int v12[] = { 0,1,1,2,2,2,2,3,-1 };
 static const int v22[] = { 0,0,1,1,1,1,2,2,2,2,2,2,2,2,3,-1 };
@@ -33,10 +38,40 @@ static void check(int w, int s, const int *v) {
   }
 }
 
+// Prune a long synthetic backup history in one go
+static void checkMany(size_t count) {
+  Host *host = new Host(&config, "host");
+  Volume *volume = new Volume(host, "volume", "/volume");
+  volume->prunePolicy = "decay";
+  volume->pruneParameters["decay-limit"] = "100000000";
+  // One backup per day, the most recent one yesterday
+  std::vector<Backup> backups(count);
+  std::vector<Backup *> onDevice;
+  Date d(100, 1, 1);
+  for(auto &backup: backups) {
+    backup.date = d;
+    backup.deviceName = "device";
+    backup.volume = volume;
+    onDevice.push_back(&backup);
+    ++d;
+  }
+  const Date today = d;
+  const PrunePolicy *policy = PrunePolicy::find(volume->prunePolicy);
+  std::unique_ptr<PruneParameters> parameters = policy->parse(volume);
+  std::map<Backup *, std::string> prune;
+  policy->prunable(onDevice, prune, count, parameters.get(), today);
+  // The survivors are the youngest backup and the oldest in each bucket
+  std::set<int> buckets;
+  for(size_t a = 1; a < count; ++a)
+    buckets.insert(prune_decay_bucket(1, 2, a));
+  assert(count - prune.size() == 1 + buckets.size());
+}
+
 int main(void) {
   check(1, 2, v12);
   check(2, 2, v22);
   check(1, 3, v13);
   check(2, 3, v23);
+  checkMany(1000);
   return 0;
 }
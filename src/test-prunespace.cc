@@ -0,0 +1,85 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Prune.h"
+#include "Conf.h"
+#include "Backup.h"
+#include "Volume.h"
+#include "Host.h"
+#include "Device.h"
+#include <algorithm>
+#include <cassert>
+
+// Add a volume with a complete backup on each of days 1 to 5 of 2017
+static Volume *addVolume(Host *host, const std::string &name,
+                         const std::string &policy) {
+  Volume *volume = new Volume(host, name, "/" + name);
+  volume->prunePolicy = policy;
+  for(int day = 1; day <= 5; ++day) {
+    Backup *backup = new Backup();
+    backup->date = Date(2017, 1, day);
+    backup->id = backup->date.toString();
+    backup->deviceName = "d";
+    backup->volume = volume;
+    backup->setStatus(COMPLETE);
+    volume->addBackup(backup);
+  }
+  return volume;
+}
+
+// Describe candidates as volume name and day
+static std::vector<std::string> describe(
+    const std::vector<SpaceCandidate> &candidates) {
+  std::vector<std::string> result;
+  for(auto &c: candidates)
+    result.push_back(c.backup->volume->name + ":"
+                     + std::to_string(c.backup->date.toNumber()
+                                      - Date(2016, 12, 31).toNumber())
+                     + (c.prunable ? "" : "*"));
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+int main() {
+  Device *device = new Device("d");
+  config.devices["d"] = device;
+  Host *host = new Host(&config, "h");
+  // Old enough to prune, but two must be kept
+  Volume *aged = addVolume(host, "aged", "age");
+  aged->pruneParameters["prune-age"] = "10";
+  aged->pruneParameters["min-backups"] = "2";
+  // Too young to prune
+  Volume *young = addVolume(host, "young", "age");
+  young->pruneParameters["prune-age"] = "100";
+  // Never pruned
+  addVolume(host, "kept", "never");
+  const Date today(2017, 1, 20);
+
+  // By default only what the policy allows
+  std::vector<SpaceCandidate> candidates;
+  findSpaceCandidates(device, today, candidates);
+  assert(describe(candidates)
+         == std::vector<std::string>({ "aged:1", "aged:2", "aged:3" }));
+
+  // Beyond the policy only if asked for, but still keeping min-backups
+  device->spacePrune = Device::SpacePruneOldest;
+  candidates.clear();
+  findSpaceCandidates(device, today, candidates);
+  assert(describe(candidates)
+         == std::vector<std::string>({ "aged:1", "aged:2", "aged:3",
+                                       "young:1*", "young:2*", "young:3*",
+                                       "young:4*" }));
+  return 0;
+}
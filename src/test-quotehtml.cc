@@ -0,0 +1,126 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Document.h"
+#include "HtmlScan.h"
+#include "Utils.h"
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <clocale>
+#include <sstream>
+
+// The original implementation of Document::quoteHtml
+static void referenceQuoteHtml(std::ostream &os, const std::string &s) {
+  std::u32string u;
+  toUnicode(u, s);
+  for(auto w: u) {
+    switch(w) {
+    default:
+      if(w >= 127) {
+      case '&':
+      case '<':
+      case '"':
+      case '\'':
+        os << "&#" << w << ";";
+        break;
+      } else
+        os << (char)w;
+    }
+  }
+}
+
+static std::string quote(const std::string &s) {
+  std::stringstream ss;
+  Document::quoteHtml(ss, s);
+  return ss.str();
+}
+
+static std::string referenceQuote(const std::string &s) {
+  std::stringstream ss;
+  referenceQuoteHtml(ss, s);
+  return ss.str();
+}
+
+// Check every scanner against the scalar one
+static void checkScanners(const std::string &s) {
+  for(size_t start = 0; start <= s.size(); ++start) {
+    const char *p = s.data() + start;
+    size_t n = s.size() - start;
+    size_t expected = htmlPlainPrefixScalar(p, n);
+    assert(htmlPlainPrefix(p, n) == expected);
+#if __SSE2__
+    assert(htmlPlainPrefixSSE2(p, n) == expected);
+#endif
+#if HTML_SCAN_AVX2
+    if(htmlScanAVX2Supported())
+      assert(htmlPlainPrefixAVX2(p, n) == expected);
+#endif
+  }
+}
+
+static void check(const std::string &s) {
+  assert(quote(s) == referenceQuote(s));
+  checkScanners(s);
+}
+
+int main() {
+  if(!setlocale(LC_CTYPE, "C.UTF-8")
+     && !setlocale(LC_CTYPE, "en_US.UTF-8")
+     && !setlocale(LC_CTYPE, "en_GB.UTF-8")) {
+    fprintf(stderr, "ERROR: cannot find a UTF-8 locale to test in\n");
+    return 77;
+  }
+  assert(quote("") == "");
+  assert(quote("plain text") == "plain text");
+  assert(quote("<a href=\"x\">&'") == "&#60;a href=&#34;x&#34;>&#38;&#39;");
+  assert(quote("\x7f") == "&#127;");
+  assert(quote("caf\xc3\xa9!") == "caf&#233;!");
+  assert(quote("\xf0\x90\x8c\xb2\xf0\x90\x8c\xbf") == "&#66354;&#66367;");
+  assert(quote(std::string("a\0b", 3)) == std::string("a\0b", 3));
+
+  // Specials at every position relative to vector boundaries
+  const char specials[] = { '&', '<', '"', '\'', '\x7f', '\xc3', '>', '\n' };
+  for(size_t len = 0; len < 80; ++len)
+    for(size_t pos = 0; pos < len; ++pos)
+      for(char c: specials) {
+        std::string s(len, 'x');
+        s[pos] = c;
+        if(c == '\xc3') {
+          if(pos + 1 >= len)
+            continue;
+          s[pos + 1] = '\xa9';
+        }
+        check(s);
+      }
+
+  // Random strings
+  srand(1);
+  for(int n = 0; n < 2000; ++n) {
+    std::string s;
+    size_t len = rand() % 200;
+    while(s.size() < len) {
+      int r = rand() % 100;
+      if(r < 2)
+        s += "\xe2\x82\xac";            // euro sign
+      else if(r < 6)
+        s += specials[rand() % 5];
+      else
+        s += static_cast<char>(rand() % 95 + 32);
+    }
+    check(s);
+  }
+  return 0;
+}
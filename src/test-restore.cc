@@ -0,0 +1,210 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Restore.h"
+#include "TreeCopy.h"
+#include "Conf.h"
+#include "Backup.h"
+#include "Device.h"
+#include "Host.h"
+#include "Volume.h"
+#include "Store.h"
+#include "Errors.h"
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static void test_parse() {
+  std::string host, volume, path;
+  parseRestoreSource("h:v", host, volume, path);
+  assert(host == "h");
+  assert(volume == "v");
+  assert(path == "");
+  parseRestoreSource("h:v:/etc/a:b", host, volume, path);
+  assert(host == "h");
+  assert(volume == "v");
+  assert(path == "/etc/a:b");
+  try {
+    parseRestoreSource("h", host, volume, path);
+    assert(!"unexpectedly succeeded");
+  } catch(CommandError &) {
+  }
+  try {
+    parseRestoreSource("h::etc", host, volume, path);
+    assert(!"unexpectedly succeeded");
+  } catch(CommandError &) {
+  }
+
+  assert(isRemoteDestination("host:/restore"));
+  assert(isRemoteDestination("root@host:restore"));
+  assert(!isRemoteDestination("/restore/a:b"));
+  assert(!isRemoteDestination("./a:b"));
+  assert(!isRemoteDestination("restore"));
+}
+
+static Backup *addBackup(Volume *volume, const char *date,
+                         const char *device, int status) {
+  Backup *backup = new Backup();
+  backup->volume = volume;
+  backup->date = Date(date);
+  backup->id = date;
+  backup->deviceName = device;
+  backup->setStatus(status);
+  volume->addBackup(backup);
+  return backup;
+}
+
+static void test_choose() {
+  Conf c;
+  auto h = new Host(&c, "h");
+  auto v = new Volume(h, "v", "/v");
+  c.devices["d1"] = new Device("d1");
+  c.devices["d2"] = new Device("d2");
+  Store s("/store");
+  c.devices["d1"]->store = &s;
+  const Backup *b1 = addBackup(v, "2017-01-01", "d1", COMPLETE);
+  const Backup *b2 = addBackup(v, "2017-01-02", "d2", COMPLETE);
+  const Backup *b3 = addBackup(v, "2017-01-03", "d1", FAILED);
+  const Backup *b4 = addBackup(v, "2017-01-04", "d1", COMPLETE);
+  (void)b2;
+  (void)b3;
+  assert(chooseRestoreBackup(v, Date("2016-12-31")) == nullptr);
+  assert(chooseRestoreBackup(v, Date("2017-01-01")) == b1);
+  // d2 is not available, and the 3rd backup failed
+  assert(chooseRestoreBackup(v, Date("2017-01-03")) == b1);
+  assert(chooseRestoreBackup(v, Date("2017-01-04")) == b4);
+  assert(chooseRestoreBackup(v, Date("2018-01-01")) == b4);
+  c.devices["d2"]->store = &s;
+  assert(chooseRestoreBackup(v, Date("2017-01-03")) == b2);
+}
+
+static void create(const std::string &path, const std::string &contents) {
+  int fd = open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0666);
+  assert(fd >= 0);
+  assert(write(fd, contents.data(), contents.size())
+         == (ssize_t)contents.size());
+  close(fd);
+}
+
+static std::string contents(const std::string &path) {
+  FILE *fp = fopen(path.c_str(), "r");
+  assert(fp);
+  std::string s;
+  int c;
+  while((c = getc(fp)) != EOF)
+    s += c;
+  fclose(fp);
+  return s;
+}
+
+static struct stat inspect(const std::string &path) {
+  struct stat sb;
+  assert(lstat(path.c_str(), &sb) == 0);
+  return sb;
+}
+
+static void test_copy(const std::string &dir) {
+  const std::string src = dir + "/src", dst = dir + "/dst";
+  assert(mkdir(src.c_str(), 0755) == 0);
+  assert(mkdir((src + "/d").c_str(), 0750) == 0);
+  assert(mkdir((src + "/d/e").c_str(), 0700) == 0);
+  create(src + "/top", "top\n");
+  assert(chmod((src + "/top").c_str(), 0640) == 0);
+  create(src + "/d/one", "one\n");
+  assert(link((src + "/d/one").c_str(), (src + "/d/e/two").c_str()) == 0);
+  assert(link((src + "/d/one").c_str(), (src + "/three").c_str()) == 0);
+  assert(symlink("d/one", (src + "/link").c_str()) == 0);
+  assert(mkfifo((src + "/fifo").c_str(), 0600) == 0);
+  // A sparse file with data in the middle
+  int fd = open((src + "/sparse").c_str(), O_WRONLY|O_CREAT, 0666);
+  assert(fd >= 0);
+  assert(pwrite(fd, "data", 4, 1 << 22) == 4);
+  assert(ftruncate(fd, 1 << 23) == 0);
+  close(fd);
+  struct timespec times[2] = { { 1000, 0 }, { 2000, 500 } };
+  assert(utimensat(AT_FDCWD, (src + "/d/e").c_str(), times, 0) == 0);
+
+  // Existing files are replaced and others left alone
+  assert(mkdir(dst.c_str(), 0755) == 0);
+  create(dst + "/top", "old\n");
+  create(dst + "/extra", "extra\n");
+
+  TreeCopy copy(src, dst);
+  copy.run(4);
+  assert(copy.directories == 3);
+  assert(copy.files == 5);
+  assert(copy.links == 2);
+  assert(copy.skipped == 0);
+
+  assert(contents(dst + "/top") == "top\n");
+  assert((inspect(dst + "/top").st_mode & 07777) == 0640);
+  assert(contents(dst + "/extra") == "extra\n");
+  assert(contents(dst + "/d/one") == "one\n");
+  struct stat one = inspect(dst + "/d/one");
+  assert(one.st_nlink == 3);
+  assert(inspect(dst + "/d/e/two").st_ino == one.st_ino);
+  assert(inspect(dst + "/three").st_ino == one.st_ino);
+  assert(one.st_ino != inspect(src + "/d/one").st_ino);
+  char target[64];
+  ssize_t n = readlink((dst + "/link").c_str(), target, sizeof target);
+  assert(n == 5 && !memcmp(target, "d/one", 5));
+  assert(S_ISFIFO(inspect(dst + "/fifo").st_mode));
+  struct stat e = inspect(dst + "/d/e");
+  assert((e.st_mode & 07777) == 0700);
+  assert(e.st_mtim.tv_sec == 2000 && e.st_mtim.tv_nsec == 500);
+  assert((inspect(dst + "/d").st_mode & 07777) == 0750);
+  struct stat sparse = inspect(dst + "/sparse");
+  assert(sparse.st_size == 1 << 23);
+  assert(sparse.st_blocks <= inspect(src + "/sparse").st_blocks);
+  assert(contents(dst + "/sparse").substr(1 << 22, 4) == "data");
+
+  // A single file can be copied
+  TreeCopy single(src + "/top", dir + "/single");
+  single.run(4);
+  assert(single.files == 1);
+  assert(contents(dir + "/single") == "top\n");
+
+  // Errors are reported
+  try {
+    TreeCopy missing(src + "/missing", dir + "/missing");
+    missing.run(4);
+    assert(!"unexpectedly succeeded");
+  } catch(IOError &e) {
+    assert(e.errno_value == ENOENT);
+  }
+}
+
+int main() {
+  test_parse();
+  test_choose();
+
+  const char *tmpdir;
+  char *dir;
+  tmpdir = getenv("TMPDIR");
+  if(!tmpdir)
+    tmpdir = "/tmp";
+  assert(asprintf(&dir, "%s/XXXXXX", tmpdir) > 0);
+  assert(mkdtemp(dir));
+  test_copy(dir);
+  int r = system(("rm -rf " + (std::string)dir).c_str());
+  (void)r;                              // Work around GCC/Glibc stupidity
+  free(dir);
+  return 0;
+}
@@ -0,0 +1,94 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Conf.h"
+#include "Command.h"
+#include "Backup.h"
+#include "Device.h"
+#include "Host.h"
+#include "Volume.h"
+#include "Database.h"
+#include "Schedule.h"
+#include <cassert>
+#include <cmath>
+
+static Backup *addBackup(Volume *volume, const std::string &device,
+                         const Date &date) {
+  Backup *b = new Backup();
+  b->id = date.toString();
+  b->date = date;
+  b->deviceName = device;
+  b->volume = volume;
+  b->rc = 0;
+  b->setStatus(COMPLETE);
+  volume->addBackup(b);
+  return b;
+}
+
+int main() {
+  database = ":memory:";
+  Database &db = config.getdb();
+  const Date today(2017, 6, 30);
+
+  Host *h1 = new Host(&config, "h1");
+  Host *h2 = new Host(&config, "h2");
+  Volume *v1 = new Volume(h1, "v1", "/v1");
+  Volume *v2 = new Volume(h1, "v2", "/v2");
+  Volume *v3 = new Volume(h2, "v3", "/v3");
+  v1->maxAge = v2->maxAge = v3->maxAge = 2;
+  Device d1("d1"), d2("d2");
+  Backup *b1 = addBackup(v1, "d1", Date(2017, 6, 29));
+  addBackup(v2, "d1", Date(2017, 6, 26));
+  addBackup(v3, "d1", Date(2017, 6, 28));
+
+  // Overdue-ness is relative to max-age
+  assert(backupOverdue(v1, &d1, today) == 0.5);
+  assert(backupOverdue(v2, &d1, today) == 2);
+  assert(backupOverdue(v3, &d1, today) == 1);
+  assert(backupOverdue(v1, &d2, today) == HUGE_VAL);
+
+  // Most overdue first
+  std::vector<PendingBackup> pending;
+  for(Volume *v: {v1, v2, v3})
+    for(Device *d: {&d1, &d2})
+      pending.push_back({v, d, backupOverdue(v, d, today), -1});
+  orderBackups(pending);
+  assert(pending[0].volume == v1 && pending[0].device == &d2);
+  assert(pending[1].volume == v2 && pending[1].device == &d2);
+  assert(pending[2].volume == v3 && pending[2].device == &d2);
+  assert(pending[3].volume == v2 && pending[3].device == &d1);
+  assert(pending[4].volume == v3 && pending[4].device == &d1);
+  assert(pending[5].volume == v1 && pending[5].device == &d1);
+
+  // Priority trumps overdue-ness
+  h2->priority = 1;
+  orderBackups(pending);
+  assert(pending[0].volume == v3 && pending[0].device == &d2);
+  assert(pending[1].volume == v3 && pending[1].device == &d1);
+  assert(pending[2].volume == v1 && pending[2].device == &d2);
+
+  // Durations
+  int64_t seconds;
+  assert(!predictBackupDuration(db, "h1", "v1", "d1", seconds));
+  recordBackupDuration(db, b1, 600);
+  assert(predictBackupDuration(db, "h1", "v1", "d1", seconds));
+  assert(seconds == 600);
+  Backup *b = addBackup(v1, "d1", Date(2017, 6, 30));
+  recordBackupDuration(db, b, 900);
+  assert(predictBackupDuration(db, "h1", "v1", "d1", seconds));
+  assert(seconds == 900);
+  assert(!predictBackupDuration(db, "h1", "v1", "d2", seconds));
+  return 0;
+}
@@ -0,0 +1,89 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Shard.h"
+#include <cassert>
+
+typedef std::vector<std::string> Filters;
+
+static void test_listing() {
+  std::string name;
+  assert(!parseListingLine("drwxr-xr-x          4,096 2017/07/01 12:00:00 .",
+                           name));
+  assert(parseListingLine("drwxr-xr-x          4,096 2017/07/01 12:00:00 home",
+                          name));
+  assert(name == "home");
+  assert(parseListingLine("-rw-r--r--             12 2017/07/01 12:00:00  two"
+                          " spaces", name));
+  assert(name == " two spaces");
+  assert(parseListingLine("lrwxrwxrwx              4 2017/07/01 12:00:00 link"
+                          " -> dest", name));
+  assert(name == "link");
+  assert(parseListingLine("-rw-r--r--             12 2017/07/01 12:00:00"
+                          " new\\#012line", name));
+  assert(name == "new\nline");
+  assert(!parseListingLine("", name));
+  assert(!parseListingLine("receiving incremental file list", name));
+}
+
+static void test_pattern() {
+  assert(filterPattern("plain") == "plain");
+  assert(filterPattern("back\\slash") == "back\\slash");
+  assert(filterPattern("star*") == "star\\*");
+  assert(filterPattern("[x]\\?") == "\\[x]\\\\\\?");
+}
+
+static void test_filters() {
+  // Explicit groups only
+  std::vector<Filters> f = shardFilters({ { "mail" },
+                                          { "home/a*", "home/b*" } },
+                                        1, {});
+  assert(f.size() == 3);
+  assert(f[0] == Filters({ "--include=/mail", "--exclude=/*" }));
+  assert(f[1] == Filters({ "--include=/home/",
+                           "--include=/home/a*",
+                           "--include=/home/b*",
+                           "--exclude=/home/*",
+                           "--exclude=/*" }));
+  assert(f[2] == Filters({ "--exclude=/mail",
+                           "--exclude=/home/a*",
+                           "--exclude=/home/b*" }));
+
+  // Top-level names divided between shards
+  f = shardFilters({}, 3, { "e", "d", "c", "b", "a" });
+  assert(f.size() == 3);
+  assert(f[0] == Filters({ "--include=/a", "--include=/d", "--exclude=/*" }));
+  assert(f[1] == Filters({ "--include=/b", "--include=/e", "--exclude=/*" }));
+  assert(f[2] == Filters({ "--exclude=/a", "--exclude=/d",
+                           "--exclude=/b", "--exclude=/e" }));
+
+  // Names in groups are not divided up, and empty shards are omitted
+  f = shardFilters({ { "m*" } }, 4, { "mail", "misc", "home", "etc" });
+  assert(f.size() == 4);
+  assert(f[0] == Filters({ "--include=/m*", "--exclude=/*" }));
+  assert(f[1] == Filters({ "--exclude=/m*", "--include=/etc",
+                           "--exclude=/*" }));
+  assert(f[2] == Filters({ "--exclude=/m*", "--include=/home",
+                           "--exclude=/*" }));
+  assert(f[3] == Filters({ "--exclude=/m*", "--exclude=/etc",
+                           "--exclude=/home" }));
+}
+
+int main() {
+  test_listing();
+  test_pattern();
+  test_filters();
+  return 0;
+}
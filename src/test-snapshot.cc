@@ -0,0 +1,69 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Snapshot.h"
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <dirent.h>
+#include <unistd.h>
+
+int main() {
+  const char *tmpdir;
+  char *dir;
+
+  tmpdir = getenv("TMPDIR");
+  if(!tmpdir)
+    tmpdir = "/tmp";
+  assert(asprintf(&dir, "%s/XXXXXX", tmpdir) > 0);
+  assert(mkdtemp(dir));
+
+  // A fresh directory is not a subvolume, and nor is a missing one
+  assert(!isSubvolume(dir));
+  assert(!isSubvolume(std::string(dir) + "/missing"));
+
+  // Detection must not leave anything behind
+  SnapshotMethod method = detectSnapshotMethod(dir);
+  printf("%s: %s\n", dir, snapshotMethodName(method));
+  DIR *dp = opendir(dir);
+  assert(dp);
+  struct dirent *de;
+  while((de = readdir(dp)))
+    assert(!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."));
+  closedir(dp);
+
+  assert(snapshotCommand(SnapshotBtrfs, "a", "b")
+         == std::vector<std::string>({"btrfs", "subvolume", "snapshot",
+                                      "a", "b"}));
+  assert(snapshotCommand(SnapshotReflink, "a", "b")
+         == std::vector<std::string>({"cp", "--archive", "--reflink=always",
+                                      "a", "b"}));
+  try {
+    snapshotCommand(SnapshotNone, "a", "b");
+    assert(!"unexpectedly succeeded");
+  } catch(std::logic_error &) {
+  }
+  assert(createSubvolumeCommand("a")
+         == std::vector<std::string>({"btrfs", "subvolume", "create", "a"}));
+  assert(deleteSubvolumeCommand("a")
+         == std::vector<std::string>({"btrfs", "subvolume", "delete", "a"}));
+  assert(!strcmp(snapshotMethodName(SnapshotNone), "none"));
+
+  rmdir(dir);
+  free(dir);
+  return 0;
+}
@@ -70,6 +70,38 @@ int main() {
   assert(WEXITSTATUS(rc) == 0);
   assert(nwarnings == 1);
 
+  // A background subprocess survives a foreground one
+  command = { "sh", "-c", "sleep 1; exit 3" };
+  Subprocess sp3(command);
+  sp3.runBackground();
+  command = { "sh", "-c", "echo foreground" };
+  Subprocess sp4(command);
+  std::string foregroundCapture;
+  sp4.capture(1, &foregroundCapture);
+  rc = sp4.runAndWait(0);
+  assert(foregroundCapture == "foreground\n");
+  assert(WIFEXITED(rc));
+  assert(WEXITSTATUS(rc) == 0);
+  rc = sp3.waitBackground(0);
+  assert(WIFEXITED(rc));
+  assert(WEXITSTATUS(rc) == 3);
+
+  // Output a line at a time, including a final line with no newline
+  command = { "sh", "-c", "echo one; printf 'tw'; sleep 1; printf 'o\\n\\nthree'" };
+  Subprocess sp5(command);
+  std::vector<std::string> lines;
+  sp5.captureLines(1, [&lines](const std::string &line) {
+    lines.push_back(line);
+  });
+  rc = sp5.runAndWait(0);
+  assert(WIFEXITED(rc));
+  assert(WEXITSTATUS(rc) == 0);
+  assert(lines.size() == 4);
+  assert(lines[0] == "one");
+  assert(lines[1] == "two");
+  assert(lines[2] == "");
+  assert(lines[3] == "three");
+
   // NB assumes the 'usual' encoding of exit status, will need to do something
   // more sophisticated if some useful platform doesn't play along.
   //
@@ -0,0 +1,116 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Conf.h"
+#include "Command.h"
+#include "Backup.h"
+#include "Volume.h"
+#include "Host.h"
+#include "Database.h"
+#include "Transfer.h"
+#include <cassert>
+
+// Output of rsync 3.1
+static const char *const output31[] = {
+  "",
+  "Number of files: 1,234 (reg: 1,000, dir: 234)",
+  "Number of created files: 10 (reg: 10)",
+  "Number of deleted files: 0",
+  "Number of regular files transferred: 12",
+  "Total file size: 12,345,678 bytes",
+  "Total transferred file size: 54,321 bytes",
+  "Literal data: 4,321 bytes",
+  "Matched data: 50,000 bytes",
+  "File list size: 0",
+  "File list generation time: 0.001 seconds",
+  "File list transfer time: 0.000 seconds",
+  "Total bytes sent: 5,678",
+  "Total bytes received: 910",
+  "",
+  "sent 5,678 bytes  received 910 bytes  13,176.00 bytes/sec",
+  "total size is 12,345,678  speedup is 1,874.04",
+};
+
+// Output of rsync 3.0
+static const char *const output30[] = {
+  "Number of files: 99",
+  "Number of files transferred: 3",
+  "Total file size: 1000 bytes",
+  "Total transferred file size: 300 bytes",
+  "Literal data: 300 bytes",
+  "Matched data: 0 bytes",
+  "File list size: 1500",
+  "Total bytes sent: 2000",
+  "Total bytes received: 70",
+};
+
+int main() {
+  TransferStats t;
+  assert(!t.valid);
+  for(auto line: output31)
+    assert(t.parse(line));
+  assert(t.valid);
+  assert(t.files == 1234);
+  assert(t.filesTransferred == 12);
+  assert(t.totalSize == 12345678);
+  assert(t.transferredSize == 54321);
+  assert(t.literalBytes == 4321);
+  assert(t.matchedBytes == 50000);
+  assert(t.bytesSent == 5678);
+  assert(t.bytesReceived == 910);
+
+  TransferStats u;
+  for(auto line: output30)
+    assert(u.parse(line));
+  assert(u.valid);
+  assert(u.files == 99);
+  assert(u.filesTransferred == 3);
+  assert(u.totalSize == 1000);
+  assert(u.bytesReceived == 70);
+
+  // Anything else is left for the caller
+  TransferStats v;
+  assert(!v.parse(">f+++++++++ Number of files: 1"));
+  assert(!v.parse("rsync: some warning"));
+  assert(!v.parse("skipping non-regular file \"x\""));
+  assert(!v.valid);
+
+  // Round trip through the database
+  database = ":memory:";
+  Database &db = config.getdb();
+  Host *h = new Host(&config, "h");
+  Volume *vol = new Volume(h, "v", "/v");
+  Backup b;
+  b.id = "2017-07-01";
+  b.deviceName = "d";
+  b.volume = vol;
+  TransferStats w;
+  assert(!w.retrieve(db, "h", "v", "d", b.id));
+  t.linkDests = 7;
+  t.record(db, &b);
+  assert(w.retrieve(db, "h", "v", "d", b.id));
+  assert(w.valid);
+  assert(w.linkDests == 7);
+  assert(w.files == t.files);
+  assert(w.filesTransferred == t.filesTransferred);
+  assert(w.totalSize == t.totalSize);
+  assert(w.transferredSize == t.transferredSize);
+  assert(w.literalBytes == t.literalBytes);
+  assert(w.matchedBytes == t.matchedBytes);
+  assert(w.bytesSent == t.bytesSent);
+  assert(w.bytesReceived == t.bytesReceived);
+  assert(!w.retrieve(db, "h", "v", "e", b.id));
+  return 0;
+}
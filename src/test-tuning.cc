@@ -0,0 +1,181 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Conf.h"
+#include "Command.h"
+#include "Backup.h"
+#include "Volume.h"
+#include "Host.h"
+#include "Database.h"
+#include "Schedule.h"
+#include "Tuning.h"
+#include <cassert>
+
+typedef std::vector<std::string> Options;
+
+static void test_capabilities() {
+  RsyncCapabilities c;
+  c.parse("rsync  version 3.2.3  protocol version 31\n"
+          "Copyright (C) 1996-2020 by Andrew Tridgell, Wayne Davison,"
+          " and others.\n"
+          "Web site: https://rsync.samba.org/\n"
+          "Capabilities:\n"
+          "    64-bit files, 64-bit inums, 64-bit timestamps,\n"
+          "Optimizations:\n"
+          "    SIMD, no asm, openssl-crypto\n"
+          "Checksum list:\n"
+          "    xxh128 xxh3 xxh64 (xxhash) md5 md4 none\n"
+          "Compress list:\n"
+          "    zstd lz4 zlibx zlib none\n"
+          "\n"
+          "rsync comes with ABSOLUTELY NO WARRANTY.\n");
+  assert(c.version == "3.2.3");
+  assert(c.protocol == 31);
+  assert(c.supportsChecksum("xxh64"));
+  assert(!c.supportsChecksum("(xxhash)"));
+  assert(!c.supportsChecksum("zstd"));
+  assert(c.supportsCompression("zstd"));
+  assert(!c.supportsCompression("SIMD,"));
+  assert(!c.supportsCompression("bzip2"));
+
+  // Older versions don't list algorithms
+  RsyncCapabilities d;
+  d.parse("rsync  version 3.1.2  protocol version 31\n"
+          "Capabilities:\n"
+          "    64-bit files, 64-bit inums, 64-bit timestamps,\n");
+  assert(d.version == "3.1.2");
+  assert(!d.supportsCompression("zlib"));
+  assert(!d.supportsChecksum("md5"));
+}
+
+static void test_options() {
+  TransferTuning t;
+  assert(t.rsyncOptions() == Options({ "--compress", "--fuzzy" }));
+  t.compressChoice = "zstd";
+  t.compressLevel = 3;
+  t.checksumChoice = "xxh64";
+  assert(t.rsyncOptions() == Options({ "--compress",
+                                       "--compress-choice=zstd",
+                                       "--compress-level=3",
+                                       "--fuzzy",
+                                       "--checksum-choice=xxh64" }));
+  t.compress = false;
+  t.fuzzy = false;
+  t.wholeFile = true;
+  t.checksumChoice.clear();
+  assert(t.rsyncOptions() == Options({ "--whole-file" }));
+}
+
+static TransferRun run(int64_t seconds, int64_t transferred, int64_t literal,
+                       int64_t matched, int64_t received,
+                       bool compress = true, bool wholeFile = false) {
+  TransferRun r;
+  r.seconds = seconds;
+  r.stats.valid = true;
+  r.stats.transferredSize = transferred;
+  r.stats.literalBytes = literal;
+  r.stats.matchedBytes = matched;
+  r.stats.bytesReceived = received;
+  r.tuning.compress = compress;
+  r.tuning.wholeFile = wholeFile;
+  r.tuning.fuzzy = !wholeFile;
+  return r;
+}
+
+static void test_choose() {
+  const int64_t M = 1024 * 1024;
+  Conf c;
+  // Explicit settings are used as they are
+  c.rsyncCompress = TRISTATE_FALSE;
+  c.rsyncWholeFile = TRISTATE_TRUE;
+  c.rsyncFuzzy = TRISTATE_FALSE;
+  c.rsyncCompressChoice = "lz4";
+  TransferTuning t = chooseTransferTuning(c, {});
+  assert(!t.compress && t.wholeFile && !t.fuzzy);
+  assert(t.compressChoice == "lz4");
+
+  c.rsyncCompress = TRISTATE_AUTO;
+  c.rsyncWholeFile = TRISTATE_AUTO;
+  c.rsyncFuzzy = TRISTATE_AUTO;
+  // With no history, the defaults
+  t = chooseTransferTuning(c, {});
+  assert(t.compress && !t.wholeFile && t.fuzzy);
+
+  // A fast link: no compression or delta-transfer
+  t = chooseTransferTuning(c, { run(10, 1000 * M, 900 * M, 100 * M,
+                                    300 * M) });
+  assert(!t.compress && t.wholeFile && !t.fuzzy);
+
+  // Small transfers don't tell us anything about the link
+  t = chooseTransferTuning(c, { run(1, 1 * M, 1 * M, 0, 1 * M),
+                                run(100, 1000 * M, 500 * M, 500 * M,
+                                    100 * M) });
+  assert(t.compress && !t.wholeFile && t.fuzzy);
+
+  // Incompressible data, even after a later uncompressed backup
+  t = chooseTransferTuning(c, { run(100, 100 * M, 80 * M, 20 * M, 80 * M,
+                                    false),
+                                run(100, 100 * M, 80 * M, 20 * M,
+                                    75 * M) });
+  assert(!t.compress && !t.wholeFile && t.fuzzy);
+
+  // Delta-transfer that finds nothing to reuse
+  t = chooseTransferTuning(c, { run(100, 100 * M, 98 * M, 2 * M, 40 * M) });
+  assert(t.compress && t.wholeFile && !t.fuzzy);
+}
+
+static void test_history() {
+  database = ":memory:";
+  Database &db = config.getdb();
+  Host *h = new Host(&config, "h");
+  Volume *vol = new Volume(h, "v", "/v");
+  assert(transferHistory(db, "h", "v").empty());
+  for(auto id: { "2017-07-01", "2017-07-02", "2017-07-03" }) {
+    Backup b;
+    b.id = id;
+    b.deviceName = "d";
+    b.volume = vol;
+    TransferStats s;
+    s.valid = true;
+    s.literalBytes = 100;
+    s.record(db, &b);
+    recordBackupDuration(db, &b, 60);
+    // Backups without tuning recorded are not returned
+    if(b.id == "2017-07-03")
+      continue;
+    TransferTuning t;
+    t.wholeFile = b.id == "2017-07-02";
+    t.compressChoice = "zlib";
+    t.record(db, &b);
+  }
+  std::vector<TransferRun> history = transferHistory(db, "h", "v");
+  assert(history.size() == 2);
+  assert(history[0].tuning.wholeFile);
+  assert(!history[1].tuning.wholeFile);
+  assert(history[1].tuning.compressChoice == "zlib");
+  assert(history[1].tuning.compressLevel == -1);
+  assert(history[0].seconds == 60);
+  assert(history[0].stats.literalBytes == 100);
+  assert(transferHistory(db, "h", "v", 1).size() == 1);
+  assert(transferHistory(db, "h", "w").empty());
+}
+
+int main() {
+  test_capabilities();
+  test_options();
+  test_choose();
+  test_history();
+  return 0;
+}
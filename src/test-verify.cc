@@ -0,0 +1,211 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Verify.h"
+#include "Hash.h"
+#include "Errors.h"
+#include "Backup.h"
+#include "Command.h"
+#include "Conf.h"
+#include "Database.h"
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static void create(const std::string &path, const std::string &contents) {
+  int fd = open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0666);
+  assert(fd >= 0);
+  assert(write(fd, contents.data(), contents.size())
+         == (ssize_t)contents.size());
+  close(fd);
+}
+
+// Change the contents of a file without changing its size or modification
+// time
+static void corrupt(const std::string &path, const std::string &contents) {
+  struct stat sb;
+  assert(stat(path.c_str(), &sb) == 0);
+  create(path, contents);
+  struct timespec times[2] = { sb.st_atim, sb.st_mtim };
+  assert(utimensat(AT_FDCWD, path.c_str(), times, 0) == 0);
+}
+
+static void test_needed() {
+  VerifiedInode v;
+  v.size = 10;
+  v.mtime = 1000;
+  v.verified = 100;
+  assert(!verifyNeeded(v, 10, 1000, 150, 100));
+  assert(verifyNeeded(v, 10, 1000, 200, 100));
+  assert(verifyNeeded(v, 11, 1000, 150, 100));
+  assert(verifyNeeded(v, 10, 1001, 150, 100));
+}
+
+static void test_verify(const std::string &dir) {
+  const std::string root = dir + "/backup";
+  assert(mkdir(root.c_str(), 0755) == 0);
+  assert(mkdir((root + "/d").c_str(), 0755) == 0);
+  assert(mkdir((root + "/d/e").c_str(), 0755) == 0);
+  create(root + "/top", "top\n");
+  create(root + "/d/one", "one\n");
+  create(root + "/d/e/big", std::string(3 << 20, 'x'));
+  assert(link((root + "/d/one").c_str(), (root + "/d/e/two").c_str()) == 0);
+  assert(symlink("d/one", (root + "/link").c_str()) == 0);
+  struct stat one;
+  assert(stat((root + "/d/one").c_str(), &one) == 0);
+
+  // The first verification hashes each inode once
+  VerifyTree first(root, nullptr, 1000, 100);
+  first.run(4);
+  assert(first.files == 4);
+  assert(first.hashed == 3);
+  assert(first.bytes == 8 + (3 << 20));
+  assert(first.corrupted.size() == 0);
+  assert(first.unreadable.size() == 0);
+  assert(first.results.size() == 3);
+  assert(first.results[one.st_ino].hash == XXHash64::hash("one\n"));
+  assert(first.results[one.st_ino].verified == 1000);
+
+  // Recently verified inodes are not hashed again
+  VerifiedInodes known = first.results;
+  VerifyTree second(root, &known, 1050, 100);
+  second.run(4);
+  assert(second.files == 4);
+  assert(second.hashed == 0);
+  // ...but are still reported, so their records follow the newest backup
+  assert(second.results.size() == 3);
+  assert(second.results[one.st_ino].hash == XXHash64::hash("one\n"));
+  assert(second.results[one.st_ino].verified == 1000);
+
+  // Inodes already recorded by a newer backup are left alone, even when due
+  VerifiedInodes claimed = known;
+  claimed[one.st_ino].recorded = true;
+  VerifyTree older(root, &claimed, 1100, 100);
+  older.run(4);
+  assert(older.hashed == 2);
+  assert(older.results.size() == 2);
+  assert(older.results.find(one.st_ino) == older.results.end());
+
+  // Changes to files that look unchanged are detected when they are due for
+  // verification
+  corrupt(root + "/d/one", "bad\n");
+  VerifyTree third(root, &known, 1050, 100);
+  third.run(4);
+  assert(third.hashed == 0);
+  VerifyTree fourth(root, &known, 1100, 100);
+  fourth.run(4);
+  assert(fourth.hashed == 3);
+  assert(fourth.corrupted.size() == 1);
+  assert(fourth.corrupted[0] == "d/one" || fourth.corrupted[0] == "d/e/two");
+  assert(fourth.results.size() == 2);
+  assert(fourth.results.find(one.st_ino) == fourth.results.end());
+
+  // Files whose size or modification time has changed are just hashed again
+  create(root + "/top", "new top\n");
+  VerifyTree fifth(root, &known, 1050, 100);
+  fifth.run(4);
+  assert(fifth.hashed == 1);
+  assert(fifth.corrupted.size() == 0);
+
+  // Errors are reported
+  try {
+    VerifyTree missing(dir + "/missing", nullptr, 1000, 100);
+    missing.run(4);
+    assert(!"unexpectedly succeeded");
+  } catch(IOError &e) {
+    assert(e.errno_value == ENOENT);
+  }
+}
+
+// Add a backup record, and a verification record for inode 1 in it
+static void addBackup(const std::string &id, int status, int64_t size) {
+  const std::string host = "h", volume = "v", device = "d";
+  Database::Statement(config.getdb(),
+                      "INSERT INTO backup (host,volume,device,id,status)"
+                      " VALUES (?,?,?,?,?)",
+                      SQL_STRING, &host,
+                      SQL_STRING, &volume,
+                      SQL_STRING, &device,
+                      SQL_STRING, &id,
+                      SQL_INT, status,
+                      SQL_END).next();
+  Database::Statement(config.getdb(),
+                      "INSERT INTO verify_inode"
+                      " (device,inode,size,mtime,hash,verified,"
+                      "host,volume,id)"
+                      " VALUES (?,1,?,1000,?,?,?,?,?)",
+                      SQL_STRING, &device,
+                      SQL_INT64, (sqlite_int64)size,
+                      SQL_INT64, (sqlite_int64)size,
+                      SQL_INT64, (sqlite_int64)size,
+                      SQL_STRING, &host,
+                      SQL_STRING, &volume,
+                      SQL_STRING, &id,
+                      SQL_END).next();
+}
+
+static void test_records() {
+  database = ":memory:";
+  // Inode 1 was hashed in a backup that has since been pruned, and its
+  // number has been reused for a different file in a later backup
+  addBackup("2017-07-01", PRUNED, 10);
+  addBackup("2017-07-02", COMPLETE, 20);
+  VerifiedInodes known;
+  readVerifiedInodes(config.getdb(), "d", known);
+  assert(known.size() == 1);
+  assert(known[1].size == 20);
+  assert(known[1].hash == 20);
+
+  // Once that backup has been pruned too there is nothing to trust
+  Database::Statement(config.getdb(),
+                      "UPDATE backup SET status=? WHERE id='2017-07-02'",
+                      SQL_INT, PRUNED,
+                      SQL_END).next();
+  known.clear();
+  readVerifiedInodes(config.getdb(), "d", known);
+  assert(known.size() == 0);
+
+  // Records for pruned backups are removed
+  addBackup("2017-07-03", COMPLETE, 30);
+  pruneVerify(config.getdb());
+  Database::Statement stmt(config.getdb(),
+                           "SELECT id FROM verify_inode",
+                           SQL_END);
+  assert(stmt.next());
+  assert(stmt.get_string(0) == "2017-07-03");
+  assert(!stmt.next());
+}
+
+int main() {
+  test_needed();
+  test_records();
+
+  const char *tmpdir;
+  char *dir;
+  tmpdir = getenv("TMPDIR");
+  if(!tmpdir)
+    tmpdir = "/tmp";
+  assert(asprintf(&dir, "%s/XXXXXX", tmpdir) > 0);
+  assert(mkdtemp(dir));
+  test_verify(dir);
+  int r = system(("rm -rf " + (std::string)dir).c_str());
+  (void)r;                              // Work around GCC/Glibc stupidity
+  free(dir);
+  return 0;
+}
@@ -16,9 +16,60 @@
 #include "Conf.h"
 #include "Backup.h"
 #include "Volume.h"
+#include "Device.h"
+#include "Host.h"
 #include <getopt.h>
 #include <cassert>
 
+static const Backup *addBackup(Volume *volume, const std::string &device,
+                               int day, int rc, int status) {
+  Backup *b = new Backup();
+  b->date = Date(2017, 7, day);
+  b->id = b->date.toString();
+  b->deviceName = device;
+  b->volume = volume;
+  b->rc = rc;
+  b->setStatus(status);
+  volume->addBackup(b);
+  return b;
+}
+
+static void test_link_candidates() {
+  Host *h = new Host(&config, "h");
+  Volume *v = new Volume(h, "v", "/v");
+  Device d1("d1"), d2("d2");
+  assert(v->linkCandidates(&d1, 20).empty());
+  const Backup *c1 = addBackup(v, "d1", 1, 0, COMPLETE);
+  const Backup *f2 = addBackup(v, "d1", 2, 1, FAILED);
+  const Backup *c3 = addBackup(v, "d1", 3, 0, COMPLETE);
+  addBackup(v, "d1", 4, 0, PRUNING);
+  const Backup *f5 = addBackup(v, "d1", 5, 1, FAILED);
+  const Backup *f6 = addBackup(v, "d1", 6, 1, FAILED);
+  addBackup(v, "d2", 7, 0, COMPLETE);
+  // Newest complete, then newer incomplete, then older complete, then older
+  // incomplete
+  std::vector<const Backup *> c = v->linkCandidates(&d1, 20);
+  assert(c.size() == 5);
+  assert(c[0] == c3);
+  assert(c[1] == f6);
+  assert(c[2] == f5);
+  assert(c[3] == c1);
+  assert(c[4] == f2);
+  c = v->linkCandidates(&d1, 2);
+  assert(c.size() == 2);
+  assert(c[0] == c3);
+  assert(c[1] == f6);
+  // Only incomplete backups
+  Volume *w = new Volume(h, "w", "/w");
+  const Backup *g1 = addBackup(w, "d1", 1, 1, FAILED);
+  const Backup *g2 = addBackup(w, "d1", 2, 1, FAILED);
+  c = w->linkCandidates(&d1, 20);
+  assert(c.size() == 2);
+  assert(c[0] == g2);
+  assert(c[1] == g1);
+  assert(w->linkCandidates(&d2, 20).empty());
+}
+
 int main() {
   assert(!Volume::valid(""));
   assert(Volume::valid(
@@ -29,5 +80,6 @@ int main() {
   assert(!Volume::valid(" "));
   assert(!Volume::valid("\x1F"));
   assert(!Volume::valid("-whatever"));
+  test_link_candidates();
   return 0;
 }
@@ -0,0 +1,33 @@
+// Copyright © 2017 Richard Kettlewell.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <config.h>
+#include "Utils.h"
+
+std::string unescapeRsync(const std::string &s) {
+  std::string r;
+  for(size_t n = 0; n < s.size(); ++n) {
+    if(s.compare(n, 2, "\\#") == 0 && n + 5 <= s.size()
+       && s[n + 2] >= '0' && s[n + 2] <= '3'
+       && s[n + 3] >= '0' && s[n + 3] <= '7'
+       && s[n + 4] >= '0' && s[n + 4] <= '7') {
+      r += static_cast<char>((s[n + 2] - '0') * 64
+                             + (s[n + 3] - '0') * 8
+                             + (s[n + 4] - '0'));
+      n += 4;
+    } else
+      r += s[n];
+  }
+  return r;
+}